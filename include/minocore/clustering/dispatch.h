@@ -29,14 +29,72 @@ bool use_packed_distmat(const T &app) {
     return true;
 }
 
-template<typename IT=uint32_t, typename FT, typename WFT=FT, typename OracleType, typename Traits>
-auto perform_cluster_metric_kmedian(const OracleType &app, size_t np, Traits traits)
+/*
+ * Solves k-median over a facility x client cost matrix, returning the rows of the chosen facilities.
+ * With traits.nrestarts > 1, local search runs as a portfolio of restarts: for JV_PLUS_LOCAL_SEARCH,
+ * restart 0 starts from the JV solution and the others from random seeds, all concurrently.
+ * JV itself is deterministic, so JAIN_VAZIRANI_FL ignores nrestarts.
+ */
+template<typename IT=uint32_t, typename CostMatrix, typename Traits>
+std::vector<IT> solve_facility_kmedian(const CostMatrix &costmat, const Traits &traits) {
+    METRICS_STAGE("solve_facility_kmedian");
+    std::vector<IT> center_sol;
+    auto local_search = [&](uint64_t seed, const std::vector<IT> *init, RestartPortfolio *portfolio) {
+        auto lsearcher = minocore::make_kmed_lsearcher(costmat, traits.k, traits.eps, seed);
+        lsearcher.lazy_eval_ = 2;
+        lsearcher.portfolio_ = portfolio;
+        if(init) lsearcher.assign_centers(init->begin(), init->end());
+        lsearcher.run();
+        const double cost = lsearcher.abandoned_ ? std::numeric_limits<double>::infinity(): double(lsearcher.current_cost_);
+        return std::make_pair(cost, std::vector<IT>(lsearcher.sol_.begin(), lsearcher.sol_.end()));
+    };
+    switch(traits.metric_solver) {
+        case JAIN_VAZIRANI_FL: case JV_PLUS_LOCAL_SEARCH: case LOCAL_SEARCH: {
+            const bool use_jv = traits.metric_solver != LOCAL_SEARCH;
+            // Returns no centers if terminate is set first, e.g. once another restart reaches the portfolio's target
+            auto run_jv = [&](std::atomic<int> *terminate=nullptr) {
+                auto jvs = jv::make_jv_solver(costmat);
+                auto [c_centers, c_assignments] = jvs.kmedian(traits.k, traits.max_jv_rounds, 0., 0., terminate);
+                return std::vector<IT>(c_centers.begin(), c_centers.end());
+            };
+            if(traits.metric_solver == JAIN_VAZIRANI_FL) {
+                center_sol = run_jv();
+            } else if(traits.nrestarts <= 1) {
+                std::vector<IT> init;
+                if(use_jv) init = run_jv();
+                center_sol = local_search(traits.seed, use_jv ? &init: nullptr, nullptr).second;
+            } else {
+                RestartPortfolio portfolio(traits.restart_slack);
+                center_sol = run_portfolio(traits.nrestarts, [&](unsigned r, RestartPortfolio &pf) {
+                    std::vector<IT> init;
+                    if(use_jv && r == 0) init = run_jv(pf.terminate_flag());
+                    return local_search(traits.seed + r, init.empty() ? nullptr: &init, &pf);
+                }, portfolio, traits.restart_groups).second;
+                PRETTY_SAY << "Best of " << traits.nrestarts << " restarts: " << portfolio.best() << ", " << portfolio.nabandoned() << " abandoned\n";
+            }
+            break;
+        }
+        default: throw std::invalid_argument("Unrecognized metric solver strategy");
+    }
+    return center_sol;
+}
+
+/*
+ * Candidate facilities for metric k-median (Thorup, D2, uniform or greedy, per traits.sampling)
+ * and, unless traits.sparse_candidates is set, their dense facility x point cost matrix.
+ * If traits.weights is set, column j of the cost matrix is scaled by traits.weights[j].
+ */
+template<typename IT=uint32_t, typename FT, typename OracleType, typename Traits>
+MetricSelectionResult<IT, FT> select_metric_candidates(const OracleType &app, size_t np, const Traits &traits)
 {
+    METRICS_STAGE("select_candidates");
     MetricSelectionResult<IT, FT> ret;
+    // With sparse candidates, the dense |S| x n facility cost matrix is never built.
+    const bool sparse = traits.sparse_candidates;
 
     std::unique_ptr<dm::DistanceMatrix<FT, 0, dm::DM_MMAP>> distmatp;
     std::unique_ptr<PolymorphicMat<FT>> full_distmatp;
-    if(traits.compute_full) {
+    if(traits.compute_full && !sparse) {
         if(use_packed_distmat(app)) {
             distmatp.reset(new dm::DistanceMatrix<FT, 0, dm::DM_MMAP>(np));
             for(size_t i = 0; i < np; ++i) {
@@ -58,14 +116,17 @@ auto perform_cluster_metric_kmedian(const OracleType &app, size_t np, Traits tra
         }
     }
     auto fill_distance_mat = [&](const auto &lu) {
+        if(sparse) return;
         auto &retdm = std::get<3>(ret);
         retdm.resize(std::get<0>(ret).size(), np);
+        const auto weights = traits.weights;
         for(size_t i = 0; i < std::get<0>(ret).size(); ++i) {
             const auto cid = std::get<0>(ret)[i];
             auto rowptr = row(retdm, i);
             OMP_PFOR
             for(size_t j = 0; j < np; ++j) {
                 rowptr[j] = (unlikely(j == cid) ? static_cast<FT>(0.): FT(lu(cid, j)));
+                if(weights) rowptr[j] *= weights[j];
             }
         }
     };
@@ -81,78 +142,130 @@ auto perform_cluster_metric_kmedian(const OracleType &app, size_t np, Traits tra
         } else if(full_distmatp) {
             sample_and_fill(~*full_distmatp);
         } else {
-            auto caching_app = make_row_caching_oracle_wrapper<
-                shared::flat_hash_map, /*is_symmetric=*/ true, /*is_threadsafe=*/true
-            >(app, np);
+            // Lock-striped pairwise cache: Thorup's parallel sweeps and the cost matrix fill never serialize on one lock
+            MINOCORE_REQUIRE(np <= std::numeric_limits<uint32_t>::max(), "The pairwise oracle cache takes 32-bit indices");
+            // Never reserve room for more than the np * (np - 1) / 2 distinct pairs; shards are allocated as they fill
+            const size_t npairs = np * (np - 1) / 2;
+            const size_t budget = traits.oracle_cache_bytes ? traits.oracle_cache_bytes
+                                                            : npairs * (sizeof(uint64_t) + sizeof(FT));
+            auto caching_app = make_sharded_caching_oracle</*symmetric=*/true, uint32_t>(app, budget, 0, npairs);
             sample_and_fill(caching_app);
+            const auto cs = caching_app.stats();
+            PRETTY_SAY << "Oracle cache: " << cs.hits_ << " hits, " << cs.misses_ << " misses of " << cs.lookups() << " lookups, " << cs.evictions_ << " evictions\n";
         }
-    } else switch(traits.sampling) {
-        case D2_SAMPLING: {
-            ret = select_d2(app, np, traits);
-            break;
-        }
-        case UNIFORM_SAMPLING: {
-            ret = select_uniform_random(app, np, traits);
-            break;
-        }
-        case GREEDY_SAMPLING: {
-            ret = select_greedy(app, np, traits);
-            break;
-        }
-        case DEFAULT_SAMPLING: default: {
-            char buf[128];
-            auto l = std::sprintf(buf, "Unrecognized sampling: %d\n", (int)DEFAULT_SAMPLING);
-            throw std::invalid_argument(std::string(buf, l));
-        }
-        fill_distance_mat(app);
-    }
-    auto &costmat = ret.facility_cost_matrix();
-    std::vector<IT> center_sol;
-    switch(traits.metric_solver) {
-        case JAIN_VAZIRANI_FL: case JV_PLUS_LOCAL_SEARCH: {
-            auto jvs = jv::make_jv_solver(costmat);
-            auto [c_centers, c_assignments] = jvs.kmedian(traits.k, traits.max_jv_rounds);
-            if(traits.metric_solver == JAIN_VAZIRANI_FL) {
-                center_sol = std::move(c_centers);
+    } else {
+        switch(traits.sampling) {
+            case D2_SAMPLING: {
+                ret = select_d2(app, np, traits);
                 break;
             }
-            // JV_PLUS_LOCAL_SEARCH
-            auto lsearcher = minocore::make_kmed_lsearcher(costmat, traits.k, traits.eps, traits.seed);
-            lsearcher.lazy_eval_ = 2;
-            lsearcher.assign_centers(c_centers.begin(), c_centers.end());
-            lsearcher.run();
-            center_sol.assign(lsearcher.sol_.begin(), lsearcher.sol_.end());
-            break;
-        }
-        case LOCAL_SEARCH: {
-            auto lsearcher = minocore::make_kmed_lsearcher(costmat, traits.k, traits.eps, traits.seed);
-            lsearcher.lazy_eval_ = 2;
-            lsearcher.run();
-            center_sol.assign(lsearcher.sol_.begin(), lsearcher.sol_.end());
-            break;
+            case UNIFORM_SAMPLING: {
+                ret = select_uniform_random(app, np, traits);
+                break;
+            }
+            case GREEDY_SAMPLING: {
+                ret = select_greedy(app, np, traits);
+                break;
+            }
+            case DEFAULT_SAMPLING: default: {
+                char buf[128];
+                auto l = std::sprintf(buf, "Unrecognized sampling: %d\n", (int)DEFAULT_SAMPLING);
+                throw std::invalid_argument(std::string(buf, l));
+            }
         }
-        default: throw std::invalid_argument("Unrecognized metric solver strategy");
+        fill_distance_mat(app);
     }
-    std::transform(center_sol.begin(), center_sol.end(), center_sol.begin(),
-                   [&sel=ret.selected()](auto x) {return sel[x];});
-    blaze::DynamicVector<IT> asn(np, center_sol.front());
-    blaze::DynamicVector<FT> costs = trans(row(costmat, center_sol.front()));
-    for(unsigned ci = 1; ci < center_sol.size(); ++ci) {
-        auto r = row(costmat, ci);
-        OMP_PFOR
-        for(size_t i = 0; i < np; ++i) {
-            if(auto newv = r[i]; newv < costs[i])
-                costs[i] = newv, asn[i] = center_sol[ci];
-        }
+    return ret;
+}
+
+/*
+ * Assigns every point to the nearest of the candidate rows center_rows of ret, using
+ * the dense facility cost matrix, or exact costs from the oracle if exact.
+ * exact is required if the matrix was not built (sparse candidates) or holds weighted costs.
+ * Returns (sorted center ids, assignments as ids, unweighted costs).
+ */
+template<typename IT=uint32_t, typename FT, typename OracleType>
+auto assign_metric_centers(const OracleType &app, size_t np, const MetricSelectionResult<IT, FT> &ret,
+                           const std::vector<IT> &center_rows, bool exact)
+{
+    METRICS_STAGE("assign_centers");
+    const auto &sel = ret.selected();
+    blaze::DynamicVector<IT> asn(np);
+    blaze::DynamicVector<FT> costs(np);
+    const auto &costmat = ret.facility_cost_matrix();
+    OMP_PFOR
+    for(size_t i = 0; i < np; ++i) {
+        auto cost = [&](IT r) -> FT {return exact ? (sel[r] == i ? FT(0): FT(app(sel[r], i))): costmat(r, i);};
+        FT best = cost(center_rows[0]);
+        IT bestr = center_rows[0];
+        for(size_t ci = 1; ci < center_rows.size(); ++ci)
+            if(const FT c = cost(center_rows[ci]); c < best)
+                best = c, bestr = center_rows[ci];
+        costs[i] = best;
+        asn[i] = sel[bestr];
     }
+    std::vector<IT> center_sol(center_rows.size());
+    std::transform(center_rows.begin(), center_rows.end(), center_sol.begin(), [&sel](auto x) {return sel[x];});
     shared::sort(center_sol.begin(), center_sol.end());
     return std::make_tuple(center_sol, asn, costs);
 }
 
+/*
+ * Sparse facility x point costs over the candidates selected in ret, keeping traits.sparse_candidates per point:
+ * from the neighbor lists traits.knns if set (plus each point's nearest selected facility), otherwise exact.
+ * Columns are scaled by traits.weights, if set.
+ */
+template<typename IT=uint32_t, typename FT, typename OracleType, typename Traits>
+SparseFacilityCosts<FT, IT> make_candidate_costs(const OracleType &app, size_t np, const MetricSelectionResult<IT, FT> &ret, const Traits &traits)
+{
+    METRICS_STAGE("candidate_costs");
+    const auto &sel = ret.selected();
+    SparseFacilityCosts<FT, IT> costs;
+    if(traits.knns) {
+        // Selection assignments are point ids; the kNN builder takes positions in sel
+        shared::flat_hash_map<IT, IT> id2pos;
+        for(size_t i = 0; i < sel.size(); ++i) id2pos[sel[i]] = i;
+        const auto &asn = ret.assignments();
+        std::vector<IT> asnpos;
+        if(asn.size() == np) {
+            asnpos.resize(np);
+            OMP_PFOR
+            for(size_t i = 0; i < np; ++i) asnpos[i] = id2pos.find(asn[i])->second;
+        }
+        costs = make_knn_facility_costs<FT, IT>(app, sel.data(), sel.size(), np, traits.sparse_candidates, *traits.knns,
+                                                asnpos.empty() ? static_cast<const IT *>(nullptr): asnpos.data());
+    } else {
+        costs = make_sparse_facility_costs<FT, IT>(app, sel.data(), sel.size(), np, traits.sparse_candidates);
+    }
+    if(traits.weights) costs.scale_clients(traits.weights);
+    return costs;
+}
+
+/*
+ * Metric k-median over the np points of the oracle app, with clients weighted by traits.weights if set.
+ * Returns (sorted center ids, assignments as ids, unweighted costs).
+ */
+template<typename IT=uint32_t, typename FT, typename WFT=FT, typename OracleType, typename Traits>
+auto perform_cluster_metric_kmedian(const OracleType &app, size_t np, Traits traits)
+{
+    // With sparse candidates, the dense |S| x n facility cost matrix is never built.
+    const bool sparse = traits.sparse_candidates;
+    auto ret = select_metric_candidates<IT, FT>(app, np, traits);
+    std::vector<IT> center_rows;
+    if(sparse) {
+        center_rows = solve_facility_kmedian<IT>(make_candidate_costs(app, np, ret, traits), traits);
+    } else {
+        center_rows = solve_facility_kmedian<IT>(ret.facility_cost_matrix(), traits);
+    }
+    // Weighted matrix entries are not the point costs, so weighted solutions are assigned with the oracle
+    return assign_metric_centers<IT, FT>(app, np, ret, center_rows, sparse || traits.weights);
+}
+
 enum LloydLoopResult {
     FINISHED,
     REACHED_MAX_ROUNDS,
-    UNFINISHED
+    UNFINISHED,
+    ABANDONED // Stopped by a RestartPortfolio because another restart is better
 };
 
 template<Assignment asn_method=HARD, CenterOrigination co=EXTRINSIC, typename MatrixType, typename CentersType, typename Assignments, typename WFT=ElementType_t<MatrixType>,
@@ -160,8 +273,10 @@ template<Assignment asn_method=HARD, CenterOrigination co=EXTRINSIC, typename Ma
 LloydLoopResult perform_lloyd_loop(CentersType &centers, Assignments &assignments,
     const jsd::DissimilarityApplicator<MatrixType> &app,
     unsigned k, CostType &retcost, uint64_t seed=0, const WFT *weights=static_cast<WFT *>(nullptr),
-    size_t max_iter=100, double eps=1e-4)
+    size_t max_iter=100, double eps=1e-4, RestartPortfolio *portfolio=nullptr)
 {
+    METRICS_STAGE("lloyd");
+    app.prepare_caches();
     if constexpr(asn_method == HARD) {
         if(retcost.size() != app.size()) retcost.resize(app.size());
     } else {
@@ -225,11 +340,20 @@ LloydLoopResult perform_lloyd_loop(CentersType &centers, Assignments &assignment
             }
         }
     };
+    // Shares the current cost with the portfolio, if any
+    auto share = [&](FT cost) {
+        const int rc = portfolio ? portfolio->update(cost, iternum): 0;
+        return rc == 2 ? ABANDONED: rc ? FINISHED: UNFINISHED;
+    };
     auto check = [&]() {
         ++iternum;
-        if(first_cost == std::numeric_limits<FT>::max()) first_cost = getcost();
-        else {
+        METRICS_COUNT(LLOYD_ITERATIONS, 1);
+        if(first_cost == std::numeric_limits<FT>::max()) {
+            first_cost = getcost();
+            if(auto rc = share(first_cost); rc != UNFINISHED) return rc;
+        } else {
             FT itercost = getcost();
+            if(auto rc = share(itercost); rc != UNFINISHED) return rc;
             if(current_cost == std::numeric_limits<FT>::max()) {
                 current_cost = itercost;
                 assert(current_cost != std::numeric_limits<FT>::max());
@@ -442,6 +566,188 @@ void update_defaults_with_measure(ClusteringTraits<FT, IT, asn_method, co> &ct,
 }
 
 
+// Number of coreset points requested by ct, or 0 if coreset mode is off.
+template<typename CT>
+size_t requested_coreset_size(const CT &ct) {
+    size_t ret = ct.coreset_size;
+    if(!ret && ct.coreset_eps > 0.)
+        ret = std::ceil(ct.k / (ct.coreset_eps * ct.coreset_eps));
+    return ret ? std::max(ret, size_t(ct.k)): size_t(0);
+}
+
+namespace detail {
+
+/*
+ * The stages of coreset-accelerated hard clustering, kept as one object so that they can be
+ * scheduled separately (see clustering/pipeline.h). Each stage consumes what the previous one left:
+ * 1. seed():        approximate solution on the full data (D2 sampling or Thorup, per ct.sampling),
+ * 2. sensitivity(): sensitivities from that solution (LBK for bicriteria approximations, BFL otherwise),
+ * 3. sample():      a weighted coreset of cs_size points,
+ * 4. optimize():    EM or metric k-median (JV/local search) on the weighted coreset,
+ * 5. assign():      a parallel pass assigning every point to its nearest final center.
+ * ct should already have been passed through update_defaults_with_measure.
+ */
+template<CenterOrigination co, typename MatrixType, typename FT, typename IT>
+struct CoresetRun {
+    using ct_t = ClusteringTraits<FT, IT, HARD, co>;
+    const jsd::DissimilarityApplicator<MatrixType> &app_;
+    const ct_t ct_;
+    const size_t cs_size_, np_;
+
+    // Approximate solution, with assignments as positions in approx_centers_
+    std::vector<IT> approx_centers_, approx_asn_;
+    std::vector<FT> approx_costs_;
+    coresets::CoresetSampler<FT, IT> sampler_;
+    std::unique_ptr<coresets::IndexCoreset<IT, FT>> cs_;
+
+    typename ct_t::centers_t centers_;
+    typename ct_t::assignments_t assignments_;
+    typename ct_t::costs_t costs_;
+    std::vector<IT> center_ids_; // Metric solutions, as ids in the full data
+
+    CoresetRun(const jsd::DissimilarityApplicator<MatrixType> &app, const ct_t &ct, size_t cs_size):
+        app_(app), ct_(ct), cs_size_(cs_size), np_(app.size()) {}
+
+    void seed() {
+        METRICS_STAGE("coreset_seed");
+        approx_asn_.resize(np_);
+        approx_costs_.resize(np_);
+        if(ct_.sampling == THORUP_SAMPLING) {
+            auto [F, tcosts, bestindices] = iterated_oracle_thorup_d(
+                make_aa(app_), np_, ct_.k, ct_.thorup_iter, ct_.thorup_sub_iter, ct_.weights, ct_.thorup_npermult, 3, 0.5, ct_.seed);
+            approx_centers_.assign(F.begin(), F.end());
+            shared::flat_hash_map<IT, IT> id2pos;
+            for(size_t i = 0; i < approx_centers_.size(); ++i) id2pos[approx_centers_[i]] = i;
+            OMP_PFOR
+            for(size_t i = 0; i < np_; ++i) {
+                approx_asn_[i] = id2pos.find(bestindices[i])->second;
+                approx_costs_[i] = tcosts[i];
+            }
+        } else {
+            auto [ids, asn, dcosts] = jsd::make_kmeanspp(app_, ct_.k, ct_.seed, ct_.weights);
+            approx_centers_.assign(ids.begin(), ids.end());
+            std::copy(asn.begin(), asn.end(), approx_asn_.begin());
+            std::copy(dcosts.begin(), dcosts.end(), approx_costs_.begin());
+        }
+    }
+    void sensitivity() {
+        METRICS_STAGE("coreset_sensitivity");
+        sampler_.make_sampler(np_, approx_centers_.size(), approx_costs_.data(), approx_asn_.data(), ct_.weights,
+                              ct_.seed + 1, ct_.approx == BICRITERIA ? coresets::LBK: coresets::BFL);
+    }
+    void sample() {
+        METRICS_STAGE("coreset_sample");
+        cs_.reset(new coresets::IndexCoreset<IT, FT>(sampler_.sample(cs_size_, ct_.seed + 2)));
+        cs_->compact();
+        if(cs_->size() <= ct_.k)
+            throw std::runtime_error("Coreset has only " + std::to_string(cs_->size()) + " unique points for k = " + std::to_string(ct_.k) + "; increase its size");
+        PRETTY_SAY << "Clustering coreset of " << cs_->size() << " unique points (" << cs_size_ << " sampled) of " << np_ << '\n';
+    }
+    void optimize() {
+        METRICS_STAGE("coreset_optimize");
+        const size_t ncs = cs_->size();
+        if(co == INTRINSIC || ct_.opt == METRIC_KMEDIAN) {
+            const IT *csids = cs_->indices_.data();
+            auto aa = make_aa(app_);
+            auto csoracle = [&aa,csids](size_t i, size_t j) {return aa(csids[i], csids[j]);};
+            auto csct = ct_;
+            csct.npoints = ncs;
+            csct.weights = cs_->weights_.data();
+            csct.knns = nullptr; // Neighbor lists are over the full data
+            auto [cc, csasn, cscosts] = perform_cluster_metric_kmedian<IT, FT>(csoracle, ncs, csct);
+            for(const auto id: cc) center_ids_.push_back(csids[id]);
+        } else if constexpr(co == EXTRINSIC) {
+            blaze::ResultType_t<MatrixType> csmat = rows(app_.data(), cs_->indices_.data(), ncs);
+            auto csapp = jsd::make_like_applicator(app_, csmat, cs_->indices_.data(), ncs);
+            auto [ids, initasn, initcosts] = jsd::make_kmeanspp(csapp, ct_.k, ct_.seed, cs_->weights_.data());
+            for(const auto id: ids)
+                centers_.emplace_back(row(csmat, id));
+            blz::DV<IT> csasn(ncs);
+            blz::DV<FT> cscosts(ncs);
+            if(auto ret = perform_lloyd_loop<HARD>(centers_, csasn, csapp, ct_.k, cscosts, ct_.seed, cs_->weights_.data(), ct_.max_lloyd_iter, ct_.eps))
+                std::fprintf(stderr, "lloyd loop ret: %s\n", ret == REACHED_MAX_ROUNDS ? "max rounds": "unfinished");
+        }
+    }
+    void assign() {
+        METRICS_STAGE("coreset_assign");
+        const auto measure = app_.get_measure();
+        assignments_.resize(np_);
+        costs_.resize(np_);
+        if(center_ids_.size()) {
+            auto aa = make_aa(app_);
+            OMP_PFOR
+            for(size_t i = 0; i < np_; ++i) {
+                FT best = aa(i, center_ids_[0]);
+                IT asn = 0;
+                for(size_t j = 1; j < center_ids_.size(); ++j)
+                    if(FT d = aa(i, center_ids_[j]); d < best)
+                        best = d, asn = j;
+                costs_[i] = best;
+                assignments_[i] = center_ids_[asn];
+            }
+            if constexpr(co == EXTRINSIC) {
+                for(const auto id: center_ids_)
+                    centers_.emplace_back(row(app_.data(), id));
+            } else {
+                centers_.resize(center_ids_.size());
+                std::copy(center_ids_.begin(), center_ids_.end(), centers_.begin());
+            }
+        } else if constexpr(co == EXTRINSIC) {
+            typename ct_t::centers_t centers_cache;
+            if(dist::detail::needs_logs(measure) || dist::detail::needs_sqrt(measure)) {
+                centers_cache.resize(centers_.size());
+                for(size_t j = 0; j < centers_.size(); ++j)
+                    dist::detail::set_cache(centers_[j], centers_cache[j], measure);
+            }
+            auto getcache = [&](size_t j) {
+                decltype(&centers_cache[j]) ret = nullptr;
+                if(centers_cache.size()) ret = &centers_cache[j];
+                return ret;
+            };
+            OMP_PFOR
+            for(size_t i = 0; i < np_; ++i) {
+                FT best = app_(i, centers_[0], getcache(0), measure);
+                IT asn = 0;
+                for(size_t j = 1; j < centers_.size(); ++j)
+                    if(FT d = app_(i, centers_[j], getcache(j), measure); d < best)
+                        best = d, asn = j;
+                costs_[i] = best;
+                assignments_[i] = asn;
+            }
+        }
+    }
+    // Weighted cost of the final assignment; valid after assign()
+    double cost() const {
+        double ret = 0.;
+        for(size_t i = 0; i < np_; ++i)
+            ret += ct_.weights ? double(costs_[i]) * ct_.weights[i]: double(costs_[i]);
+        return ret;
+    }
+    auto result() {
+        return std::make_tuple(std::move(centers_), std::move(assignments_), std::move(costs_));
+    }
+};
+
+} // namespace detail
+
+/*
+ * Coreset-accelerated hard clustering: runs every stage of detail::CoresetRun in order.
+ * ct should already have been passed through update_defaults_with_measure.
+ */
+template<CenterOrigination co, typename MatrixType, typename FT, typename IT>
+auto perform_coreset_clustering(const jsd::DissimilarityApplicator<MatrixType> &app,
+                                const ClusteringTraits<FT, IT, HARD, co> &ct, size_t cs_size)
+{
+    detail::CoresetRun<co, MatrixType, FT, IT> run(app, ct, cs_size);
+    run.seed();
+    run.sensitivity();
+    run.sample();
+    run.optimize();
+    run.assign();
+    return run.result();
+}
+
+
 template<Assignment asn_method=HARD, CenterOrigination co=INTRINSIC, typename MatrixType, typename IT=uint32_t>
 auto perform_clustering(const jsd::DissimilarityApplicator<MatrixType> &app, size_t npoints, unsigned k,
                         const ElementType_t<MatrixType> *weights=nullptr,
@@ -449,18 +755,32 @@ auto perform_clustering(const jsd::DissimilarityApplicator<MatrixType> &app, siz
                         OptimizationMethod opt=DEFAULT_OPT,
                         ApproximateSolutionType approx=DEFAULT_APPROX,
                         uint64_t seed=0,
-                        size_t max_iter=100, double eps=1e-4)
+                        size_t max_iter=100, double eps=1e-4,
+                        size_t coreset_size=0, double coreset_eps=0., unsigned nrestarts=1)
 {
+    METRICS_STAGE("perform_clustering");
     MINOCORE_REQUIRE(npoints == app.size(), "assumption");
     using FT = typename MatrixType::ElementType;
+    app.prepare_caches();
 
     // Setup clustering traits
     auto ct = make_clustering_traits<FT, IT, asn_method, co>(npoints, k,
         csample, opt, approx, weights, seed, max_iter, eps);
     using ct_t = decltype(ct);
+    ct.coreset_size = coreset_size;
+    ct.coreset_eps = coreset_eps;
+    ct.nrestarts = nrestarts;
     auto measure = app.get_measure();
     update_defaults_with_measure(ct, measure);
 
+    if(const size_t cs_size = requested_coreset_size(ct); cs_size && cs_size < npoints) {
+        if constexpr(asn_method == HARD) {
+            return perform_coreset_clustering(app, ct, cs_size);
+        } else {
+            throw NotImplementedError("Coreset mode supports hard assignment only");
+        }
+    }
+
     // and helpers
     typename ct_t::centers_t centers;
     centers.reserve(k);
@@ -494,8 +814,6 @@ auto perform_clustering(const jsd::DissimilarityApplicator<MatrixType> &app, siz
 
     // Delegate to solvers and set-up return values
     if(dist::detail::satisfies_d2(measure) || measure == dist::L1 || measure == dist::TOTAL_VARIATION_DISTANCE || co == EXTRINSIC) {
-        auto [initcenters, initasn, initcosts] = jsd::make_kmeanspp(app, ct.k, ct.seed, ct.weights);
-        assert(initcenters.size() == k);
         if(co == INTRINSIC || opt == METRIC_KMEDIAN) {
             PRETTY_SAY << "Performing metric clustering\n";
             // Do graph metric calculation
@@ -504,13 +822,39 @@ auto perform_clustering(const jsd::DissimilarityApplicator<MatrixType> &app, siz
             set_metric_return_values(metric_ret);
         } else {
             PRETTY_SAY << "Setting centers with D2\n";
-            for(const auto id: initcenters)
-                centers.emplace_back(row(app.data(), id));
-            assert(centers.size() == k);
-            PRETTY_SAY << "Beginning lloyd loop\n";
-            // Perform EM
-            if(auto ret = perform_lloyd_loop<asn_method>(centers, assignments, app, k, costs, ct.seed, ct.weights, max_iter, eps))
-                std::fprintf(stderr, "lloyd loop ret: %s\n", ret == REACHED_MAX_ROUNDS ? "max rounds": "unfinished");
+            // One restart: k-means++ seeding with seed, then EM. Returns (cost, infinite if abandoned) and the result.
+            auto lloyd_restart = [&](uint64_t seed, RestartPortfolio *portfolio) {
+                typename ct_t::centers_t rcenters;
+                typename ct_t::assignments_t rasn = assignments; // Already sized
+                typename ct_t::costs_t rcosts;
+                auto [initcenters, initasn, initcosts] = jsd::make_kmeanspp(app, ct.k, seed, ct.weights);
+                assert(initcenters.size() == k);
+                for(const auto id: initcenters)
+                    rcenters.emplace_back(row(app.data(), id));
+                assert(rcenters.size() == k);
+                PRETTY_SAY << "Beginning lloyd loop\n";
+                // Perform EM
+                double cost = 0.;
+                if(auto ret = perform_lloyd_loop<asn_method>(rcenters, rasn, app, k, rcosts, seed, ct.weights, max_iter, eps, portfolio)) {
+                    if(ret == ABANDONED) cost = std::numeric_limits<double>::infinity();
+                    else std::fprintf(stderr, "lloyd loop ret: %s\n", ret == REACHED_MAX_ROUNDS ? "max rounds": "unfinished");
+                }
+                if constexpr(asn_method == HARD) {
+                    if(cost == 0.)
+                        for(size_t i = 0; i < rcosts.size(); ++i)
+                            cost += weights ? double(rcosts[i]) * weights[i]: double(rcosts[i]);
+                }
+                return std::make_pair(cost, std::make_tuple(std::move(rcenters), std::move(rasn), std::move(rcosts)));
+            };
+            if(asn_method == HARD && nrestarts > 1) {
+                RestartPortfolio portfolio(ct.restart_slack);
+                std::tie(centers, assignments, costs) = run_portfolio(nrestarts, [&](unsigned r, RestartPortfolio &pf) {
+                    return lloyd_restart(ct.seed + r, &pf);
+                }, portfolio, ct.restart_groups).second;
+                PRETTY_SAY << "Best of " << nrestarts << " restarts: " << portfolio.best() << ", " << portfolio.nabandoned() << " abandoned\n";
+            } else {
+                std::tie(centers, assignments, costs) = lloyd_restart(ct.seed, nullptr).second;
+            }
         }
     } else if(dist::detail::satisfies_metric(measure) || dist::detail::satisfies_rho_metric(measure)) {
         MINOCORE_REQUIRE(asn_method == HARD, "Can't do soft metric k-median");
@@ -530,9 +874,11 @@ auto perform_clustering(const jsd::DissimilarityApplicator<MatrixType> &app, uns
                         OptimizationMethod opt=DEFAULT_OPT,
                         ApproximateSolutionType approx=DEFAULT_APPROX,
                         uint64_t seed=0,
-                        size_t max_iter=100, double eps=1e-4)
+                        size_t max_iter=100, double eps=1e-4,
+                        size_t coreset_size=0, double coreset_eps=0., unsigned nrestarts=1)
 {
-    return perform_clustering<asn_method, co, MatrixType, IT>(app, app.size(), k, weights, csample, opt, approx, seed, max_iter, eps);
+    return perform_clustering<asn_method, co, MatrixType, IT>(app, app.size(), k, weights, csample, opt, approx, seed, max_iter, eps,
+                                                              coreset_size, coreset_eps, nrestarts);
 }
 
 template<typename FT=float, typename IT=uint32_t, typename OracleType>
@@ -542,8 +888,10 @@ auto perform_clustering(const OracleType &app, size_t npoints, unsigned k,
                         OptimizationMethod opt=DEFAULT_OPT,
                         ApproximateSolutionType approx=DEFAULT_APPROX,
                         uint64_t seed=0,
-                        size_t max_iter=100, double eps=ClusteringTraits<FT, IT, HARD, EXTRINSIC>::DEFAULT_EPS)
+                        size_t max_iter=100, double eps=ClusteringTraits<FT, IT, HARD, EXTRINSIC>::DEFAULT_EPS,
+                        unsigned nrestarts=1)
 {
+    METRICS_STAGE("perform_clustering");
     // Setup
     if(opt == DEFAULT_OPT) opt = METRIC_KMEDIAN;
     if(approx == DEFAULT_APPROX) approx = CONSTANT_FACTOR;
@@ -551,6 +899,7 @@ auto perform_clustering(const OracleType &app, size_t npoints, unsigned k,
     MINOCORE_REQUIRE(opt == METRIC_KMEDIAN, "No other method supported for metric clustering");
     auto clustering_traits = make_clustering_traits<FT, IT, HARD, EXTRINSIC>(npoints, k,
         csample, opt, approx, weights, seed, max_iter, eps);
+    clustering_traits.nrestarts = nrestarts;
     using ct_t = decltype(clustering_traits);
 
     // Cluster
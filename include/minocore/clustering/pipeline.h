@@ -0,0 +1,175 @@
+#pragma once
+#ifndef FGC_CLUSTERING_PIPELINE_H__
+#define FGC_CLUSTERING_PIPELINE_H__
+#include "minocore/clustering/dispatch.h"
+#include "taskflow/taskflow.hpp"
+#include <exception>
+#include <functional>
+#include <thread>
+
+namespace minocore {
+
+namespace clustering {
+
+/*
+ * Task-graph executor for coreset clustering, built on taskflow.
+ *
+ * The graph is
+ *     load -> prepare -> {seed -> sensitivity -> sample -> optimize -> assign} for each job,
+ * where prepare builds the DissimilarityApplicator (normalizing the data in place) and, with the threads
+ * of every worker, its log/sqrt caches per its cache mode, so that no job builds them on first use;
+ * each job (e.g., one per k or per restart seed)
+ * runs the stages of detail::CoresetRun.
+ * Jobs are independent, so their stages overlap: while one job is in a serial section
+ * (prefix sums in k-means++, alias table construction, JV's edge sort), workers steal ready stages
+ * of other jobs instead of waiting at the end of a parallel loop.
+ *
+ * Each task runs its OpenMP loops on threads_per_task threads, so that
+ * nworkers * threads_per_task need not oversubscribe the machine.
+ * An exception in any stage stops the remaining stages of its job and is rethrown by run().
+ */
+template<CenterOrigination co=INTRINSIC, typename MatrixType=blaze::DynamicMatrix<float>, typename IT=uint32_t>
+class CoresetPipeline {
+public:
+    using FT = ElementType_t<MatrixType>;
+    using app_t = jsd::DissimilarityApplicator<MatrixType>;
+    using ct_t = ClusteringTraits<FT, IT, HARD, co>;
+    using run_t = detail::CoresetRun<co, MatrixType, FT, IT>;
+    using PriorContainer = blaze::DynamicVector<FT, blaze::rowVector>;
+private:
+    MatrixType &data_;
+    std::function<void(MatrixType &)> load_;
+    const DissimilarityMeasure measure_;
+    const dist::Prior prior_;
+    const PriorContainer *prior_data_;
+    std::unique_ptr<app_t> app_;
+    std::vector<ct_t> jobs_;
+    std::vector<size_t> cs_sizes_;
+    std::vector<std::unique_ptr<run_t>> runs_;
+    std::vector<double> costs_; // Kept apart from runs_, which result() moves out of
+    std::vector<std::exception_ptr> errors_;
+    tf::Executor executor_;
+    unsigned threads_per_task_;
+
+    template<typename F>
+    auto stage(size_t j, F &&f) {
+        return [this,j,f=std::forward<F>(f)]() {
+            if(errors_[j]) return;
+            OMP_SET_NT(threads_per_task_);
+            try {
+                f();
+            } catch(...) {
+                errors_[j] = std::current_exception();
+            }
+        };
+    }
+public:
+    /*
+     * data is read, and normalized in place, by the prepare task.
+     * If load is provided, it fills data first, as the graph's load task.
+     * nworkers defaults to the number of hardware threads, and threads_per_task to hardware threads / nworkers.
+     */
+    CoresetPipeline(MatrixType &data, DissimilarityMeasure measure, dist::Prior prior=dist::NONE,
+                    const PriorContainer *prior_data=nullptr, std::function<void(MatrixType &)> load=nullptr,
+                    unsigned nworkers=0, unsigned threads_per_task=0):
+        data_(data), load_(std::move(load)), measure_(measure), prior_(prior), prior_data_(prior_data),
+        executor_(nworkers ? nworkers: std::max(1u, std::thread::hardware_concurrency())),
+        threads_per_task_(threads_per_task ? threads_per_task
+                                           : std::max(1u, std::thread::hardware_concurrency() / unsigned(executor_.num_workers())))
+    {
+    }
+
+    /*
+     * Adds a job; ct may come from make_clustering_traits and must request a coreset
+     * (coreset_size or coreset_eps). Returns the job's index.
+     */
+    size_t add_job(ct_t ct) {
+        update_defaults_with_measure(ct, measure_);
+        const size_t cs_size = requested_coreset_size(ct);
+        if(!cs_size) throw std::invalid_argument("Pipeline jobs must set coreset_size or coreset_eps");
+        jobs_.push_back(ct);
+        cs_sizes_.push_back(cs_size);
+        return jobs_.size() - 1;
+    }
+    // Convenience for sweeps over k and restarts: copies base with k and seed replaced.
+    size_t add_job(const ct_t &base, unsigned k, uint64_t seed) {
+        ct_t ct = base;
+        ct.k = k;
+        ct.seed = seed;
+        return add_job(ct);
+    }
+    size_t njobs() const {return jobs_.size();}
+
+    /*
+     * Runs every job added so far. The data are loaded and prepared only by the first call;
+     * later calls (e.g., after adding jobs) rerun every job from its seed stage on the prepared applicator.
+     */
+    void run() {
+        runs_.clear();
+        runs_.resize(jobs_.size());
+        costs_.clear();
+        errors_.assign(jobs_.size(), nullptr);
+        std::exception_ptr prep_error;
+        tf::Taskflow taskflow;
+        const bool prepared = bool(app_);
+        auto load = taskflow.emplace([&]() {
+            if(prepared) return;
+            OMP_SET_NT(threads_per_task_ * unsigned(executor_.num_workers()));
+            try {
+                if(load_) load_(data_);
+            } catch(...) {prep_error = std::current_exception();}
+        });
+        auto prepare = taskflow.emplace([&]() {
+            if(prepared || prep_error) return;
+            OMP_SET_NT(threads_per_task_ * unsigned(executor_.num_workers()));
+            try {
+                app_.reset(new app_t(data_, measure_, prior_, prior_data_));
+                app_->prepare_caches();
+            } catch(...) {prep_error = std::current_exception();}
+        });
+        load.precede(prepare);
+        for(size_t j = 0; j < jobs_.size(); ++j) {
+            auto seed = taskflow.emplace(stage(j, [this,j,&prep_error]() {
+                if(prep_error) std::rethrow_exception(prep_error);
+                runs_[j].reset(new run_t(*app_, jobs_[j], cs_sizes_[j]));
+                runs_[j]->seed();
+            }));
+            auto sensitivity = taskflow.emplace(stage(j, [this,j]() {runs_[j]->sensitivity();}));
+            auto sample = taskflow.emplace(stage(j, [this,j]() {runs_[j]->sample();}));
+            auto optimize = taskflow.emplace(stage(j, [this,j]() {runs_[j]->optimize();}));
+            auto assign = taskflow.emplace(stage(j, [this,j]() {runs_[j]->assign();}));
+            prepare.precede(seed);
+            seed.precede(sensitivity);
+            sensitivity.precede(sample);
+            sample.precede(optimize);
+            optimize.precede(assign);
+        }
+        executor_.run(taskflow).wait();
+        if(prep_error) std::rethrow_exception(prep_error);
+        for(const auto &e: errors_)
+            if(e) std::rethrow_exception(e);
+        costs_.resize(runs_.size());
+        for(size_t j = 0; j < runs_.size(); ++j) costs_[j] = runs_[j]->cost();
+    }
+
+    const app_t &applicator() const {return *app_;}
+    // Stages' state of job j; its final centers, assignments and costs are gone once result(j) has been called.
+    const run_t &job(size_t j) const {return *runs_.at(j);}
+    // Weighted cost of job j's final assignment; valid after result(j) as well.
+    double cost(size_t j) const {return costs_.at(j);}
+    // Index of the cheapest job, for restarts of the same k
+    size_t best() const {
+        if(costs_.empty()) throw std::runtime_error("No jobs have been run");
+        return std::min_element(costs_.begin(), costs_.end()) - costs_.begin();
+    }
+    // (centers, assignments, costs) of job j, as returned by perform_clustering; moves out of the job.
+    auto result(size_t j) {return runs_.at(j)->result();}
+};
+
+} // namespace clustering
+
+using clustering::CoresetPipeline;
+
+} // namespace minocore
+
+#endif /* FGC_CLUSTERING_PIPELINE_H__ */
@@ -43,7 +43,7 @@ select_uniform_random(const OracleType &oracle, size_t np, ClusteringTraits<FT,
             if(costs[i] == 0.) continue;
             auto c = oracle(next, i);
             if(c < costs[i])
-                costs[i] = c, assignments[i] = selected.size();
+                costs[i] = c, assignments[i] = next;
         }
         sel.insert(next);
         selected.push_back(next);
@@ -0,0 +1,202 @@
+#pragma once
+#ifndef FGC_CLUSTERING_SWEEP_H__
+#define FGC_CLUSTERING_SWEEP_H__
+#include "minocore/clustering/dispatch.h"
+#include <random>
+
+namespace minocore {
+
+namespace clustering {
+
+/*
+ * Solutions for several values of k, for model selection.
+ * ks_ is sorted and unique; cost_curve_[i] and solutions_[i] (centers, assignments, costs) are for ks_[i].
+ */
+template<typename CentersType, typename AssignmentsType, typename CostsType>
+struct KSweepResult {
+    std::vector<unsigned> ks_;
+    std::vector<double> cost_curve_;
+    std::vector<std::tuple<CentersType, AssignmentsType, CostsType>> solutions_;
+
+    size_t size() const {return ks_.size();}
+    size_t index(unsigned k) const {
+        auto it = std::lower_bound(ks_.begin(), ks_.end(), k);
+        if(it == ks_.end() || *it != k) throw std::out_of_range(std::string("k = ") + std::to_string(k) + " was not swept");
+        return it - ks_.begin();
+    }
+    double cost(unsigned k) const {return cost_curve_[index(k)];}
+    const auto &solution(unsigned k) const {return solutions_[index(k)];}
+};
+
+namespace detail {
+
+inline std::vector<unsigned> sweep_ks(std::vector<unsigned> ks, size_t np) {
+    shared::sort(ks.begin(), ks.end());
+    ks.erase(std::unique(ks.begin(), ks.end()), ks.end());
+    if(ks.empty() || ks.front() == 0) throw std::invalid_argument("Need at least one nonzero k to sweep");
+    if(ks.back() > np) throw std::invalid_argument("k cannot exceed the number of points");
+    return ks;
+}
+
+template<typename CT, typename WFT>
+double weighted_cost(const CT &costs, const WFT *weights) {
+    double ret = 0.;
+    for(size_t i = 0; i < costs.size(); ++i)
+        ret += weights ? double(costs[i]) * weights[i]: double(costs[i]);
+    return ret;
+}
+
+/*
+ * Removes facilities from sol (rows of costmat) until k remain, each time the one whose removal
+ * increases the cost least, computed from each client's best and second-best open facility.
+ */
+template<typename IT, typename CostMatrix>
+void drop_cheapest_facilities(std::vector<IT> &sol, unsigned k, const CostMatrix &costmat) {
+    using FT = std::decay_t<decltype(costmat(0, 0))>;
+    const size_t nc = costmat.columns();
+    std::vector<double> loss(sol.size());
+    while(sol.size() > k) {
+        std::fill(loss.begin(), loss.begin() + sol.size(), 0.);
+        OMP_PFOR
+        for(size_t c = 0; c < nc; ++c) {
+            FT b1 = std::numeric_limits<FT>::max(), b2 = b1;
+            size_t bi = 0;
+            for(size_t i = 0; i < sol.size(); ++i) {
+                const FT v = costmat(sol[i], c);
+                if(v < b1) b2 = b1, b1 = v, bi = i;
+                else if(v < b2) b2 = v;
+            }
+            if(b2 != b1) {
+                OMP_ATOMIC
+                loss[bi] += double(b2) - double(b1);
+            }
+        }
+        const size_t worst = std::min_element(loss.begin(), loss.begin() + sol.size()) - loss.begin();
+        sol.erase(sol.begin() + worst);
+    }
+}
+
+} // namespace detail
+
+/*
+ * Metric k-median for every k in ks, sharing candidate selection and the facility cost matrix.
+ *
+ * Candidates are selected once, per traits (sampling, approx_mul, sparse_candidates), for max(ks):
+ * a candidate set good enough for k_max is a superset of one for any smaller k,
+ * and Thorup's and D2 selections for k_max are valid prefixes for every smaller k.
+ * k_max is solved with traits.metric_solver; then, in decreasing order, each k starts from
+ * the solution for k + 1 (or the next larger k swept) with its cheapest facilities removed,
+ * and is improved by local search on the shared cost matrix.
+ * If warm_start is false, each k is solved from scratch on the shared matrix instead.
+ * Centers are point ids, as in perform_cluster_metric_kmedian.
+ */
+template<typename IT=uint32_t, typename FT, typename OracleType, typename Traits>
+auto sweep_metric_kmedian(const OracleType &app, size_t np, std::vector<unsigned> ks, Traits traits, bool warm_start=true)
+{
+    KSweepResult<std::vector<IT>, blaze::DynamicVector<IT>, blaze::DynamicVector<FT>> ret;
+    ret.ks_ = detail::sweep_ks(std::move(ks), np);
+    const size_t nk = ret.ks_.size();
+    ret.cost_curve_.resize(nk);
+    ret.solutions_.resize(nk);
+    const bool sparse = traits.sparse_candidates;
+    traits.k = ret.ks_.back();
+    const auto sel = select_metric_candidates<IT, FT>(app, np, traits);
+    auto sweep = [&](const auto &costmat) {
+        std::vector<IT> center_rows;
+        for(size_t ki = nk; ki--;) {
+            const unsigned k = ret.ks_[ki];
+            traits.k = k;
+            if(!warm_start || ki == nk - 1 || traits.metric_solver == JAIN_VAZIRANI_FL) {
+                center_rows = solve_facility_kmedian<IT>(costmat, traits);
+            } else {
+                detail::drop_cheapest_facilities(center_rows, k, costmat);
+                auto lsearcher = minocore::make_kmed_lsearcher(costmat, k, traits.eps, traits.seed + k);
+                lsearcher.lazy_eval_ = 2;
+                lsearcher.assign_centers(center_rows.begin(), center_rows.end());
+                lsearcher.run();
+                center_rows.assign(lsearcher.sol_.begin(), lsearcher.sol_.end());
+            }
+            auto &sol = ret.solutions_[ki];
+            sol = assign_metric_centers<IT, FT>(app, np, sel, center_rows, sparse || traits.weights);
+            ret.cost_curve_[ki] = detail::weighted_cost(std::get<2>(sol), traits.weights);
+            PRETTY_SAY << "k = " << k << ": cost " << ret.cost_curve_[ki] << '\n';
+        }
+    };
+    if(sparse) {
+        sweep(make_candidate_costs(app, np, sel, traits));
+    } else {
+        sweep(sel.facility_cost_matrix());
+    }
+    return ret;
+}
+
+/*
+ * Hard Lloyd's (EM) for every k in ks, sharing one k-means++ prefix.
+ *
+ * The D2 prefix of length max(ks) is computed once; its first k centers are a k-means++ seeding for every k.
+ * The smallest k starts from its prefix. With warm_start, each larger k starts from the converged
+ * centers of the previous k, plus centers D2-sampled from that solution's point costs
+ * (updated after each new center), so each k usually needs only a few Lloyd iterations;
+ * otherwise each k starts from its prefix.
+ */
+template<typename MatrixType, typename IT=uint32_t, typename WFT=ElementType_t<MatrixType>>
+auto sweep_lloyd(const jsd::DissimilarityApplicator<MatrixType> &app, std::vector<unsigned> ks,
+                 uint64_t seed=0, const WFT *weights=nullptr, size_t max_iter=100, double eps=1e-4, bool warm_start=true)
+{
+    using FT = ElementType_t<MatrixType>;
+    using ct_t = ClusteringTraits<FT, IT, HARD, EXTRINSIC>;
+    using centers_t = typename ct_t::centers_t;
+    using assignments_t = typename ct_t::assignments_t;
+    using costs_t = typename ct_t::costs_t;
+    const size_t np = app.size();
+    KSweepResult<centers_t, assignments_t, costs_t> ret;
+    ret.ks_ = detail::sweep_ks(std::move(ks), np);
+    ret.cost_curve_.resize(ret.ks_.size());
+    ret.solutions_.resize(ret.ks_.size());
+    auto [prefix, prefix_asn, prefix_costs] = jsd::make_kmeanspp(app, ret.ks_.back(), seed, weights);
+    auto aa = detail::make_aa(app);
+    std::mt19937_64 rng(seed);
+    std::vector<double> cdf(np);
+    for(size_t ki = 0; ki < ret.ks_.size(); ++ki) {
+        const unsigned k = ret.ks_[ki];
+        centers_t centers;
+        assignments_t asn(np);
+        costs_t costs;
+        if(!warm_start || ki == 0) {
+            for(unsigned i = 0; i < k; ++i)
+                centers.emplace_back(row(app.data(), prefix[i]));
+        } else {
+            const auto &[pcenters, pasn, pcosts] = ret.solutions_[ki - 1];
+            centers = pcenters;
+            costs = pcosts;
+            while(centers.size() < k) {
+                double total = 0.;
+                for(size_t i = 0; i < np; ++i)
+                    cdf[i] = total += weights ? double(costs[i]) * weights[i]: double(costs[i]);
+                // If every point is already at cost 0, any point will do
+                const size_t id = total > 0. ? std::min(size_t(std::upper_bound(cdf.begin(), cdf.end(), std::uniform_real_distribution<double>(0., total)(rng)) - cdf.begin()), np - 1)
+                                             : size_t(rng() % np);
+                centers.emplace_back(row(app.data(), id));
+                OMP_PFOR
+                for(size_t i = 0; i < np; ++i)
+                    if(const FT d = aa(i, id); d < costs[i]) costs[i] = d;
+            }
+        }
+        if(auto rc = perform_lloyd_loop<HARD>(centers, asn, app, k, costs, seed + k, weights, max_iter, eps))
+            std::fprintf(stderr, "lloyd loop ret for k = %u: %s\n", k, rc == REACHED_MAX_ROUNDS ? "max rounds": "unfinished");
+        ret.cost_curve_[ki] = detail::weighted_cost(costs, weights);
+        PRETTY_SAY << "k = " << k << ": cost " << ret.cost_curve_[ki] << '\n';
+        ret.solutions_[ki] = std::make_tuple(std::move(centers), std::move(asn), std::move(costs));
+    }
+    return ret;
+}
+
+} // namespace clustering
+
+using clustering::KSweepResult;
+using clustering::sweep_metric_kmedian;
+using clustering::sweep_lloyd;
+
+} // namespace minocore
+
+#endif /* FGC_CLUSTERING_SWEEP_H__ */
@@ -1,5 +1,7 @@
 #ifndef FGC_CLUSTERING_TRAITS_H__
 #define FGC_CLUSTERING_TRAITS_H__
+#include "minocore/util/packed.h"
+#include <vector>
 
 namespace minocore {
 namespace clustering {
@@ -113,8 +115,26 @@ struct ClusteringTraits {
     size_t npoints = 0;
 
     bool compute_full = true;
+    // If nonzero, metric solvers keep only this many candidate facilities per point (see SparseFacilityCosts)
+    unsigned sparse_candidates = 0;
+    // If set along with sparse_candidates, candidates come from these neighbor lists (as built by make_knns
+    // or make_knns_by_lsh over the same points) instead of from every selected facility
+    const std::vector<packed::pair<FT, IT>> *knns = nullptr;
+    // Memory budget for the pairwise oracle cache used by Thorup sampling when no distance matrix is precomputed (0 to hold every pair)
+    size_t oracle_cache_bytes = size_t(1) << 30;
+    // Restarts of local search and Lloyd's run as a portfolio (see RestartPortfolio) on restart_groups thread groups
+    unsigned nrestarts = 1;
+    unsigned restart_groups = 0;
+    // Abandons restarts more than this fraction behind the best after a few steps. As this depends on how far
+    // the other restarts have got, results may depend on timing when nrestarts > 1; set negative to disable.
+    double restart_slack = .5;
     uint64_t seed = 13;
 
+    // Coreset mode: if either is set, optimize on a weighted coreset and then assign all points.
+    // coreset_size takes precedence; otherwise, about k / coreset_eps^2 points are sampled.
+    size_t coreset_size = 0;
+    double coreset_eps = 0.;
+
     const FT *weights = nullptr;
 
     static_assert(std::is_floating_point_v<FT>, "FT must be floating");
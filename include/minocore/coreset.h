@@ -3,6 +3,8 @@
 
 #include <minocore/coreset/coreset.h>
 #include <minocore/coreset/matrix_coreset.h>
+#include <minocore/coreset/merge_reduce.h>
+#include <minocore/coreset/distortion.h>
 
 #include <minocore/coreset/gmm.h>
 
@@ -4,8 +4,8 @@
 #include <vector>
 #include <map>
 #include <queue>
-#include "alias_sampler/alias_sampler.h"
 #include "minocore/util/shared.h"
+#include "minocore/util/alias.h"
 #include "blaze/math/CustomVector.h"
 #include "blaze/math/DynamicVector.h"
 #include <zlib.h>
@@ -54,6 +54,23 @@ static const char *sm2str(SensitivityMethod sm) {
     }
     return "UNKNOWN";
 }
+
+enum SamplingScheme: int {
+    IID,                  // Independent draws with replacement
+    SYSTEMATIC,           // One uniform offset, n evenly spaced points on the cdf
+    STRATIFIED_BY_CENTER, // Samples allocated to clusters by probability mass, systematic within each
+    POISSON               // Independent inclusion with probability min(1, c * p_i), expected size n
+};
+
+static const char *ss2str(SamplingScheme ss) {
+    switch(ss) {
+        case IID:                  return "IID";
+        case SYSTEMATIC:           return "SYSTEMATIC";
+        case STRATIFIED_BY_CENTER: return "STRATIFIED_BY_CENTER";
+        case POISSON:              return "POISSON";
+    }
+    return "UNKNOWN";
+}
 using namespace std::literals;
 
 template<typename IT, typename FT>
@@ -91,7 +108,7 @@ struct IndexCoreset {
             throw std::runtime_error("Failed to write in "s + __PRETTY_FUNCTION__);
     }
     void write(std::string path) const {
-        gzFile fp = gzopen(path.data(), "rb");
+        gzFile fp = gzopen(path.data(), "wb");
         if(!fp) throw std::runtime_error("Failed to open file in "s + __PRETTY_FUNCTION__);
         write(fp);
         gzclose(fp);
@@ -184,23 +201,104 @@ auto map2index(const MapCoreset<IT, FT, MapType, Extra...> &map) {
     return ret;
 }
 
+namespace detail {
+
+struct Identity {
+    template<typename T> double operator()(T x) const {return x;}
+};
+
+struct CenterSums {
+    std::vector<double> weight_sums_, cost_sums_;
+    std::vector<uint64_t> counts_;
+    double total_cost_ = 0.;   // sum of w * f(cost)
+    double total_weight_ = 0.; // sum of w
+    double raw_cost_ = 0.;     // sum of f(cost), ignoring weights
+};
+
+/*
+ * Per-center sums of weights, weighted costs and point counts.
+ * Points are split into one fixed block per thread; each block accumulates into its own
+ * partials, and partials are combined in block order.
+ * Results are therefore bitwise identical for a given thread count, with no atomics.
+ * func is applied to each cost before accumulation.
+ */
+template<typename CFT, typename IT, typename WFT, typename Func=Identity>
+CenterSums center_sums(size_t np, size_t ncenters, const CFT *costs, const IT *assignments,
+                       const WFT *weights, const Func &func=Func())
+{
+    unsigned nblocks = 1;
+    OMP_ONLY(nblocks = std::max(1, omp_get_max_threads());)
+    nblocks = std::max(size_t(1), std::min(size_t(nblocks), np));
+    std::vector<double> wsums(size_t(nblocks) * ncenters), csums(size_t(nblocks) * ncenters), rawsums(nblocks);
+    std::vector<uint64_t> counts(size_t(nblocks) * ncenters);
+    OMP_PRAGMA("omp parallel for schedule(static, 1)")
+    for(unsigned b = 0; b < nblocks; ++b) {
+        double *const lw = &wsums[size_t(b) * ncenters], *const lc = &csums[size_t(b) * ncenters];
+        uint64_t *const ln = &counts[size_t(b) * ncenters];
+        double raw = 0.;
+        for(size_t i = np * b / nblocks, e = np * (b + 1) / nblocks; i < e; ++i) {
+            const auto asn = assignments[i];
+            assert(asn < ncenters);
+            const double w = weights ? double(weights[i]): 1., c = func(costs[i]);
+            lw[asn] += w;
+            lc[asn] += w * c;
+            ++ln[asn];
+            raw += c;
+        }
+        rawsums[b] = raw;
+    }
+    CenterSums ret;
+    ret.weight_sums_.resize(ncenters);
+    ret.cost_sums_.resize(ncenters);
+    ret.counts_.resize(ncenters);
+    OMP_PFOR
+    for(size_t c = 0; c < ncenters; ++c) {
+        double w = 0., cs = 0.;
+        uint64_t n = 0;
+        for(unsigned b = 0; b < nblocks; ++b) {
+            w += wsums[size_t(b) * ncenters + c];
+            cs += csums[size_t(b) * ncenters + c];
+            n += counts[size_t(b) * ncenters + c];
+        }
+        ret.weight_sums_[c] = w; ret.cost_sums_[c] = cs; ret.counts_[c] = n;
+    }
+    for(size_t c = 0; c < ncenters; ++c)
+        ret.total_cost_ += ret.cost_sums_[c], ret.total_weight_ += ret.weight_sums_[c];
+    for(const auto v: rawsums) ret.raw_cost_ += v;
+    return ret;
+}
+
+} // namespace detail
+
 template<typename FT=float, typename IT=std::uint32_t>
 struct CoresetSampler {
-    using Sampler = alias::AliasSampler<FT, wy::WyRand<IT, 2>, IT>;
+    using Sampler = sampling::AliasTable<FT, wy::WyRand<IT, 2>, IT>;
     using CoresetType = IndexCoreset<IT, FT>;
     std::unique_ptr<Sampler>     sampler_;
-    std::unique_ptr<FT []>         probs_;
+    std::shared_ptr<FT []>         probs_; // Shared so that a loaded sampler can point into a mapped file
     std::unique_ptr<blaze::DynamicVector<FT>> weights_;
     std::unique_ptr<blaze::DynamicVector<IT>> fl_bicriteria_points_; // Used only by FL
     std::unique_ptr<IT []>        fl_asn_;
+    std::unique_ptr<IT []>           asn_; // Used only by STRATIFIED_BY_CENTER sampling; kept if keep_asn_ is set
     size_t                            np_;
     size_t                             k_;
     size_t                             b_;
     uint64_t                  seed_ = 137;
     SensitivityMethod sens_        =  BFL;
+    bool lazy_alias_            = false; // If set, the alias table is built on the first call to sample()
+    bool keep_asn_              = false; // If set, make_sampler keeps a copy of assignments for stratified sampling
 
 
-    bool ready() const {return sampler_.get();}
+    bool ready() const {return probs_.get();}
+
+    // Set before make_sampler to defer alias table construction, e.g., when only sample_once will be used.
+    void set_lazy_alias(bool lazy=true) {lazy_alias_ = lazy;}
+    // Set before make_sampler to keep a copy of the assignments, which STRATIFIED_BY_CENTER sampling needs.
+    void set_keep_assignments(bool keep=true) {keep_asn_ = keep;}
+    void build_sampler(uint64_t seed) {
+        if(lazy_alias_) sampler_.reset();
+        else            sampler_.reset(new Sampler(probs_.get(), probs_.get() + np_, seed));
+    }
 
     bool operator==(const CoresetSampler &o) const {
         return np_ == o.np_ &&
@@ -277,7 +375,7 @@ struct CoresetSampler {
             weights_.reset(new blaze::DynamicVector<FT>(n));
             gzread(fp, weights_->data(), sizeof(FT) * n);
         }
-        sampler_.reset(new Sampler(probs_.get(), probs_.get() + n, seed_));
+        build_sampler(seed_);
     }
     void read(std::FILE *fp) {
         uint64_t n;
@@ -293,7 +391,7 @@ struct CoresetSampler {
             weights_.reset(new blaze::DynamicVector<FT>(n));
             ::read(fd, weights_->data(), sizeof(FT) * n);
         }
-        sampler_.reset(new Sampler(probs_.get(), probs_.get() + n, seed_));
+        build_sampler(seed_);
     }
 
     template<typename CFT>
@@ -308,47 +406,23 @@ struct CoresetSampler {
         // http://www.jmlr.org/papers/volume18/15-506/15-506.pdf
         // Note: this can be expanded to general probability measures.
         throw std::runtime_error("I'm not certain this is correct. Do not use this until I am.");
-        std::vector<FT> weight_sums(ncenters), weighted_cost_sums(ncenters);
-        std::vector<FT> sqcosts(ncenters);
-        std::vector<IT> center_counts(ncenters);
-        double total_cost = 0.;
-
-        // TODO: vectorize
-        // Sketch: check for SSE2/AVX2/AVX512
-        //         if weights is null,
-        //         set a vector via Space::set1()
-        //
-        OMP_PRAGMA("omp parallel for reduction(+:total_cost)")
-        for(size_t i = 0; i < np_; ++i) {
-            // TODO: vectorize?
-            // weight sums per assignment couldn't be vectorized,
-            // total costs could be
-            // Probably a 4-16x speedup on 1/3 of the cost
-            // So maybe like a ~30% speedup?
-            auto asn = assignments[i];
-            assert(asn < ncenters);
-            const auto w = getweight(i);
-            auto cost = costs[i] * costs[i]; // d^2(x, A)
-            auto wcost = w * cost;
-            OMP_ATOMIC
-            weighted_cost_sums[asn] += wcost;
-            OMP_ATOMIC
-            weight_sums[asn] += w; // If unweighted, weights are 1.
-            OMP_ATOMIC
-            ++center_counts[asn];
-            total_cost += wcost;
-            sqcosts[i] = cost;
-        }
+        const auto sums = detail::center_sums(np_, ncenters, costs, assignments, weights_ ? weights_->data(): static_cast<const FT *>(nullptr),
+                                              [](auto x) {return double(x) * x;}); // d^2(x, A)
+        const double total_cost = sums.total_cost_;
+        probs_.reset(new FT[np_]);
+        double total_prob = 0.;
+        for(size_t a = 0; a < ncenters; ++a)
+            if(sums.counts_[a])
+                total_prob += 2. * alpha_est * sums.cost_sums_[a] + 2. * total_cost * sums.counts_[a] / sums.weight_sums_[a];
+        const double tpinv = 1. / total_prob;
         OMP_PFOR
         for(size_t i = 0; i < np_; ++i) {
-            this->probs_[i] = alpha_est * getweight(i) * (sqcosts[i] + weighted_cost_sums[assignments[i]] / weight_sums[assignments[i]])
-                        + 2. * total_cost / weight_sums[assignments[i]];
+            const auto asn = assignments[i];
+            const double sqcost = double(costs[i]) * costs[i];
+            probs_[i] = (alpha_est * getweight(i) * (sqcost + sums.cost_sums_[asn] / sums.weight_sums_[asn])
+                        + 2. * total_cost / sums.weight_sums_[asn]) * tpinv;
         }
-        auto si = 1. / std::accumulate(&this->probs_[0], this->probs_.get() + np_, 0.);
-        OMP_PFOR
-        for(size_t i = 0; i < np_; ++i)
-            this->probs_[i] *= si;
-        sampler_.reset(new Sampler(probs_.get(), probs_.get() + np_, seed));
+        build_sampler(seed);
     }
     template<typename CFT>
     void make_sampler(size_t np, size_t ncenters,
@@ -361,14 +435,19 @@ struct CoresetSampler {
                       double alpha_est=0.)
     {
         sens_ = sens;
+        seed_ = seed;
         np_ = np;
         b_ = ncenters;
+        if(keep_asn_) {
+            asn_.reset(new IT[np_]);
+            std::copy(assignments, assignments + np_, asn_.get());
+        } else asn_.reset();
         if(!k) k = ncenters;
         k_ = k;
         if(weights) {
             weights_.reset(new blaze::DynamicVector<FT>(np_));
             std::memcpy(weights_->data(), weights, sizeof(FT) * np_);
-        } else weights_.release();
+        } else weights_.reset();
         if(sens == LUCIC_FAULKNER_KRAUSE_FELDMAN) {
             make_gmm_sampler(ncenters, costs, assignments, seed, alpha_est);
         } else if(sens == VARADARAJAN_XIAO) {
@@ -391,36 +470,17 @@ struct CoresetSampler {
                          const CFT *costs, const IT *assignments,
                          uint64_t seed=137)
     {
-        auto cv = blaze::CustomVector<CFT, blaze::unaligned, blaze::unpadded>(const_cast<CFT *>(costs), np_);
-        double total_cost =
-            weights_ ? blaze::dot(*weights_, cv)
-                     : blaze::sum(cv);
+        const auto sums = detail::center_sums(np_, ncenters, costs, assignments, weights_ ? weights_->data(): static_cast<const FT *>(nullptr));
+        // sensitivity = weight * cost / total_cost + 1. / (cluster size)
+        // These sum to 1 + the number of non-empty clusters, so normalization is folded into the same pass.
+        size_t nonempty = 0;
+        for(const auto c: sums.counts_) nonempty += c != 0;
+        const double tcinv = 1. / sums.total_cost_, norm = 1. / (1. + nonempty);
         probs_.reset(new FT[np_]);
-        blaze::CustomVector<FT, blaze::unaligned, blaze::unpadded> sensitivies(probs_.get(), np_);
-        std::vector<IT> center_counts(ncenters);
         OMP_PFOR
-        for(size_t i = 0; i < np_; ++i) {
-            OMP_ATOMIC
-            ++center_counts[assignments[i]];
-        }
-        if(weights_) {
-            sensitivies = (*weights_) * cv * (1. / total_cost);
-        } else {
-            sensitivies = cv * (1. / total_cost);
-        }
-        // sensitivities = weights * costs / total_cost
-        blaze::DynamicVector<FT> ccinv(ncenters);
-        for(unsigned i = 0; i < ncenters; ++i)
-            ccinv[i] = 1. / center_counts[i];
-        OMP_PFOR
-        for(size_t i = 0; i < np_; ++i) {
-            sensitivies[i] += ccinv[assignments[i]];
-        }
-        // sensitivities = weights * costs / total_cost + 1. / (cluster_size)
-        const double total_sensitivity = blaze::sum(sensitivies);
-        // probabilities = sensitivity / sum(sensitivities) [use the same location in memory because we no longer need sensitivities]
-        sensitivies *= 1. / total_sensitivity;
-        sampler_.reset(new Sampler(probs_.get(), probs_.get() + np_, seed));
+        for(size_t i = 0; i < np_; ++i)
+            probs_[i] = (getweight(i) * costs[i] * tcinv + 1. / sums.counts_[assignments[i]]) * norm;
+        build_sampler(seed);
     }
     template<typename CFT>
     void make_sampler_fl(size_t,
@@ -441,7 +501,6 @@ struct CoresetSampler {
             weights_ ? blaze::dot(*weights_, cv)
                      : blaze::sum(cv);
         probs_.reset(new FT[np_]);
-        sampler_.reset(new Sampler(probs_.get(), probs_.get() + np_, seed));
         double total_cost_inv = 1. / (total_cost);
         if(weights_) {
             OMP_PFOR
@@ -452,7 +511,7 @@ struct CoresetSampler {
             blaze::CustomVector<FT, blaze::unaligned, blaze::unpadded> probv(const_cast<FT *>(probs_.get()), np_);
             probv = blaze::ceil(FT(np_) * total_cost_inv * cv) + 1.;
         }
-        sampler_.reset(new Sampler(probs_.get(), probs_.get() + np_, seed));
+        build_sampler(seed);
     }
     template<typename CFT>
     void make_sampler_lbk(size_t ncenters,
@@ -461,39 +520,22 @@ struct CoresetSampler {
     {
         const double alpha = 16 * std::log(k_) + 32., alpha2 = 2. * alpha;
 
-        //auto center_counts = std::make_unique<IT[]>(ncenters);
-        blaze::DynamicVector<FT> weight_sums(ncenters, FT(0));
-        blaze::DynamicVector<FT> cost_sums(ncenters, FT(0));
-
-        double total_costs(0.);
-        OMP_PRAGMA("omp parallel for reduction(+:total_costs)")
-        for(size_t i = 0; i < np_; ++i) {
-            const auto asn = assignments[i];
-            assert(asn < ncenters);
-            const auto w = getweight(i);
-
-            OMP_ATOMIC
-            weight_sums[asn] += w; // If unweighted, weights are 1.
-            //OMP_ATOMIC
-            //++center_counts[asn];
-
-            const double pointcost = w * costs[i];
-            OMP_ATOMIC
-            cost_sums[asn] += pointcost;
-            total_costs += w * costs[i];
-        }
-        double weight_sum = blaze::sum(weight_sums);
-        total_costs /= weight_sum;
-        const double tcinv = alpha / total_costs;
-        blaze::DynamicVector<FT> sens(np_);
-        for(size_t i = 0; i < ncenters; ++i) {
-            cost_sums[i] = alpha2 * cost_sums[i] / (weight_sums[i] * total_costs) + 4 * weight_sum / weight_sums[i];
+        const auto sums = detail::center_sums(np_, ncenters, costs, assignments, weights_ ? weights_->data(): static_cast<const FT *>(nullptr));
+        const double weight_sum = sums.total_weight_, mean_cost = sums.total_cost_ / weight_sum;
+        const double tcinv = alpha / mean_cost;
+        std::vector<double> center_terms(ncenters);
+        double total_sens = tcinv * sums.raw_cost_;
+        for(size_t a = 0; a < ncenters; ++a) {
+            if(!sums.counts_[a]) continue;
+            center_terms[a] = alpha2 * sums.cost_sums_[a] / (sums.weight_sums_[a] * mean_cost) + 4 * weight_sum / sums.weight_sums_[a];
+            total_sens += sums.counts_[a] * center_terms[a];
         }
+        const double norm = 1. / total_sens;
+        probs_.reset(new FT[np_]);
         OMP_PFOR
-        for(size_t i = 0; i < np_; ++i) {
-            sens[i] = tcinv * costs[i] + cost_sums[assignments[i]];
-        }
-        sampler_.reset(new Sampler(sens.data(), sens.data() + np_, seed));
+        for(size_t i = 0; i < np_; ++i)
+            probs_[i] = (tcinv * costs[i] + center_terms[assignments[i]]) * norm;
+        build_sampler(seed);
     }
     template<typename CFT>
     void make_sampler_bfl(size_t ncenters,
@@ -503,36 +545,150 @@ struct CoresetSampler {
         // This is for a bicriteria approximation
         // Use make_sampler_vx for a constant approximation for arbitrary metric spaces,
         // and make_sampler_lbk for bicriteria approximations for \mu-similar divergences.
-        auto cv = blaze::CustomVector<CFT, blaze::unaligned, blaze::unpadded>(const_cast<CFT *>(costs), np_);
-        double total_cost =
-            weights_ ? blaze::dot(*weights_, cv)
-                    : blaze::sum(cv);
+        const auto sums = detail::center_sums(np_, ncenters, costs, assignments, weights_ ? weights_->data(): static_cast<const FT *>(nullptr));
+        // probability = .5 * (weight * cost / total_cost + weight / (cluster weight * cluster size)),
+        // which sums to .5 * (1 + sum over non-empty clusters of 1 / cluster size).
+        double total_probs = 1.;
+        for(const auto c: sums.counts_) if(c) total_probs += 1. / c;
+        const double tcinv = 1. / sums.total_cost_, norm = 1. / total_probs;
+        std::vector<double> center_terms(ncenters);
+        for(size_t a = 0; a < ncenters; ++a)
+            if(sums.counts_[a]) center_terms[a] = 1. / (sums.weight_sums_[a] * sums.counts_[a]);
         probs_.reset(new FT[np_]);
-        double total_probs = 0.;
-        std::vector<IT> center_counts(ncenters);
-        std::vector<FT> weight_sums(ncenters);
         OMP_PFOR
         for(size_t i = 0; i < np_; ++i) {
-            const auto asn = assignments[i];
-            assert(asn < ncenters);
-            const auto w = getweight(i);
-            OMP_ATOMIC
-            weight_sums[asn] += w; // If unweighted, weights are 1.
-            OMP_ATOMIC
-            ++center_counts[asn];
+            const double w = getweight(i);
+            probs_[i] = w * (costs[i] * tcinv + center_terms[assignments[i]]) * norm;
         }
-        OMP_PRAGMA("omp parallel for reduction(+:total_probs)")
-        for(size_t i = 0; i < np_; ++i) {
-            const auto w = getweight(i);
-            double fraccost = w * costs[i] / total_cost;
-            const auto asn = assignments[i];
-            double fracw = w / (weight_sums[asn] * center_counts[asn]);
-            probs_[i] = .5 * (fraccost + fracw);
-            total_probs += probs_[i];
+        build_sampler(seed);
+    }
+    double total_probability() const {
+        double ret = 0.;
+        for(size_t i = 0; i < np_; ++i) ret += probs_[i];
+        return ret;
+    }
+    /*
+     * Systematic sampling along the cdf of the range: point i is hit
+     * floor(n * C_i - u) - floor(n * C_{i - 1} - u) times, with one u ~ U[0, 1) for all points.
+     * Weight = w_i * hits / (n * p_i), as for IID.
+     */
+    // Samples from points idx[0, len) (or [0, len) if idx is null) with total probability mass.
+    void systematic_range(const size_t *idx, size_t len, double mass, size_t n, double u,
+                          std::vector<std::pair<IT, FT>> &out) const
+    {
+        double cum = 0.;
+        int64_t prev = -1;
+        const double mul = n / mass;
+        for(size_t j = 0; j < len; ++j) {
+            const size_t i = idx ? idx[j]: j;
+            cum += probs_[i];
+            const int64_t cur = std::min(int64_t(std::floor(cum * mul - u)), int64_t(n) - 1);
+            if(cur > prev) {
+                out.emplace_back(IT(i), getweight(i) * (cur - prev) / (probs_[i] * mul));
+                prev = cur;
+            }
+        }
+    }
+    std::vector<std::pair<IT, FT>> sample_systematic(size_t n, uint64_t seed) const {
+        wy::WyRand<uint64_t, 2> rng(seed);
+        const double u = std::uniform_real_distribution<double>()(rng);
+        std::vector<std::pair<IT, FT>> ret;
+        ret.reserve(n);
+        systematic_range(nullptr, np_, total_probability(), n, u, ret);
+        return ret;
+    }
+    /*
+     * Gives each cluster with positive probability mass one sample, allocates the rest
+     * in proportion to mass (largest remainder), then samples systematically within each cluster.
+     * Weight = w_i * hits * mass_a / (n_a * p_i), which is unbiased within each stratum.
+     * n must be at least the number of clusters with positive mass.
+     */
+    std::vector<std::pair<IT, FT>> sample_stratified(size_t n, uint64_t seed) const {
+        if(!asn_) throw std::runtime_error("Stratified sampling requires set_keep_assignments() before make_sampler");
+        std::vector<size_t> offsets(b_ + 1);
+        std::vector<double> mass(b_);
+        for(size_t i = 0; i < np_; ++i)
+            ++offsets[asn_[i] + 1], mass[asn_[i]] += probs_[i];
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        std::vector<size_t> order(np_);
+        {
+            auto pos = offsets;
+            for(size_t i = 0; i < np_; ++i) order[pos[asn_[i]]++] = i;
+        }
+        const double total = std::accumulate(mass.begin(), mass.end(), 0.);
+        const size_t nstrata = std::count_if(mass.begin(), mass.end(), [](double x) {return x > 0.;});
+        if(n < nstrata)
+            throw std::invalid_argument(std::string("Stratified sampling needs at least one sample per cluster with positive mass: n = ")
+                                        + std::to_string(n) + " < " + std::to_string(nstrata));
+        const size_t nfree = n - nstrata;
+        std::vector<size_t> alloc(b_);
+        std::vector<std::pair<double, IT>> remainders(b_);
+        size_t allocated = 0;
+        for(size_t a = 0; a < b_; ++a) {
+            const double share = nfree * mass[a] / total;
+            alloc[a] = share;
+            allocated += alloc[a];
+            remainders[a] = {alloc[a] - share, IT(a)}; // Negated, so that sorting puts the largest first
+        }
+        std::sort(remainders.begin(), remainders.end());
+        for(size_t i = 0; allocated < nfree && i < b_; ++i)
+            if(mass[remainders[i].second] > 0.) ++alloc[remainders[i].second], ++allocated;
+        for(size_t a = 0; a < b_; ++a) alloc[a] += mass[a] > 0.;
+        std::vector<std::vector<std::pair<IT, FT>>> per_center(b_);
+        OMP_PFOR_DYN
+        for(size_t a = 0; a < b_; ++a) {
+            if(!alloc[a]) continue;
+            wy::WyRand<uint64_t, 2> rng(seed + a);
+            const double u = std::uniform_real_distribution<double>()(rng);
+            systematic_range(&order[offsets[a]], offsets[a + 1] - offsets[a], mass[a], alloc[a], u, per_center[a]);
+        }
+        std::vector<std::pair<IT, FT>> ret;
+        ret.reserve(n);
+        for(const auto &v: per_center) ret.insert(ret.end(), v.begin(), v.end());
+        return ret;
+    }
+    /*
+     * Poisson sampling without replacement: point i is kept independently with probability
+     * pi_i = min(1, c * p_i), where c is chosen so that the pi_i sum to n, and gets weight w_i / pi_i.
+     * Uniforms are hashed from (seed, i), so results do not depend on the thread count.
+     */
+    std::vector<std::pair<IT, FT>> sample_poisson(size_t n, uint64_t seed) const {
+        std::vector<std::pair<IT, FT>> ret;
+        if(n >= np_) {
+            ret.resize(np_);
+            for(size_t i = 0; i < np_; ++i) ret[i] = {IT(i), getweight(i)};
+            return ret;
+        }
+        double c = n / total_probability();
+        for(int iter = 0; iter < 100; ++iter) {
+            size_t ncapped = 0;
+            double uncapped_mass = 0.;
+            OMP_PRAGMA("omp parallel for reduction(+:ncapped,uncapped_mass)")
+            for(size_t i = 0; i < np_; ++i) {
+                if(c * probs_[i] >= 1.) ++ncapped;
+                else                    uncapped_mass += probs_[i];
+            }
+            if(uncapped_mass <= 0.) break;
+            const double newc = (n - double(ncapped)) / uncapped_mass;
+            if(newc <= c) break;
+            c = newc;
         }
-        // Because this doesn't necessarily sum to 1.
-        blaze::CustomVector<FT, blaze::unaligned, blaze::unpadded>(probs_.get(), np_) /= total_probs;
-        sampler_.reset(new Sampler(probs_.get(), probs_.get() + np_, seed));
+        unsigned nblocks = 1;
+        OMP_ONLY(nblocks = std::max(1, omp_get_max_threads());)
+        std::vector<std::vector<std::pair<IT, FT>>> blocks(nblocks);
+        static constexpr double max64inv = 1. / 18446744073709551616.;
+        OMP_PRAGMA("omp parallel for schedule(static, 1)")
+        for(unsigned b = 0; b < nblocks; ++b) {
+            for(size_t i = np_ * b / nblocks, e = np_ * (b + 1) / nblocks; i < e; ++i) {
+                const double pi = std::min(1., c * probs_[i]);
+                uint64_t h = seed ^ (i * 0x9E3779B97F4A7C15ull);
+                h = wy::wyhash64_stateless(&h);
+                if(h * max64inv < pi)
+                    blocks[b].emplace_back(IT(i), getweight(i) / pi);
+            }
+        }
+        for(const auto &v: blocks) ret.insert(ret.end(), v.begin(), v.end());
+        return ret;
     }
     auto getweight(size_t ind) const {
         return weights_ ? weights_->operator[](ind): static_cast<FT>(1.);
@@ -576,8 +732,32 @@ struct CoresetSampler {
             ret.weights_[i] = getweight(ind) / (dn * container[i].second);
         }
     }
+    /*
+     * Draws a coreset of n points (in expectation, for POISSON) with the given scheme.
+     * Each scheme weights points by the inverse of their expected multiplicity,
+     * so weighted sums over the coreset are unbiased for every scheme.
+     * The non-IID schemes return each selected point once; IID may repeat points.
+     */
+    IndexCoreset<IT, FT> sample(const size_t n, uint64_t seed, double eps, SamplingScheme scheme) {
+        if(unlikely(!probs_.get())) throw std::runtime_error("Sampler not constructed");
+        if(!seed) seed = seed_;
+        std::vector<std::pair<IT, FT>> selected;
+        switch(scheme) {
+            case IID: return sample(n, seed, eps);
+            case SYSTEMATIC: selected = sample_systematic(n, seed); break;
+            case STRATIFIED_BY_CENTER: selected = sample_stratified(n, seed); break;
+            case POISSON: selected = sample_poisson(n, seed); break;
+            default: throw std::invalid_argument("Invalid SamplingScheme");
+        }
+        IndexCoreset<IT, FT> ret(selected.size());
+        for(size_t i = 0; i < selected.size(); ++i)
+            ret.indices_[i] = selected[i].first, ret.weights_[i] = selected[i].second;
+        add_fl_points(ret, eps);
+        return ret;
+    }
     IndexCoreset<IT, FT> sample(const size_t n, uint64_t seed=0, double eps=0.1) {
-        if(unlikely(!sampler_.get())) throw std::runtime_error("Sampler not constructed");
+        if(unlikely(!probs_.get())) throw std::runtime_error("Sampler not constructed");
+        if(!sampler_) sampler_.reset(new Sampler(probs_.get(), probs_.get() + np_, seed_));
         if(seed) sampler_->seed(seed);
         IndexCoreset<IT, FT> ret(n);
         const double dn = n;
@@ -587,12 +767,36 @@ struct CoresetSampler {
             ret.indices_[i] = ind;
             ret.weights_[i] = getweight(ind) / (dn * probs_[ind]);
         }
+        add_fl_points(ret, eps);
+        return ret;
+    }
+    /*
+     * Draws a single coreset by a parallel prefix sum over probs_ and sorted uniforms,
+     * without building (or needing) the alias table. Prefer this with set_lazy_alias()
+     * when only one coreset is drawn; indices are returned in sorted order.
+     */
+    IndexCoreset<IT, FT> sample_once(const size_t n, uint64_t seed=0, double eps=0.1) const {
+        if(unlikely(!probs_.get())) throw std::runtime_error("Sampler not constructed");
+        auto indices = sampling::sample_sorted_uniforms<IT>(probs_.get(), np_, n, seed ? seed: seed_);
+        IndexCoreset<IT, FT> ret(n);
+        const double dn = n;
+        OMP_PFOR
+        for(size_t i = 0; i < n; ++i) {
+            const auto ind = indices[i];
+            ret.indices_[i] = ind;
+            ret.weights_[i] = getweight(ind) / (dn * probs_[ind]);
+        }
+        add_fl_points(ret, eps);
+        return ret;
+    }
+    void add_fl_points(IndexCoreset<IT, FT> &ret, double eps) const {
+        const size_t n = ret.size();
         if(sens_ == FL && fl_bicriteria_points_) {
             assert(fl_bicriteria_points_->size() == b_);
             std::unique_ptr<FT[]> wsums(new FT[b_]());
             auto &bicp = *fl_bicriteria_points_;
             for(size_t i = 0; i < n; ++i)
-                wsums[fl_asn_[i]] += ret.weights_[i];
+                wsums[fl_asn_[ret.indices_[i]]] += ret.weights_[i];
             const double wmul = (1. + 10. * eps) * b_;
             ret.resize(n + b_);
             for(size_t i = n; i < ret.size(); ++i) {
@@ -600,7 +804,6 @@ struct CoresetSampler {
                 ret.weights_[i] = std::max(wmul - wsums[i - n], 0.);
             }
         }
-        return ret;
     }
     size_t size() const {return np_;}
 };
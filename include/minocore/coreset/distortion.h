@@ -0,0 +1,166 @@
+#pragma once
+#ifndef FGC_CORESET_DISTORTION_H__
+#define FGC_CORESET_DISTORTION_H__
+#include "minocore/coreset/coreset.h"
+#include "blaze/math/DynamicMatrix.h"
+
+namespace minocore {
+namespace coresets {
+
+struct DistortionStats {
+    size_t size_;        // Number of points in the coreset
+    double max_ = 0.;    // max over center sets of |coreset cost / full cost - 1|
+    double mean_ = 0.;   // mean over center sets
+};
+
+/*
+ * Evaluates many coresets against many center sets at once.
+ *
+ * Each coreset's cost for a center set is sum_{i in S} w_i * cost(i)^z, and its distortion is
+ * |coreset cost / full cost - 1|. Since coreset points are data points, coreset costs are gathered
+ * during the full-data pass through an inverted index from point to (coreset, weight) occurrences,
+ * so no distance is computed twice.
+ *
+ * Two entry points:
+ * 1. evaluate(dist, centersets): a blocked pass over points x (union of all centers);
+ *    each distance is computed once and shared by every center set containing that center,
+ *    and each block is reduced in parallel across center sets.
+ * 2. add_costs(s, costs): per-point costs for center set s computed elsewhere
+ *    (e.g., multi-source shortest paths on a graph). Calls for distinct s may run concurrently.
+ *
+ * Results are accumulated in a fixed order, so they do not depend on the number of threads.
+ */
+template<typename IT=std::uint32_t, typename CSWT=float>
+class DistortionEvaluator {
+public:
+    using CoresetType = IndexCoreset<IT, CSWT>;
+private:
+    const std::vector<CoresetType> &coresets_;
+    size_t np_;
+    double z_;
+    // Occurrences of point i are entries_[offsets_[i]:offsets_[i + 1]]
+    std::vector<size_t> offsets_;
+    std::vector<std::pair<uint32_t, double>> entries_;
+    blaze::DynamicVector<double> fullcost_;
+    blaze::DynamicMatrix<double> cscost_; // center sets x coresets
+
+    double transform(double c) const {return z_ == 1. ? c: std::pow(c, z_);}
+    void accumulate(size_t s, size_t i, double cost, double w) {
+        fullcost_[s] += w * cost;
+        for(size_t e = offsets_[i], end = offsets_[i + 1]; e < end; ++e)
+            cscost_(s, entries_[e].first) += entries_[e].second * cost;
+    }
+public:
+    DistortionEvaluator(const std::vector<CoresetType> &coresets, size_t np, double z=1.):
+        coresets_(coresets), np_(np), z_(z), offsets_(np + 1)
+    {
+        if(coresets_.size() > std::numeric_limits<uint32_t>::max()) throw std::invalid_argument("Too many coresets");
+        for(const auto &cs: coresets_) {
+            for(size_t i = 0; i < cs.size(); ++i) {
+                if(cs.indices_[i] >= np_) throw std::out_of_range("Coreset index out of range");
+                ++offsets_[cs.indices_[i] + 1];
+            }
+        }
+        std::partial_sum(offsets_.begin(), offsets_.end(), offsets_.begin());
+        entries_.resize(offsets_[np_]);
+        std::vector<size_t> pos(offsets_.begin(), offsets_.end() - 1);
+        for(size_t j = 0; j < coresets_.size(); ++j) {
+            const auto &cs = coresets_[j];
+            for(size_t i = 0; i < cs.size(); ++i)
+                entries_[pos[cs.indices_[i]]++] = {uint32_t(j), double(cs.weights_[i])};
+        }
+    }
+
+    // Clears results and prepares for nsets center sets.
+    void reset(size_t nsets) {
+        fullcost_.resize(nsets);
+        fullcost_ = 0.;
+        cscost_.resize(nsets, coresets_.size());
+        cscost_ = 0.;
+    }
+    size_t nsets() const {return fullcost_.size();}
+
+    /*
+     * Records the per-point costs (before exponentiation by z) of center set s.
+     * Safe to call concurrently for distinct s after reset().
+     */
+    template<typename Costs, typename WT=CSWT>
+    void add_costs(size_t s, const Costs &costs, const WT *weights=static_cast<const WT *>(nullptr)) {
+        if(s >= nsets()) throw std::out_of_range("Center set index out of range; call reset() first");
+        for(size_t i = 0; i < np_; ++i)
+            accumulate(s, i, transform(costs[i]), weights ? double(weights[i]): 1.);
+    }
+
+    /*
+     * Evaluates every row of centersets, whose entries are center ids passed to dist(point, center).
+     * block_bytes bounds the points x centers distance block held in memory.
+     */
+    template<typename Oracle, typename CIT, typename WT=CSWT>
+    void evaluate(const Oracle &dist, const blaze::DynamicMatrix<CIT> &centersets,
+                  const WT *weights=static_cast<const WT *>(nullptr), size_t block_bytes=size_t(64) << 20)
+    {
+        const size_t nsets = centersets.rows(), k = centersets.columns();
+        reset(nsets);
+        if(!nsets || !k) return;
+        // Union of centers, and each set's centers as columns of the distance block
+        std::vector<CIT> ids;
+        ids.reserve(nsets * k);
+        for(size_t s = 0; s < nsets; ++s)
+            for(size_t c = 0; c < k; ++c) ids.push_back(centersets(s, c));
+        shared::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        const size_t nu = ids.size();
+        blaze::DynamicMatrix<uint32_t> cols(nsets, k);
+        OMP_PFOR
+        for(size_t s = 0; s < nsets; ++s)
+            for(size_t c = 0; c < k; ++c)
+                cols(s, c) = std::lower_bound(ids.begin(), ids.end(), centersets(s, c)) - ids.begin();
+        const size_t block_rows = std::max(size_t(1), std::min(np_, block_bytes / (sizeof(double) * nu)));
+        blaze::DynamicMatrix<double> block(block_rows, nu);
+        for(size_t start = 0; start < np_; start += block_rows) {
+            const size_t nr = std::min(block_rows, np_ - start);
+            OMP_PFOR
+            for(size_t r = 0; r < nr; ++r)
+                for(size_t c = 0; c < nu; ++c)
+                    block(r, c) = transform(dist(start + r, ids[c]));
+            OMP_PFOR_DYN
+            for(size_t s = 0; s < nsets; ++s) {
+                const uint32_t *sc = &cols(s, 0);
+                for(size_t r = 0; r < nr; ++r) {
+                    double mincost = block(r, sc[0]);
+                    for(size_t c = 1; c < k; ++c) mincost = std::min(mincost, block(r, sc[c]));
+                    accumulate(s, start + r, mincost, weights ? double(weights[start + r]): 1.);
+                }
+            }
+        }
+    }
+
+    // Distortion of coreset j for center set s
+    double distortion(size_t s, size_t j) const {
+        return std::abs(cscost_(s, j) / fullcost_[s] - 1.);
+    }
+    double full_cost(size_t s) const {return fullcost_[s];}
+    double coreset_cost(size_t s, size_t j) const {return cscost_(s, j);}
+
+    // Max and mean distortion over center sets, one entry per coreset in input order
+    std::vector<DistortionStats> report() const {
+        std::vector<DistortionStats> ret(coresets_.size());
+        const size_t ns = nsets();
+        OMP_PFOR
+        for(size_t j = 0; j < ret.size(); ++j) {
+            ret[j].size_ = coresets_[j].size();
+            for(size_t s = 0; s < ns; ++s) {
+                const double d = distortion(s, j);
+                ret[j].max_ = std::max(ret[j].max_, d);
+                ret[j].mean_ += d;
+            }
+            if(ns) ret[j].mean_ /= ns;
+        }
+        return ret;
+    }
+};
+
+} // namespace coresets
+} // namespace minocore
+
+#endif /* FGC_CORESET_DISTORTION_H__ */
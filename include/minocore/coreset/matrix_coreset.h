@@ -4,33 +4,142 @@
 namespace minocore {
 namespace coresets {
 
+namespace detail {
+
+// Grows to at least n elements, doubling capacity so that repeated appends are amortized O(1) per element.
+template<typename Container>
+void grow_capacity(Container &c, size_t n) {
+    if(n > c.capacity()) c.reserve(std::max(n, 2 * c.capacity()));
+}
+
+template<typename FT>
+void append_weights(blaze::DynamicVector<FT> &dest, const blaze::DynamicVector<FT> &src) {
+    const size_t oldn = dest.size();
+    grow_capacity(dest, oldn + src.size());
+    dest.resize(oldn + src.size(), true);
+    subvector(dest, oldn, src.size()) = src;
+}
+
+/*
+ * Sets the number of rows of a row-major CompressedMatrix, preserving its contents.
+ * CompressedMatrix sizes its row-pointer array to exactly the requested rows whenever it grows,
+ * so growing one append at a time reallocates it on every call. Instead, whenever the row count
+ * passes a power of two, the matrix is first grown to the next power of two (one allocation)
+ * and then shrunk, which keeps the larger row-pointer capacity.
+ */
+template<typename MT>
+void resize_sparse_rows(MT &dest, size_t m) {
+    auto pow2ceil = [](size_t x) {size_t ret = 1; while(ret < x) ret <<= 1; return ret;};
+    const size_t oldr = dest.rows(), nc = dest.columns();
+    if(m > oldr && (!oldr || pow2ceil(m) != pow2ceil(oldr))) dest.resize(pow2ceil(m), nc, true);
+    dest.resize(m, nc, true);
+}
+
+/*
+ * Appends the rows of src to dest.
+ * For row-major DynamicMatrix, capacity is reserved with doubling, after which resizing
+ * to the new row count leaves the existing rows in place (the row layout does not change),
+ * so only the new rows are written.
+ * For row-major CompressedMatrix, nonzero and row-pointer capacity are reserved with doubling and the new
+ * rows are appended with append/finalize, which never moves existing elements.
+ * Other types fall back to resize-and-assign.
+ */
+template<typename MT, typename OMT>
+void append_rows(MT &dest, const OMT &src) {
+    static constexpr bool sparse_rows = blaze::IsSparseMatrix_v<MT> && blaze::IsResizable_v<MT> && blaze::StorageOrder_v<MT> == blaze::rowMajor;
+    const size_t oldr = dest.rows(), nr = src.rows(), nc = src.columns();
+    if(!nr) return;
+    if(!oldr) {
+        // Sparse rows are appended below, so that the row pointers get power-of-two capacity from the start
+        if constexpr(sparse_rows) dest.resize(0, nc, false);
+        else {
+            dest = src;
+            return;
+        }
+    }
+    if(dest.columns() != nc)
+        throw std::invalid_argument("Can't append rows with " + std::to_string(nc) + " columns to a matrix with " + std::to_string(dest.columns()));
+    if constexpr(blaze::IsDenseMatrix_v<MT> && blaze::IsResizable_v<MT> && blaze::StorageOrder_v<MT> == blaze::rowMajor) {
+        grow_capacity(dest, (oldr + nr) * dest.spacing());
+        dest.resize(oldr + nr, nc, false);
+        submatrix(dest, oldr, 0, nr, nc) = src;
+    } else if constexpr(sparse_rows) {
+        grow_capacity(dest, blaze::nonZeros(dest) + blaze::nonZeros(src));
+        resize_sparse_rows(dest, oldr + nr);
+        for(size_t i = 0; i < nr; ++i) {
+            for(auto it = src.begin(i), e = src.end(i); it != e; ++it)
+                dest.append(oldr + i, it->index(), it->value());
+            dest.finalize(oldr + i);
+        }
+    } else {
+        dest.resize(oldr + nr, nc);
+        submatrix(dest, oldr, 0, nr, nc) = src;
+    }
+}
+
+template<typename MT, typename OMT>
+void append_columns(MT &dest, const OMT &src) {
+    const size_t oldc = dest.columns(), nc = src.columns(), nr = src.rows();
+    if(!nc) return;
+    if(!oldc) {
+        dest = src;
+        return;
+    }
+    if(dest.rows() != nr)
+        throw std::invalid_argument("Can't append columns with " + std::to_string(nr) + " rows to a matrix with " + std::to_string(dest.rows()));
+    if constexpr(blaze::IsDenseMatrix_v<MT> && blaze::IsResizable_v<MT> && blaze::StorageOrder_v<MT> == blaze::columnMajor) {
+        grow_capacity(dest, (oldc + nc) * dest.spacing());
+        dest.resize(nr, oldc + nc, false);
+        submatrix(dest, 0, oldc, nr, nc) = src;
+    } else {
+        dest.resize(nr, oldc + nc);
+        submatrix(dest, 0, oldc, nr, nc) = src;
+    }
+}
+
+/*
+ * Gathers rows idx[0, n) of a sparse row-major matrix into a CompressedMatrix,
+ * reserving exactly the selected nonzeros and appending row by row, without densifying.
+ */
+template<typename OMT, typename MT, typename IT>
+void gather_sparse_rows(OMT &dest, const MT &mat, const IT *idx, size_t n) {
+    size_t nnz = 0;
+    for(size_t i = 0; i < n; ++i) nnz += nonZeros(row(mat, idx[i] BLAZE_CHECK_DEBUG));
+    dest.resize(n, mat.columns(), false);
+    dest.reset();
+    dest.reserve(nnz);
+    for(size_t i = 0; i < n; ++i) {
+        auto r = row(mat, idx[i] BLAZE_CHECK_DEBUG);
+        for(auto it = r.begin(), e = r.end(); it != e; ++it)
+            dest.append(i, it->index(), it->value());
+        dest.finalize(i);
+    }
+}
+
+} // namespace detail
+
+// Storage selected for a coreset of MatrixType: compressed for sparse inputs, dense otherwise.
+template<typename MatrixType>
+using coreset_matrix_t = std::conditional_t<blaze::IsSparseMatrix_v<MatrixType>,
+                                            blaze::CompressedMatrix<blaze::ElementType_t<MatrixType>, blaze::StorageOrder_v<MatrixType>>,
+                                            blaze::DynamicMatrix<blaze::ElementType_t<MatrixType>, blaze::StorageOrder_v<MatrixType>>>;
+
 template<typename MatrixType, typename FT=double>
 struct MatrixCoreset {
     MatrixType mat_;
     blaze::DynamicVector<FT> weights_;
     bool rowwise_;
+    // Amortized O(new points): storage grows by doubling and existing points are not copied on most merges.
     MatrixCoreset &merge(const MatrixCoreset &o) {
         if(rowwise_ != o.rowwise_) throw std::runtime_error("Can't merge coresets of differing rowwiseness");
-        weights_.reserve(weights_.size() + o.weights_.size());
-        //weights_.insert(weights_.end(), o.weights_.begin(), o.weights_.end());
-        for(auto w: o.weights_) push_back(weights_, w);
-        if(rowwise_) {
-            assert(mat_.columns() == o.mat_.columns());
-            auto nc = mat_.columns();
-            size_t oldr = mat_.rows();
-            mat_.resize(mat_.rows() + o.mat_.rows(), mat_.columns());
-            submatrix(mat_, oldr, 0, o.mat_.rows(), nc) = o.mat_;
-        } else {
-            assert(mat_.rows() == o.mat_.rows());
-            auto nr = mat_.rows();
-            size_t oldc = mat_.columns();
-            mat_.resize(nr, mat_.columns() + o.mat_.columns());
-            submatrix(mat_, 0, oldc, nr, o.mat_.columns()) = o.mat_;
-        }
+        detail::append_weights(weights_, o.weights_);
+        if(rowwise_) detail::append_rows(mat_, o.mat_);
+        else         detail::append_columns(mat_, o.mat_);
         return *this;
     }
-    MatrixCoreset &operator+=(const MatrixType &o) {return this->merge(o);}
-    MatrixCoreset operator+(const MatrixType &o) const {
+    size_t size() const {return weights_.size();}
+    MatrixCoreset &operator+=(const MatrixCoreset &o) {return this->merge(o);}
+    MatrixCoreset operator+(const MatrixCoreset &o) const {
         MatrixCoreset ret(*this);
         ret += o;
         return ret;
@@ -43,7 +152,7 @@ void resize_and_assign(Mat &dest, const View &view) {
     dest = view;
 }
 
-template<typename FT, typename IT, typename MatrixType, typename CMatrixType=blaze::DynamicMatrix<FT>>
+template<typename FT, typename IT, typename MatrixType, typename CMatrixType=coreset_matrix_t<MatrixType>>
 MatrixCoreset<MatrixType, FT>
 index2matrix(const IndexCoreset<IT, FT> &ic, const MatrixType &mat,
              bool rowwise=(blaze::StorageOrder_v<MatrixType> == blaze::rowMajor))
@@ -56,12 +165,17 @@ index2matrix(const IndexCoreset<IT, FT> &ic, const MatrixType &mat,
 #if !NDEBUG
         for(size_t i = 0; i < icsz; ++i) assert(icdat[i] < mat.rows());
 #endif
-        auto rows = blaze::rows(mat, icdat, icsz);
-        std::fprintf(stderr, "blaze row selection: %zu/%zu of matrix %zu/%zu\n", rows.rows(), rows.columns(), mat.rows(), mat.columns());
-        resize_and_assign(ret, rows);
+        if constexpr(blaze::IsSparseMatrix_v<CMatrixType> && blaze::StorageOrder_v<CMatrixType> == blaze::rowMajor
+                     && blaze::StorageOrder_v<MatrixType> == blaze::rowMajor) {
+            detail::gather_sparse_rows(ret, mat, icdat, icsz);
+        } else {
+            auto rows = blaze::rows(mat, icdat, icsz);
+            std::fprintf(stderr, "blaze row selection: %zu/%zu of matrix %zu/%zu\n", rows.rows(), rows.columns(), mat.rows(), mat.columns());
+            resize_and_assign(ret, rows);
+        }
     } else {
 #if !NDEBUG
-        for(size_t i = 0; i < icsz; ++i) assert(icdat[icsz] < mat.columns());
+        for(size_t i = 0; i < icsz; ++i) assert(icdat[i] < mat.columns());
 #endif
         auto columns = blaze::columns(mat, icdat, icsz);
         resize_and_assign(ret, columns);
@@ -0,0 +1,153 @@
+#pragma once
+#ifndef FGC_MERGE_REDUCE_H__
+#define FGC_MERGE_REDUCE_H__
+#include "minocore/optim/kmeans.h"
+
+namespace minocore {
+namespace coresets {
+
+/*
+ * Samples a coreset of cs_size rows of a weighted matrix: weighted k-means++ gives the bicriteria
+ * solution, CoresetSampler gives the importance weights, and duplicate samples are merged.
+ * Weights compose: a point's input weight is carried into its sampled weight, so applying this to
+ * a coreset yields a coreset of the data that coreset summarizes.
+ */
+template<typename FT=double, typename IT=std::uint32_t, typename MatrixType, typename RNG, typename Norm=sqrL2Norm>
+MatrixCoreset<MatrixType, FT>
+sample_matrix_coreset(const MatrixType &mat, const FT *weights, size_t k, size_t cs_size, RNG &rng,
+                      SensitivityMethod sens=BFL, const Norm &norm=Norm())
+{
+    const size_t n = mat.rows();
+    auto [centers, asn, costs] = kmeanspp(mat, rng, std::min(k, n), norm, true, weights);
+    CoresetSampler<FT, IT> sampler;
+    sampler.make_sampler(n, centers.size(), costs.data(), asn.data(), weights, rng(), sens);
+    auto ics = sampler.sample(cs_size, rng());
+    ics.compact();
+    return index2matrix(ics, mat);
+}
+
+/*
+ * Merge-and-reduce streaming coreset (Har-Peled and Mazumdar, 2004; Bentley and Saxe, 1980).
+ *
+ * Points are buffered into leaves of cs_size points. Full leaves are inserted into
+ * levels_ like a binary counter: when two buckets share a level, their union is reduced
+ * by clustering it with weighted k-means++, building a CoresetSampler on the result and
+ * resampling cs_size points. Memory is O(cs_size * log(n / cs_size)) points.
+ *
+ * Each reduction adds a (1 + eps) factor, so the final coreset is a
+ * (1 + eps)^{levels} coreset; choose cs_size for eps / log(n) to bound the total error by eps.
+ * Rows are points.
+ */
+template<typename MatrixType, typename FT=double, typename IT=std::uint32_t, typename Norm=sqrL2Norm>
+class MergeReduceCoreset {
+public:
+    using CoresetType = MatrixCoreset<MatrixType, FT>;
+private:
+    size_t k_, cs_size_;
+    SensitivityMethod sens_;
+    Norm norm_;
+    std::vector<CoresetType> levels_; // levels_[i] is empty or summarizes cs_size * 2^i points
+    CoresetType buffer_;
+    wy::WyRand<uint64_t, 2> rng_;
+    size_t npoints_ = 0, nreductions_ = 0;
+
+    static bool empty(const CoresetType &cs) {return cs.mat_.rows() == 0;}
+    static void append(CoresetType &dest, CoresetType &&src) {
+        if(empty(dest)) dest = std::move(src);
+        else            dest.merge(src);
+    }
+    void carry(CoresetType &&cs) {
+        for(size_t i = 0;; ++i) {
+            if(i == levels_.size()) levels_.emplace_back(CoresetType{MatrixType(), blaze::DynamicVector<FT>(), true});
+            if(empty(levels_[i])) {
+                levels_[i] = std::move(cs);
+                return;
+            }
+            append(cs, std::move(levels_[i]));
+            levels_[i] = CoresetType{MatrixType(), blaze::DynamicVector<FT>(), true};
+            cs = reduce(std::move(cs));
+        }
+    }
+public:
+    MergeReduceCoreset(size_t k, size_t cs_size, uint64_t seed=137,
+                       SensitivityMethod sens=BFL, const Norm &norm=Norm()):
+        k_(k), cs_size_(cs_size), sens_(sens), norm_(norm),
+        buffer_{MatrixType(), blaze::DynamicVector<FT>(), true}, rng_(seed)
+    {
+        if(!k_ || !cs_size_) throw std::invalid_argument("k and cs_size must be nonzero");
+    }
+
+    // Reduces a weighted coreset to cs_size points, or returns it unchanged if it is no larger.
+    CoresetType reduce(CoresetType &&cs) {
+        const size_t n = cs.mat_.rows();
+        if(n <= cs_size_) return std::move(cs);
+        ++nreductions_;
+        return sample_matrix_coreset<FT, IT>(cs.mat_, cs.weights_.data(), k_, cs_size_, rng_, sens_, norm_);
+    }
+
+    // Adds a batch of points (rows), with optional weights.
+    template<typename MT, bool SO>
+    void add(const blaze::Matrix<MT, SO> &batch, const FT *weights=nullptr) {
+        const auto &b = ~batch;
+        const size_t nr = b.rows(), nc = b.columns();
+        if(!empty(buffer_) && buffer_.mat_.columns() != nc)
+            throw std::invalid_argument("Batch has " + std::to_string(nc) + " columns; expected " + std::to_string(buffer_.mat_.columns()));
+        for(size_t offset = 0; offset < nr;) {
+            const size_t take = std::min(nr - offset, cs_size_ - buffer_.mat_.rows());
+            blaze::DynamicVector<FT> w(take);
+            if(weights) w = blaze::CustomVector<const FT, blaze::unaligned, blaze::unpadded>(weights + offset, take);
+            else        w = FT(1);
+            append(buffer_, CoresetType{MatrixType(submatrix(b, offset, 0, take, nc)), std::move(w), true});
+            offset += take;
+            if(buffer_.mat_.rows() == cs_size_) {
+                carry(std::move(buffer_));
+                buffer_ = CoresetType{MatrixType(), blaze::DynamicVector<FT>(), true};
+            }
+        }
+        npoints_ += nr;
+    }
+
+    /*
+     * Returns the union of all buckets and the partial leaf, a coreset for every point added so far.
+     * If reduce_result is set, the union is reduced once more to cs_size points.
+     * The stream state is unchanged, so more points can be added afterwards.
+     */
+    CoresetType result(bool reduce_result=true) {
+        CoresetType ret{MatrixType(), blaze::DynamicVector<FT>(), true};
+        if(!empty(buffer_)) ret = buffer_;
+        for(const auto &level: levels_)
+            if(!empty(level)) append(ret, CoresetType(level));
+        return reduce_result ? reduce(std::move(ret)): ret;
+    }
+
+    size_t npoints() const {return npoints_;}
+    size_t nreductions() const {return nreductions_;}
+    size_t nlevels() const {return levels_.size();}
+    // Number of points currently held, which is at most cs_size * (nlevels() + 1)
+    size_t size() const {
+        size_t ret = buffer_.mat_.rows();
+        for(const auto &level: levels_) ret += level.mat_.rows();
+        return ret;
+    }
+};
+
+/*
+ * Streaming coreset over a chunked source (e.g., hdf5::DenseRowReader): chunks are fed through a
+ * MergeReduceCoreset, so at most O(cs_size * log(n / cs_size)) points are held at once.
+ * Returns a coreset of cs_size points for the whole stream.
+ */
+template<typename Source, typename FT=blz::ElementType_t<typename Source::MatrixType>>
+auto stream_kmeans_coreset(const Source &source, size_t k, size_t cs_size, uint64_t seed=137,
+                           const FT *weights=nullptr)
+{
+    MergeReduceCoreset<typename Source::MatrixType, FT> mr(k, cs_size, seed);
+    source.for_each([&](size_t start, const auto &chunk) {
+        mr.add(chunk, weights ? weights + start: weights);
+    });
+    return mr.result();
+}
+
+} // namespace coresets
+} // namespace minocore
+
+#endif /* FGC_MERGE_REDUCE_H__ */
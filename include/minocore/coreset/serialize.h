@@ -0,0 +1,337 @@
+#ifndef FGC_CORESET_SERIALIZE_H__
+#define FGC_CORESET_SERIALIZE_H__
+#include "minocore/coreset/matrix_coreset.h"
+#include "minocore/util/serialize.h"
+#include <array>
+
+/*
+ * Binary save/load for coresets, samplers and clustering solutions, using the container in util/serialize.h.
+ * Every function takes `compress`; uncompressed files can be loaded without copying the large arrays.
+ */
+
+namespace minocore {
+
+namespace serial {
+
+namespace tags {
+static constexpr uint32_t META = make_tag("META");
+static constexpr uint32_t SHAP = make_tag("SHAP");
+static constexpr uint32_t INDX = make_tag("INDX");
+static constexpr uint32_t WTS  = make_tag("WTS ");
+static constexpr uint32_t DATA = make_tag("DATA");
+static constexpr uint32_t INDP = make_tag("INDP");
+static constexpr uint32_t INDC = make_tag("INDC");
+static constexpr uint32_t PROB = make_tag("PROB");
+static constexpr uint32_t ASN  = make_tag("ASN ");
+static constexpr uint32_t FLAS = make_tag("FLAS");
+static constexpr uint32_t FLBP = make_tag("FLBP");
+static constexpr uint32_t ALPR = make_tag("ALPR");
+static constexpr uint32_t ALIA = make_tag("ALIA");
+static constexpr uint32_t CTRS = make_tag("CTRS");
+static constexpr uint32_t COST = make_tag("COST");
+} // namespace tags
+
+namespace detail {
+
+template<typename T>
+blaze::DynamicVector<std::remove_const_t<T>> to_vector(const Array<T> &arr) {
+    blaze::DynamicVector<std::remove_const_t<T>> ret(arr.size());
+    std::copy(arr.begin(), arr.end(), ret.begin());
+    return ret;
+}
+
+// Contiguous, unpadded copy of a dense matrix in its storage order.
+template<typename MT>
+std::vector<blaze::ElementType_t<MT>> dense_values(const MT &mat) {
+    constexpr bool SO = blaze::StorageOrder_v<MT>;
+    const size_t nmajor = SO == blaze::rowMajor ? mat.rows(): mat.columns(),
+                 nminor = SO == blaze::rowMajor ? mat.columns(): mat.rows();
+    std::vector<blaze::ElementType_t<MT>> ret(nmajor * nminor);
+    OMP_PFOR
+    for(size_t i = 0; i < nmajor; ++i)
+        for(size_t j = 0; j < nminor; ++j)
+            ret[i * nminor + j] = SO == blaze::rowMajor ? mat(i, j): mat(j, i);
+    return ret;
+}
+
+// Compressed pointer/index/value arrays of a sparse matrix in its storage order.
+template<typename MT, typename IndPtrType=uint64_t, typename IndicesType=uint32_t>
+auto sparse_arrays(const MT &mat) {
+    constexpr bool SO = blaze::StorageOrder_v<MT>;
+    const size_t nmajor = SO == blaze::rowMajor ? mat.rows(): mat.columns();
+    std::vector<IndPtrType> indptr(nmajor + 1);
+    for(size_t i = 0; i < nmajor; ++i) indptr[i + 1] = indptr[i] + mat.nonZeros(i);
+    std::vector<IndicesType> indices(indptr.back());
+    std::vector<blaze::ElementType_t<MT>> data(indptr.back());
+    OMP_PFOR
+    for(size_t i = 0; i < nmajor; ++i) {
+        size_t j = indptr[i];
+        for(auto it = mat.begin(i), e = mat.end(i); it != e; ++it, ++j)
+            indices[j] = it->index(), data[j] = it->value();
+    }
+    return std::make_tuple(std::move(indptr), std::move(indices), std::move(data));
+}
+
+} // namespace detail
+
+template<typename IT, typename FT>
+void save(const coresets::IndexCoreset<IT, FT> &cs, const std::string &path, bool compress=false) {
+    Writer w(path, INDEX_CORESET, compress);
+    w.add(tags::INDX, cs.indices_.data(), cs.size());
+    w.add(tags::WTS, cs.weights_.data(), cs.size());
+    w.finish();
+}
+
+template<typename IT=uint32_t, typename FT=float>
+coresets::IndexCoreset<IT, FT> load_index_coreset(const std::string &path) {
+    Reader r(path);
+    r.require_kind(INDEX_CORESET);
+    auto indices = r.get<IT>(tags::INDX);
+    auto weights = r.get<FT>(tags::WTS);
+    if(indices.size() != weights.size()) throw std::runtime_error("Index coreset has mismatched indices and weights");
+    coresets::IndexCoreset<IT, FT> ret(indices.size());
+    std::copy(indices.begin(), indices.end(), ret.indices_.begin());
+    std::copy(weights.begin(), weights.end(), ret.weights_.begin());
+    return ret;
+}
+
+/*
+ * Dense coresets store SHAP = {rows, columns, rowwise, storage order} and unpadded DATA;
+ * sparse coresets store the compressed arrays INDP, INDC and DATA in the matrix's storage order.
+ */
+template<typename MT, typename FT>
+void save(const coresets::MatrixCoreset<MT, FT> &cs, const std::string &path, bool compress=false) {
+    const uint64_t shape[4] = {cs.mat_.rows(), cs.mat_.columns(), cs.rowwise_, blaze::StorageOrder_v<MT>};
+    if constexpr(blaze::IsSparseMatrix_v<MT>) {
+        Writer w(path, SPARSE_MATRIX_CORESET, compress);
+        auto [indptr, indices, data] = detail::sparse_arrays(cs.mat_);
+        w.add(tags::SHAP, shape, 4).add(tags::INDP, indptr.data(), indptr.size())
+         .add(tags::INDC, indices.data(), indices.size()).add(tags::DATA, data.data(), data.size())
+         .add(tags::WTS, cs.weights_.data(), cs.weights_.size());
+        w.finish();
+    } else {
+        Writer w(path, DENSE_MATRIX_CORESET, compress);
+        auto data = detail::dense_values(cs.mat_);
+        w.add(tags::SHAP, shape, 4).add(tags::DATA, data.data(), data.size())
+         .add(tags::WTS, cs.weights_.data(), cs.weights_.size());
+        w.finish();
+    }
+}
+
+/*
+ * Loads a coreset into owned storage (DynamicMatrix or CompressedMatrix, as chosen by MatrixType).
+ * The storage order of MatrixType must match the file's.
+ */
+template<typename MatrixType, typename FT=double>
+coresets::MatrixCoreset<MatrixType, FT> load_matrix_coreset(const std::string &path) {
+    using VT = blaze::ElementType_t<MatrixType>;
+    constexpr bool SO = blaze::StorageOrder_v<MatrixType>;
+    Reader r(path);
+    r.require_kind(blaze::IsSparseMatrix_v<MatrixType> ? SPARSE_MATRIX_CORESET: DENSE_MATRIX_CORESET);
+    auto shape = r.get<uint64_t>(tags::SHAP);
+    const size_t nr = shape[0], nc = shape[1];
+    if(shape[3] != SO) throw std::invalid_argument("Storage order of the file does not match the requested matrix type");
+    const size_t nmajor = SO == blaze::rowMajor ? nr: nc;
+    auto data = r.get<VT>(tags::DATA);
+    MatrixType mat(nr, nc);
+    if constexpr(blaze::IsSparseMatrix_v<MatrixType>) {
+        auto indptr = r.get<uint64_t>(tags::INDP);
+        auto indices = r.get<uint32_t>(tags::INDC);
+        if(indptr.size() != nmajor + 1 || indices.size() != data.size() || indptr[nmajor] != data.size())
+            throw std::runtime_error("Sparse coreset has inconsistent array sizes");
+        mat.reserve(data.size());
+        for(size_t i = 0; i < nmajor; ++i) {
+            for(size_t j = indptr[i]; j < indptr[i + 1]; ++j) mat.append(SO == blaze::rowMajor ? i: indices[j], SO == blaze::rowMajor ? indices[j]: i, data[j]);
+            mat.finalize(i);
+        }
+    } else {
+        if(data.size() != nr * nc) throw std::runtime_error("Dense coreset has inconsistent array sizes");
+        const size_t nminor = SO == blaze::rowMajor ? nc: nr;
+        OMP_PFOR
+        for(size_t i = 0; i < nmajor; ++i)
+            for(size_t j = 0; j < nminor; ++j)
+                (SO == blaze::rowMajor ? mat(i, j): mat(j, i)) = data[i * nminor + j];
+    }
+    return coresets::MatrixCoreset<MatrixType, FT>{std::move(mat), detail::to_vector(r.get<FT>(tags::WTS)), bool(shape[2])};
+}
+
+/*
+ * Maps a row-major sparse coreset without copying its nonzeros: the returned view
+ * points into the mapping (or the decompressed buffers) and keeps them alive.
+ * Weights are copied.
+ */
+template<typename VT=float, typename FT=double>
+coresets::MatrixCoreset<csr::CSRMatrixView<VT, uint64_t, uint32_t>, FT> map_sparse_coreset(const std::string &path) {
+    Reader r(path);
+    r.require_kind(SPARSE_MATRIX_CORESET);
+    auto shape = r.get<uint64_t>(tags::SHAP);
+    if(shape[3] != blaze::rowMajor) throw std::invalid_argument("Only row-major sparse coresets can be mapped");
+    auto indptr = r.get<uint64_t>(tags::INDP);
+    auto indices = r.get<uint32_t>(tags::INDC);
+    auto data = r.get<VT>(tags::DATA);
+    if(indptr.size() != shape[0] + 1 || indices.size() != data.size() || indptr[shape[0]] != data.size())
+        throw std::runtime_error("Sparse coreset has inconsistent array sizes");
+    auto owner = std::make_shared<std::array<std::shared_ptr<const void>, 3>>(
+        std::array<std::shared_ptr<const void>, 3>{indptr.owner_, indices.owner_, data.owner_});
+    // The mapping is private and copy-on-write, so handing out mutable data is safe.
+    csr::CSRMatrixView<VT, uint64_t, uint32_t> view(indptr.data(), indices.data(), const_cast<VT *>(data.data()),
+                                                    shape[0], shape[1], std::move(owner));
+    return coresets::MatrixCoreset<csr::CSRMatrixView<VT, uint64_t, uint32_t>, FT>{
+        std::move(view), detail::to_vector(r.get<FT>(tags::WTS)), bool(shape[2])};
+}
+
+/*
+ * Saves the sampling distribution, optional weights and assignments, FL state and the alias table (if built),
+ * so that a loaded sampler can draw immediately.
+ */
+template<typename FT, typename IT>
+void save(const coresets::CoresetSampler<FT, IT> &sampler, const std::string &path, bool compress=false) {
+    if(!sampler.ready()) throw std::invalid_argument("Sampler not constructed");
+    const uint64_t np = sampler.np_;
+    const uint64_t meta[6] = {np, sampler.k_, sampler.b_, sampler.seed_, uint64_t(sampler.sens_), sampler.lazy_alias_};
+    Writer w(path, CORESET_SAMPLER, compress);
+    w.add(tags::META, meta, 6).add(tags::PROB, sampler.probs_.get(), np);
+    if(sampler.weights_) w.add(tags::WTS, sampler.weights_->data(), np);
+    if(sampler.asn_) w.add(tags::ASN, sampler.asn_.get(), np);
+    if(sampler.fl_asn_) w.add(tags::FLAS, sampler.fl_asn_.get(), np);
+    if(sampler.fl_bicriteria_points_) w.add(tags::FLBP, sampler.fl_bicriteria_points_->data(), sampler.fl_bicriteria_points_->size());
+    if(sampler.sampler_) w.add(tags::ALPR, sampler.sampler_->probs(), np).add(tags::ALIA, sampler.sampler_->aliases(), np);
+    w.finish();
+}
+
+/*
+ * probs_ and the alias table point into the mapping when the file is uncompressed;
+ * if the file holds no alias table, one is built unless the sampler was saved lazy.
+ * Weights and assignments are copied, since CoresetSampler owns them as vectors.
+ */
+template<typename FT=float, typename IT=uint32_t>
+coresets::CoresetSampler<FT, IT> load_sampler(const std::string &path) {
+    using Sampler = typename coresets::CoresetSampler<FT, IT>::Sampler;
+    Reader r(path);
+    r.require_kind(CORESET_SAMPLER);
+    auto meta = r.get<uint64_t>(tags::META);
+    if(meta.size() != 6) throw std::runtime_error("Malformed sampler metadata");
+    coresets::CoresetSampler<FT, IT> ret;
+    const size_t np = meta[0];
+    ret.np_ = np; ret.k_ = meta[1]; ret.b_ = meta[2]; ret.seed_ = meta[3];
+    ret.sens_ = static_cast<coresets::SensitivityMethod>(meta[4]);
+    ret.lazy_alias_ = meta[5];
+    // Every per-point section must hold exactly np entries, or sampling would read past its end
+    auto check_length = [np](const auto &arr, size_t expected, const char *what) {
+        if(arr.size() != expected)
+            throw std::runtime_error(std::string("Sampler ") + what + " have length " + std::to_string(arr.size())
+                                     + "; expected " + std::to_string(expected) + " for np = " + std::to_string(np));
+    };
+    auto probs = r.get<FT>(tags::PROB);
+    check_length(probs, np, "probabilities");
+    ret.probs_ = std::shared_ptr<FT[]>(probs.owner_, const_cast<FT *>(probs.data()));
+    if(r.has(tags::WTS)) {
+        auto weights = r.get<FT>(tags::WTS);
+        check_length(weights, np, "weights");
+        ret.weights_.reset(new blaze::DynamicVector<FT>(detail::to_vector(weights)));
+    }
+    auto copy_ids = [&](uint32_t tag, auto &dest, const char *what) {
+        if(!r.has(tag)) return;
+        auto arr = r.get<IT>(tag);
+        check_length(arr, np, what);
+        dest.reset(new IT[arr.size()]);
+        std::copy(arr.begin(), arr.end(), dest.get());
+    };
+    copy_ids(tags::ASN, ret.asn_, "assignments");
+    copy_ids(tags::FLAS, ret.fl_asn_, "FL assignments");
+    if(r.has(tags::FLBP)) {
+        auto flbp = r.get<IT>(tags::FLBP);
+        check_length(flbp, ret.b_, "FL bicriteria points");
+        ret.fl_bicriteria_points_.reset(new blaze::DynamicVector<IT>(detail::to_vector(flbp)));
+    }
+    if(r.has(tags::ALPR)) {
+        auto aprob = r.get<FT>(tags::ALPR);
+        auto alias = r.get<IT>(tags::ALIA);
+        check_length(aprob, np, "alias probabilities");
+        check_length(alias, np, "aliases");
+        ret.sampler_.reset(new Sampler(std::shared_ptr<FT[]>(aprob.owner_, const_cast<FT *>(aprob.data())),
+                                       std::shared_ptr<IT[]>(alias.owner_, const_cast<IT *>(alias.data())),
+                                       np, ret.seed_));
+    } else ret.build_sampler(ret.seed_);
+    return ret;
+}
+
+/*
+ * Clustering solutions as returned by perform_clustering: (centers, assignments, costs).
+ * Centers are either center ids (intrinsic) or a list of center vectors (extrinsic, stored as a k x d matrix);
+ * assignments and costs are either vectors (hard) or point-by-center matrices (soft).
+ * SHAP records {k, d (0 for ids), assignment columns, cost columns}.
+ */
+template<typename IT, typename FT>
+struct Solution {
+    blaze::DynamicVector<IT> center_ids_;     // Intrinsic solutions
+    blaze::DynamicMatrix<FT> center_matrix_;  // Extrinsic solutions, one center per row
+    blaze::DynamicMatrix<IT> assignments_;    // One column for hard assignments
+    blaze::DynamicMatrix<FT> costs_;          // One column for hard assignments
+};
+
+namespace detail {
+template<typename T, typename Container>
+std::pair<std::vector<T>, size_t> flatten(const Container &c) {
+    if constexpr(blaze::IsMatrix_v<Container>) {
+        std::vector<T> ret(c.rows() * c.columns());
+        for(size_t i = 0; i < c.rows(); ++i)
+            for(size_t j = 0; j < c.columns(); ++j) ret[i * c.columns() + j] = c(i, j);
+        return {std::move(ret), c.columns()};
+    } else return {std::vector<T>(std::begin(c), std::end(c)), 1};
+}
+} // namespace detail
+
+template<typename IT=uint32_t, typename FT=float, typename Centers, typename Assignments, typename Costs>
+void save_solution(const std::string &path, const Centers &centers, const Assignments &asn, const Costs &costs, bool compress=false) {
+    std::vector<FT> cdata;
+    std::vector<IT> cids;
+    uint64_t k = std::size(centers), d = 0;
+    if constexpr(std::is_integral_v<std::decay_t<decltype(*std::begin(centers))>>) {
+        cids.assign(std::begin(centers), std::end(centers));
+    } else {
+        d = k ? std::begin(centers)->size(): 0;
+        cdata.resize(k * d);
+        size_t i = 0;
+        for(const auto &c: centers) {
+            if(c.size() != d) throw std::invalid_argument("Centers have differing dimensions");
+            std::copy(c.begin(), c.end(), cdata.begin() + (i++ * d));
+        }
+    }
+    auto [adata, acols] = detail::flatten<IT>(asn);
+    auto [costdata, ccols] = detail::flatten<FT>(costs);
+    const uint64_t shape[4] = {k, d, acols, ccols};
+    Writer w(path, SOLUTION, compress);
+    w.add(tags::SHAP, shape, 4);
+    if(d) w.add(tags::CTRS, cdata.data(), cdata.size());
+    else  w.add(tags::CTRS, cids.data(), cids.size());
+    w.add(tags::ASN, adata.data(), adata.size()).add(tags::COST, costdata.data(), costdata.size());
+    w.finish();
+}
+
+template<typename IT=uint32_t, typename FT=float>
+Solution<IT, FT> load_solution(const std::string &path) {
+    Reader r(path);
+    r.require_kind(SOLUTION);
+    auto shape = r.get<uint64_t>(tags::SHAP);
+    const size_t k = shape[0], d = shape[1], acols = shape[2], ccols = shape[3];
+    Solution<IT, FT> ret;
+    if(d) {
+        auto c = r.get<FT>(tags::CTRS);
+        if(c.size() != k * d) throw std::runtime_error("Solution centers have the wrong size");
+        ret.center_matrix_ = blaze::CustomMatrix<const FT, blaze::unaligned, blaze::unpadded>(c.data(), k, d);
+    } else ret.center_ids_ = detail::to_vector(r.get<IT>(tags::CTRS));
+    auto a = r.get<IT>(tags::ASN);
+    auto costs = r.get<FT>(tags::COST);
+    if(!acols || !ccols || a.size() % acols || costs.size() % ccols)
+        throw std::runtime_error("Solution assignments or costs have the wrong size");
+    ret.assignments_ = blaze::CustomMatrix<const IT, blaze::unaligned, blaze::unpadded>(a.data(), a.size() / acols, acols);
+    ret.costs_ = blaze::CustomMatrix<const FT, blaze::unaligned, blaze::unpadded>(costs.data(), costs.size() / ccols, ccols);
+    return ret;
+}
+
+} // namespace serial
+
+} // namespace minocore
+
+#endif /* FGC_CORESET_SERIALIZE_H__ */
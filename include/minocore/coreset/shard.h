@@ -0,0 +1,108 @@
+#pragma once
+#ifndef FGC_CORESET_SHARD_H__
+#define FGC_CORESET_SHARD_H__
+#include "minocore/coreset/merge_reduce.h"
+#include "minocore/coreset/serialize.h"
+
+namespace minocore {
+namespace coresets {
+
+/*
+ * Shard-and-merge coresets across independent processes, exchanging files only.
+ *
+ * Map:    each process loads one shard, calls build_shard_coreset and writes the result with serial::save.
+ * Reduce: reduce_shard_coresets loads every shard coreset, concatenates them, resamples the union
+ *         to the final size and cluster_coreset solves weighted k-means on it.
+ *
+ * The union of coresets of disjoint shards is a coreset of their union, since sampled weights
+ * estimate each shard's weighted cost; resampling the union with its weights adds one more
+ * (1 + eps) factor, so the result is a (1 + eps)^2 coreset of the full data.
+ * Shards are merged in the order given, so the reduction is reproducible for a given seed.
+ */
+
+// Samples a cs_size-point coreset of one shard; shards with at most cs_size points are kept whole.
+template<typename FT=double, typename IT=std::uint32_t, typename MatrixType, typename Norm=sqrL2Norm>
+MatrixCoreset<MatrixType, FT>
+build_shard_coreset(const MatrixType &shard, size_t k, size_t cs_size, uint64_t seed=137,
+                    SensitivityMethod sens=BFL, const FT *weights=nullptr, const Norm &norm=Norm())
+{
+    if(!k || !cs_size) throw std::invalid_argument("k and cs_size must be nonzero");
+    const size_t n = shard.rows();
+    if(n <= cs_size) {
+        blaze::DynamicVector<FT> w(n);
+        if(weights) w = blaze::CustomVector<const FT, blaze::unaligned, blaze::unpadded>(weights, n);
+        else        w = FT(1);
+        return MatrixCoreset<MatrixType, FT>{shard, std::move(w), true};
+    }
+    wy::WyRand<uint64_t, 2> rng(seed);
+    return sample_matrix_coreset<FT, IT>(shard, weights, k, cs_size, rng, sens, norm);
+}
+
+// Loads shard coresets (in parallel) and concatenates them in the order of paths.
+template<typename MatrixType, typename FT=double>
+MatrixCoreset<MatrixType, FT> merge_shard_coresets(const std::vector<std::string> &paths) {
+    if(paths.empty()) throw std::invalid_argument("No shard coresets to merge");
+    std::vector<std::unique_ptr<MatrixCoreset<MatrixType, FT>>> shards(paths.size());
+    std::vector<std::string> errors(paths.size());
+    OMP_PFOR_DYN
+    for(size_t i = 0; i < paths.size(); ++i) {
+        try {
+            shards[i].reset(new MatrixCoreset<MatrixType, FT>(serial::load_matrix_coreset<MatrixType, FT>(paths[i])));
+        } catch(const std::exception &ex) {
+            errors[i] = paths[i] + ": " + ex.what();
+        }
+    }
+    for(const auto &e: errors)
+        if(!e.empty()) throw std::runtime_error("Failed to load shard coreset " + e);
+    MatrixCoreset<MatrixType, FT> ret = std::move(*shards[0]);
+    for(size_t i = 1; i < shards.size(); ++i) {
+        if(shards[i]->mat_.columns() != ret.mat_.columns())
+            throw std::invalid_argument(paths[i] + " has " + std::to_string(shards[i]->mat_.columns())
+                                        + " columns; expected " + std::to_string(ret.mat_.columns()));
+        ret.merge(*shards[i]);
+        shards[i].reset();
+    }
+    return ret;
+}
+
+// Merges shard coresets and resamples the union to cs_size points if it is larger.
+template<typename MatrixType, typename FT=double, typename IT=std::uint32_t, typename Norm=sqrL2Norm>
+MatrixCoreset<MatrixType, FT>
+reduce_shard_coresets(const std::vector<std::string> &paths, size_t k, size_t cs_size, uint64_t seed=137,
+                      SensitivityMethod sens=BFL, const Norm &norm=Norm())
+{
+    auto merged = merge_shard_coresets<MatrixType, FT>(paths);
+    if(merged.size() <= cs_size) return merged;
+    wy::WyRand<uint64_t, 2> rng(seed);
+    return sample_matrix_coreset<FT, IT>(merged.mat_, merged.weights_.data(), k, cs_size, rng, sens, norm);
+}
+
+/*
+ * Weighted k-means on a (row-wise) coreset: weighted k-means++ seeding followed by Lloyd's algorithm.
+ * Returns (centers, assignments, per-point costs).
+ */
+template<typename IT=std::uint32_t, typename MatrixType, typename FT>
+auto cluster_coreset(MatrixCoreset<MatrixType, FT> &cs, size_t k, uint64_t seed=137,
+                     size_t maxiter=100, double tolerance=1e-4)
+{
+    using VT = blaze::ElementType_t<MatrixType>;
+    if(!cs.rowwise_) throw std::invalid_argument("cluster_coreset requires a row-wise coreset");
+    wy::WyRand<uint64_t, 2> rng(seed);
+    const size_t n = cs.mat_.rows();
+    auto [ids, asn, costs] = kmeanspp(cs.mat_, rng, std::min(k, n), sqrL2Norm(), true, cs.weights_.data());
+    blaze::DynamicMatrix<VT> centers(ids.size(), cs.mat_.columns());
+    for(size_t i = 0; i < ids.size(); ++i) row(centers, i) = row(cs.mat_, ids[i]);
+    std::vector<IT> assignments(asn.begin(), asn.end());
+    std::vector<FT> counts(centers.rows());
+    lloyd_loop(assignments, counts, centers, cs.mat_, tolerance, maxiter, sqrL2Norm(), cs.weights_.data());
+    blaze::DynamicVector<FT> pointcosts(n);
+    OMP_PFOR
+    for(size_t i = 0; i < n; ++i)
+        pointcosts[i] = sqrL2Norm()(row(cs.mat_, i), row(centers, assignments[i]));
+    return std::make_tuple(std::move(centers), std::move(assignments), std::move(pointcosts));
+}
+
+} // namespace coresets
+} // namespace minocore
+
+#endif /* FGC_CORESET_SHARD_H__ */
@@ -1,13 +1,18 @@
 #ifndef FGC_JSD_H__
 #define FGC_JSD_H__
 #include "minocore/util/exception.h"
+#include "minocore/util/csr.h"
+#include "minocore/util/metrics.h"
 #include "minocore/coreset.h"
 #include "minocore/dist/distance.h"
 #include "distmat/distmat.h"
 #include "minocore/optim/kmeans.h"
 #include <boost/math/special_functions/digamma.hpp>
 #include <boost/math/special_functions/polygamma.hpp>
+#include <atomic>
+#include <mutex>
 #include <set>
+#include <unistd.h>
 
 
 namespace minocore {
@@ -17,6 +22,73 @@ namespace jsd {
 using namespace blz;
 using namespace blz::distance;
 
+/*
+ * Storage for the log and square-root caches of a DissimilarityApplicator.
+ * Caches are built by prepare_caches() or, failing that, on first use.
+ */
+enum CacheMode {
+    CACHE_AUTO,  // CACHE_FULL if it fits in the cache budget, else CACHE_FLOAT if it fits, else CACHE_NONE
+    CACHE_FULL,  // Same type as the data
+    CACHE_FLOAT, // Single precision, for double data; same as CACHE_FULL otherwise
+    CACHE_NONE   // No cache: logs and square roots are computed per row, as used
+};
+
+namespace detail {
+
+// Single-precision counterpart of a double-precision matrix, or the matrix type itself
+template<typename MT> struct float_cache {using type = MT;};
+template<bool SO> struct float_cache<blaze::DynamicMatrix<double, SO>> {using type = blaze::DynamicMatrix<float, SO>;};
+template<bool SO> struct float_cache<blaze::CompressedMatrix<double, SO>> {using type = blaze::CompressedMatrix<float, SO>;};
+
+/*
+ * Value built by the first call to get(); thread-safe.
+ * Movable (unlike std::once_flag) so that applicators can be returned by value.
+ */
+template<typename T>
+class LazyCache {
+    mutable std::unique_ptr<T> data_;
+    mutable std::atomic<bool> built_{false};
+    mutable std::mutex mut_;
+public:
+    LazyCache() {}
+    LazyCache(LazyCache &&o): data_(std::move(o.data_)), built_(static_cast<bool>(data_)) {o.built_ = false;}
+    template<typename F>
+    const T &get(const F &build) const {
+        if(!built_.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(mut_);
+            if(!built_.load(std::memory_order_relaxed)) {
+                data_.reset(new T(build()));
+                built_.store(true, std::memory_order_release);
+            }
+        }
+        return *data_;
+    }
+    bool built() const {return built_.load(std::memory_order_acquire);}
+    // The value if it has been built, without building it
+    const T *get_if_built() const {return built() ? data_.get(): nullptr;}
+    // Supplies the value, e.g. as restored from disk; not safe while get() may be called
+    void set(T &&value) {
+        data_.reset(new T(std::move(value)));
+        built_ = true;
+    }
+    void reset() {
+        data_.reset();
+        built_ = false;
+    }
+};
+
+struct RestoreTag {};
+
+// Cache budget used when none is given: a quarter of physical memory, or unlimited if that is unknown
+inline size_t default_cache_budget() {
+    const long pages = ::sysconf(_SC_PHYS_PAGES), pagesize = ::sysconf(_SC_PAGESIZE);
+    return pages > 0 && pagesize > 0 ? size_t(pages) * size_t(pagesize) / 4: std::numeric_limits<size_t>::max();
+}
+
+} // namespace detail
+
+template<typename MatrixType> struct ApplicatorStore;
+
 
 template<typename MatrixType>
 class DissimilarityApplicator {
@@ -24,16 +96,22 @@ class DissimilarityApplicator {
     MatrixType &data_;
     using VecT = blaze::DynamicVector<typename MatrixType::ElementType, IsRowMajorMatrix_v<MatrixType> ? blaze::rowVector: blaze::columnVector>;
     using matrix_type = MatrixType;
+    using FloatCacheType = typename detail::float_cache<MatrixType>::type;
     VecT row_sums_;
-    std::unique_ptr<MatrixType> logdata_;
-    std::unique_ptr<MatrixType> sqrdata_;
-    std::unique_ptr<VecT> jsd_cache_;
+    detail::LazyCache<MatrixType> logdata_, sqrdata_;
+    detail::LazyCache<FloatCacheType> flogdata_, fsqrdata_;
+    detail::LazyCache<VecT> jsd_cache_;
+    CacheMode cache_mode_ = CACHE_FULL; // Resolved; never CACHE_AUTO
     std::unique_ptr<VecT> prior_data_;
     std::unique_ptr<VecT> l2norm_cache_;
     std::unique_ptr<VecT> pl2norm_cache_;
     typename MatrixType::ElementType lambda_ = 0.5;
     static constexpr bool IS_SPARSE      = IsSparseMatrix_v<MatrixType>;
     static constexpr bool IS_DENSE_BLAZE = IsDenseMatrix_v<MatrixType>;
+    template<typename MT> friend struct ApplicatorStore;
+    template<typename MT> friend class DissimilarityApplicator;
+    // For ApplicatorStore, which restores the prepared state instead of calling prep
+    DissimilarityApplicator(MatrixType &ref, DissimilarityMeasure measure, detail::RestoreTag): data_(ref), measure_(measure) {}
 public:
     using FT = typename MatrixType::ElementType;
     using MT = MatrixType;
@@ -44,16 +122,74 @@ public:
     const MatrixType &data() const {return data_;}
     const VecT &row_sums() const {return row_sums_;}
     size_t size() const {return data_.rows();}
+    /*
+     * Log and square-root caches, where the measure needs them, are built on first use
+     * and stored per cache_mode; CACHE_AUTO chooses the most precise mode whose caches
+     * take at most cache_budget bytes (0 for detail::default_cache_budget()).
+     */
     template<typename PriorContainer=blaze::DynamicVector<FT, blaze::rowVector>>
     DissimilarityApplicator(MatrixType &ref,
                       DissimilarityMeasure measure=JSM,
                       Prior prior=NONE,
-                      const PriorContainer *c=nullptr):
-        data_(ref), logdata_(nullptr), measure_(measure)
+                      const PriorContainer *c=nullptr,
+                      CacheMode cache_mode=CACHE_AUTO,
+                      size_t cache_budget=0):
+        data_(ref), measure_(measure)
     {
         prep(prior, c);
+        set_cache_mode(cache_mode, cache_budget);
         MINOCORE_REQUIRE(dist::detail::is_valid_measure(measure_), "measure_ must be valid");
     }
+    // Bytes taken by the log and square-root caches the measure needs, with elements of elsize bytes
+    size_t cache_bytes(size_t elsize) const {
+        const size_t ncaches = dist::detail::needs_logs(measure_) + dist::detail::needs_sqrt(measure_);
+        if constexpr(is_csr_view_v<MatrixType>) {
+            return ncaches * data_.nonZeros() * elsize; // Only a value array is allocated
+        } else if constexpr(IS_SPARSE) {
+            return ncaches * blaze::nonZeros(data_) * (elsize + sizeof(size_t));
+        } else {
+            return ncaches * data_.rows() * data_.columns() * elsize;
+        }
+    }
+    /*
+     * Sets how the log and square-root caches are stored, dropping any which have been built.
+     * Not safe to call while distances are being computed.
+     */
+    void set_cache_mode(CacheMode mode, size_t budget=0) {
+        static constexpr bool has_float = !std::is_same_v<FloatCacheType, MatrixType>;
+        if(mode == CACHE_AUTO) {
+            if(!budget) budget = detail::default_cache_budget();
+            mode = cache_bytes(sizeof(FT)) <= budget ? CACHE_FULL
+                 : has_float && cache_bytes(sizeof(float)) <= budget ? CACHE_FLOAT
+                 : CACHE_NONE;
+        }
+        if(mode == CACHE_FLOAT && !has_float) mode = CACHE_FULL;
+        cache_mode_ = mode;
+        logdata_.reset(); sqrdata_.reset();
+        flogdata_.reset(); fsqrdata_.reset();
+    }
+    CacheMode cache_mode() const {return cache_mode_;}
+    /*
+     * Builds every cache the measure uses under cache_mode(), each with a parallel loop.
+     * Call before computing distances inside a parallel region: there, the first use builds a cache
+     * on a single thread while the others wait for it.
+     */
+    void prepare_caches() const {
+        METRICS_STAGE("prepare_caches");
+        const bool logs = dist::detail::needs_logs(measure_), sqrts = dist::detail::needs_sqrt(measure_);
+        switch(cache_mode_) {
+            case CACHE_FULL:
+                if(logs) logdata_.get([&]() {return make_cache<MatrixType>(LOG_CACHE);});
+                if(sqrts) sqrdata_.get([&]() {return make_cache<MatrixType>(SQRT_CACHE);});
+                break;
+            case CACHE_FLOAT:
+                if(logs) flogdata_.get([&]() {return make_cache<FloatCacheType>(LOG_CACHE);});
+                if(sqrts) fsqrdata_.get([&]() {return make_cache<FloatCacheType>(SQRT_CACHE);});
+                break;
+            default: break;
+        }
+        if(logs) jsd_cache_.get([this]() {return make_jsd_cache();});
+    }
     /*
      * Sets distance matrix, under measure_ (if not provided)
      * or measure (if provided as an argument).
@@ -221,8 +357,26 @@ public:
         return blaze::row(data_, ind BLAZE_CHECK_DEBUG) * row_sums_[ind];
     }
     auto row(size_t ind) const {return blaze::row(data_, ind BLAZE_CHECK_DEBUG);}
-    auto logrow(size_t ind) const {return blaze::row(*logdata_, ind BLAZE_CHECK_DEBUG);}
-    auto sqrtrow(size_t ind) const {return blaze::row(*sqrdata_, ind BLAZE_CHECK_DEBUG);}
+    /*
+     * Call f with row ind's logs (or square roots): a row of the cache, as stored under cache_mode(),
+     * or an expression computing them as used.
+     */
+    template<typename F>
+    FT with_logrow(size_t ind, const F &f) const {
+        switch(cache_mode_) {
+            case CACHE_FULL: return f(blaze::row(logdata_.get([&]() {return make_cache<MatrixType>(LOG_CACHE);}), ind BLAZE_CHECK_DEBUG));
+            case CACHE_FLOAT: return f(blaze::row(flogdata_.get([&]() {return make_cache<FloatCacheType>(LOG_CACHE);}), ind BLAZE_CHECK_DEBUG));
+            default: return f(blaze::neginf2zero(blaze::log(row(ind))));
+        }
+    }
+    template<typename F>
+    FT with_sqrtrow(size_t ind, const F &f) const {
+        switch(cache_mode_) {
+            case CACHE_FULL: return f(blaze::row(sqrdata_.get([&]() {return make_cache<MatrixType>(SQRT_CACHE);}), ind BLAZE_CHECK_DEBUG));
+            case CACHE_FLOAT: return f(blaze::row(fsqrdata_.get([&]() {return make_cache<FloatCacheType>(SQRT_CACHE);}), ind BLAZE_CHECK_DEBUG));
+            default: return f(blaze::sqrt(row(ind)));
+        }
+    }
 
     /*
      * Distances
@@ -273,8 +427,9 @@ public:
         } else if constexpr(constexpr_measure == POISSON) {
             ret = cp ? pkl(o, i, *cp): pkl(o, i);
         } else if constexpr(constexpr_measure == HELLINGER) {
-            ret = cp ? blaze::sqrNorm(sqrtrow(i) - *cp)
-                     : blaze::sqrNorm(sqrtrow(i) - blaze::sqrt(o));
+            ret = with_sqrtrow(i, [&](const auto &si) {
+                return cp ? blaze::sqrNorm(si - *cp): blaze::sqrNorm(si - blaze::sqrt(o));
+            });
         } else if constexpr(constexpr_measure == BHATTACHARYYA_METRIC) {
             ret = bhattacharyya_metric(i, o);
         } else if constexpr(constexpr_measure == BHATTACHARYYA_DISTANCE) {
@@ -340,11 +495,9 @@ public:
         } else if constexpr(constexpr_measure == POISSON) {
             ret = cp ? pkl(i, o, *cp): pkl(i, o);
         } else if constexpr(constexpr_measure == HELLINGER) {
-            if(cp) {
-                ret = blaze::sqrNorm(sqrtrow(i) - *cp);
-            } else {
-                ret = blaze::sqrNorm(sqrtrow(i) - blaze::sqrt(o));
-            }
+            ret = with_sqrtrow(i, [&](const auto &si) {
+                return cp ? blaze::sqrNorm(si - *cp): blaze::sqrNorm(si - blaze::sqrt(o));
+            });
         } else if constexpr(constexpr_measure == BHATTACHARYYA_METRIC) {
             ret = cp ? bhattacharyya_metric(i, o, *cp)
                      : bhattacharyya_metric(i, o);
@@ -448,6 +601,7 @@ public:
             std::exit(1);
         }
         //PRETTY_SAY << "Performing with " << (void *)&o << " and row " << i << '\n';
+        METRICS_COUNT_DISTANCE(measure);
         FT ret;
         switch(measure) {
             case TOTAL_VARIATION_DISTANCE: ret = call<TOTAL_VARIATION_DISTANCE>(o, i); break;
@@ -469,6 +623,7 @@ public:
             case UWLLR: ret = call<UWLLR>(o, i, cache); break;
             case OLLR: ret = call<OLLR>(o, i, cache); break;
             case ITAKURA_SAITO: ret = call<ITAKURA_SAITO>(o, i, cache); break;
+            case REVERSE_ITAKURA_SAITO: ret = call<REVERSE_ITAKURA_SAITO>(o, i, cache); break;
             case COSINE_DISTANCE: ret = call<COSINE_DISTANCE>(o, i); break;
             case PROBABILITY_COSINE_DISTANCE: ret = call<PROBABILITY_COSINE_DISTANCE>(o, i); break;
             case COSINE_SIMILARITY: ret = call<COSINE_SIMILARITY>(o, i); break;
@@ -476,6 +631,7 @@ public:
             case ORACLE_METRIC: case ORACLE_PSEUDOMETRIC: std::fprintf(stderr, "These are placeholders and should not be called."); return 0.;
             default: __builtin_unreachable();
         }
+        return ret;
     }
     template<typename OT, typename CacheT=OT, typename=std::enable_if_t<!std::is_integral_v<OT> > >
     INLINE FT operator()(size_t i, const OT &o, const CacheT *cache=static_cast<CacheT *>(nullptr)) const {
@@ -498,6 +654,7 @@ public:
             << (void *)&o
             << '\n';
 #endif
+        METRICS_COUNT_DISTANCE(measure);
         FT ret;
         switch(measure) {
             case TOTAL_VARIATION_DISTANCE: ret = call<TOTAL_VARIATION_DISTANCE>(i, o); break;
@@ -519,6 +676,7 @@ public:
             case UWLLR: ret = call<UWLLR>(i, o, cache); break;
             case OLLR: ret = call<OLLR>(i, o, cache); break;
             case ITAKURA_SAITO: ret = call<ITAKURA_SAITO>(i, o, cache); break;
+            case REVERSE_ITAKURA_SAITO: ret = call<REVERSE_ITAKURA_SAITO>(i, o, cache); break;
             case COSINE_DISTANCE: ret = call<COSINE_DISTANCE>(i, o); break;
             case PROBABILITY_COSINE_DISTANCE: ret = call<PROBABILITY_COSINE_DISTANCE>(i, o); break;
             case COSINE_SIMILARITY: ret = call<COSINE_SIMILARITY>(i, o); break;
@@ -533,6 +691,7 @@ public:
             std::cerr << (std::string("Invalid rows selection: ") + std::to_string(i) + ", " + std::to_string(j) + '\n');
             std::exit(1);
         }
+        METRICS_COUNT_DISTANCE(measure);
         FT ret;
         switch(measure) {
             case TOTAL_VARIATION_DISTANCE: ret = call<TOTAL_VARIATION_DISTANCE>(i, j); break;
@@ -554,6 +713,7 @@ public:
             case UWLLR: ret = call<UWLLR>(i, j); break;
             case OLLR: ret = call<OLLR>(i, j); break;
             case ITAKURA_SAITO: ret = call<ITAKURA_SAITO>(i, j); break;
+            case REVERSE_ITAKURA_SAITO: ret = call<REVERSE_ITAKURA_SAITO>(i, j); break;
             case COSINE_DISTANCE: ret = call<COSINE_DISTANCE>(i, j); break;
             case PROBABILITY_COSINE_DISTANCE: ret = call<PROBABILITY_COSINE_DISTANCE>(i, j); break;
             case COSINE_SIMILARITY: ret = call<COSINE_SIMILARITY>(i, j); break;
@@ -628,8 +788,9 @@ public:
     }
 
     auto hellinger(size_t i, size_t j) const {
-        return sqrdata_ ? blaze::sqrNorm(sqrtrow(i) - sqrtrow(j))
-                        : blaze::sqrNorm(blaze::sqrt(row(i)) - blaze::sqrt(row(j)));
+        return with_sqrtrow(i, [&](const auto &si) {
+            return with_sqrtrow(j, [&](const auto &sj) {return blaze::sqrNorm(si - sj);});
+        });
     }
     FT jsd(size_t i, size_t j) const {
         if(!IsSparseMatrix_v<MatrixType> || !prior_data_) {
@@ -724,7 +885,7 @@ public:
     auto jsd(size_t i, const OT &o, const OT2 &olog) const {
         if(IS_SPARSE && blaze::IsSparseVector_v<OT> && prior_data_) throw TODOError("TODO: complete special fast version of this supporting priors at no runtime cost.");
         auto mnlog = evaluate(log(0.5 * (row(i) + o)));
-        return (blaze::dot(row(i), logrow(i) - mnlog) + blaze::dot(o, olog - mnlog));
+        return with_logrow(i, [&](const auto &li) {return blaze::dot(row(i), li - mnlog);}) + blaze::dot(o, olog - mnlog);
     }
     template<typename OT, typename=std::enable_if_t<!std::is_integral_v<OT>>>
     auto jsd(size_t i, const OT &o) const {
@@ -839,7 +1000,7 @@ public:
                 return ret + get_jsdcache(i);
             }
         }
-        return FT(get_jsdcache(i) - blz::dot(row(i), logrow(j)));
+        return FT(get_jsdcache(i) - with_logrow(j, [&](const auto &lj) {return blz::dot(row(i), lj);}));
     }
     template<typename OT, typename=std::enable_if_t<!std::is_integral_v<OT>>>
     auto mkl(size_t i, const OT &o) const {
@@ -849,17 +1010,17 @@ public:
     template<typename OT, typename=std::enable_if_t<!std::is_integral_v<OT>>, typename OT2>
     auto mkl(const OT &o, size_t i, const OT2 &olog) const {
         if(IS_SPARSE && blaze::IsSparseVector_v<OT> && prior_data_) throw TODOError("TODO: complete special fast version of this supporting priors at no runtime cost.");
-        return blaze::dot(o, olog - logrow(i));
+        return with_logrow(i, [&](const auto &li) {return blaze::dot(o, olog - li);});
     }
     template<typename OT, typename=std::enable_if_t<!std::is_integral_v<OT>>>
     auto mkl(const OT &o, size_t i) const {
         if(IS_SPARSE && prior_data_) throw TODOError("TODO: complete special fast version of this supporting priors at no runtime cost.");
-        return blaze::dot(o, blaze::neginf2zero(blaze::log(o)) - logrow(i));
+        return with_logrow(i, [&](const auto &li) {return blaze::dot(o, blaze::neginf2zero(blaze::log(o)) - li);});
     }
     template<typename OT, typename=std::enable_if_t<!std::is_integral_v<OT>>, typename OT2>
     auto mkl(size_t i, const OT &, const OT2 &olog) const {
         if(IS_SPARSE && prior_data_) throw TODOError("TODO: complete special fast version of this supporting priors at no runtime cost.");
-        return blaze::dot(row(i), logrow(i) - olog);
+        return with_logrow(i, [&](const auto &li) {return blaze::dot(row(i), li - olog);});
     }
     template<typename...Args>
     auto pkl(Args &&...args) const { return mkl(std::forward<Args>(args)...);}
@@ -869,14 +1030,14 @@ public:
     auto psm(Args &&...args) const { return jsm(std::forward<Args>(args)...);}
     auto bhattacharyya_sim(size_t i, size_t j) const {
         if(IS_SPARSE && prior_data_) throw TODOError("TODO: complete special fast version of this supporting priors at no runtime cost.");
-        return sqrdata_ ? blaze::dot(sqrtrow(i), sqrtrow(j))
-                        : blaze::sum(blaze::sqrt(row(i) * row(j)));
+        return with_sqrtrow(i, [&](const auto &si) {
+            return with_sqrtrow(j, [&](const auto &sj) {return blaze::dot(si, sj);});
+        });
     }
     template<typename OT, typename=std::enable_if_t<!std::is_integral_v<OT>>, typename OT2>
     auto bhattacharyya_sim(size_t i, const OT &o, const OT2 &osqrt) const {
         if(IS_SPARSE && prior_data_) throw std::runtime_error("Failed to calculate. TODO: complete special fast version of this supporting priors at no runtime cost.");
-        return sqrdata_ ? blaze::dot(sqrtrow(i), osqrt)
-                        : blaze::sum(blaze::sqrt(row(i) * o));
+        return with_sqrtrow(i, [&](const auto &si) {return blaze::dot(si, osqrt);});
     }
     template<typename OT, typename=std::enable_if_t<!std::is_integral_v<OT>>>
     auto bhattacharyya_sim(size_t i, const OT &o) const {
@@ -961,11 +1122,54 @@ public:
             throw std::invalid_argument(std::string("Param for lambda ") + std::to_string(param) + " is out of range.");
         lambda_ = param;
     }
+    FT get_lambda() const {return lambda_;}
     auto get_measure() const {return measure_;}
+    // Prior applied at evaluation time (sparse data only); dense data has its prior added in place.
+    const VecT *prior_data() const {return prior_data_.get();}
+    /*
+     * Applicator over data, which holds rows ids[0, n) of this applicator's data, in order.
+     * Those rows are already prepared, so nothing is prepared again: row sums, the prior,
+     * the norm caches and any log, square-root and JSD caches built so far are gathered from this applicator.
+     */
+    template<typename OMatrixType, typename IT>
+    DissimilarityApplicator<OMatrixType> gather(OMatrixType &data, const IT *ids, size_t n) const {
+        if(data.rows() != n || data.columns() != data_.columns())
+            throw std::invalid_argument("data must hold the n selected rows");
+        using OApp = DissimilarityApplicator<OMatrixType>;
+        using OVecT = typename OApp::VecT;
+        auto gather_vec = [ids,n](const VecT &v) {
+            OVecT ret(n);
+            for(size_t i = 0; i < n; ++i) ret[i] = v[ids[i]];
+            return ret;
+        };
+        OApp ret(data, measure_, detail::RestoreTag{});
+        ret.lambda_ = lambda_;
+        ret.row_sums_ = gather_vec(row_sums_);
+        if(prior_data_) {
+            ret.prior_data_.reset(new OVecT(prior_data_->size()));
+            std::copy(prior_data_->begin(), prior_data_->end(), ret.prior_data_->begin());
+        }
+        if(l2norm_cache_) ret.l2norm_cache_.reset(new OVecT(gather_vec(*l2norm_cache_)));
+        if(pl2norm_cache_) ret.pl2norm_cache_.reset(new OVecT(gather_vec(*pl2norm_cache_)));
+        if(auto jc = jsd_cache_.get_if_built()) ret.jsd_cache_.set(gather_vec(*jc));
+        ret.set_cache_mode(cache_mode_);
+        if constexpr(std::is_same_v<OMatrixType, MatrixType>) {
+            auto gather_cache = [ids,n](const auto &src, auto &dest) {
+                if(auto c = src.get_if_built())
+                    dest.set(std::decay_t<decltype(*c)>(rows(*c, ids, n)));
+            };
+            gather_cache(logdata_, ret.logdata_);
+            gather_cache(sqrdata_, ret.sqrdata_);
+            gather_cache(flogdata_, ret.flogdata_);
+            gather_cache(fsqrdata_, ret.fsqrdata_);
+        }
+        return ret;
+    }
 private:
     template<typename Container=blaze::DynamicVector<FT, blaze::rowVector>>
     void prep(Prior prior, const Container *c=nullptr) {
         std::fprintf(stderr, "beginning prep.\n");
+        METRICS_STAGE("prep");
         switch(prior) {
             case NONE:
             break;
@@ -997,43 +1201,51 @@ private:
         }
         row_sums_.resize(data_.rows());
         {
+            DBG_ONLY(std::atomic<bool> negative{false};)
+            OMP_PFOR
             for(size_t i = 0; i < data_.rows(); ++i) {
-                auto r(row(i));
-                FT countsum = blaze::sum(r);
-                if constexpr(blaze::IsDenseMatrix_v<MatrixType>) {
-                    if(prior == NONE) {
-                        r += 1e-50;
-#ifndef NDEBUG
-                        if(dist::detail::expects_nonnegative(measure_) && blaze::min(r) < 0.)
-                            throw std::invalid_argument(std::string("Measure ") + dist::detail::prob2str(measure_) + " expects nonnegative data");
-#endif
-                    }
-                } else if constexpr(blaze::IsSparseMatrix_v<MatrixType>) {
+                if constexpr(is_csr_view_v<MatrixType>) {
+                    // Update the view's value array through its row iterators, since the view's structure is fixed
+                    FT countsum = 0;
+                    for(auto it = data_.begin(i), e = data_.end(i); it != e; ++it) countsum += it->value();
                     if(prior_data_) {
-                        bool single_value = prior_data_->size() == 1;
-                        if(prior == DIRICHLET) {
-                            countsum += r.size();
-                        } else {
-                            MINOCORE_VALIDATE(prior_data_ != nullptr);
-                            countsum += single_value ? r.size() * *prior_data_->begin()
-                                                     : blaze::sum(*prior_data_);
+                        const bool single_value = prior_data_->size() == 1;
+                        countsum += single_value ? FT(data_.columns() * *prior_data_->begin()): FT(blaze::sum(*prior_data_));
+                        for(auto it = data_.begin(i), e = data_.end(i); it != e; ++it)
+                            it->value() += (*prior_data_)[single_value ? size_t(0): it->index()];
+                    }
+                    for(auto it = data_.begin(i), e = data_.end(i); it != e; ++it) it->value() /= countsum;
+                    row_sums_[i] = countsum;
+                } else {
+                    auto r(row(i));
+                    FT countsum = blaze::sum(r);
+                    if constexpr(blaze::IsDenseMatrix_v<MatrixType>) {
+                        if(prior == NONE) {
+                            r += 1e-50;
+                            DBG_ONLY(if(dist::detail::expects_nonnegative(measure_) && blaze::min(r) < 0.) negative = true;)
+                        }
+                    } else if constexpr(blaze::IsSparseMatrix_v<MatrixType>) {
+                        if(prior_data_) {
+                            bool single_value = prior_data_->size() == 1;
+                            if(prior == DIRICHLET) {
+                                countsum += r.size();
+                            } else {
+                                MINOCORE_VALIDATE(prior_data_ != nullptr);
+                                countsum += single_value ? r.size() * *prior_data_->begin()
+                                                         : blaze::sum(*prior_data_);
+                            }
+                            for(auto &item: r)
+                                item.value() +=
+                                    (*prior_data_)[single_value ? size_t(0): item.index()];
                         }
-                        for(auto &item: r)
-                            item.value() +=
-                                (*prior_data_)[single_value ? size_t(0): item.index()];
                     }
+                    r /= countsum;
+                    row_sums_[i] = countsum;
                 }
-                r /= countsum;
-                row_sums_[i] = countsum;
             }
+            DBG_ONLY(if(negative) throw std::invalid_argument(std::string("Measure ") + dist::detail::prob2str(measure_) + " expects nonnegative data");)
         }
 
-        if(dist::detail::needs_logs(measure_)) {
-            logdata_.reset(new MatrixType(neginf2zero(log(data_))));
-        }
-        if(dist::detail::needs_sqrt(measure_)) {
-            sqrdata_.reset(new MatrixType(blaze::sqrt(data_)));
-        }
         if(dist::detail::needs_l2_cache(measure_)) {
             l2norm_cache_.reset(new VecT(data_.rows()));
             OMP_PFOR
@@ -1048,55 +1260,83 @@ private:
                 pl2norm_cache_->operator[](i) = 1. / blaze::l2Norm(row(i));
             }
         }
-        if(logdata_) {
-            jsd_cache_.reset(new VecT(data_.rows()));
-            auto &jc = *jsd_cache_;
-            if constexpr(IS_SPARSE) {
-                if(prior_data_) {
-                    // Handle sparse priors
-                    MINOCORE_VALIDATE(prior_data_->size() == 1 || prior_data_->size() == data_.columns());
-                    auto &pd = *prior_data_;
-                    const bool single_value = pd.size() == 1;
-                    for(size_t i = 0; i < data_.rows(); ++i) {
-                        const auto rs = row_sums_[i];
-                        auto r = row(i);
-                        double contrib = 0.;
-                        auto upcontrib = [&](auto x) {contrib += x * std::log(x);};
-                        if(single_value) {
-                            FT invp = pd[0] / rs;
-                            size_t number_zero = r.size() - nonZeros(r);
-                            contrib += number_zero * (invp * std::log(invp)); // Empty
-                            for(auto &pair: r) upcontrib(pair.value());       // Non-empty
-                        } else {
-                            size_t i = 0;
-                            auto it = r.begin();
-                            auto contribute_range = [&](size_t end) {
-                                while(i < end) upcontrib(pd[i++] / rs);
-                            };
-                            while(it != r.end() && i < r.size()) {
-                                contribute_range(it->index());
-                                upcontrib(it->value());
-                                if(++it == r.end())
-                                    contribute_range(r.size());
-                            }
+    }
+    enum CacheKind {LOG_CACHE, SQRT_CACHE};
+    // Copies the data (sharing its structure, if sparse) and transforms the copy's values in parallel
+    template<typename CacheType>
+    CacheType make_cache(CacheKind kind) const {
+        auto f = [kind](auto x) -> blaze::ElementType_t<CacheType> {
+            if(kind == SQRT_CACHE) return std::sqrt(x);
+            return x ? std::log(x): 0; // neginf2zero
+        };
+        if constexpr(is_csr_view_v<MatrixType>) {
+            // Shares the sparsity structure; only a value array is allocated.
+            return data_.map([&f](FT x) {return FT(f(x));});
+        } else {
+            CacheType ret(data_);
+            OMP_PFOR
+            for(size_t i = 0; i < ret.rows(); ++i) {
+                auto r = blaze::row(ret, i BLAZE_CHECK_DEBUG);
+                if constexpr(blaze::IsSparseMatrix_v<CacheType>) {
+                    for(auto &pair: r) pair.value() = f(pair.value());
+                } else {
+                    for(auto &x: r) x = f(x);
+                }
+            }
+            return ret;
+        }
+    }
+    // Sum of x log(x) over each row, including the sparse prior's contribution
+    VecT make_jsd_cache() const {
+        VecT jc(data_.rows());
+        if constexpr(IS_SPARSE) {
+            if(prior_data_) {
+                // Handle sparse priors
+                MINOCORE_VALIDATE(prior_data_->size() == 1 || prior_data_->size() == data_.columns());
+                auto &pd = *prior_data_;
+                const bool single_value = pd.size() == 1;
+                OMP_PFOR
+                for(size_t i = 0; i < data_.rows(); ++i) {
+                    const auto rs = row_sums_[i];
+                    auto r = row(i);
+                    double contrib = 0.;
+                    auto upcontrib = [&](auto x) {contrib += x * std::log(x);};
+                    if(single_value) {
+                        FT invp = pd[0] / rs;
+                        size_t number_zero = r.size() - nonZeros(r);
+                        contrib += number_zero * (invp * std::log(invp)); // Empty
+                        for(auto &pair: r) upcontrib(pair.value());       // Non-empty
+                    } else {
+                        size_t i = 0;
+                        auto it = r.begin();
+                        auto contribute_range = [&](size_t end) {
+                            while(i < end) upcontrib(pd[i++] / rs);
+                        };
+                        while(it != r.end() && i < r.size()) {
+                            contribute_range(it->index());
+                            upcontrib(it->value());
+                            if(++it == r.end())
+                                contribute_range(r.size());
                         }
-                        jc[i] = contrib;
                     }
+                    jc[i] = contrib;
                 }
+                return jc;
             }
-            if(!(IS_SPARSE && prior_data_))
-                for(size_t i = 0; i < jc.size(); ++i)
-                    jc[i] = dot(row(i), logrow(i));
         }
+        // Logs are computed per row rather than building the log cache
+        OMP_PFOR
+        for(size_t i = 0; i < jc.size(); ++i)
+            jc[i] = dot(row(i), blaze::neginf2zero(blaze::log(row(i))));
+        return jc;
     }
     FT get_jsdcache(size_t index) const {
-        assert(jsd_cache_ && jsd_cache_->size() > index);
-        return (*jsd_cache_)[index];
+        const auto &jc = jsd_cache_.get([this]() {return make_jsd_cache();});
+        assert(jc.size() > index);
+        return jc[index];
     }
     FT get_llrcache(size_t index) const {
-        assert(jsd_cache_ && jsd_cache_->size() > index);
-        return get_jsdcache(index) * row_sums_->operator[](index);
-        return (*jsd_cache_)[index] * row_sums_->operator[](index);
+        return get_jsdcache(index) * row_sums_[index];
     }
 }; // DissimilarityApplicator
 
@@ -1158,6 +1398,15 @@ auto make_jsm_applicator(MatrixType &data, Prior prior=NONE, const PriorContaine
 }
 
 
+/*
+ * Applicator over data, which holds rows ids[0, n) of app.data() (e.g., a coreset), with app's measure,
+ * prior, lambda and cache mode. The rows are not prepared again (see DissimilarityApplicator::gather).
+ */
+template<typename MatrixType, typename OMatrixType, typename IT>
+auto make_like_applicator(const DissimilarityApplicator<OMatrixType> &app, MatrixType &data, const IT *ids, size_t n) {
+    return app.gather(data, ids, n);
+}
+
 template<typename MatrixType>
 auto make_kmc2(const DissimilarityApplicator<MatrixType> &app, unsigned k, size_t m=2000, uint64_t seed=13) {
     wy::WyRand<uint64_t> gen(seed);
@@ -1184,6 +1433,7 @@ using jsd::DissimilarityApplicator;
 using jsd::make_d2_coreset_sampler;
 using jsd::make_kmc2;
 using jsd::make_kmeanspp;
+using jsd::make_like_applicator;
 using jsd::make_jsm_applicator;
 using jsd::make_probdiv_applicator;
 
@@ -0,0 +1,284 @@
+#pragma once
+#ifndef FGC_APPLICATOR_CACHE_H__
+#define FGC_APPLICATOR_CACHE_H__
+#include "minocore/dist/applicator.h"
+#include "minocore/util/serialize.h"
+#include <optional>
+#include <sys/stat.h>
+
+/*
+ * On-disk cache of a DissimilarityApplicator's prepared state, so that repeated runs over the same data
+ * skip normalization and cache construction.
+ *
+ * Preparation only changes values (normalization and dense priors), never the sparsity structure,
+ * so files store values in row-major order plus the per-row state:
+ *   META = {key, measure, rows, columns, stored values}
+ *   LMBD = {lambda}
+ *   DATA normalized values; RSUM row sums; PRIR sparse prior;
+ *   JSDC, L2NC, PL2N per-row caches; LOGD, SQRD log and sqrt values (if those caches were built at full precision).
+ * Files are written with serial::Writer, so uncompressed files are read from a private mapping.
+ */
+
+namespace minocore {
+
+namespace jsd {
+
+namespace tags {
+static constexpr uint32_t META = serial::make_tag("META");
+static constexpr uint32_t LMBD = serial::make_tag("LMBD");
+static constexpr uint32_t DATA = serial::make_tag("DATA");
+static constexpr uint32_t RSUM = serial::make_tag("RSUM");
+static constexpr uint32_t PRIR = serial::make_tag("PRIR");
+static constexpr uint32_t JSDC = serial::make_tag("JSDC");
+static constexpr uint32_t L2NC = serial::make_tag("L2NC");
+static constexpr uint32_t PL2N = serial::make_tag("PL2N");
+static constexpr uint32_t LOGD = serial::make_tag("LOGD");
+static constexpr uint32_t SQRD = serial::make_tag("SQRD");
+} // namespace tags
+
+template<typename MatrixType>
+struct ApplicatorStore {
+    static_assert(IsRowMajorMatrix_v<MatrixType>, "Applicator caches require row-major data");
+    using app_t = DissimilarityApplicator<MatrixType>;
+    using FT = typename app_t::FT;
+    using VecT = typename app_t::VecT;
+
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+        return h ^ (h >> 33);
+    }
+    static uint64_t bits(FT x) {
+        uint64_t ret = 0;
+        std::memcpy(&ret, &x, sizeof(x));
+        return ret;
+    }
+    static size_t nvalues(const MatrixType &mat) {
+        if constexpr(IsSparseMatrix_v<MatrixType>) {
+            size_t ret = 0;
+            for(size_t i = 0; i < mat.rows(); ++i) ret += mat.nonZeros(i);
+            return ret;
+        } else return mat.rows() * mat.columns();
+    }
+    // Calls f(value, offset) for each stored value of mat, offsets following row-major order; parallel over rows.
+    template<typename MT, typename F>
+    static void for_each_value(MT &mat, const F &f) {
+        const size_t nr = mat.rows();
+        if constexpr(IsSparseMatrix_v<std::decay_t<MT>>) {
+            std::vector<size_t> offsets(nr + 1);
+            for(size_t i = 0; i < nr; ++i) offsets[i + 1] = offsets[i] + mat.nonZeros(i);
+            OMP_PFOR
+            for(size_t i = 0; i < nr; ++i) {
+                size_t off = offsets[i];
+                for(auto it = mat.begin(i), e = mat.end(i); it != e; ++it) f(it->value(), off++);
+            }
+        } else {
+            const size_t nc = mat.columns();
+            OMP_PFOR
+            for(size_t i = 0; i < nr; ++i)
+                for(size_t j = 0; j < nc; ++j) f(mat(i, j), i * nc + j);
+        }
+    }
+    template<typename MT>
+    static std::vector<FT> values(const MT &mat) {
+        std::vector<FT> ret(nvalues(mat));
+        for_each_value(mat, [&ret](const auto &x, size_t off) {ret[off] = x;});
+        return ret;
+    }
+    // Values of mat in row-major order: its own storage if contiguous, and otherwise a copy made into buf
+    static const FT *contiguous_values(const MatrixType &mat, std::vector<FT> &buf) {
+        if constexpr(is_csr_view_v<MatrixType>) {
+            if(mat.rows()) return mat.data() + (mat.indptr()[0] - mat.data_offset());
+        } else if constexpr(IsDenseMatrix_v<MatrixType>) {
+            if(mat.spacing() == mat.columns()) return mat.data();
+        }
+        buf = values(mat);
+        return buf.data();
+    }
+    /*
+     * The structure of mat with values vals. CSR views share mat's structure and use vals in place,
+     * keeping the file's private mapping alive; dense matrices are allocated without copying mat.
+     */
+    static MatrixType with_values(const MatrixType &mat, const serial::Array<FT> &vals) {
+        if constexpr(is_csr_view_v<MatrixType>) {
+            auto keepalive = std::make_shared<std::pair<std::shared_ptr<const void>, std::shared_ptr<const void>>>(mat.owner(), vals.owner_);
+            return MatrixType(mat.indptr(), mat.indices(), const_cast<FT *>(vals.data()), mat.rows(), mat.columns(),
+                              std::move(keepalive), mat.rows() ? size_t(mat.indptr()[0]): size_t(0));
+        } else {
+            auto ret = [&]() {
+                if constexpr(IsDenseMatrix_v<MatrixType> && std::is_constructible_v<MatrixType, size_t, size_t>)
+                    return MatrixType(mat.rows(), mat.columns());
+                else return MatrixType(mat);
+            }();
+            for_each_value(ret, [&vals](auto &x, size_t off) {x = vals[off];});
+            return ret;
+        }
+    }
+
+    // Order-sensitive hash of the values (and, for sparse data, the indices) of mat, computed in parallel over rows
+    static uint64_t hash_input(const MatrixType &mat) {
+        uint64_t ret = mix(mat.rows() * 0x9E3779B97F4A7C15ull + mat.columns());
+        OMP_PRAGMA("omp parallel for reduction(+:ret)")
+        for(size_t i = 0; i < mat.rows(); ++i) {
+            uint64_t h = mix(i + 1);
+            if constexpr(IsSparseMatrix_v<MatrixType>) {
+                for(auto it = mat.begin(i), e = mat.end(i); it != e; ++it)
+                    h = mix(h ^ (uint64_t(it->index()) << 32 ^ bits(it->value())));
+            } else {
+                for(size_t j = 0; j < mat.columns(); ++j) h = mix(h ^ bits(mat(i, j)));
+            }
+            ret += mix(h + i);
+        }
+        return ret;
+    }
+    template<typename PriorContainer>
+    static uint64_t make_key(uint64_t input_hash, DissimilarityMeasure measure, Prior prior, const PriorContainer *c) {
+        uint64_t ret = mix(input_hash ^ (uint64_t(measure) << 40) ^ (uint64_t(prior) << 48) ^ (uint64_t(sizeof(FT)) << 56));
+        if(c) for(const auto v: *c) ret = mix(ret ^ bits(v));
+        return ret;
+    }
+
+    /*
+     * Writes app's prepared state to path. With with_caches, the per-row JSD cache and, at full precision,
+     * the log and sqrt caches are stored if they have been built (e.g., by app.prepare_caches()); none is built here.
+     */
+    static void save(const app_t &app, const std::string &path, uint64_t key, bool compress=false, bool with_caches=true) {
+        const auto &data = app.data();
+        const size_t nv = nvalues(data);
+        const uint64_t meta[5] = {key, uint64_t(app.measure_), data.rows(), data.columns(), nv};
+        const double lambda = app.lambda_;
+        serial::Writer w(path, serial::APPLICATOR_STATE, compress);
+        std::vector<FT> vals, logs, sqrts;
+        w.add(tags::META, meta, 5).add(tags::LMBD, &lambda, 1).add(tags::DATA, contiguous_values(data, vals), nv)
+         .add(tags::RSUM, app.row_sums_.data(), app.row_sums_.size());
+        if(app.prior_data_) w.add(tags::PRIR, app.prior_data_->data(), app.prior_data_->size());
+        if(app.l2norm_cache_) w.add(tags::L2NC, app.l2norm_cache_->data(), app.l2norm_cache_->size());
+        if(app.pl2norm_cache_) w.add(tags::PL2N, app.pl2norm_cache_->data(), app.pl2norm_cache_->size());
+        if(with_caches) {
+            if(auto jc = app.jsd_cache_.get_if_built()) w.add(tags::JSDC, jc->data(), jc->size());
+            if(auto ld = app.logdata_.get_if_built()) w.add(tags::LOGD, contiguous_values(*ld, logs), nv);
+            if(auto sd = app.sqrdata_.get_if_built()) w.add(tags::SQRD, contiguous_values(*sd, sqrts), nv);
+        }
+        w.finish();
+    }
+
+    /*
+     * Restores an applicator over data (the raw input from which the file was made) from path.
+     * data is overwritten with the stored normalized values.
+     * Throws if the file does not match key, measure or data's shape.
+     */
+    static app_t load(MatrixType &data, const std::string &path, uint64_t key, DissimilarityMeasure measure,
+                      CacheMode cache_mode=CACHE_AUTO, size_t cache_budget=0)
+    {
+        serial::Reader r(path);
+        r.require_kind(serial::APPLICATOR_STATE);
+        auto meta = r.get<uint64_t>(tags::META);
+        if(meta.size() != 5 || meta[0] != key || meta[1] != uint64_t(measure))
+            throw std::runtime_error(path + " was made for different data, measure or prior");
+        const size_t nr = data.rows(), nv = meta[4];
+        if(meta[2] != nr || meta[3] != data.columns() || nv != nvalues(data))
+            throw std::runtime_error(path + " does not match the shape of the data");
+        // Every section is read and checked before data is modified.
+        auto get = [&](uint32_t tag, size_t expected) {
+            std::optional<serial::Array<FT>> ret;
+            if(r.has(tag)) {
+                ret = r.get<FT>(tag);
+                if(expected && ret->size() != expected) throw std::runtime_error(path + " has the wrong size for section " + serial::tag2str(tag));
+            }
+            return ret;
+        };
+        app_t ret(data, measure, detail::RestoreTag{});
+        ret.set_cache_mode(cache_mode, cache_budget);
+        // Full-precision caches are only read (and, if compressed, decompressed) if they will be used
+        const bool full = ret.cache_mode_ == CACHE_FULL;
+        auto vals = get(tags::DATA, nv), rsums = get(tags::RSUM, nr), prior = get(tags::PRIR, 0),
+             l2 = get(tags::L2NC, nr), pl2 = get(tags::PL2N, nr), jc = get(tags::JSDC, nr),
+             logs = full ? get(tags::LOGD, nv): std::nullopt, sqrts = full ? get(tags::SQRD, nv): std::nullopt;
+        if(!vals || !rsums) throw std::runtime_error(path + " is missing the normalized data");
+        // Priors hold one value for every feature, or one shared by all of them
+        if(prior && prior->size() != 1 && prior->size() != data.columns())
+            throw std::runtime_error(path + " has the wrong size for section " + serial::tag2str(tags::PRIR));
+        const double lambda = r.scalar<double>(tags::LMBD);
+        auto to_vec = [](const serial::Array<FT> &arr) {
+            VecT ret(arr.size());
+            std::copy(arr.begin(), arr.end(), ret.begin());
+            return ret;
+        };
+        for_each_value(data, [&v=*vals](auto &x, size_t off) {x = v[off];});
+        ret.lambda_ = lambda;
+        ret.row_sums_ = to_vec(*rsums);
+        if(prior) ret.prior_data_.reset(new VecT(to_vec(*prior)));
+        if(l2) ret.l2norm_cache_.reset(new VecT(to_vec(*l2)));
+        if(pl2) ret.pl2norm_cache_.reset(new VecT(to_vec(*pl2)));
+        if(jc) ret.jsd_cache_.set(to_vec(*jc));
+        if(logs) ret.logdata_.set(with_values(data, *logs));
+        if(sqrts) ret.sqrdata_.set(with_values(data, *sqrts));
+        return ret;
+    }
+};
+
+template<typename MatrixType>
+void save_applicator(const DissimilarityApplicator<MatrixType> &app, const std::string &path, uint64_t key,
+                     bool compress=false, bool with_caches=true)
+{
+    ApplicatorStore<MatrixType>::save(app, path, key, compress, with_caches);
+}
+
+template<typename MatrixType>
+DissimilarityApplicator<MatrixType>
+load_applicator(MatrixType &data, const std::string &path, uint64_t key, DissimilarityMeasure measure,
+                CacheMode cache_mode=CACHE_AUTO, size_t cache_budget=0)
+{
+    return ApplicatorStore<MatrixType>::load(data, path, key, measure, cache_mode, cache_budget);
+}
+
+/*
+ * Applicator over data, with its prepared state cached in cache_dir under a key made from
+ * a hash of data, the measure, the prior and the prior's values.
+ * If the cache file exists, data is overwritten with the stored normalized values and the applicator
+ * is restored without recomputation; otherwise it is prepared as usual and saved.
+ * input_hash, if nonzero, replaces hashing data (e.g., a hash of the input file's path, size and modification time).
+ */
+template<typename MatrixType, typename PriorContainer=blaze::DynamicVector<blaze::ElementType_t<MatrixType>, blaze::rowVector>>
+DissimilarityApplicator<MatrixType>
+make_cached_applicator(MatrixType &data, const std::string &cache_dir, DissimilarityMeasure measure=JSM, Prior prior=NONE,
+                       const PriorContainer *c=nullptr, uint64_t input_hash=0, bool compress=false,
+                       CacheMode cache_mode=CACHE_AUTO, size_t cache_budget=0)
+{
+    using store_t = ApplicatorStore<MatrixType>;
+    if(!input_hash) input_hash = store_t::hash_input(data);
+    const uint64_t key = store_t::make_key(input_hash, measure, prior, c);
+    char buf[24];
+    std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(key));
+    const std::string path = cache_dir + "/" + buf + ".applicator";
+    struct stat st;
+    if(::stat(path.data(), &st) == 0) {
+        try {
+            auto ret = store_t::load(data, path, key, measure, cache_mode, cache_budget);
+            std::fprintf(stderr, "Loaded prepared applicator from %s\n", path.data());
+            return ret;
+        } catch(const std::exception &ex) {
+            // load only overwrites data after every check has passed, so data is still the raw input
+            std::fprintf(stderr, "Failed to load %s (%s); preparing from scratch\n", path.data(), ex.what());
+        }
+    }
+    DissimilarityApplicator<MatrixType> ret(data, measure, prior, c, cache_mode, cache_budget);
+    // Clustering builds the caches before its first parallel region anyway; building them now lets them be saved
+    ret.prepare_caches();
+    try {
+        store_t::save(ret, path, key, compress);
+    } catch(const std::exception &ex) {
+        std::fprintf(stderr, "Failed to save applicator cache to %s: %s\n", path.data(), ex.what());
+    }
+    return ret;
+}
+
+} // namespace jsd
+
+using jsd::make_cached_applicator;
+using jsd::save_applicator;
+using jsd::load_applicator;
+
+} // namespace minocore
+
+#endif /* FGC_APPLICATOR_CACHE_H__ */
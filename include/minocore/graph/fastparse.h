@@ -0,0 +1,324 @@
+#pragma once
+#include "minocore/graph/graph.h"
+#include "minocore/util/timer.h"
+#include "minocore/util/fastparse.h"
+#include "mio/single_include/mio/mio.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <vector>
+
+/*
+ * Memory-mapped, chunk-parallel graph loaders.
+ *
+ * Files are mapped, split into roughly equal chunks at line boundaries,
+ * and each chunk is parsed independently into a thread-private edge buffer.
+ * Buffers are concatenated in chunk order, so the resulting edge list is identical
+ * regardless of the number of threads used.
+ *
+ * EdgeList can be dumped to (and reloaded from) a binary cache keyed on the source file's size and mtime,
+ * which skips text parsing entirely on repeated runs.
+ */
+
+namespace minocore {
+
+namespace graph {
+
+// Identifies a source file by size and modification time so that stale caches are detected.
+struct SourceKey {
+    uint64_t size_ = 0;
+    uint64_t mtime_ns_ = 0;
+    static SourceKey from_file(const std::string &path) {
+        struct stat st;
+        if(::stat(path.data(), &st)) throw std::system_error(errno, std::system_category(), std::string("Failed to stat ") + path);
+        SourceKey ret;
+        ret.size_ = st.st_size;
+        ret.mtime_ns_ = uint64_t(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec;
+        return ret;
+    }
+    bool operator==(const SourceKey &o) const {return size_ == o.size_ && mtime_ns_ == o.mtime_ns_;}
+    bool operator!=(const SourceKey &o) const {return !operator==(o);}
+};
+
+template<typename FT=float, typename IT=uint32_t>
+struct EdgeList {
+    using edge_type = std::pair<IT, IT>;
+    static_assert(sizeof(edge_type) == 2 * sizeof(IT), "edge pairs must be tightly packed for binary caching");
+    static constexpr uint64_t MAGIC = 0x4843474d434e494dull; // "MINCMGCH"
+    static constexpr uint32_t VERSION = 1;
+
+    size_t nnodes_ = 0;
+    std::vector<edge_type> edges_;
+    std::vector<FT> weights_;
+
+    size_t num_vertices() const {return nnodes_;}
+    size_t num_edges() const {return edges_.size();}
+
+    template<typename DirectedS=undirectedS>
+    Graph<DirectedS, FT> to_graph() const {
+        assert(edges_.size() == weights_.size());
+        // Range constructor: builds adjacency lists in one pass without per-edge vertex bounds checks/resizes.
+        return Graph<DirectedS, FT>(edges_.begin(), edges_.end(), weights_.begin(), nnodes_, edges_.size());
+    }
+
+    struct Header {
+        uint64_t magic_;
+        uint32_t version_;
+        uint16_t itsize_, ftsize_;
+        uint64_t nnodes_, nedges_;
+        SourceKey key_;
+    };
+
+    void write(const std::string &path, const SourceKey &key) const {
+        const std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) throw std::system_error(errno, std::system_category(), std::string("Failed to open ") + tmp);
+        Header h{MAGIC, VERSION, uint16_t(sizeof(IT)), uint16_t(sizeof(FT)), nnodes_, edges_.size(), key};
+        try {
+            shared::checked_posix_write(fd, &h, sizeof(h));
+            if(edges_.size()) {
+                shared::checked_posix_write(fd, edges_.data(), edges_.size() * sizeof(edge_type));
+                shared::checked_posix_write(fd, weights_.data(), weights_.size() * sizeof(FT));
+            }
+        } catch(...) {
+            ::close(fd);
+            std::remove(tmp.data());
+            throw;
+        }
+        ::close(fd);
+        // Rename into place so that a concurrent or interrupted run never observes a partial cache.
+        if(std::rename(tmp.data(), path.data()))
+            throw std::system_error(errno, std::system_category(), std::string("Failed to rename ") + tmp);
+    }
+
+    // Returns false if the cache is missing, malformed, or does not match key.
+    bool read(const std::string &path, const SourceKey *key=nullptr) {
+        struct stat st;
+        if(::stat(path.data(), &st) || size_t(st.st_size) < sizeof(Header)) return false;
+        mio::mmap_source ms(path);
+        Header h;
+        std::memcpy(&h, ms.data(), sizeof(h));
+        if(h.magic_ != MAGIC || h.version_ != VERSION || h.itsize_ != sizeof(IT) || h.ftsize_ != sizeof(FT))
+            return false;
+        if(key && h.key_ != *key) return false;
+        if(ms.size() != sizeof(Header) + h.nedges_ * (sizeof(edge_type) + sizeof(FT))) return false;
+        nnodes_ = h.nnodes_;
+        edges_.resize(h.nedges_);
+        weights_.resize(h.nedges_);
+        const char *p = ms.data() + sizeof(Header);
+        std::memcpy(static_cast<void *>(edges_.data()), p, h.nedges_ * sizeof(edge_type));
+        std::memcpy(weights_.data(), p + h.nedges_ * sizeof(edge_type), h.nedges_ * sizeof(FT));
+        return true;
+    }
+};
+
+// DIMACS shortest-path challenge format ("c" comments, "p sp n m", "a u v w"; 1-based ids).
+template<typename FT=float, typename IT=uint32_t>
+EdgeList<FT, IT> fast_dimacs_official_parse(const std::string &fn, size_t nchunks=fastparse::default_nchunks()) {
+    mio::mmap_source ms(fn);
+    const char *p = ms.data(), *const e = p + ms.size();
+    EdgeList<FT, IT> ret;
+    size_t nedges_expected = 0;
+    // The header is parsed serially; everything after the problem line is edges or comments.
+    for(;p < e; p = fastparse::next_line(p, e)) {
+        if(*p == 'p') {
+            const char *q = p + 1;
+            while(q < e && fastparse::ishspace(*q)) ++q;
+            while(q < e && !fastparse::ishspace(*q) && *q != '\n') ++q; // problem type
+            ret.nnodes_ = fastparse::parse_uint(q, e);
+            nedges_expected = fastparse::parse_uint(q, e);
+            p = fastparse::next_line(p, e);
+            break;
+        }
+        if(*p != 'c' && *p != '\n') throw std::runtime_error(std::string("Unexpected line before problem line in ") + fn);
+    }
+    if(!ret.nnodes_) throw std::runtime_error(std::string("Failed to parse problem line from ") + fn);
+    auto chunks = fastparse::line_chunks(p, e, nchunks);
+    std::vector<std::vector<typename EdgeList<FT, IT>::edge_type>> edges(chunks.size());
+    std::vector<std::vector<FT>> weights(chunks.size());
+    int bad = 0;
+    OMP_PFOR_DYN
+    for(size_t i = 0; i < chunks.size(); ++i) {
+        const char *s = chunks[i].first, *const ce = chunks[i].second;
+        const size_t guess = nedges_expected * (ce - s) / std::max(size_t(1), size_t(e - p)) + 16;
+        edges[i].reserve(guess); weights[i].reserve(guess);
+        for(; s < ce; s = fastparse::next_line(s, ce)) {
+            if(*s == 'a') {
+                const char *q = s + 1;
+                uint64_t lhs = fastparse::parse_uint(q, ce), rhs = fastparse::parse_uint(q, ce);
+                double w = fastparse::parse_double(q, ce);
+                if(unlikely(lhs - 1 >= ret.nnodes_ || rhs - 1 >= ret.nnodes_)) {
+                    OMP_ATOMIC
+                    ++bad;
+                    break;
+                }
+                edges[i].emplace_back(lhs - 1, rhs - 1);
+                weights[i].push_back(w);
+            } else if(unlikely(*s != 'c' && *s != '\n' && *s != '\r')) {
+                OMP_ATOMIC
+                ++bad;
+                break;
+            }
+        }
+    }
+    if(bad) throw std::runtime_error(std::string("Malformed or out-of-range edge line in ") + fn);
+    fastparse::concatenate(edges, ret.edges_);
+    fastparse::concatenate(weights, ret.weights_);
+    if(nedges_expected && ret.edges_.size() != nedges_expected)
+        std::fprintf(stderr, "Warning: expected %zu edges, parsed %zu from %s\n", nedges_expected, ret.edges_.size(), fn.data());
+    return ret;
+}
+
+// Adjacency-list format: "n m" header, then one line of 1-based neighbor ids per vertex.
+// Lines which do not begin with a digit are skipped and do not consume a vertex id, matching parse_dimacs_unweighted.
+template<typename FT=float, typename IT=uint32_t>
+EdgeList<FT, IT> fast_dimacs_unweighted_parse(const std::string &fn, size_t nchunks=fastparse::default_nchunks()) {
+    mio::mmap_source ms(fn);
+    const char *p = ms.data(), *const e = p + ms.size();
+    EdgeList<FT, IT> ret;
+    ret.nnodes_ = fastparse::parse_uint(p, e);
+    const size_t nedges = fastparse::parse_uint(p, e);
+    if(!ret.nnodes_ || !nedges) throw std::runtime_error(std::string("Failed to read header from file ") + fn);
+    p = fastparse::next_line(p, e);
+    auto chunks = fastparse::line_chunks(p, e, nchunks);
+    std::vector<std::vector<typename EdgeList<FT, IT>::edge_type>> edges(chunks.size());
+    std::vector<size_t> nverts(chunks.size() + 1);
+    int bad = 0;
+    OMP_PFOR_DYN
+    for(size_t i = 0; i < chunks.size(); ++i) {
+        const char *s = chunks[i].first, *const ce = chunks[i].second;
+        IT id = 0; // Chunk-local; rebased once all chunks' vertex counts are known.
+        for(; s < ce; s = fastparse::next_line(s, ce)) {
+            if(!fastparse::isdig(*s)) continue;
+            const char *le = fastparse::line_end(s, ce);
+            while(s < le && fastparse::isdig(*s)) {
+                uint64_t nbr = fastparse::parse_uint(s, le) - 1;
+                if(unlikely(nbr >= ret.nnodes_)) {
+                    OMP_ATOMIC
+                    ++bad;
+                }
+                edges[i].emplace_back(id, nbr);
+                while(s < le && fastparse::ishspace(*s)) ++s;
+            }
+            ++id;
+        }
+        nverts[i + 1] = id;
+    }
+    if(bad) throw std::runtime_error(std::string("Out-of-range neighbor id in ") + fn);
+    std::partial_sum(nverts.begin(), nverts.end(), nverts.begin());
+    OMP_PFOR
+    for(size_t i = 0; i < chunks.size(); ++i)
+        for(auto &edge: edges[i]) edge.first += nverts[i];
+    fastparse::concatenate(edges, ret.edges_);
+    ret.weights_.assign(ret.edges_.size(), FT(1));
+    return ret;
+}
+
+// NBER county/place distance csv: state1,place1,mi_to_place,state2,place2
+// Vertex ids are assigned in order of first appearance, as in parse_nber.
+template<typename FT=float, typename IT=uint32_t, typename VtxIdType=uint64_t>
+EdgeList<FT, IT> fast_nber_parse(const std::string &fn, size_t nchunks=fastparse::default_nchunks()) {
+    static constexpr unsigned SHIFT = sizeof(VtxIdType) * CHAR_BIT / 2;
+    struct Record {VtxIdType lhs, rhs; FT dist;};
+    mio::mmap_source ms(fn);
+    const char *const b = ms.data(), *const e = b + ms.size();
+    auto chunks = fastparse::line_chunks(b, e, nchunks);
+    std::vector<std::vector<Record>> records(chunks.size());
+    OMP_PFOR_DYN
+    for(size_t i = 0; i < chunks.size(); ++i) {
+        const char *s = chunks[i].first, *const ce = chunks[i].second;
+        auto skip_field = [](const char *&q, const char *le) {
+            while(q < le && *q != ',') ++q;
+            q += q < le;
+        };
+        for(; s < ce; s = fastparse::next_line(s, ce)) {
+            const char *q = s, *le = fastparse::line_end(s, ce);
+            while(q < le && (*q == '"' || fastparse::ishspace(*q))) ++q;
+            if(q == le || !fastparse::isdig(*q)) continue; // comments and the column header
+            VtxIdType lhs = VtxIdType(fastparse::parse_uint(q, le)) << SHIFT;
+            skip_field(q, le);
+            lhs |= fastparse::parse_uint(q, le);
+            skip_field(q, le);
+            double dist = fastparse::parse_double(q, le);
+            skip_field(q, le);
+            VtxIdType rhs = VtxIdType(fastparse::parse_uint(q, le)) << SHIFT;
+            skip_field(q, le);
+            rhs |= fastparse::parse_uint(q, le);
+            records[i].push_back(Record{lhs, rhs, FT(dist)});
+        }
+    }
+    std::vector<Record> all;
+    fastparse::concatenate(records, all);
+    EdgeList<FT, IT> ret;
+    ret.edges_.resize(all.size());
+    ret.weights_.resize(all.size());
+    // Id assignment is inherently order-dependent, so it is the only serial pass.
+    shared::flat_hash_map<VtxIdType, IT> loc2id;
+    loc2id.reserve(all.size() / 4 + 16);
+    auto getid = [&](VtxIdType x) {
+        return loc2id.emplace(x, IT(loc2id.size())).first->second;
+    };
+    for(size_t i = 0; i < all.size(); ++i) {
+        IT lid = getid(all[i].lhs);
+        ret.edges_[i] = {lid, getid(all[i].rhs)};
+        ret.weights_[i] = all[i].dist;
+    }
+    ret.nnodes_ = loc2id.size();
+    return ret;
+}
+
+// Assigns the same random weight distribution as dimacs_parse, in edge-list order.
+template<typename FT, typename IT>
+void randomize_weights(EdgeList<FT, IT> &el) {
+    wy::WyRand<uint64_t, 2> gen(el.nnodes_);
+    for(auto &w: el.weights_) w = 1. / (double(gen()) / gen.max());
+}
+
+template<typename FT=float, typename IT=uint32_t>
+EdgeList<FT, IT> parse_edgelist_by_fn(const std::string &input) {
+    if(input.find(".csv") != std::string::npos)
+        return fast_nber_parse<FT, IT>(input);
+    if(input.find(".gr") != std::string::npos && input.find(".graph") == std::string::npos)
+        return fast_dimacs_official_parse<FT, IT>(input);
+    auto ret = fast_dimacs_unweighted_parse<FT, IT>(input);
+    randomize_weights(ret);
+    return ret;
+}
+
+inline std::string default_graph_cache_path(const std::string &input) {
+    return input + ".mcgc";
+}
+
+/*
+ * Loads the edge list from cache_path if it exists and was built from the current version of input;
+ * otherwise parses input and (re)writes the cache. Failure to write the cache is not fatal.
+ */
+template<typename FT=float, typename IT=uint32_t>
+EdgeList<FT, IT> cached_parse_edgelist(const std::string &input, std::string cache_path="") {
+    if(cache_path.empty()) cache_path = default_graph_cache_path(input);
+    const SourceKey key = SourceKey::from_file(input);
+    EdgeList<FT, IT> ret;
+    if(ret.read(cache_path, &key)) {
+        std::fprintf(stderr, "Loaded graph with %zu vertices and %zu edges from cache %s\n", ret.num_vertices(), ret.num_edges(), cache_path.data());
+        return ret;
+    }
+    ret = parse_edgelist_by_fn<FT, IT>(input);
+    try {
+        ret.write(cache_path, key);
+    } catch(const std::system_error &ex) {
+        std::fprintf(stderr, "Warning: failed to write graph cache to %s: %s\n", cache_path.data(), ex.what());
+    }
+    return ret;
+}
+
+} // namespace graph
+
+using graph::EdgeList;
+using graph::parse_edgelist_by_fn;
+using graph::cached_parse_edgelist;
+
+} // namespace minocore
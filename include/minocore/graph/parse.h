@@ -1,5 +1,6 @@
 #pragma once
 #include "graph.h"
+#include "fastparse.h"
 #include <fstream>
 #include <string>
 #include <climits>
@@ -168,14 +169,10 @@ static auto csv_parse(std::string fn) {
     return parse_nber<boost::undirectedS>(fn);
 }
 
-static minocore::Graph<undirectedS> parse_by_fn(std::string input) {
-    minocore::Graph<undirectedS> g;
-    if(input.find(".csv") != std::string::npos) {
-        g = csv_parse(input);
-    } else if(input.find(".gr") != std::string::npos && input.find(".graph") == std::string::npos) {
-        g = dimacs_official_parse(input);
-    } else g = dimacs_parse(input);
-    return g;
+// Uses the memory-mapped parallel loaders; if use_cache is set, a binary edge list is kept next to the input.
+static minocore::Graph<undirectedS> parse_by_fn(std::string input, bool use_cache=false) {
+    auto el = use_cache ? cached_parse_edgelist(input): parse_edgelist_by_fn(input);
+    return el.to_graph();
 }
 
 } // namespace graph
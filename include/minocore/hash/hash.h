@@ -360,6 +360,10 @@ public:
             for(auto &pair: tables_[i])
                 shared::sort(pair.second.begin(), pair.second.end());
     }
+    void clear() {
+        for(unsigned i = 0; i < l(); ++i) tables_[i].clear();
+        ids_used_ = 0;
+    }
     const LSHasherSettings &settings() const {return hasher_.settings();}
     auto k()   const {return settings().k_;}
     auto l()   const {return settings().l_;}
@@ -8,6 +8,7 @@
 
 // Discrete solvers
 #include <optim/graph_thorup.h>
+#include <optim/sparse_costs.h>
 #include <optim/oracle_thorup.h>
 #include <optim/jv_solver.h>
 #include <optim/jv.h>
@@ -2,6 +2,7 @@
 #define JV_SOLVER_H__
 #include "minocore/util/blaze_adaptor.h"
 #include "minocore/util/packed.h"
+#include "minocore/optim/sparse_costs.h"
 #include <chrono>
 #include <atomic>
 #include <mutex>
@@ -106,7 +107,11 @@ private:
     // Private members
     // Distance matrix: values are infinite for those missing (e.g., sparse)
     const MatrixType *distmatp_;
-    blaze::DynamicMatrix<FT> client_w_;  // W matrix: Willingness of each client to pay for each facility
+    static constexpr bool IS_CANDIDATE_COSTS = is_sparse_facility_costs_v<MatrixType>;
+    // W matrix: Willingness of each client to pay for each facility
+    // For SparseFacilityCosts, one entry per candidate pair, in the order of its facility-major arrays;
+    // other pairs never become tight, so their willingness is always 0.
+    std::conditional_t<IS_CANDIDATE_COSTS, std::vector<FT>, blaze::DynamicMatrix<FT>> client_w_;
     std::shared_ptr<edge_type[]> edges_; // list of all edges, sorted by cost (shared ptr so that it can be shared by multiple instances)
     std::vector<payment_t> client_v_;    // List of coverage by each facility
 
@@ -140,6 +145,40 @@ private:
 
     // Private code
 
+    FT getw(IT fid, IT cid) const {
+        if constexpr(IS_CANDIDATE_COSTS) {
+            const size_t pos = distmatp_->find(fid, cid);
+            return pos == MatrixType::npos ? FT(0): client_w_[pos];
+        } else return client_w_(fid, cid);
+    }
+    void setw(IT fid, IT cid, FT val) {
+        if constexpr(IS_CANDIDATE_COSTS) client_w_[distmatp_->find(fid, cid)] = val;
+        else client_w_(fid, cid) = val;
+    }
+    void resetw(const MatrixType &mat) {
+        if constexpr(IS_CANDIDATE_COSTS) client_w_.assign(mat.nonZeros(), FT(0));
+        else {
+            client_w_.resize(mat.rows(), mat.columns());
+            client_w_ = static_cast<FT>(0);
+        }
+    }
+    // Largest finite cost in mat
+    static double matrix_max(const MatrixType &mat) {
+        if constexpr(IS_CANDIDATE_COSTS) {
+            return mat.max_cost();
+        } else {
+            double ret = max(mat);
+            if(std::isinf(ret)) {
+                ret = 0.;
+                for(auto r: blz::rowiterator(mat))
+                    for(auto v: r)
+                        if(std::isfinite(v) && v > ret)
+                            ret = v;
+            }
+            return ret;
+        }
+    }
+
     FT final_phase1_loop(FT time) {
         while(!next_paid_.empty()) {
             if(next_paid_.top().first > 0) {
@@ -173,7 +212,7 @@ private:
                 if(open_client(open_fac) && fid != gfid) {
                     auto &fac_pay = pay_schedule_[fid];
                     if(fac_pay != PAID_IN_FULL) {
-                        if(client_w_(fid, cid) != PAID_IN_FULL) {
+                        if(getw(fid, cid) != PAID_IN_FULL) {
                             FT nclients_fid = working_open_facilities_[fid].size();
                             FT update_pay = nclients_fid * (cost - contribution_time_[fid]);
                             FT oldv = fac_pay;
@@ -245,19 +284,24 @@ private:
             IT cfid = temporarily_open.back();
             temporarily_open.pop_back();
             std::vector<IT> facility_assignment;
-            for(IT cid = 0; cid < ncities_; ++cid) {
+            // Only clients with an edge to cfid can have paid towards it; for SparseFacilityCosts, visit just those.
+            size_t nvisit = ncities_;
+            if constexpr(IS_CANDIDATE_COSTS) nvisit = distmat.row_span(cfid).size();
+            for(size_t ci = 0; ci < nvisit; ++ci) {
+                IT cid = ci;
+                if constexpr(IS_CANDIDATE_COSTS) cid = distmat.row_span(cfid).idx_[ci];
                 payment_t client_data = client_v_[cid];
                 IT witness = client_data.second; // WITNESS ME
-                FT witness_cost = client_data.first - client_w_(witness, cid) + distmat(witness, cid);
-                FT current_cost = client_data.first - client_w_(cfid, cid) + distmat(cfid, cid);
-                if(current_cost <= witness_cost && client_w_(cfid, cid) != PAID_IN_FULL) {
+                const FT cwc = getw(cfid, cid);
+                FT witness_cost = client_data.first - getw(witness, cid) + distmat(witness, cid);
+                FT current_cost = client_data.first - cwc + distmat(cfid, cid);
+                if(current_cost <= witness_cost && cwc != PAID_IN_FULL) {
                     unassigned_clients.erase(cid);
                     facility_assignment.push_back(cid);
                     std::vector<IT> facilities_to_rm;
-                    const FT cwc = client_w_(cfid, cid);
                     if(cwc > 0 && cwc != PAID_IN_FULL) {
                         for(const auto f2rm: temporarily_open) {
-                            FT c2c = client_w_(f2rm, cid);
+                            FT c2c = getw(f2rm, cid);
                             if(c2c > 0 && c2c != PAID_IN_FULL) {
                                 facilities_to_rm.push_back(f2rm);
                             }
@@ -285,8 +329,15 @@ private:
         if(early_terminate && early_terminate->load()) return;
         // Assign all unassigned
         if(open_facilities.empty()) {
-            blaze::DynamicVector<FT> fac_costs = blaze::sum<blaze::rowwise>(distmat);
-            open_facilities.push_back(std::min_element(fac_costs.begin(), fac_costs.end()) - fac_costs.begin());
+            if constexpr(IS_CANDIDATE_COSTS) {
+                blaze::DynamicVector<double> fac_costs(distmat.rows());
+                OMP_PFOR
+                for(size_t i = 0; i < fac_costs.size(); ++i) fac_costs[i] = distmat.facility_total(i);
+                open_facilities.push_back(std::min_element(fac_costs.begin(), fac_costs.end()) - fac_costs.begin());
+            } else {
+                blaze::DynamicVector<FT> fac_costs = blaze::sum<blaze::rowwise>(distmat);
+                open_facilities.push_back(std::min_element(fac_costs.begin(), fac_costs.end()) - fac_costs.begin());
+            }
         }
         for(const IT cid: unassigned_clients) {
             // cout << "Assigning client " << j << endl;
@@ -328,7 +379,7 @@ private:
         const bool open_cid = open_client(clients_cpy_[cid]);
         //std::fprintf(stderr, "open_cid? %d\n", open_cid);
         if(open_cid) {
-            client_w_(fid, cid) = cost;
+            setw(fid, cid, cost);
         }
 
         //
@@ -398,9 +449,8 @@ public:
     template<typename CostType>
     JVSolver(const this_type &o, const CostType &cost):
         distmatp_(o.distmatp_),
-        client_w_(o.client_w_.rows(), o.client_w_.columns()),
         edges_(o.edges_), // Note: this is copying a reference to the shared ptr of edges_.
-        client_v_(o.client_w_.columns(), payment_t{PAID_IN_FULL, EMPTY}),
+        client_v_(o.distmatp_->columns(), payment_t{PAID_IN_FULL, EMPTY}),
         clients_cpy_(o.distmatp_->columns(), std::vector<IT>()),
         working_open_facilities_(new std::vector<IT>[o.distmatp_->rows()]),
         contribution_time_(new FT[o.distmatp_->rows()]()),
@@ -410,7 +460,7 @@ public:
         ncities_(o.ncities_),
         nfac_(o.nfac_)
     {
-        client_w_ = FT(0);
+        resetw(*distmatp_);
         set_fac_cost(cost);
         pay_schedule_.resize(nfac_);
         next_paid_.clear();
@@ -429,13 +479,13 @@ public:
     JVSolver(const MatrixType &mat, const CostType &cost): JVSolver() {
         setup(mat, cost);
     }
-    JVSolver(const MatrixType &mat): JVSolver(mat, blaze::max(mat)) {
+    JVSolver(const MatrixType &mat): JVSolver(mat, matrix_max(mat)) {
     }
 
     template<typename CostType>
     void reset_cost(const CostType &cost) {
         set_fac_cost(cost);
-        client_w_ = static_cast<FT>(0);
+        resetw(*distmatp_);
         for(size_t i = 0; i < ncities_; ++i) clients_cpy_[i].clear();
             for(size_t i = 0; i < nfac_; ++i)
                 working_open_facilities_[i] = {EMPTY};
@@ -451,8 +501,6 @@ public:
         }
         assert(next_paid_.find({get_fac_cost(0), 0}) != next_paid_.end());
         assert(next_paid_.size() == pay_schedule_.size());
-        assert(client_w_.rows() == distmatp_->rows());
-        assert(client_w_.columns() == distmatp_->columns());
     }
 
     template<typename CostType>
@@ -466,15 +514,24 @@ public:
         set_fac_cost(cost);
 
         // Initialize W and edge vector
-        client_w_.resize(mat.rows(), mat.columns());
-        client_w_ = static_cast<FT>(0);
-        const size_t edges_to_use = blaze::IsDenseMatrix_v<MatrixType> ? mat.rows() * mat.columns(): blaze::nonZeros(mat);
+        resetw(mat);
+        size_t edges_to_use;
+        if constexpr(IS_CANDIDATE_COSTS) edges_to_use = mat.nonZeros();
+        else edges_to_use = blaze::IsDenseMatrix_v<MatrixType> ? mat.rows() * mat.columns(): blaze::nonZeros(mat);
         if(nedges_ != edges_to_use) {
             edges_.reset(new edge_type[edges_to_use]);
         }
         nedges_ = edges_to_use;
         // Set edge values, then sort by cost
-        if constexpr(blaze::IsDenseMatrix_v<MatrixType>) {
+        if constexpr(IS_CANDIDATE_COSTS) {
+            OMP_PFOR
+            for(size_t i = 0; i < mat.rows(); ++i) {
+                const auto span = mat.row_span(i);
+                edge_type *const eptr = &edges_[mat.row_offset(i)];
+                for(size_t j = 0; j < span.size(); ++j)
+                    eptr[j] = {span.val_[j], i, span.idx_[j]};
+            }
+        } else if constexpr(blaze::IsDenseMatrix_v<MatrixType>) {
             OMP_PFOR
             for(size_t i = 0; i < mat.rows(); ++i) {
                 const size_t nc = mat.columns();
@@ -603,7 +660,7 @@ public:
 
     template<typename VT, bool TF>
     void set_fac_cost(const blaze::Vector<VT, TF> &val) {
-        if((~val).size() != client_w_.rows()) throw std::invalid_argument("Val has wrong number of rows");
+        if((~val).size() != distmatp_->rows()) throw std::invalid_argument("Val has wrong number of rows");
         facility_cost_.resize((~val).size());
         facility_cost_ = (~val);
     }
@@ -613,7 +670,7 @@ public:
         facility_cost_[0] = val;
     }
     size_t nedges() const {
-        return client_w_.rows() * client_w_.columns();
+        return nedges_;
     }
     FT calculate_cost(bool including_costs=true) {
         FT sum = 0.;
@@ -722,17 +779,8 @@ public:
             return kmedian(k, maxrounds, maxcost, mincost);
         std::vector<this_type> solvers;
         auto &dm = *distmatp_;
-        if(maxcost == 0.) {
-            maxcost = max(dm);
-            if(std::isinf(maxcost)) {
-                maxcost = 0.;
-                for(auto r: blz::rowiterator(dm))
-                    for(auto v: r)
-                        if(std::isfinite(v) && v > maxcost)
-                            maxcost = v;
-            }
-            maxcost *= dm.columns();
-        }
+        if(maxcost == 0.)
+            maxcost = matrix_max(dm) * dm.columns();
         std::unique_ptr<double[]> assigned_costs(new double[num_threads]);
         if(mincost == 0) {
             while(solvers.size() < size_t(num_threads)) {
@@ -809,27 +857,20 @@ public:
                                  ret.first.size(), rounds_completed.load(), (fstop - fstart).count() * 1.e-6);
         return ret;
     }
+    // If early_terminate is set during the search, returns empty vectors.
     std::pair<std::vector<IT>, std::vector<std::vector<IT>>>
-    kmedian(unsigned k, unsigned maxrounds=100, double maxcost=0., double mincost=0.)
+    kmedian(unsigned k, unsigned maxrounds=100, double maxcost=0., double mincost=0., std::atomic<int> *early_terminate=nullptr)
     {
         auto kmed_start = std::chrono::high_resolution_clock::now();
         auto &dm = *distmatp_;
-        if(maxcost == 0.) {
-            maxcost = max(dm);
-            if(std::isinf(maxcost)) {
-                maxcost = 0.;
-                for(auto r: blz::rowiterator(dm))
-                    for(auto v: r)
-                        if(std::isfinite(v) && v > maxcost)
-                            maxcost = v;
-            }
-            maxcost *= dm.columns();
-        }
+        if(maxcost == 0.)
+            maxcost = matrix_max(dm) * dm.columns();
         double medcost = (maxcost - mincost) / (dm.columns()) + mincost;
         if(verbose) std::fprintf(stderr, "First iteration, medcost = %0.12g, mincost = %0.12g, maxcost = %0.12g\n", medcost, mincost, maxcost);
         auto fstart = std::chrono::high_resolution_clock::now();
         reset_cost(medcost);
-        run();
+        run(early_terminate);
+        if(early_terminate && early_terminate->load()) return {};
         auto fstop = std::chrono::high_resolution_clock::now();
         if(verbose) std::fprintf(stderr, "[V|%s:%d:%s] first solution for cost %0.12g took %0.6gms and had %zu facilities (want k %u)\n",
                                  __PRETTY_FUNCTION__, __LINE__, __FILE__, medcost, (fstop - fstart).count() *1.e-6, final_open_facilities_.size(), k);
@@ -865,7 +906,8 @@ public:
             }
             fstart = std::chrono::high_resolution_clock::now();
             reset_cost(medcost);
-            run();
+            run(early_terminate);
+            if(early_terminate && early_terminate->load()) return {};
             fstop = std::chrono::high_resolution_clock::now();
             if(verbose) std::fprintf(stderr, "[Round %zu] Facility cost: %0.12g. Size: %zu. Time in ms: %g. \n",
                                      roundnum, medcost, final_open_facilities_.size(), (fstop - fstart).count() * 0.000001);
@@ -890,26 +932,48 @@ public:
                      (kmed_stop - kmed_start).count() * 1.e-6);
         return std::make_pair(final_open_facilities_, final_open_facility_assignments_);
     }
+    blaze::DynamicVector<FT, blaze::rowVector> open_facility_costs() const {
+        if constexpr(IS_CANDIDATE_COSTS) {
+            // Non-candidates cost the client's fallback, which bounds every candidate cost from above
+            blaze::DynamicVector<FT, blaze::rowVector> ret(ncities_);
+            for(size_t i = 0; i < ncities_; ++i) ret[i] = distmatp_->fallback(i);
+            for(const auto fid: final_open_facilities_) {
+                const auto span = distmatp_->row_span(fid);
+                for(size_t j = 0; j < span.size(); ++j)
+                    ret[span.idx_[j]] = std::min(ret[span.idx_[j]], span.val_[j]);
+            }
+            return ret;
+        } else {
+            return blaze::min<blaze::columnwise>(blaze::rows(*distmatp_, final_open_facilities_.data(), final_open_facilities_.size()));
+        }
+    }
     IT local_best_to_add() const {
-        blaze::DynamicVector<FT,blaze::rowVector> current_costs = blaze::min<blaze::columnwise>(blaze::rows(*distmatp_, final_open_facilities_.data(), final_open_facilities_.size()));
+        blaze::DynamicVector<FT,blaze::rowVector> current_costs = open_facility_costs();
         FT max_improvement = -std::numeric_limits<FT>::max();
         IT bestind = -1;
         for(size_t i = 0; i < nfac_; ++i) {
             if(std::find(final_open_facilities_.begin(), final_open_facilities_.end(), i) !=  final_open_facilities_.end())
                 continue;
             FT improvement = 0.;
-            auto lrow = row(*distmatp_, i);
-            for(size_t j = 0; j < lrow.size(); ++j) {
-                FT cost = lrow[j];
-                if(cost < current_costs[j])
-                    improvement += (current_costs[j] - cost);
+            if constexpr(IS_CANDIDATE_COSTS) {
+                const auto span = distmatp_->row_span(i);
+                for(size_t j = 0; j < span.size(); ++j)
+                    if(span.val_[j] < current_costs[span.idx_[j]])
+                        improvement += current_costs[span.idx_[j]] - span.val_[j];
+            } else {
+                auto lrow = row(*distmatp_, i);
+                for(size_t j = 0; j < lrow.size(); ++j) {
+                    FT cost = lrow[j];
+                    if(cost < current_costs[j])
+                        improvement += (current_costs[j] - cost);
+                }
             }
             if(improvement > max_improvement) improvement = max_improvement, bestind = i;
         }
         return bestind;
     }
     IT local_best_to_rm() const {
-        blaze::DynamicVector<FT, blaze::rowVector> current_costs = blaze::min<blaze::columnwise>(blaze::rows(*distmatp_, final_open_facilities_.data(), final_open_facilities_.size()));
+        blaze::DynamicVector<FT, blaze::rowVector> current_costs = open_facility_costs();
         FT min_loss = std::numeric_limits<FT>::max();
         IT bestind = -1;
         std::unique_ptr<IT[]> min_counters(new IT[ncities_]());
@@ -7,6 +7,7 @@
 #include "minocore/coreset/matrix_coreset.h"
 #include "minocore/util/oracle.h"
 #include "minocore/util/timer.h"
+#include "minocore/util/metrics.h"
 #include "minocore/util/div.h"
 #include "minocore/util/blaze_adaptor.h"
 
@@ -346,7 +347,8 @@ double lloyd_iteration(std::vector<IT> &assignments, std::vector<WFT> &counts,
         assignments[i] = label;
         total_loss += getw(i) * dist;
     }
-    std::fprintf(stderr, "total loss: %g\n", total_loss);
+    VERBOSE_ONLY(std::fprintf(stderr, "total loss: %g\n", total_loss);)
+    METRICS_COUNT(LLOYD_ITERATIONS, 1);
     if(std::isnan(total_loss)) total_loss = std::numeric_limits<decltype(total_loss)>::infinity();
     return total_loss;
 }
@@ -364,14 +366,14 @@ double lloyd_loop(std::vector<IT> &assignments, std::vector<WFT> &counts,
     size_t iternum = 0;
     double oldloss = std::numeric_limits<double>::max(), newloss;
     for(;;) {
-        std::fprintf(stderr, "Starting iter %zu\n", iternum);
+        VERBOSE_ONLY(std::fprintf(stderr, "Starting iter %zu\n", iternum);)
         newloss = lloyd_iteration(assignments, counts, centers, data, func, weights, use_moving_average);
         double change_in_cost = std::abs(oldloss - newloss) / std::min(oldloss, newloss);
         if(iternum++ == maxiter || change_in_cost <= tolerance) {
             std::fprintf(stderr, "Change in cost from %g to %g is %g\n", oldloss, newloss, change_in_cost);
             break;
         }
-        std::fprintf(stderr, "new loss at %zu: %0.30g. old loss: %0.30g\n", iternum, newloss, oldloss);
+        VERBOSE_ONLY(std::fprintf(stderr, "new loss at %zu: %0.30g. old loss: %0.30g\n", iternum, newloss, oldloss);)
         oldloss = newloss;
     }
     std::fprintf(stderr, "Completed with final loss of %0.30g after %zu rounds\n", newloss, iternum);
@@ -446,7 +448,7 @@ double mb_lloyd_loop(std::vector<IT> &assignments, std::vector<WFT> &counts,
     wy::WyRand<IT, 4> rng(seed);
     size_t iternum = 0;
     while(iternum++ < maxiter) {
-        std::fprintf(stderr, "Starting minibatch iter %zu\n", iternum);
+        VERBOSE_ONLY(std::fprintf(stderr, "Starting minibatch iter %zu\n", iternum);)
         minibatch_lloyd_iteration(assignments, counts, centers, data, batch_size, rng, selection, func, weights);
     }
     double loss = 0.;
@@ -517,6 +519,89 @@ auto kmeans_matrix_coreset(const blaze::Matrix<MT, SO> &mat, size_t k, RNG &rng,
     return index2matrix(ics, ~mat);
 }
 
+/*
+ * Chunked (out-of-core) drivers.
+ * Source is any row-chunk source exposing for_each(func), calling func(start_row, chunk) in row order,
+ * such as hdf5::DenseRowReader/SparseRowReader in minocore/util/hdf5.h.
+ */
+
+/*
+ * One minibatch k-means step (Sculley, 2010), using an entire chunk as the batch.
+ * Centers have per-center learning rates of w / counts[label]; rows are grouped by
+ * assigned center so that each center is updated by one thread, in row order,
+ * which keeps results independent of the number of threads.
+ * Returns the chunk's (weighted) cost against the centers before the update.
+ */
+template<typename IT=uint32_t, typename MatrixType, typename CMatrixType, typename WFT=double, typename Functor=blz::sqrL2Norm>
+double minibatch_lloyd_chunk(std::vector<WFT> &counts, CMatrixType &centers, const MatrixType &chunk,
+                             const Functor &func=Functor(), const WFT *weights=nullptr)
+{
+    const size_t n = chunk.rows(), k = centers.rows();
+    assert(counts.size() == k);
+    std::unique_ptr<IT[]> labels(new IT[n]);
+    double loss = 0.;
+    OMP_PRAGMA("omp parallel for reduction(+:loss)")
+    for(size_t i = 0; i < n; ++i) {
+        const auto dr = row(chunk, i BLAZE_CHECK_DEBUG);
+        double dist = blz::serial(func(dr, row(centers, 0 BLAZE_CHECK_DEBUG))), newdist;
+        IT label = 0;
+        for(unsigned j = 1; j < k; ++j)
+            if((newdist = blz::serial(func(dr, row(centers, j BLAZE_CHECK_DEBUG)))) < dist)
+                dist = newdist, label = j;
+        labels[i] = label;
+        loss += (weights ? weights[i]: WFT(1)) * dist;
+    }
+    std::vector<size_t> offsets(k + 1), order(n);
+    for(size_t i = 0; i < n; ++i) ++offsets[labels[i] + 1];
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    {
+        std::vector<size_t> pos(offsets.begin(), offsets.end() - 1);
+        for(size_t i = 0; i < n; ++i) order[pos[labels[i]]++] = i;
+    }
+    OMP_PFOR_DYN
+    for(size_t j = 0; j < k; ++j) {
+        auto crow = row(centers, j BLAZE_CHECK_DEBUG);
+        for(size_t o = offsets[j]; o < offsets[j + 1]; ++o) {
+            const size_t i = order[o];
+            const WFT w = weights ? weights[i]: WFT(1);
+            counts[j] += w;
+            const double eta = w / counts[j];
+            crow = blz::serial((1. - eta) * crow + eta * row(chunk, i BLAZE_CHECK_DEBUG));
+        }
+    }
+    return loss;
+}
+
+/*
+ * Minibatch k-means over a chunked source, making npasses passes over the data.
+ * If centers does not already have k rows, it is seeded by k-means++ on the first chunk.
+ * Returns the cost accumulated over the final pass, which is an upper bound estimate
+ * since centers move during the pass.
+ */
+template<typename Source, typename CMatrixType, typename WFT=double, typename Functor=blz::sqrL2Norm>
+double stream_minibatch_kmeans(const Source &source, CMatrixType &centers, std::vector<WFT> &counts,
+                               size_t k, size_t npasses=1, uint64_t seed=137,
+                               const Functor &func=Functor(), const WFT *weights=nullptr)
+{
+    wy::WyRand<uint64_t, 2> rng(seed);
+    if(centers.rows() != k) counts.clear();
+    counts.resize(k);
+    double loss = 0.;
+    for(size_t pass = 0; pass < npasses; ++pass) {
+        loss = 0.;
+        source.for_each([&](size_t start, const auto &chunk) {
+            if(centers.rows() != k) {
+                if(chunk.rows() < k) throw std::runtime_error("First chunk has fewer rows than k; cannot seed centers");
+                auto [idx, asn, costs] = kmeanspp(chunk, rng, k, func);
+                centers = rows(chunk, idx.data(), idx.size());
+            }
+            loss += minibatch_lloyd_chunk(counts, centers, chunk, func, weights ? weights + start: weights);
+        });
+        VERBOSE_ONLY(std::fprintf(stderr, "Streaming minibatch pass %zu/%zu: loss %0.12g\n", pass + 1, npasses, loss);)
+    }
+    return loss;
+}
+
 // TODO: 1. get run kmeans clustering on MatrixCoreset
 //       2. Use this for better coreset construction (since coreset size is dependent on the approximation ratio)
 //       3. Generate new solution
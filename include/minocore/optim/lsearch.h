@@ -4,6 +4,8 @@
 #include "diskmat/diskmat.h"
 #include "minocore/util/oracle.h"
 #include "minocore/optim/kcenter.h"
+#include "minocore/optim/sparse_costs.h"
+#include "minocore/optim/portfolio.h"
 #include "pdqsort/pdqsort.h"
 #include "discreture/include/discreture.hpp"
 #include <atomic>
@@ -73,6 +75,10 @@ struct LocalKMedSearcher {
     uint32_t max_swap_n_:16;
     // if(max_swap_n_ > 1), after exhaustive single-swap optimization, enables multiswap search.
     // TODO: enable searches for multiswaps.
+    // If set, the cost is shared after each swap, and the search stops when the portfolio says so.
+    RestartPortfolio *portfolio_ = nullptr;
+    bool abandoned_ = false;
+    double lower_bound_ = -1.; // all_open_cost(), shared by the portfolio
 
     // Constructors
 
@@ -303,6 +309,39 @@ struct LocalKMedSearcher {
     auto k() const {
         return k_;
     }
+    // Cost with every facility open, a lower bound on the cost of any solution
+    double all_open_cost() const {
+        decltype(current_costs_) mins = row(mat_, 0);
+        for(size_t i = 1; i < nr_; ++i) mins = blaze::min(mins, row(mat_, i BLAZE_CHECK_DEBUG));
+        return blaze::sum(mins);
+    }
+    // Largest decrease in cost from opening one more facility, which bounds the gain of any swap
+    double max_add_gain() const {
+        double ret = 0.;
+        OMP_PRAGMA("omp parallel for reduction(max:ret)")
+        for(size_t i = 0; i < nr_; ++i) {
+            if(sol_.find(IType(i)) != sol_.end()) continue;
+            auto r = row(mat_, i BLAZE_CHECK_DEBUG);
+            double gain = 0.;
+            for(size_t j = 0; j < nc_; ++j) gain += std::max(double(current_costs_[j]) - r[j], 0.);
+            ret = std::max(ret, gain);
+        }
+        return ret;
+    }
+    /*
+     * Returns true if the portfolio stops this search after step swaps.
+     * The lower bound on this search's final cost is its current cost if it cannot improve,
+     * that is, if no swap gains more than diffthresh_ (checked once, before the first swap, as it costs a pass over mat_),
+     * and otherwise the all-open cost, computed once for the whole portfolio.
+     */
+    bool portfolio_stop(size_t step) {
+        if(!portfolio_) return false;
+        if(lower_bound_ < 0.) lower_bound_ = portfolio_->shared_lower_bound([this]() {return all_open_cost();});
+        const bool converged = current_cost_ - diffthresh_ <= lower_bound_ || (!step && max_add_gain() <= diffthresh_);
+        const int rc = portfolio_->update(current_cost_, step, converged ? current_cost_: lower_bound_);
+        abandoned_ = rc == 2;
+        return rc;
+    }
 
     void run_lazy() {
 #if 0
@@ -344,6 +383,8 @@ struct LocalKMedSearcher {
                     }
                 }
                 assert(sol_.size() == k_);
+                METRICS_COUNT(SWAPS_EVALUATED, 1);
+                METRICS_ONLY(if(val <= diffthresh_) METRICS_COUNT(SWAPS_PRUNED, 1);)
                 // Only calculate exhaustively if the lazy form returns yes.
                 if(val > diffthresh_ && (val = evaluate_swap(potential_index, oldcenter)) > diffthresh_) {
                     assert(sol_.size() == k_);
@@ -353,7 +394,9 @@ struct LocalKMedSearcher {
                     assign();
                     //current_cost_ = blaze::sum(current_costs_);
                     ++total;
-                    std::fprintf(stderr, "Swap number %zu updated with delta %.12g to new cost with cost %0.12g\n", total, val, current_cost_);
+                    METRICS_COUNT(SWAPS_ACCEPTED, 1);
+                    VERBOSE_ONLY(std::fprintf(stderr, "Swap number %zu updated with delta %.12g to new cost with cost %0.12g\n", total, val, current_cost_);)
+                    if(portfolio_stop(total)) return;
                     goto next;
                 }
             }
@@ -396,9 +439,10 @@ struct LocalKMedSearcher {
         const double diffthresh = initial_cost_ / k_ * eps_;
         diffthresh_ = diffthresh;
         if(mat_.rows() <= k_) return;
+        if(portfolio_stop(0)) return;
         if(lazy_eval_) {
             run_lazy();
-            if(lazy_eval_ > 1)
+            if(lazy_eval_ > 1 || abandoned_ || (portfolio_ && portfolio_->terminated()))
                 return;
         }
         //const double diffthresh = 0.;
@@ -414,6 +458,7 @@ struct LocalKMedSearcher {
             for(size_t pi = 0; pi < nr_; ++pi) {
                 size_t potential_index = ordering_[pi];
                 if(sol_.find(potential_index) != sol_.end()) continue;
+                METRICS_COUNT(SWAPS_EVALUATED, 1);
                 if(const auto val = evaluate_swap(potential_index, oldcenter, true);
                    val > diffthresh) {
 #ifndef NDEBUG
@@ -423,7 +468,9 @@ struct LocalKMedSearcher {
                     sol_.insert(potential_index);
                     ++total;
                     current_cost_ -= val;
-                    std::fprintf(stderr, "Swap number %zu with cost %0.12g\n", total, current_cost_);
+                    METRICS_COUNT(SWAPS_ACCEPTED, 1);
+                    VERBOSE_ONLY(std::fprintf(stderr, "Swap number %zu with cost %0.12g\n", total, current_cost_);)
+                    if(portfolio_stop(total)) return;
                     goto next;
                 }
             }
@@ -472,6 +519,193 @@ struct LocalKMedSearcher {
     }
 };
 
+/*
+ * Local search over candidate-restricted costs.
+ * Each client's cost is its cheapest candidate in the solution, or its fallback if it has none.
+ * A swap only changes the costs of clients assigned to the removed center, which are re-scanned
+ * over their candidates, and of the added center's candidates, so evaluating a swap costs
+ * O(m * |cluster| + |candidates of the new center|) rather than O(n * k).
+ */
+template<typename FT, typename CIT, typename IType>
+struct LocalKMedSearcher<SparseFacilityCosts<FT, CIT>, IType> {
+    using MatType = SparseFacilityCosts<FT, CIT>;
+    using value_type = FT;
+    static constexpr IType EMPTY = std::numeric_limits<IType>::max(); // Assignment for clients served by their fallback
+
+    const MatType &mat_;
+    shared::flat_hash_set<IType> sol_;
+    blaze::DynamicVector<IType> assignments_;
+    blaze::DynamicVector<FT, blaze::rowVector> current_costs_;
+    double current_cost_;
+    double eps_, initial_cost_, init_cost_div_;
+    IType k_;
+    const size_t nr_, nc_;
+    double diffthresh_;
+    blaze::DynamicVector<IType> ordering_;
+    std::vector<uint8_t> insol_;
+    std::vector<std::vector<IType>> members_; // Clients assigned to each facility
+    uint32_t shuffle_:1;
+    uint32_t lazy_eval_:15; // Unused: candidate swaps are always evaluated exactly
+    uint32_t max_swap_n_:16;
+    RestartPortfolio *portfolio_ = nullptr;
+    bool abandoned_ = false;
+    double lower_bound_ = -1.; // all_open_cost(), shared by the portfolio
+
+    template<typename IndexContainer=std::vector<uint32_t>>
+    LocalKMedSearcher(const MatType &mat, unsigned k, double eps=1e-8, uint64_t seed=0,
+                      const IndexContainer * =nullptr, double initdiv=0.):
+        mat_(mat), assignments_(mat.columns(), EMPTY),
+        current_cost_(std::numeric_limits<value_type>::max()),
+        eps_(eps), k_(k), nr_(mat.rows()), nc_(mat.columns()),
+        ordering_(mat.rows()), insol_(mat.rows()), members_(mat.rows()),
+        shuffle_(true), lazy_eval_(2), max_swap_n_(1)
+    {
+        std::iota(ordering_.begin(), ordering_.end(), 0);
+        init_cost_div_ = initdiv ? initdiv: double(mat.columns());
+        reseed(seed);
+    }
+    template<typename It>
+    void assign_centers(It start, It end) {
+        sol_.clear();
+        sol_.insert(start, end);
+    }
+    template<typename IndexContainer=std::vector<uint32_t>>
+    void reseed(uint64_t seed, bool=false, const IndexContainer * =nullptr) {
+        current_cost_ = std::numeric_limits<value_type>::max();
+        wy::WyRand<IType, 2> rng(seed);
+        sol_.clear();
+        if(nr_ <= k_) {
+            for(unsigned i = 0; i < nr_; ++i) sol_.insert(i);
+        } else {
+            while(sol_.size() < k_) sol_.insert(rng() % nr_);
+        }
+    }
+    auto k() const {return k_;}
+    // Cost with every facility open: each client's cheapest candidate, as no other facility is cheaper
+    double all_open_cost() const {
+        double ret = 0.;
+        OMP_PRAGMA("omp parallel for reduction(+:ret)")
+        for(size_t c = 0; c < nc_; ++c) {
+            const auto span = mat_.column_span(c);
+            ret += span.size() ? span.val_[0]: mat_.fallback(c);
+        }
+        return ret;
+    }
+    // Only a facility's candidates can be served more cheaply by it, as clients never cost more than their fallback
+    double max_add_gain() const {
+        double ret = 0.;
+        OMP_PRAGMA("omp parallel for reduction(max:ret)")
+        for(size_t f = 0; f < nr_; ++f) {
+            if(insol_[f]) continue;
+            const auto span = mat_.row_span(f);
+            double gain = 0.;
+            for(size_t i = 0; i < span.size(); ++i)
+                gain += std::max(double(current_costs_[span.idx_[i]]) - span.val_[i], 0.);
+            ret = std::max(ret, gain);
+        }
+        return ret;
+    }
+    // As in the dense searcher
+    bool portfolio_stop(size_t step) {
+        if(!portfolio_) return false;
+        if(lower_bound_ < 0.) lower_bound_ = portfolio_->shared_lower_bound([this]() {return all_open_cost();});
+        const bool converged = current_cost_ - diffthresh_ <= lower_bound_ || (!step && max_add_gain() <= diffthresh_);
+        const int rc = portfolio_->update(current_cost_, step, converged ? current_cost_: lower_bound_);
+        abandoned_ = rc == 2;
+        return rc;
+    }
+
+    // Cheapest candidate of client c in the solution, skipping facility skip, and its facility
+    std::pair<FT, IType> best_for_client(size_t c, IType skip=EMPTY) const {
+        const auto span = mat_.column_span(c);
+        for(size_t i = 0; i < span.size(); ++i) // Sorted by cost, so the first open candidate is the best
+            if(const IType f = span.idx_[i]; f != skip && insol_[f])
+                return {span.val_[i], f};
+        return {mat_.fallback(c), EMPTY};
+    }
+    void assign() {
+        std::fill(insol_.begin(), insol_.end(), uint8_t(0));
+        for(const auto f: sol_) insol_[f] = 1;
+        current_costs_.resize(nc_);
+        OMP_PFOR
+        for(size_t c = 0; c < nc_; ++c)
+            std::tie(current_costs_[c], assignments_[c]) = best_for_client(c);
+        for(auto &m: members_) m.clear();
+        for(size_t c = 0; c < nc_; ++c)
+            if(assignments_[c] != EMPTY) members_[assignments_[c]].push_back(c);
+        current_cost_ = blaze::sum(current_costs_);
+        initial_cost_ = current_cost_ / 2 / init_cost_div_;
+    }
+    // Improvement in cost from replacing oldcenter with newcenter
+    double evaluate_swap(IType newcenter, IType oldcenter, bool=false) const {
+        double diff = 0.;
+        for(const auto c: members_[oldcenter]) {
+            const auto span = mat_.column_span(c);
+            FT best = mat_.fallback(c);
+            for(size_t i = 0; i < span.size(); ++i) {
+                const IType f = span.idx_[i];
+                if(f == newcenter || (f != oldcenter && insol_[f])) {
+                    best = span.val_[i];
+                    break;
+                }
+            }
+            diff += current_costs_[c] - best;
+        }
+        const auto span = mat_.row_span(newcenter);
+        for(size_t i = 0; i < span.size(); ++i) {
+            const auto c = span.idx_[i];
+            if(assignments_[c] != oldcenter && span.val_[i] < current_costs_[c])
+                diff += current_costs_[c] - span.val_[i];
+        }
+        return diff;
+    }
+    template<typename Container>
+    double cost_for_sol(const Container &c) const {
+        std::vector<uint8_t> in(nr_);
+        for(const auto f: c) in[f] = 1;
+        double ret = 0.;
+        OMP_PRAGMA("omp parallel for reduction(+:ret)")
+        for(size_t ci = 0; ci < nc_; ++ci) {
+            const auto span = mat_.column_span(ci);
+            FT best = mat_.fallback(ci);
+            for(size_t i = 0; i < span.size(); ++i)
+                if(in[span.idx_[i]]) {best = span.val_[i]; break;}
+            ret += best;
+        }
+        return ret;
+    }
+    void run() {
+        assign();
+        diffthresh_ = initial_cost_ / k_ * eps_;
+        if(nr_ <= k_ || portfolio_stop(0)) return;
+        size_t total = 0;
+        next:
+        for(const auto oldcenter: sol_) {
+            if(shuffle_) {
+                wy::WyRand<uint64_t, 2> rng(total);
+                std::shuffle(ordering_.begin(), ordering_.end(), rng);
+            }
+            for(size_t pi = 0; pi < nr_; ++pi) {
+                const IType potential_index = ordering_[pi];
+                if(insol_[potential_index]) continue;
+                METRICS_COUNT(SWAPS_EVALUATED, 1);
+                if(const double val = evaluate_swap(potential_index, oldcenter); val > diffthresh_) {
+                    sol_.erase(oldcenter);
+                    sol_.insert(potential_index);
+                    assign();
+                    ++total;
+                    METRICS_COUNT(SWAPS_ACCEPTED, 1);
+                    VERBOSE_ONLY(std::fprintf(stderr, "Swap number %zu updated with delta %.12g to new cost with cost %0.12g\n", total, val, current_cost_);)
+                    if(portfolio_stop(total)) return;
+                    goto next;
+                }
+            }
+        }
+        std::fprintf(stderr, "Finished in %zu swaps by exhausting all potential improvements. Final cost: %f\n",
+                     total, current_cost_);
+    }
+};
+
 template<typename Mat, typename IType=std::uint32_t, typename IndexContainer=std::vector<uint32_t>>
 auto make_kmed_lsearcher(const Mat &mat, unsigned k, double eps=0.01, uint64_t seed=0,
                          const IndexContainer *wc=nullptr, double initdiv=0.) {
@@ -19,6 +19,8 @@ namespace thorup {
  *  2. Use the selected points F as the new set of points (``npoints''), with weight = |C_f| (number of cities assigned to facility f)
  *  3. Wrap the previous oracle in another oracle that maps indices within F to the original data
  *  4. Performing the next iteration
+ *
+ * If cstats is provided, the hits and misses of a caching oracle (see cache_stats) during this call are added to it.
  */
 template<typename Oracle,
          typename FT=std::decay_t<decltype(std::declval<Oracle>()(0,0))>,
@@ -26,8 +28,10 @@ template<typename Oracle,
          typename IT=uint32_t
         >
 std::tuple<std::vector<IT>, blaze::DynamicVector<FT>, std::vector<IT>>
-oracle_thorup_d(const Oracle &oracle, size_t npoints, unsigned k, const WFT *weights=static_cast<const WFT *>(nullptr), double npermult=21, double nroundmult=3, double eps=0.5, uint64_t seed=1337)
+oracle_thorup_d(const Oracle &oracle, size_t npoints, unsigned k, const WFT *weights=static_cast<const WFT *>(nullptr), double npermult=21, double nroundmult=3, double eps=0.5, uint64_t seed=1337,
+                CacheStats *cstats=nullptr)
 {
+    const CacheStats start_stats = cache_stats(oracle);
     const FT total_weight = weights ? static_cast<FT>(blaze::sum(blaze::CustomVector<WFT, blaze::unaligned, blaze::unpadded>((WFT *)weights, npoints)))
                                     : static_cast<FT>(npoints);
     size_t nperround = npermult * k * std::log(total_weight) / eps;
@@ -165,6 +169,7 @@ oracle_thorup_d(const Oracle &oracle, size_t npoints, unsigned k, const WFT *wei
     }
     std::fprintf(stderr, "[LINE %d] Returning solution with mincosts [%zu] and minindices [%zu] with F of size %zu/%zu and final total cost %g for weight %g.\n", __LINE__, mincosts.size(), minindices.size(), F.size(), npoints, final_total_cost, total_weight);
 #endif
+    if(cstats) *cstats += cache_stats(oracle) - start_stats;
 #if 0
     for(size_t i = 0; i < mincosts.size(); ++i) {
         std::fprintf(stderr, "ID %zu has %g as mincost and %u as minind\n", i, mincosts[i], minindices[i]);
@@ -177,6 +182,9 @@ oracle_thorup_d(const Oracle &oracle, size_t npoints, unsigned k, const WFT *wei
  * Note: iterated_oracle_thorup_d uses the cost *according to the weighted data* from previous iterations,
  * not the cost of the current solution against the original data when selecting which
  * sub-iteration to pursue. This might be change in future iterations.
+ *
+ * Sub-iterations share the oracle, so a caching oracle's counters are only read before and after
+ * the whole call; its hits and misses are added to cstats if provided.
  */
 
 template<typename Oracle,
@@ -186,8 +194,10 @@ template<typename Oracle,
         >
 std::tuple<std::vector<IT>, blaze::DynamicVector<FT>, std::vector<IT>>
 iterated_oracle_thorup_d(const Oracle &oracle, size_t npoints, unsigned k, unsigned num_iter=3, unsigned num_sub_iter=8,
-                         const WFT *weights=static_cast<const WFT *>(nullptr), double npermult=21, double nroundmult=3, double eps=0.5, uint64_t seed=1337)
+                         const WFT *weights=static_cast<const WFT *>(nullptr), double npermult=21, double nroundmult=3, double eps=0.5, uint64_t seed=1337,
+                         CacheStats *cstats=nullptr)
 {
+    const CacheStats start_stats = cache_stats(oracle);
     auto getw = [weights](size_t index) {
         return weights ? weights[index]: static_cast<WFT>(1.);
     };
@@ -324,6 +334,13 @@ iterated_oracle_thorup_d(const Oracle &oracle, size_t npoints, unsigned k, unsig
         std::tie(centers, center_weights, bestindices)
             = std::tie(sub_centers, sub_center_weights, sub_bestindices);
     }
+    const CacheStats run_stats = cache_stats(oracle) - start_stats;
+#if VERBOSE_AF
+    if(run_stats.lookups())
+        std::fprintf(stderr, "Oracle cache: %zu hits, %zu misses (%0.4g%% hit rate), %zu evictions\n",
+                     size_t(run_stats.hits_), size_t(run_stats.misses_), run_stats.hit_rate() * 100., size_t(run_stats.evictions_));
+#endif
+    if(cstats) *cstats += run_stats;
     return {std::move(centers), std::move(costs), std::move(bestindices)};
 }
 
@@ -0,0 +1,141 @@
+#pragma once
+#ifndef FGC_RESTART_PORTFOLIO_H__
+#define FGC_RESTART_PORTFOLIO_H__
+#include "minocore/util/macros.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace minocore {
+
+/*
+ * Shared state for a portfolio of restarts run concurrently (see run_portfolio).
+ *
+ * Restarts offer the cost of the solution they currently hold. LocalKMedSearcher and
+ * perform_lloyd_loop only ever lower their cost, so every offered cost is achievable, and best()
+ * is an upper bound on the final cost of the portfolio.
+ * A restart stops when:
+ * 1. a lower bound on its final cost exceeds best(); it is abandoned, as it cannot win or tie, or
+ * 2. that lower bound has reached its cost, so it cannot improve; it keeps its current solution, or
+ * 3. after grace steps, its cost is more than (1 + slack) * best(); it is abandoned, or
+ * 4. best() has reached target, or stop() was called; the restart then keeps its current solution.
+ * 1 and 2 do not change the result. 3 depends on how far other restarts have got, and so on timing,
+ * and is disabled by default (slack < 0).
+ * shared_lower_bound() holds a lower bound on the cost of any solution, computed once for all restarts.
+ */
+class RestartPortfolio {
+    std::atomic<double> best_cost_;
+    std::atomic<int> terminate_;
+    std::atomic<uint32_t> nabandoned_;
+    double slack_, target_;
+    unsigned grace_;
+    std::once_flag lower_bound_once_;
+    double lower_bound_ = 0.;
+public:
+    RestartPortfolio(double slack=-1., unsigned grace=3, double target=0.):
+        best_cost_(std::numeric_limits<double>::infinity()), terminate_(0), nabandoned_(0),
+        slack_(slack), target_(target), grace_(grace) {}
+
+    // Records a cost achieved by some restart; returns true if it is the best so far.
+    bool offer(double cost) {
+        double cur = best_cost_.load(std::memory_order_relaxed);
+        while(cost < cur && !best_cost_.compare_exchange_weak(cur, cost, std::memory_order_relaxed));
+        if(cost <= target_) terminate_.store(1, std::memory_order_relaxed);
+        return cost < cur;
+    }
+    double best() const {return best_cost_.load(std::memory_order_relaxed);}
+    bool cannot_win(double lower_bound) const {return lower_bound > best();}
+    bool lagging(double cost, unsigned step) const {
+        return slack_ >= 0. && step >= grace_ && cost > best() * (1. + slack_);
+    }
+    bool terminated() const {return terminate_.load(std::memory_order_relaxed);}
+    void stop() {terminate_.store(1, std::memory_order_relaxed);}
+    // For solvers which take a termination flag, such as JVSolver::run and JVSolver::kmedian
+    std::atomic<int> *terminate_flag() {return &terminate_;}
+    // Returns compute(), called only by the first restart to ask; every restart must pass an equivalent compute.
+    template<typename F>
+    double shared_lower_bound(const F &compute) {
+        std::call_once(lower_bound_once_, [&]() {lower_bound_ = compute();});
+        return lower_bound_;
+    }
+
+    /*
+     * Called by a restart after each step with its current cost and, if known (0 otherwise), a lower bound on its final cost.
+     * Returns 0 to continue, 1 to stop and keep the current solution, or 2 if the restart is abandoned.
+     */
+    int update(double cost, unsigned step, double lower_bound=0.) {
+        offer(cost);
+        if(lagging(cost, step) || (lower_bound > 0. && cannot_win(lower_bound))) {
+            nabandoned_.fetch_add(1, std::memory_order_relaxed);
+            return 2;
+        }
+        return terminated() || (lower_bound > 0. && lower_bound >= cost);
+    }
+    uint32_t nabandoned() const {return nabandoned_.load(std::memory_order_relaxed);}
+};
+
+/*
+ * Runs run_one(r, portfolio) for r in [0, nrestarts) on ngroups thread groups at once,
+ * each group running OpenMP loops on an equal share of the available threads.
+ * run_one returns (cost, result); abandoned restarts should return an infinite cost.
+ * Returns (cost, result) of the cheapest restart; ties go to the lowest r, so results
+ * do not depend on scheduling unless the portfolio has a slack or target.
+ * ngroups defaults to min(nrestarts, number of threads).
+ * If a restart throws, the others are stopped and the first exception is rethrown once all have returned.
+ */
+template<typename F>
+auto run_portfolio(unsigned nrestarts, F &&run_one, RestartPortfolio &portfolio, unsigned ngroups=0) {
+    using ret_t = std::decay_t<decltype(run_one(0u, portfolio))>;
+    if(!nrestarts) throw std::invalid_argument("Need at least one restart");
+    unsigned nthreads = 1;
+    OMP_ONLY(nthreads = omp_get_max_threads();)
+    if(!ngroups) ngroups = std::min(nrestarts, nthreads);
+    const unsigned threads_per_group = std::max(1u, nthreads / ngroups);
+    int max_levels = 1;
+    OMP_ONLY(max_levels = omp_get_max_active_levels(); if(max_levels < 2) omp_set_max_active_levels(2);)
+    std::optional<ret_t> best;
+    unsigned bestr = 0;
+    std::exception_ptr error;
+    OMP_PRAGMA("omp parallel for num_threads(ngroups) schedule(dynamic, 1)")
+    for(unsigned r = 0; r < nrestarts; ++r) {
+        OMP_SET_NT(threads_per_group);
+        std::optional<ret_t> ret;
+        // Exceptions may not leave an OpenMP region
+        try {
+            ret.emplace(run_one(r, portfolio));
+        } catch(...) {
+            portfolio.stop();
+            OMP_CRITICAL
+            {
+                if(!error) error = std::current_exception();
+            }
+            continue;
+        }
+        if(!std::isinf(ret->first)) portfolio.offer(ret->first);
+        OMP_CRITICAL
+        {
+            if(!best || ret->first < best->first || (ret->first == best->first && r < bestr)) {
+                best = std::move(ret);
+                bestr = r;
+            }
+        }
+    }
+    OMP_SET_NT(nthreads);
+    OMP_ONLY(omp_set_max_active_levels(max_levels);)
+    if(error) std::rethrow_exception(error);
+    if(std::isinf(best->first)) throw std::runtime_error("Every restart was abandoned");
+    return std::move(*best);
+}
+
+} // namespace minocore
+
+#endif /* FGC_RESTART_PORTFOLIO_H__ */
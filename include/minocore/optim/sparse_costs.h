@@ -0,0 +1,206 @@
+#pragma once
+#ifndef FGC_SPARSE_FACILITY_COSTS_H__
+#define FGC_SPARSE_FACILITY_COSTS_H__
+#include "minocore/util/blaze_adaptor.h"
+#include "minocore/util/packed.h"
+#include <numeric>
+
+namespace minocore {
+
+/*
+ * Facility x client cost matrix keeping only the m cheapest candidate facilities of each client.
+ * Every other (facility, client) pair costs fallback(client), the client's largest candidate cost.
+ * When the candidates are a client's m nearest facilities, this is a lower bound on the true cost
+ * of any other facility, and no non-candidate can ever be cheaper than a candidate.
+ *
+ * Memory is O(m * n) instead of O(|facilities| * n). JVSolver only creates edges for candidates,
+ * and its second phase visits only the candidate clients of each temporarily open facility;
+ * LocalKMedSearcher is specialized to scan candidates only. Lookups of a given pair take O(log m).
+ * Entries are stored by facility (CSR, sorted by client) and by client (sorted by cost).
+ */
+template<typename FT=float, typename IT=uint32_t>
+class SparseFacilityCosts {
+public:
+    using ElementType = FT;
+    using IndexType = IT;
+    static constexpr size_t npos = size_t(-1);
+    struct Span {
+        const IT *idx_;
+        const FT *val_;
+        size_t n_;
+        size_t size() const {return n_;}
+    };
+private:
+    size_t nf_ = 0, nc_ = 0;
+    std::vector<size_t> rowptr_, colptr_;
+    std::vector<IT> rowidx_, colidx_;
+    std::vector<FT> rowval_, colval_;
+    std::vector<FT> fallback_;
+public:
+    SparseFacilityCosts() {}
+    /*
+     * Builds from client-major candidates: client c's candidates are cand[c * stride:c * stride + counts[c]],
+     * as (cost, facility) pairs. Duplicate facilities are removed and the m cheapest are kept.
+     */
+    SparseFacilityCosts(size_t nf, size_t nc, unsigned m, std::vector<std::pair<FT, IT>> &cand,
+                        const std::vector<unsigned> &counts, size_t stride):
+        nf_(nf), nc_(nc), colptr_(nc + 1), fallback_(nc)
+    {
+        if(!m) throw std::invalid_argument("Need at least one candidate per client");
+        std::vector<unsigned> kept(nc);
+        OMP_PFOR
+        for(size_t c = 0; c < nc; ++c) {
+            auto first = &cand[c * stride], last = first + counts[c];
+            std::sort(first, last, [](const auto &x, const auto &y) {return x.second < y.second || (x.second == y.second && x.first < y.first);});
+            last = std::unique(first, last, [](const auto &x, const auto &y) {return x.second == y.second;});
+            const size_t n = std::min(size_t(last - first), size_t(m));
+            std::partial_sort(first, first + n, last);
+            kept[c] = n;
+            fallback_[c] = n ? first[n - 1].first: std::numeric_limits<FT>::infinity();
+        }
+        for(size_t c = 0; c < nc; ++c) colptr_[c + 1] = colptr_[c] + kept[c];
+        const size_t nnz = colptr_[nc];
+        colidx_.resize(nnz); colval_.resize(nnz);
+        OMP_PFOR
+        for(size_t c = 0; c < nc; ++c) {
+            for(size_t i = 0; i < kept[c]; ++i) {
+                colval_[colptr_[c] + i] = cand[c * stride + i].first;
+                colidx_[colptr_[c] + i] = cand[c * stride + i].second;
+            }
+        }
+        // Transpose by counting; clients are visited in order, so rows are sorted by client
+        rowptr_.assign(nf + 1, 0);
+        for(const auto f: colidx_) {
+            if(f >= nf) throw std::out_of_range("Candidate facility index out of range");
+            ++rowptr_[f + 1];
+        }
+        std::partial_sum(rowptr_.begin(), rowptr_.end(), rowptr_.begin());
+        rowidx_.resize(nnz); rowval_.resize(nnz);
+        std::vector<size_t> pos(rowptr_.begin(), rowptr_.end() - 1);
+        for(size_t c = 0; c < nc; ++c) {
+            for(size_t i = colptr_[c]; i < colptr_[c + 1]; ++i) {
+                const size_t p = pos[colidx_[i]]++;
+                rowidx_[p] = c;
+                rowval_[p] = colval_[i];
+            }
+        }
+    }
+    size_t rows() const {return nf_;}
+    size_t columns() const {return nc_;}
+    size_t nonZeros() const {return colidx_.size();}
+    // Candidates of facility f, sorted by client
+    Span row_span(size_t f) const {
+        return Span{rowidx_.data() + rowptr_[f], rowval_.data() + rowptr_[f], rowptr_[f + 1] - rowptr_[f]};
+    }
+    // Candidates of client c, sorted by cost
+    Span column_span(size_t c) const {
+        return Span{colidx_.data() + colptr_[c], colval_.data() + colptr_[c], colptr_[c + 1] - colptr_[c]};
+    }
+    FT fallback(size_t c) const {return fallback_[c];}
+    // Offset of (f, c) in the facility-major arrays, or npos if c is not a candidate of f
+    size_t find(size_t f, size_t c) const {
+        auto b = rowidx_.data() + rowptr_[f], e = rowidx_.data() + rowptr_[f + 1];
+        auto it = std::lower_bound(b, e, IT(c));
+        return it != e && *it == c ? size_t(it - rowidx_.data()): npos;
+    }
+    size_t row_offset(size_t f) const {return rowptr_[f];}
+    FT operator()(size_t f, size_t c) const {
+        const size_t p = find(f, c);
+        return p == npos ? fallback_[c]: rowval_[p];
+    }
+    FT max_cost() const {
+        FT ret = 0;
+        for(const auto v: fallback_) if(v > ret && std::isfinite(v)) ret = v;
+        return ret;
+    }
+    // Multiplies client c's costs by w[c], e.g. for weighted (coreset) clients; w must be nonnegative, so candidate order is kept
+    template<typename WT>
+    void scale_clients(const WT *w) {
+        OMP_PFOR
+        for(size_t c = 0; c < nc_; ++c) {
+            for(size_t i = colptr_[c]; i < colptr_[c + 1]; ++i) colval_[i] *= w[c];
+            if(std::isfinite(fallback_[c])) fallback_[c] *= w[c];
+        }
+        OMP_PFOR
+        for(size_t f = 0; f < nf_; ++f)
+            for(size_t i = rowptr_[f]; i < rowptr_[f + 1]; ++i) rowval_[i] *= w[rowidx_[i]];
+    }
+    // Total cost of serving every client from facility f
+    double facility_total(size_t f) const {
+        double ret = std::accumulate(fallback_.begin(), fallback_.end(), 0.);
+        auto s = row_span(f);
+        for(size_t i = 0; i < s.size(); ++i) ret += s.val_[i] - fallback_[s.idx_[i]];
+        return ret;
+    }
+};
+
+template<typename T> struct is_sparse_facility_costs: public std::false_type {};
+template<typename FT, typename IT> struct is_sparse_facility_costs<SparseFacilityCosts<FT, IT>>: public std::true_type {};
+template<typename T> static constexpr bool is_sparse_facility_costs_v = is_sparse_facility_costs<T>::value;
+
+/*
+ * Exact candidates: the m cheapest of facilities fids[0:nf] for each of np clients,
+ * where oracle(fids[f], c) is the cost of serving client c from facility f.
+ * Takes nf * np oracle calls, but only O(m * np) memory.
+ */
+template<typename FT=float, typename IT=uint32_t, typename Oracle>
+SparseFacilityCosts<FT, IT>
+make_sparse_facility_costs(const Oracle &oracle, const IT *fids, size_t nf, size_t np, unsigned m)
+{
+    m = std::min(size_t(m), nf);
+    std::vector<std::pair<FT, IT>> cand(np * m);
+    std::vector<unsigned> counts(np, m);
+    OMP_PFOR_DYN
+    for(size_t c = 0; c < np; ++c) {
+        auto heap = &cand[c * m];
+        for(size_t f = 0; f < m; ++f) heap[f] = {FT(oracle(fids[f], c)), IT(f)};
+        std::make_heap(heap, heap + m);
+        for(size_t f = m; f < nf; ++f) {
+            if(const FT v = oracle(fids[f], c); v < heap[0].first) {
+                std::pop_heap(heap, heap + m);
+                heap[m - 1] = {v, IT(f)};
+                std::push_heap(heap, heap + m);
+            }
+        }
+    }
+    return SparseFacilityCosts<FT, IT>(nf, np, m, cand, counts, m);
+}
+
+/*
+ * Candidates from a kNN graph, as built by make_knns or make_knns_by_lsh (np lists of kk (distance, point) pairs):
+ * client c's candidates are the facilities among c and its neighbors, plus, if asn is provided,
+ * the facility asn[c] (an index into fids), which guarantees every client at least one candidate.
+ * Takes O(np * kk) oracle calls.
+ */
+template<typename FT=float, typename IT=uint32_t, typename Oracle, typename KFT, typename KIT>
+SparseFacilityCosts<FT, IT>
+make_knn_facility_costs(const Oracle &oracle, const IT *fids, size_t nf, size_t np, unsigned m,
+                        const std::vector<packed::pair<KFT, KIT>> &knns, const IT *asn=nullptr)
+{
+    if(knns.size() % np) throw std::invalid_argument("knns must have the same number of neighbors for each point");
+    const size_t kk = knns.size() / np, stride = kk + 2;
+    std::vector<IT> point2fac(np, std::numeric_limits<IT>::max());
+    for(size_t f = 0; f < nf; ++f) point2fac[fids[f]] = f;
+    std::vector<std::pair<FT, IT>> cand(np * stride);
+    std::vector<unsigned> counts(np);
+    OMP_PFOR_DYN
+    for(size_t c = 0; c < np; ++c) {
+        auto out = &cand[c * stride];
+        unsigned n = 0;
+        auto add = [&](IT f) {
+            for(unsigned i = 0; i < n; ++i) if(out[i].second == f) return;
+            out[n++] = {FT(oracle(fids[f], c)), f};
+        };
+        if(asn) add(asn[c]);
+        if(point2fac[c] != std::numeric_limits<IT>::max()) add(point2fac[c]);
+        for(size_t i = 0; i < kk; ++i)
+            if(const auto f = point2fac[knns[c * kk + i].second]; f != std::numeric_limits<IT>::max())
+                add(f);
+        counts[c] = n;
+    }
+    return SparseFacilityCosts<FT, IT>(nf, np, m, cand, counts, stride);
+}
+
+} // namespace minocore
+
+#endif /* FGC_SPARSE_FACILITY_COSTS_H__ */
@@ -0,0 +1,232 @@
+#ifndef FGC_ALIAS_H__
+#define FGC_ALIAS_H__
+#include "minocore/util/shared.h"
+#include <memory>
+#include <numeric>
+#include <random>
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+namespace minocore {
+
+namespace sampling {
+
+namespace detail {
+// Work is split into pieces of at least this many items, up to MAX_PIECES of them,
+// independently of the number of threads, so that results are reproducible across thread counts.
+static constexpr size_t PIECE_SIZE = 4096, MAX_PIECES = 256;
+inline unsigned num_pieces(size_t n) {return std::min(MAX_PIECES, n / PIECE_SIZE + 1);}
+} // namespace detail
+
+/*
+ * Alias table (Walker, 1977) built in parallel with the PSA splitting scheme from
+ * Huebschle-Schneider and Sanders, Parallel Weighted Random Sampling (2019).
+ *
+ * 1. Items are stably partitioned into light (n * w / W < 1) and heavy lists in parallel,
+ *    along with prefix sums of light deficits and heavy excesses.
+ * 2. The combined lists are split into pieces at points where deficits and excesses
+ *    nearly balance, and each piece is filled by a sequential sweep.
+ * 3. Items left unfinished at piece boundaries (O(1) per piece) are finished serially.
+ * The number of pieces depends only on n, so the table does not depend on the thread count.
+ *
+ * The interface mirrors alias::AliasSampler: construct from an iterator range and call sample().
+ */
+template<typename FT=float, typename RNG=wy::WyRand<uint32_t, 2>, typename IT=std::uint32_t>
+class AliasTable {
+    std::shared_ptr<FT[]> prob_;
+    std::shared_ptr<IT[]> alias_;
+    size_t n_ = 0;
+    RNG rng_;
+    std::uniform_real_distribution<double> urd_;
+
+    struct Leftover {
+        IT index_;
+        double residual_;
+    };
+    template<typename Iter>
+    void build(Iter beg, size_t n) {
+        const unsigned nt = detail::num_pieces(n);
+        std::vector<double> piece_totals(nt);
+        OMP_PFOR
+        for(unsigned t = 0; t < nt; ++t) {
+            double s = 0.;
+            for(size_t i = n * t / nt, e = n * (t + 1) / nt; i < e; ++i) s += beg[i];
+            piece_totals[t] = s;
+        }
+        const double total = std::accumulate(piece_totals.begin(), piece_totals.end(), 0.);
+        if(!(total > 0.)) throw std::invalid_argument("Alias table weights must have a positive sum");
+        const double scale = n / total;
+        auto w = [beg,scale](size_t i) {return double(beg[i]) * scale;};
+
+        // 1. Partition into light and heavy lists, with prefix sums of deficits/excesses.
+        std::vector<size_t> nlight(nt + 1), nheavy(nt + 1);
+        OMP_PFOR
+        for(unsigned t = 0; t < nt; ++t) {
+            size_t nl = 0;
+            for(size_t i = n * t / nt, e = n * (t + 1) / nt; i < e; ++i) nl += w(i) < 1.;
+            nlight[t + 1] = nl;
+            nheavy[t + 1] = n * (t + 1) / nt - n * t / nt - nl;
+        }
+        std::partial_sum(nlight.begin(), nlight.end(), nlight.begin());
+        std::partial_sum(nheavy.begin(), nheavy.end(), nheavy.begin());
+        const size_t nl = nlight[nt], nh = nheavy[nt];
+        std::unique_ptr<IT[]> light(new IT[nl]), heavy(new IT[nh]);
+        // sl[i]: sum of deficits (1 - w) of light[0, i); sh[j]: sum of excesses (w - 1) of heavy[0, j)
+        std::unique_ptr<double[]> sl(new double[nl + 1]), sh(new double[nh + 1]);
+        std::vector<double> blockl(nt + 1), blockh(nt + 1);
+        OMP_PFOR
+        for(unsigned t = 0; t < nt; ++t) {
+            size_t li = nlight[t], hi = nheavy[t];
+            double ls = 0., hs = 0.;
+            for(size_t i = n * t / nt, e = n * (t + 1) / nt; i < e; ++i) {
+                const double wi = w(i);
+                if(wi < 1.) light[li] = i, sl[li++] = ls, ls += 1. - wi;
+                else        heavy[hi] = i, sh[hi++] = hs, hs += wi - 1.;
+            }
+            blockl[t + 1] = ls; blockh[t + 1] = hs;
+        }
+        std::partial_sum(blockl.begin(), blockl.end(), blockl.begin());
+        std::partial_sum(blockh.begin(), blockh.end(), blockh.begin());
+        OMP_PFOR
+        for(unsigned t = 0; t < nt; ++t) {
+            for(size_t li = nlight[t]; li < nlight[t + 1]; ++li) sl[li] += blockl[t];
+            for(size_t hi = nheavy[t]; hi < nheavy[t + 1]; ++hi) sh[hi] += blockh[t];
+        }
+        sl[nl] = blockl[nt]; sh[nh] = blockh[nt];
+
+        // 2. Split so that piece t covers (n * t / nt) items and its light deficits roughly match heavy excesses.
+        std::vector<size_t> lsplit(nt + 1), hsplit(nt + 1);
+        lsplit[nt] = nl; hsplit[nt] = nh;
+        for(unsigned t = 1; t < nt; ++t) {
+            const size_t m = n * t / nt;
+            size_t lo = m > nh ? m - nh: 0, hi = std::min(m, nl);
+            // Largest i in [lo, hi] with sl[i] <= sh[m - i]
+            while(lo < hi) {
+                const size_t mid = (lo + hi + 1) / 2;
+                if(sl[mid] <= sh[m - mid]) lo = mid;
+                else                       hi = mid - 1;
+            }
+            lsplit[t] = lo; hsplit[t] = m - lo;
+        }
+        std::vector<std::vector<Leftover>> leftovers(nt);
+        OMP_PFOR
+        for(unsigned t = 0; t < nt; ++t) {
+            size_t li = lsplit[t], hj = hsplit[t];
+            const size_t le = lsplit[t + 1], he = hsplit[t + 1];
+            auto &lo = leftovers[t];
+            double r = hj < he ? w(heavy[hj]): 0.;
+            while(hj < he) {
+                const IT cur = heavy[hj];
+                while(r > 1. && li < le) {
+                    const IT l = light[li++];
+                    const double wl = w(l);
+                    prob_[l] = wl; alias_[l] = cur;
+                    r -= 1. - wl;
+                }
+                if(r > 1.) break; // Lights exhausted; cur stays heavy
+                if(hj + 1 == he) break; // cur is light, but no heavy remains to fill it
+                const IT next = heavy[++hj];
+                prob_[cur] = r; alias_[cur] = next;
+                r = w(next) - (1. - r);
+            }
+            if(hj < he) lo.push_back(Leftover{heavy[hj], r}), ++hj;
+            while(hj < he) lo.push_back(Leftover{heavy[hj], w(heavy[hj])}), ++hj;
+            while(li < le) lo.push_back(Leftover{light[li], w(light[li])}), ++li;
+        }
+
+        // 3. Finish leftovers with Vose's method; residuals sum to their count.
+        std::vector<Leftover> small, large;
+        for(const auto &v: leftovers)
+            for(const auto &item: v)
+                (item.residual_ < 1. ? small: large).push_back(item);
+        while(!small.empty() && !large.empty()) {
+            auto s = small.back(); small.pop_back();
+            auto &l = large.back();
+            prob_[s.index_] = s.residual_; alias_[s.index_] = l.index_;
+            l.residual_ -= 1. - s.residual_;
+            if(l.residual_ < 1.) small.push_back(l), large.pop_back();
+        }
+        for(const auto &item: small) prob_[item.index_] = 1., alias_[item.index_] = item.index_;
+        for(const auto &item: large) prob_[item.index_] = 1., alias_[item.index_] = item.index_;
+    }
+public:
+    template<typename Iter>
+    AliasTable(Iter beg, Iter end, uint64_t seed=137): n_(std::distance(beg, end)), rng_(seed) {
+        if(!n_) throw std::invalid_argument("Alias table requires at least one item");
+        prob_.reset(new FT[n_]);
+        alias_.reset(new IT[n_]);
+        build(beg, n_);
+    }
+    // Adopts a previously built table (e.g., from probs() and aliases() of a serialized table) without rebuilding.
+    AliasTable(std::shared_ptr<FT[]> prob, std::shared_ptr<IT[]> alias, size_t n, uint64_t seed=137):
+        prob_(std::move(prob)), alias_(std::move(alias)), n_(n), rng_(seed)
+    {
+        if(!n_ || !prob_ || !alias_) throw std::invalid_argument("Alias table requires at least one item");
+    }
+    void seed(uint64_t seed) {rng_.seed(seed);}
+    size_t size() const {return n_;}
+    IT sample() {
+        const size_t i = std::min(size_t(urd_(rng_) * n_), n_ - 1);
+        return urd_(rng_) < prob_[i] ? IT(i): alias_[i];
+    }
+    template<typename OIter>
+    void operator()(OIter beg, OIter end) {
+        while(beg != end) *beg++ = sample();
+    }
+    const FT *probs() const {return prob_.get();}
+    const IT *aliases() const {return alias_.get();}
+};
+
+/*
+ * Draws m samples with replacement from the distribution given by probs[0, n) without building an alias table.
+ * A parallel prefix sum forms the cdf; m uniforms are sorted and located by a parallel merge against it.
+ * This costs O(n + m log m), which beats building an alias table when only one sample is needed.
+ * Returned indices are sorted.
+ */
+template<typename IT=std::uint32_t, typename FT>
+std::vector<IT> sample_sorted_uniforms(const FT *probs, size_t n, size_t m, uint64_t seed=137) {
+    const unsigned nt = detail::num_pieces(n);
+    std::unique_ptr<double[]> cdf(new double[n]);
+    std::vector<double> offsets(nt + 1);
+    OMP_PFOR
+    for(unsigned t = 0; t < nt; ++t) {
+        double s = 0.;
+        for(size_t i = n * t / nt, e = n * (t + 1) / nt; i < e; ++i) cdf[i] = (s += probs[i]);
+        offsets[t + 1] = s;
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    OMP_PFOR
+    for(unsigned t = 1; t < nt; ++t)
+        for(size_t i = n * t / nt, e = n * (t + 1) / nt; i < e; ++i) cdf[i] += offsets[t];
+    const double total = offsets[nt];
+    // Uniforms are drawn in fixed-size blocks seeded by block index, not by thread
+    std::vector<double> u(m);
+    const size_t nublocks = (m + detail::PIECE_SIZE - 1) / detail::PIECE_SIZE;
+    OMP_PFOR
+    for(size_t b = 0; b < nublocks; ++b) {
+        wy::WyRand<uint64_t, 2> rng(seed + b);
+        std::uniform_real_distribution<double> urd(0., total);
+        for(size_t i = b * detail::PIECE_SIZE, e = std::min(m, i + detail::PIECE_SIZE); i < e; ++i) u[i] = urd(rng);
+    }
+    shared::sort(u.begin(), u.end());
+    std::vector<IT> ret(m);
+    OMP_PFOR
+    for(unsigned t = 0; t < nt; ++t) {
+        size_t i = m * t / nt;
+        const size_t e = m * (t + 1) / nt;
+        if(i == e) continue;
+        size_t pos = std::upper_bound(cdf.get(), cdf.get() + n, u[i]) - cdf.get();
+        for(; i < e; ++i) {
+            while(pos < n - 1 && cdf[pos] <= u[i]) ++pos;
+            ret[i] = pos;
+        }
+    }
+    return ret;
+}
+
+} // namespace sampling
+
+} // namespace minocore
+
+#endif /* FGC_ALIAS_H__ */
@@ -3,8 +3,14 @@
 #include "./shared.h"
 #include "./timer.h"
 #include "./blaze_adaptor.h"
+#include "./csr.h"
+#include "./mtx.h"
 #include "mio/single_include/mio/mio.hpp"
 #include <fstream>
+#include <numeric>
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
 
 namespace minocore {
 
@@ -36,8 +42,92 @@ struct CSCMatrixView {
     }
 };
 
+namespace detail {
+
+/*
+ * Parallel two-pass CSC -> CSR transposition.
+ * 1. Each thread histograms row indices over a contiguous block of columns (balanced by nonzeros).
+ * 2. Row totals are prefix-summed into indptr, and each block gets its own starting offset within every row.
+ * 3. Each thread scatters its block; since blocks are ordered by column, every output row is sorted
+ *    and the result does not depend on the number of threads.
+ * DataType is converted to FT during the scatter.
+ * Per-block offsets cost nblocks * nrows * sizeof(OIndPtrType) bytes, so the block count is capped at nnz / nrows.
+ */
+template<typename FT, typename OIndPtrType=uint64_t, typename OIndicesType=uint32_t,
+         typename IndPtrType, typename IndicesType, typename DataType>
+csr::CSRArrays<FT, OIndPtrType, OIndicesType> csc_transpose(const CSCMatrixView<IndPtrType, IndicesType, DataType> &mat) {
+    const size_t nr = mat.nf_, nc = mat.n_;
+    const size_t base = mat.indptr_[0], nnz = mat.indptr_[nc] - base;
+    size_t nt = 1;
+    OMP_ONLY(nt = omp_get_max_threads();)
+    const size_t nblocks = std::max(size_t(1), std::min(nt, nnz / std::max(nr, size_t(1))));
+    std::vector<size_t> colbounds(nblocks + 1);
+    colbounds[nblocks] = nc;
+    for(size_t b = 1; b < nblocks; ++b)
+        colbounds[b] = std::lower_bound(mat.indptr_, mat.indptr_ + nc + 1, IndPtrType(base + nnz * b / nblocks)) - mat.indptr_;
+    std::unique_ptr<OIndPtrType[]> offsets(new OIndPtrType[nblocks * nr]());
+    csr::CSRArrays<FT, OIndPtrType, OIndicesType> ret;
+    ret.nr_ = nr; ret.nc_ = nc;
+    ret.indptr_.reset(new OIndPtrType[nr + 1]);
+    ret.indices_.reset(new OIndicesType[nnz]);
+    ret.data_.reset(new FT[nnz]);
+    int bad = 0;
+    OMP_PFOR
+    for(size_t b = 0; b < nblocks; ++b) {
+        OIndPtrType *const counts = offsets.get() + b * nr;
+        for(size_t s = mat.indptr_[colbounds[b]], e = mat.indptr_[colbounds[b + 1]]; s < e; ++s) {
+            const size_t r = mat.indices_[s];
+            if(unlikely(r >= nr)) {
+                OMP_ATOMIC
+                ++bad;
+                break;
+            }
+            ++counts[r];
+        }
+    }
+    if(bad) throw std::runtime_error("Row index out of range in CSC matrix");
+    ret.indptr_[0] = 0;
+    OMP_PFOR
+    for(size_t r = 0; r < nr; ++r) {
+        OIndPtrType total = 0;
+        for(size_t b = 0; b < nblocks; ++b) {
+            auto &c = offsets[b * nr + r];
+            const auto tmp = c;
+            c = total;
+            total += tmp;
+        }
+        ret.indptr_[r + 1] = total;
+    }
+    std::partial_sum(ret.indptr_.get(), ret.indptr_.get() + nr + 1, ret.indptr_.get());
+    OMP_PFOR
+    for(size_t b = 0; b < nblocks; ++b) {
+        OIndPtrType *const pos = offsets.get() + b * nr;
+        for(size_t c = colbounds[b]; c < colbounds[b + 1]; ++c) {
+            for(size_t s = mat.indptr_[c], e = mat.indptr_[c + 1]; s < e; ++s) {
+                const size_t r = mat.indices_[s];
+                const size_t dest = ret.indptr_[r] + pos[r]++;
+                ret.indices_[dest] = c;
+                ret.data_[dest] = mat.data_[s];
+            }
+        }
+    }
+    return ret;
+}
+
+} // namespace detail
+
+/*
+ * Transposes a CSC matrix into an owned CSRMatrixView, so that CSC row indices become rows.
+ * Use this for layouts (e.g., 10x Genomics) where CSC columns are features rather than samples.
+ */
 template<typename FT=float, typename IndPtrType, typename IndicesType, typename DataType>
-blz::SM<FT, blaze::rowMajor> csc2sparse(const CSCMatrixView<IndPtrType, IndicesType, DataType> &mat, bool skip_empty=false) {
+CSRMatrixView<FT, uint64_t, uint32_t> csc2csr_view(const CSCMatrixView<IndPtrType, IndicesType, DataType> &mat) {
+    return csr::arrays2view(detail::csc_transpose<FT>(mat));
+}
+
+template<typename FT=float, typename IndPtrType, typename IndicesType, typename DataType>
+blz::SM<FT, blaze::rowMajor> csc2sparse(const CSCMatrixView<IndPtrType, IndicesType, DataType> &mat, bool skip_empty=false, bool transpose=false) {
+    if(transpose) return csr::arrays2sparse(detail::csc_transpose<FT>(mat), skip_empty);
     blz::SM<FT, blaze::rowMajor> ret(mat.n_, mat.nf_);
     ret.reserve(mat.nnz_);
     size_t used_rows = 0, i;
@@ -55,7 +145,7 @@ blz::SM<FT, blaze::rowMajor> csc2sparse(const CSCMatrixView<IndPtrType, IndicesT
 }
 
 template<typename FT=float, typename IndPtrType=uint64_t, typename IndicesType=uint64_t, typename DataType=uint32_t>
-blz::SM<FT, blaze::rowMajor> csc2sparse(std::string prefix, bool skip_empty=false) {
+blz::SM<FT, blaze::rowMajor> csc2sparse(std::string prefix, bool skip_empty=false, bool transpose=false) {
     util::Timer t("csc2sparse load time");
     std::string indptrn  = prefix + "indptr.file";
     std::string indicesn = prefix + "indices.file";
@@ -76,46 +166,11 @@ blz::SM<FT, blaze::rowMajor> csc2sparse(std::string prefix, bool skip_empty=fals
     std::fprintf(stderr, "indptr size: %zu\n", indptr.size() / sizeof(IndPtrType));
     std::fprintf(stderr, "indices size: %zu\n", indices.size() / sizeof(IndicesType));
     std::fprintf(stderr, "data size: %zu\n", data.size() / sizeof(DataType));
-#ifndef MADV_REMOVE
-#  define MADV_FLAGS (MADV_DONTNEED | MADV_FREE)
-#else
-#  define MADV_FLAGS (MADV_DONTNEED | MADV_REMOVE)
-#endif
-    ::madvise((void *)indptr.data(), indptr.size(), MADV_FLAGS);
-    ::madvise((void *)indices.data(), indices.size(), MADV_FLAGS);
-    ::madvise((void *)data.data(), data.size(), MADV_FLAGS);
-#undef MADV_FLAGS
-    return csc2sparse<FT>(matview, skip_empty);
-}
-
-template<typename FT=float, bool SO=blaze::rowMajor>
-blz::SM<FT, SO> mtx2sparse(std::string prefix)
-{
-    std::string line;
-    std::ifstream ifs(prefix);
-    do std::getline(ifs, line); while(line.front() == '%');
-    char *s;
-    size_t columns = std::strtoull(line.data(), &s, 10),
-             nr  = std::strtoull(s, &s, 10),
-             lines = std::strtoull(s, nullptr, 10);
-    size_t lastline = 0;
-    blz::SM<FT, SO> ret(nr, columns);
-    ret.reserve(lines);
-    while(lines--)
-    {
-        if(!std::getline(ifs, line)) throw std::runtime_error("Error in reading file: unexpected number of lines");
-        size_t row, col, cnt;
-        col = std::strtoull(line.data(), &s, 10) - 1;
-        row = std::strtoull(s, &s, 10) - 1;
-        cnt = std::strtoull(s, &s, 10);
-        if(unlikely(lastline > row)) throw std::runtime_error("Unsorted file.");
-        while(lastline < row) ret.finalize(lastline++);
-        ret.append(row, col, cnt);
-    }
-    while(lastline < ret.rows())
-        ret.finalize(lastline++);
-    if(std::getline(ifs, line)) throw std::runtime_error("Error reading file: too many lines");
-    return ret;
+    // The mappings are read once, front to back.
+    ::madvise((void *)indptr.data(), indptr.size(), MADV_SEQUENTIAL);
+    ::madvise((void *)indices.data(), indices.size(), MADV_SEQUENTIAL);
+    ::madvise((void *)data.data(), data.size(), MADV_SEQUENTIAL);
+    return csc2sparse<FT>(matview, skip_empty, transpose);
 }
 
 } // namespace minocore
@@ -0,0 +1,326 @@
+#ifndef FGC_CSR_H__
+#define FGC_CSR_H__
+#include "./shared.h"
+#include "./timer.h"
+#include "./blaze_adaptor.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <memory>
+#include <string>
+
+namespace minocore {
+
+namespace csr {
+
+/*
+ * Read-only memory map of a whole file.
+ * If copy_on_write is set, the mapping is private and writable, so in-place updates
+ * (e.g., row normalization in DissimilarityApplicator) only materialize the pages they touch
+ * and are never written back to disk.
+ */
+class MappedFile {
+    void *data_ = nullptr;
+    size_t size_ = 0;
+public:
+    MappedFile(const std::string &path, bool copy_on_write=false) {
+        int fd = ::open(path.data(), O_RDONLY);
+        if(fd < 0) throw std::system_error(errno, std::system_category(), std::string("Failed to open ") + path);
+        struct stat st;
+        if(::fstat(fd, &st)) {
+            ::close(fd);
+            throw std::system_error(errno, std::system_category(), std::string("Failed to stat ") + path);
+        }
+        size_ = st.st_size;
+        if(size_) {
+            data_ = ::mmap(nullptr, size_, copy_on_write ? PROT_READ | PROT_WRITE: PROT_READ,
+                           copy_on_write ? MAP_PRIVATE: MAP_SHARED, fd, 0);
+            if(data_ == MAP_FAILED) {
+                ::close(fd);
+                throw std::system_error(errno, std::system_category(), std::string("Failed to mmap ") + path);
+            }
+        }
+        ::close(fd);
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() {if(data_) ::munmap(data_, size_);}
+    void *data() const {return data_;}
+    size_t size() const {return size_;}
+    void advise(int advice) const {if(data_) ::madvise(data_, size_, advice);}
+};
+
+/*
+ * Iterator over the nonzeros of one row, over separate index and value arrays.
+ * Like blaze's expression iterators, it exposes value()/index() directly and returns itself from operator->.
+ */
+template<typename VT, typename IT>
+class CSRIterator {
+    VT *val_;
+    const IT *idx_;
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = CSRIterator;
+    using pointer           = const CSRIterator *;
+    using reference         = const CSRIterator &;
+    using difference_type   = std::ptrdiff_t;
+
+    CSRIterator(): val_(nullptr), idx_(nullptr) {}
+    CSRIterator(VT *val, const IT *idx): val_(val), idx_(idx) {}
+    template<typename OVT, typename=std::enable_if_t<std::is_convertible_v<OVT *, VT *>>>
+    CSRIterator(const CSRIterator<OVT, IT> &o): val_(o.valptr()), idx_(o.idxptr()) {}
+
+    CSRIterator &operator++() {++val_; ++idx_; return *this;}
+    CSRIterator operator++(int) {CSRIterator ret(*this); ++*this; return ret;}
+    VT &value() const {return *val_;}
+    size_t index() const {return *idx_;}
+    const CSRIterator &operator*() const {return *this;}
+    const CSRIterator *operator->() const {return this;}
+    bool operator==(const CSRIterator &o) const {return idx_ == o.idx_;}
+    bool operator!=(const CSRIterator &o) const {return idx_ != o.idx_;}
+    difference_type operator-(const CSRIterator &o) const {return idx_ - o.idx_;}
+    VT *valptr() const {return val_;}
+    const IT *idxptr() const {return idx_;}
+};
+
+/*
+ * CSRMatrixView: compressed row matrix over externally-owned (typically memory-mapped) arrays.
+ *
+ * The sparsity structure is immutable; stored values may be modified through row iterators.
+ * It models enough of blaze's sparse matrix interface (begin/end/find/lowerBound/upperBound per row)
+ * for blaze::row/rows views and sparse vector expressions, so DissimilarityApplicator, CentroidPolicy
+ * and the Lloyd loop can run on it without first copying into a CompressedMatrix.
+ *
+ * Copies are shallow: they share storage, which is kept alive by owner_.
+ * The value of stored entry k (indptr()[0] <= k < indptr()[rows()]) is data()[k - data_offset()];
+ * a nonzero offset lets a value array hold only the entries of a row range.
+ */
+template<typename FT=float, typename IndPtrType=uint64_t, typename IndicesType=uint64_t>
+class CSRMatrixView: public blaze::SparseMatrix<CSRMatrixView<FT, IndPtrType, IndicesType>, blaze::rowMajor> {
+    const IndPtrType *indptr_;
+    const IndicesType *indices_;
+    FT *data_;
+    size_t data_offset_;
+    size_t nr_, nc_;
+    std::shared_ptr<const void> owner_;
+    static inline const FT zero_ = FT(0);
+
+    FT *val(size_t k) const {return data_ + (k - data_offset_);}
+public:
+    using This           = CSRMatrixView<FT, IndPtrType, IndicesType>;
+    using BaseType       = blaze::SparseMatrix<This, blaze::rowMajor>;
+    using ResultType     = blaze::CompressedMatrix<FT, blaze::rowMajor>;
+    using OppositeType   = blaze::CompressedMatrix<FT, blaze::columnMajor>;
+    using TransposeType  = blaze::CompressedMatrix<FT, blaze::columnMajor>;
+    using ElementType    = FT;
+    using ReturnType     = const FT &;
+    using CompositeType  = const This &;
+    using Reference      = const FT &;
+    using ConstReference = const FT &;
+    using Iterator       = CSRIterator<FT, IndicesType>;
+    using ConstIterator  = CSRIterator<const FT, IndicesType>;
+
+    template<typename NewType>
+    struct Rebind {using Other = blaze::CompressedMatrix<NewType, blaze::rowMajor>;};
+    template<size_t NewM, size_t NewN>
+    struct Resize {using Other = blaze::CompressedMatrix<FT, blaze::rowMajor>;};
+
+    static constexpr bool smpAssignable = false;
+
+    CSRMatrixView(): indptr_(nullptr), indices_(nullptr), data_(nullptr), data_offset_(0), nr_(0), nc_(0) {}
+    CSRMatrixView(const IndPtrType *indptr, const IndicesType *indices, FT *data, size_t nr, size_t nc,
+                  std::shared_ptr<const void> owner=nullptr, size_t data_offset=0):
+        indptr_(indptr), indices_(indices), data_(data), data_offset_(data_offset), nr_(nr), nc_(nc), owner_(std::move(owner))
+    {
+    }
+
+    size_t rows()     const {return nr_;}
+    size_t columns()  const {return nc_;}
+    size_t nonZeros() const {return nr_ ? indptr_[nr_] - indptr_[0]: size_t(0);}
+    size_t nonZeros(size_t i) const {return indptr_[i + 1] - indptr_[i];}
+    size_t capacity() const {return nonZeros();}
+    size_t capacity(size_t i) const {return nonZeros(i);}
+
+    Iterator      begin(size_t i)        {return Iterator(val(indptr_[i]), indices_ + indptr_[i]);}
+    Iterator      end(size_t i)          {return Iterator(val(indptr_[i + 1]), indices_ + indptr_[i + 1]);}
+    ConstIterator begin(size_t i)  const {return ConstIterator(val(indptr_[i]), indices_ + indptr_[i]);}
+    ConstIterator end(size_t i)    const {return ConstIterator(val(indptr_[i + 1]), indices_ + indptr_[i + 1]);}
+    ConstIterator cbegin(size_t i) const {return begin(i);}
+    ConstIterator cend(size_t i)   const {return end(i);}
+
+    ConstIterator lowerBound(size_t i, size_t j) const {
+        const IndicesType *b = indices_ + indptr_[i], *e = indices_ + indptr_[i + 1];
+        const IndicesType *p = std::lower_bound(b, e, j);
+        return ConstIterator(val(p - indices_), p);
+    }
+    Iterator lowerBound(size_t i, size_t j) {
+        auto cit = static_cast<const This &>(*this).lowerBound(i, j);
+        return Iterator(const_cast<FT *>(cit.valptr()), cit.idxptr());
+    }
+    ConstIterator upperBound(size_t i, size_t j) const {
+        const IndicesType *b = indices_ + indptr_[i], *e = indices_ + indptr_[i + 1];
+        const IndicesType *p = std::upper_bound(b, e, j);
+        return ConstIterator(val(p - indices_), p);
+    }
+    Iterator upperBound(size_t i, size_t j) {
+        auto cit = static_cast<const This &>(*this).upperBound(i, j);
+        return Iterator(const_cast<FT *>(cit.valptr()), cit.idxptr());
+    }
+    ConstIterator find(size_t i, size_t j) const {
+        auto it = lowerBound(i, j);
+        return it != end(i) && it->index() == j ? it: end(i);
+    }
+    Iterator find(size_t i, size_t j) {
+        auto cit = static_cast<const This &>(*this).find(i, j);
+        return Iterator(const_cast<FT *>(cit.valptr()), cit.idxptr());
+    }
+
+    ConstReference operator()(size_t i, size_t j) const {
+        assert(i < nr_ && j < nc_);
+        auto it = find(i, j);
+        return it == end(i) ? zero_: it->value();
+    }
+    ConstReference at(size_t i, size_t j) const {
+        if(i >= nr_ || j >= nc_) throw std::out_of_range("Invalid CSRMatrixView access");
+        return (*this)(i, j);
+    }
+
+    template<typename Other> bool canAlias(const Other *alias) const noexcept {return static_cast<const void *>(this) == static_cast<const void *>(alias);}
+    template<typename Other> bool isAliased(const Other *alias) const noexcept {return static_cast<const void *>(this) == static_cast<const void *>(alias);}
+    bool canSMPAssign() const noexcept {return false;}
+    bool isIntact() const noexcept {return true;}
+
+    const IndPtrType *indptr() const {return indptr_;}
+    const IndicesType *indices() const {return indices_;}
+    FT *data() {return data_;}
+    const FT *data() const {return data_;}
+    size_t data_offset() const {return data_offset_;}
+    const std::shared_ptr<const void> &owner() const {return owner_;}
+
+    /*
+     * Returns a view sharing this matrix's sparsity structure with values func(x) for each stored x.
+     * Used for per-nonzero caches (logs, square roots) so that only one value array is allocated.
+     */
+    template<typename F>
+    This map(const F &func) const {
+        const size_t nnz = nonZeros(), offset = nr_ ? indptr_[0]: 0;
+        std::shared_ptr<FT[]> newdata(new FT[nnz]);
+        FT *const dst = newdata.get();
+        const FT *const src = val(offset);
+        OMP_PFOR
+        for(size_t i = 0; i < nnz; ++i)
+            dst[i] = func(src[i]);
+        auto keepalive = std::make_shared<std::pair<std::shared_ptr<const void>, std::shared_ptr<FT[]>>>(owner_, std::move(newdata));
+        return This(indptr_, indices_, keepalive->second.get(), nr_, nc_, std::move(keepalive), offset);
+    }
+};
+
+// Owned compressed-row arrays, as produced by transposition or by sorting coordinate data.
+template<typename FT, typename IndPtrType, typename IndicesType>
+struct CSRArrays {
+    std::unique_ptr<IndPtrType[]> indptr_;
+    std::unique_ptr<IndicesType[]> indices_;
+    std::unique_ptr<FT[]> data_;
+    size_t nr_ = 0, nc_ = 0;
+    size_t nnz() const {return nr_ ? size_t(indptr_[nr_]): size_t(0);}
+};
+
+// Builds a CompressedMatrix in a single pass over pre-reserved storage.
+template<typename FT, typename IndPtrType, typename IndicesType>
+blz::SM<FT, blaze::rowMajor> arrays2sparse(const CSRArrays<FT, IndPtrType, IndicesType> &arr, bool skip_empty=false) {
+    size_t nr = arr.nr_;
+    if(skip_empty) {
+        nr = 0;
+        for(size_t i = 0; i < arr.nr_; ++i) nr += arr.indptr_[i + 1] != arr.indptr_[i];
+    }
+    blz::SM<FT, blaze::rowMajor> ret(nr, arr.nc_);
+    ret.reserve(arr.nnz());
+    size_t used_rows = 0;
+    for(size_t i = 0; i < arr.nr_; ++i) {
+        if(skip_empty && arr.indptr_[i + 1] == arr.indptr_[i]) continue;
+        for(size_t s = arr.indptr_[i]; s < arr.indptr_[i + 1]; ++s)
+            ret.append(used_rows, arr.indices_[s], arr.data_[s]);
+        ret.finalize(used_rows++);
+    }
+    if(used_rows != arr.nr_) std::fprintf(stderr, "Only used %zu/%zu rows, skipping empty rows\n", used_rows, arr.nr_);
+    return ret;
+}
+
+template<typename FT, typename IndPtrType, typename IndicesType>
+CSRMatrixView<FT, IndPtrType, IndicesType> arrays2view(CSRArrays<FT, IndPtrType, IndicesType> &&arr) {
+    auto owned = std::make_shared<CSRArrays<FT, IndPtrType, IndicesType>>(std::move(arr));
+    return CSRMatrixView<FT, IndPtrType, IndicesType>(owned->indptr_.get(), owned->indices_.get(), owned->data_.get(),
+                                                      owned->nr_, owned->nc_, owned);
+}
+
+template<typename T>
+struct is_csr_view: std::false_type {};
+template<typename FT, typename IPT, typename IT>
+struct is_csr_view<CSRMatrixView<FT, IPT, IT>>: std::true_type {};
+template<typename T>
+static constexpr bool is_csr_view_v = is_csr_view<std::decay_t<T>>::value;
+
+/*
+ * Maps prefix + {indptr, indices, data, shape}.file, as written for csc2sparse, as a cells x features CSR matrix.
+ * (A CSC matrix of features x cells has exactly the CSR layout of its transpose.)
+ *
+ * If DataType matches FT, values are mapped copy-on-write and nothing is copied up front.
+ * Otherwise, values are converted into an owned FT array; indices and indptr are still mapped.
+ */
+template<typename FT=float, typename IndPtrType=uint64_t, typename IndicesType=uint64_t, typename DataType=uint32_t>
+CSRMatrixView<FT, IndPtrType, IndicesType> load_csr_view(std::string prefix) {
+    util::Timer t("load_csr_view time");
+    std::FILE *ifp = std::fopen((prefix + "shape.file").data(), "rb");
+    if(!ifp) throw std::runtime_error(std::string("Failed to open shape file at ") + prefix + "shape.file");
+    uint32_t dims[2];
+    if(std::fread(dims, sizeof(uint32_t), 2, ifp) != 2) {
+        std::fclose(ifp);
+        throw std::runtime_error("Failed to read dims from file");
+    }
+    std::fclose(ifp);
+    const uint32_t nfeat = dims[0], nsamples = dims[1];
+    struct Storage {
+        MappedFile indptr_, indices_;
+        std::unique_ptr<MappedFile> data_;
+        std::unique_ptr<FT[]> converted_;
+        Storage(const std::string &prefix):
+            indptr_(prefix + "indptr.file"), indices_(prefix + "indices.file") {}
+    };
+    auto storage = std::make_shared<Storage>(prefix);
+    if(storage->indptr_.size() != (size_t(nsamples) + 1) * sizeof(IndPtrType))
+        throw std::runtime_error(std::string("indptr.file has ") + std::to_string(storage->indptr_.size() / sizeof(IndPtrType)) + " entries, expected " + std::to_string(size_t(nsamples) + 1));
+    const IndPtrType *indptr = static_cast<const IndPtrType *>(storage->indptr_.data());
+    const size_t nnz = indptr[nsamples];
+    if(storage->indices_.size() < nnz * sizeof(IndicesType))
+        throw std::runtime_error("indices.file is shorter than indptr implies");
+    FT *values;
+    if constexpr(std::is_same_v<FT, DataType>) {
+        storage->data_.reset(new MappedFile(prefix + "data.file", /*copy_on_write=*/true));
+        if(storage->data_->size() < nnz * sizeof(FT)) throw std::runtime_error("data.file is shorter than indptr implies");
+        values = static_cast<FT *>(storage->data_->data());
+    } else {
+        MappedFile raw(prefix + "data.file");
+        if(raw.size() < nnz * sizeof(DataType)) throw std::runtime_error("data.file is shorter than indptr implies");
+        raw.advise(MADV_SEQUENTIAL);
+        storage->converted_.reset(new FT[nnz]);
+        values = storage->converted_.get();
+        const DataType *src = static_cast<const DataType *>(raw.data());
+        OMP_PFOR
+        for(size_t i = 0; i < nnz; ++i)
+            values[i] = src[i];
+    }
+    std::fprintf(stderr, "Mapped CSR view with %u rows, %u columns and %zu nonzeros\n", nsamples, nfeat, nnz);
+    return CSRMatrixView<FT, IndPtrType, IndicesType>(indptr, static_cast<const IndicesType *>(storage->indices_.data()),
+                                                      values, nsamples, nfeat, std::move(storage));
+}
+
+} // namespace csr
+
+using csr::CSRMatrixView;
+using csr::load_csr_view;
+using csr::is_csr_view_v;
+using csr::CSRArrays;
+
+} // namespace minocore
+
+#endif /* FGC_CSR_H__ */
@@ -0,0 +1,119 @@
+#ifndef FGC_FASTPARSE_H__
+#define FGC_FASTPARSE_H__
+#include "./macros.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+/*
+ * Helpers for parsing numeric text from in-memory buffers (mmapped files or decompressed chunks).
+ * None of these require null termination; every function takes an end pointer.
+ */
+
+namespace minocore {
+
+namespace fastparse {
+
+INLINE bool isdig(char c) {return unsigned(c - '0') < 10u;}
+INLINE bool ishspace(char c) {return c == ' ' || c == '\t' || c == '\r';}
+
+// Parses an unsigned integer starting at p, skipping leading horizontal whitespace and quotes.
+// On return, p points one past the last digit consumed.
+INLINE uint64_t parse_uint(const char *&p, const char *e) {
+    while(p < e && (ishspace(*p) || *p == '"')) ++p;
+    uint64_t ret = 0;
+    for(unsigned d; p < e && (d = unsigned(*p - '0')) < 10u; ++p)
+        ret = ret * 10 + d;
+    return ret;
+}
+
+// Plain decimal/exponent parser. Not correctly rounded in the last ulp, which is irrelevant for single-precision data.
+INLINE double parse_double(const char *&p, const char *e) {
+    static constexpr double pow10[] {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                     1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+    while(p < e && (ishspace(*p) || *p == '"')) ++p;
+    const bool neg = p < e && *p == '-';
+    p += (p < e && (*p == '-' || *p == '+'));
+    uint64_t mant = 0;
+    int exp10 = 0, ndig = 0;
+    for(unsigned d; p < e && (d = unsigned(*p - '0')) < 10u; ++p) {
+        if(ndig < 18) mant = mant * 10 + d, ++ndig;
+        else ++exp10;
+    }
+    if(p < e && *p == '.') {
+        for(unsigned d; ++p < e && (d = unsigned(*p - '0')) < 10u;)
+            if(ndig < 18) mant = mant * 10 + d, ++ndig, --exp10;
+    }
+    if(p < e && (*p | 0x20) == 'e') {
+        const char *save = p++;
+        const bool eneg = p < e && *p == '-';
+        p += (p < e && (*p == '-' || *p == '+'));
+        if(p < e && isdig(*p)) {
+            int ev = 0;
+            for(unsigned d; p < e && (d = unsigned(*p - '0')) < 10u; ++p) ev = ev * 10 + d;
+            exp10 += eneg ? -ev: ev;
+        } else p = save;
+    }
+    double ret = mant;
+    if(exp10) {
+        if(exp10 > -19 && exp10 < 19) ret = exp10 < 0 ? ret / pow10[-exp10]: ret * pow10[exp10];
+        else                          ret *= std::pow(10., exp10);
+    }
+    return neg ? -ret: ret;
+}
+
+INLINE const char *next_line(const char *p, const char *e) {
+    const char *nl = static_cast<const char *>(std::memchr(p, '\n', e - p));
+    return nl ? nl + 1: e;
+}
+INLINE const char *line_end(const char *p, const char *e) {
+    const char *nl = static_cast<const char *>(std::memchr(p, '\n', e - p));
+    return nl ? nl: e;
+}
+
+// Split [begin, end) into at most nchunks ranges, each beginning at the start of a line.
+inline std::vector<std::pair<const char *, const char *>>
+line_chunks(const char *begin, const char *end, size_t nchunks) {
+    std::vector<std::pair<const char *, const char *>> ret;
+    if(begin >= end) return ret;
+    nchunks = std::max(size_t(1), std::min(nchunks, size_t(end - begin) / 4096 + 1));
+    const size_t step = (end - begin) / nchunks;
+    const char *p = begin;
+    for(size_t i = 0; i < nchunks && p < end; ++i) {
+        const char *stop = i + 1 == nchunks ? end: next_line(std::max(p, begin + (i + 1) * step), end);
+        if(stop > p) ret.emplace_back(p, stop);
+        p = stop;
+    }
+    return ret;
+}
+
+inline size_t default_nchunks() {
+    size_t nt = 1;
+    OMP_ONLY(nt = omp_get_max_threads();)
+    return nt * 4;
+}
+
+// Concatenate per-chunk buffers into out in chunk order.
+template<typename T>
+void concatenate(std::vector<std::vector<T>> &parts, std::vector<T> &out, size_t offset=0) {
+    std::vector<size_t> offsets(parts.size() + 1);
+    offsets[0] = offset;
+    for(size_t i = 0; i < parts.size(); ++i) offsets[i + 1] = offsets[i] + parts[i].size();
+    out.resize(offsets.back());
+    OMP_PFOR
+    for(size_t i = 0; i < parts.size(); ++i) {
+        std::copy(parts[i].begin(), parts[i].end(), out.begin() + offsets[i]);
+        std::vector<T>().swap(parts[i]);
+    }
+}
+
+} // namespace fastparse
+
+} // namespace minocore
+
+#endif /* FGC_FASTPARSE_H__ */
@@ -0,0 +1,200 @@
+#ifndef FGC_HDF5_H__
+#define FGC_HDF5_H__
+#include "H5Cpp.h"
+#include "./csr.h"
+#include "./exception.h"
+#include <future>
+
+/*
+ * Row-chunked HDF5 readers.
+ *
+ * Each reader exposes rows(), columns(), chunk_rows(), nchunks(), read(start, n, out)
+ * and for_each(func), which calls func(start_row, chunk) for every chunk in order.
+ * for_each reads chunk i + 1 on a background thread while func processes chunk i,
+ * so I/O overlaps with computation and at most two chunks are resident at once.
+ *
+ * Only one thread issues HDF5 calls at any time, so a non-threadsafe HDF5 build is fine,
+ * provided func itself does not use HDF5.
+ *
+ * Building requires HDFPATH (see the Makefile), which is why this header is not part of utility.h.
+ */
+
+namespace minocore {
+
+namespace hdf5 {
+
+template<typename T> const H5::PredType &native_type();
+template<> inline const H5::PredType &native_type<float>()    {return H5::PredType::NATIVE_FLOAT;}
+template<> inline const H5::PredType &native_type<double>()   {return H5::PredType::NATIVE_DOUBLE;}
+template<> inline const H5::PredType &native_type<int32_t>()  {return H5::PredType::NATIVE_INT32;}
+template<> inline const H5::PredType &native_type<uint32_t>() {return H5::PredType::NATIVE_UINT32;}
+template<> inline const H5::PredType &native_type<int64_t>()  {return H5::PredType::NATIVE_INT64;}
+template<> inline const H5::PredType &native_type<uint64_t>() {return H5::PredType::NATIVE_UINT64;}
+
+static constexpr size_t DEFAULT_CHUNK_BYTES = size_t(64) << 20;
+
+template<typename Reader, typename F>
+void for_each_chunk(const Reader &reader, F &&func, bool prefetch=true) {
+    using MatrixType = typename Reader::MatrixType;
+    const size_t nchunks = reader.nchunks(), cr = reader.chunk_rows(), nr = reader.rows();
+    auto load = [&reader,cr,nr](size_t i) {
+        MatrixType ret;
+        const size_t start = i * cr;
+        reader.read(start, std::min(cr, nr - start), ret);
+        return ret;
+    };
+    if(!prefetch) {
+        for(size_t i = 0; i < nchunks; ++i) {
+            auto chunk = load(i);
+            func(i * cr, chunk);
+        }
+        return;
+    }
+    std::future<MatrixType> next;
+    if(nchunks) next = std::async(std::launch::async, load, size_t(0));
+    for(size_t i = 0; i < nchunks; ++i) {
+        MatrixType chunk = next.get();
+        if(i + 1 < nchunks) next = std::async(std::launch::async, load, i + 1);
+        func(i * cr, chunk);
+    }
+}
+
+template<typename Derived>
+struct ChunkedRowSource {
+    size_t nchunks() const {
+        const auto &d = static_cast<const Derived &>(*this);
+        return (d.rows() + d.chunk_rows() - 1) / d.chunk_rows();
+    }
+    template<typename F>
+    void for_each(F &&func, bool prefetch=true) const {
+        for_each_chunk(static_cast<const Derived &>(*this), std::forward<F>(func), prefetch);
+    }
+};
+
+/*
+ * Two-dimensional dense dataset; each dataset row is a point.
+ * If chunk_rows is 0, it is taken from the dataset's own chunk layout
+ * (rounded up to at least DEFAULT_CHUNK_BYTES of data) or set from DEFAULT_CHUNK_BYTES if the dataset is contiguous.
+ */
+template<typename FT=float>
+class DenseRowReader: public ChunkedRowSource<DenseRowReader<FT>> {
+    H5::H5File file_;
+    H5::DataSet ds_;
+    size_t nr_, nc_, chunk_rows_;
+public:
+    using MatrixType = blz::DM<FT>;
+    DenseRowReader(std::string path, std::string dataset, size_t chunk_rows=0):
+        file_(path.data(), H5F_ACC_RDONLY), ds_(file_.openDataSet(dataset.data()))
+    {
+        auto space = ds_.getSpace();
+        if(space.getSimpleExtentNdims() != 2)
+            throw std::invalid_argument(std::string("Dataset ") + dataset + " is not two-dimensional");
+        hsize_t dims[2];
+        space.getSimpleExtentDims(dims);
+        nr_ = dims[0]; nc_ = dims[1];
+        if(!chunk_rows) {
+            const size_t min_rows = std::max(size_t(1), DEFAULT_CHUNK_BYTES / (std::max(nc_, size_t(1)) * sizeof(FT)));
+            chunk_rows = min_rows;
+            auto plist = ds_.getCreatePlist();
+            if(plist.getLayout() == H5D_CHUNKED) {
+                hsize_t cdims[2];
+                plist.getChunk(2, cdims);
+                // Whole storage chunks, so that each one is decompressed once
+                chunk_rows = std::max(size_t(cdims[0]), min_rows / cdims[0] * cdims[0]);
+            }
+        }
+        chunk_rows_ = std::min(chunk_rows, std::max(nr_, size_t(1)));
+    }
+    size_t rows() const {return nr_;}
+    size_t columns() const {return nc_;}
+    size_t chunk_rows() const {return chunk_rows_;}
+    void read(size_t start, size_t n, MatrixType &out) const {
+        if(start + n > nr_) throw std::out_of_range("DenseRowReader: row range out of bounds");
+        out.resize(n, nc_);
+        hsize_t offset[2] = {start, 0}, count[2] = {n, nc_};
+        auto fspace = ds_.getSpace();
+        fspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+        // Memory space matches blaze's padded row layout, so data lands in place without a copy.
+        hsize_t mdims[2] = {n, out.spacing()}, moffset[2] = {0, 0};
+        H5::DataSpace mspace(2, mdims);
+        mspace.selectHyperslab(H5S_SELECT_SET, count, moffset);
+        ds_.read(out.data(), native_type<FT>(), mspace, fspace);
+    }
+};
+
+/*
+ * Compressed sparse group, in either of two layouts:
+ *   10x Genomics: CSC matrix of features x barcodes, with a "shape" dataset [nfeatures, nbarcodes].
+ *   AnnData: csr_matrix group with a "shape" attribute [nobs, nvars].
+ * In both, indptr indexes the points (barcodes/observations), so a chunk of points is a contiguous
+ * hyperslab of data and indices, and no transposition is needed.
+ * indptr is read into memory up front (8 bytes per point).
+ */
+template<typename FT=float, typename IndicesType=uint32_t>
+class SparseRowReader: public ChunkedRowSource<SparseRowReader<FT, IndicesType>> {
+    H5::H5File file_;
+    H5::Group group_;
+    H5::DataSet data_, indices_;
+    std::vector<uint64_t> indptr_;
+    size_t nr_, nc_, chunk_rows_;
+public:
+    using MatrixType = blz::SM<FT>;
+    SparseRowReader(std::string path, std::string group="matrix", size_t chunk_rows=0):
+        file_(path.data(), H5F_ACC_RDONLY), group_(file_.openGroup(group.data())),
+        data_(group_.openDataSet("data")), indices_(group_.openDataSet("indices"))
+    {
+        if(H5Lexists(group_.getId(), "shape", H5P_DEFAULT) > 0) {
+            int64_t shape[2];
+            group_.openDataSet("shape").read(shape, native_type<int64_t>());
+            nc_ = shape[0]; nr_ = shape[1];
+        } else if(group_.attrExists("shape")) {
+            if(group_.attrExists("encoding-type")) {
+                std::string enc;
+                auto attr = group_.openAttribute("encoding-type");
+                attr.read(attr.getStrType(), enc);
+                if(enc != "csr_matrix")
+                    throw NotImplementedError(std::string("Sparse encoding ") + enc + " is not supported; only csr_matrix can be read by rows without transposition");
+            }
+            int64_t shape[2];
+            group_.openAttribute("shape").read(native_type<int64_t>(), shape);
+            nr_ = shape[0]; nc_ = shape[1];
+        } else throw std::invalid_argument(std::string("Group ") + group + " has no shape dataset or attribute");
+        indptr_.resize(nr_ + 1);
+        group_.openDataSet("indptr").read(indptr_.data(), native_type<uint64_t>());
+        if(!chunk_rows) {
+            const double nnz_per_row = double(indptr_[nr_]) / std::max(nr_, size_t(1));
+            chunk_rows = std::max(size_t(1), size_t(DEFAULT_CHUNK_BYTES / ((sizeof(FT) + sizeof(IndicesType)) * std::max(nnz_per_row, 1.))));
+        }
+        chunk_rows_ = std::min(chunk_rows, std::max(nr_, size_t(1)));
+    }
+    size_t rows() const {return nr_;}
+    size_t columns() const {return nc_;}
+    size_t nonZeros() const {return indptr_[nr_];}
+    size_t chunk_rows() const {return chunk_rows_;}
+    void read(size_t start, size_t n, MatrixType &out) const {
+        if(start + n > nr_) throw std::out_of_range("SparseRowReader: row range out of bounds");
+        const hsize_t first = indptr_[start], nnz = indptr_[start + n] - first;
+        CSRArrays<FT, uint64_t, IndicesType> arr;
+        arr.nr_ = n; arr.nc_ = nc_;
+        arr.indptr_.reset(new uint64_t[n + 1]);
+        for(size_t i = 0; i <= n; ++i) arr.indptr_[i] = indptr_[start + i] - first;
+        arr.indices_.reset(new IndicesType[nnz]);
+        arr.data_.reset(new FT[nnz]);
+        if(nnz) {
+            H5::DataSpace mspace(1, &nnz);
+            auto dspace = data_.getSpace();
+            dspace.selectHyperslab(H5S_SELECT_SET, &nnz, &first);
+            data_.read(arr.data_.get(), native_type<FT>(), mspace, dspace);
+            auto ispace = indices_.getSpace();
+            ispace.selectHyperslab(H5S_SELECT_SET, &nnz, &first);
+            indices_.read(arr.indices_.get(), native_type<IndicesType>(), mspace, ispace);
+        }
+        out = csr::arrays2sparse(arr);
+    }
+};
+
+} // namespace hdf5
+
+} // namespace minocore
+
+#endif /* FGC_HDF5_H__ */
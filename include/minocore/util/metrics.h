@@ -0,0 +1,311 @@
+#pragma once
+#ifndef FGC_METRICS_H__
+#define FGC_METRICS_H__
+#include "./macros.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ * Counters and stage timers for production runs, compiled in with -DMINOCORE_METRICS.
+ * Without it, the METRICS_* macros below expand to nothing, and nothing in this file is referenced.
+ *
+ * Counters live in per-thread, cache-line-aligned slots: a thread only ever writes its own slot,
+ * so counting is an uncontended relaxed add. Counting never allocates (so it may be used in noexcept code):
+ * threads register their slots when they open a stage, and an outermost stage also registers the OpenMP team
+ * it would start (see register_threads); threads without a slot count into shared atomics instead.
+ * Totals are summed over every slot and the shared counters.
+ * Stages are nested RAII timers; a completed stage is recorded with its path
+ * (names of the enclosing stages on the same thread, joined by '/'), thread and time span.
+ * write_json reports counter totals and per-path stage totals;
+ * write_chrome_trace writes each stage as a complete event, for chrome://tracing or Perfetto.
+ */
+
+#ifdef MINOCORE_METRICS
+#  define METRICS_ONLY(...) __VA_ARGS__
+#  define METRICS_COUNT(counter, n) ::minocore::metrics::count(::minocore::metrics::counter, n)
+#  define METRICS_COUNT_DISTANCE(measure) ::minocore::metrics::count_distance(measure)
+#  define METRICS_STAGE(name) ::minocore::metrics::Stage METRICS_CAT(metrics_stage_, __LINE__)(name)
+#  define METRICS_CAT(x, y) METRICS_CAT_(x, y)
+#  define METRICS_CAT_(x, y) x##y
+#else
+#  define METRICS_ONLY(...)
+#  define METRICS_COUNT(counter, n)
+#  define METRICS_COUNT_DISTANCE(measure)
+#  define METRICS_STAGE(name)
+#endif
+
+namespace minocore {
+
+namespace metrics {
+
+enum Counter: unsigned {
+    CACHE_HITS,
+    CACHE_MISSES,
+    LLOYD_ITERATIONS,
+    SWAPS_EVALUATED,
+    SWAPS_ACCEPTED,
+    SWAPS_PRUNED,    // Swaps skipped because a bound showed they could not improve the solution
+    NCOUNTERS
+};
+
+static constexpr const char *counter_names[NCOUNTERS] {
+    "cache_hits", "cache_misses", "lloyd_iterations", "swaps_evaluated", "swaps_accepted", "swaps_pruned"
+};
+
+// Distance evaluations are counted per DissimilarityMeasure; larger values share the last slot.
+static constexpr unsigned MAX_MEASURES = 64;
+
+using clock = std::chrono::steady_clock;
+
+struct StageEvent {
+    std::string path_;
+    clock::time_point start_, stop_;
+};
+
+namespace detail {
+
+struct alignas(64) ThreadSlot {
+    std::atomic<uint64_t> counts_[NCOUNTERS];
+    std::atomic<uint64_t> distances_[MAX_MEASURES];
+    const unsigned tid_;
+    std::vector<std::string> open_;   // Paths of open stages; only touched by the owning thread
+    std::mutex events_mutex_;
+    std::vector<StageEvent> events_;
+    ThreadSlot(unsigned tid): tid_(tid) {
+        for(auto &c: counts_) c.store(0, std::memory_order_relaxed);
+        for(auto &c: distances_) c.store(0, std::memory_order_relaxed);
+    }
+    void add(std::atomic<uint64_t> &c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+// Slots are never freed, so totals include threads which have exited.
+struct Registry {
+    std::mutex mutex_;
+    std::deque<std::unique_ptr<ThreadSlot>> slots_;
+    const clock::time_point epoch_ = clock::now();
+
+    ThreadSlot *add() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_.emplace_back(new ThreadSlot(slots_.size()));
+        return slots_.back().get();
+    }
+    template<typename F>
+    void for_each(const F &f) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(auto &s: slots_) f(*s);
+    }
+};
+
+inline Registry &registry() {
+    static Registry ret;
+    return ret;
+}
+
+// Counts from threads without a slot
+inline std::atomic<uint64_t> unregistered_counts[NCOUNTERS];
+inline std::atomic<uint64_t> unregistered_distances[MAX_MEASURES];
+
+// The calling thread's slot, or null if it has none yet; constant-initialized, so never allocates
+inline ThreadSlot *&tls_slot() noexcept {
+    thread_local ThreadSlot *slot = nullptr;
+    return slot;
+}
+inline ThreadSlot &local() {
+    auto &slot = tls_slot();
+    if(!slot) slot = registry().add();
+    return *slot;
+}
+
+inline std::string escape(const std::string &s) {
+    std::string ret;
+    for(const char c: s) {
+        if(c == '"' || c == '\\') ret += '\\';
+        if(static_cast<unsigned char>(c) >= 0x20) ret += c;
+    }
+    return ret;
+}
+
+inline std::FILE *open_or_throw(const std::string &path) {
+    std::FILE *fp = std::fopen(path.data(), "w");
+    if(!fp) throw std::runtime_error(std::string("Could not open ") + path + " for writing");
+    return fp;
+}
+
+inline double us_since(clock::time_point t, clock::time_point epoch) {
+    return std::chrono::duration<double, std::micro>(t - epoch).count();
+}
+
+} // namespace detail
+
+// Gives the calling thread its own slot, if it has none yet.
+inline void register_thread() {detail::local();}
+// Registers the calling thread and each thread of the OpenMP team it would start.
+inline void register_threads() {
+    register_thread();
+    std::atomic<bool> failed(false);
+    OMP_PRAGMA("omp parallel")
+    {
+        // Exceptions may not leave an OpenMP region
+        try {register_thread();} catch(...) {failed = true;}
+    }
+    if(failed) throw std::bad_alloc();
+}
+
+inline void count(Counter c, uint64_t n=1) noexcept {
+    if(auto slot = detail::tls_slot()) slot->add(slot->counts_[c], n);
+    else detail::unregistered_counts[c].fetch_add(n, std::memory_order_relaxed);
+}
+inline void count_distance(unsigned measure) noexcept {
+    measure = std::min(measure, MAX_MEASURES - 1);
+    if(auto slot = detail::tls_slot()) slot->add(slot->distances_[measure], 1);
+    else detail::unregistered_distances[measure].fetch_add(1, std::memory_order_relaxed);
+}
+
+inline uint64_t total(Counter c) {
+    uint64_t ret = detail::unregistered_counts[c].load(std::memory_order_relaxed);
+    detail::registry().for_each([&](auto &s) {ret += s.counts_[c].load(std::memory_order_relaxed);});
+    return ret;
+}
+inline uint64_t distance_total(unsigned measure) {
+    measure = std::min(measure, MAX_MEASURES - 1);
+    uint64_t ret = detail::unregistered_distances[measure].load(std::memory_order_relaxed);
+    detail::registry().for_each([&](auto &s) {ret += s.distances_[measure].load(std::memory_order_relaxed);});
+    return ret;
+}
+
+/*
+ * Times the enclosing scope as a stage named name (a string literal, or anything outliving the Stage).
+ * Stages opened on other threads (e.g., inside OpenMP loops) start their own paths.
+ */
+class Stage {
+    detail::ThreadSlot &slot_;
+    const clock::time_point start_;
+public:
+    explicit Stage(const char *name): slot_(detail::local()), start_(clock::now()) {
+        if(slot_.open_.empty()) {
+            bool in_parallel = false;
+            OMP_ONLY(in_parallel = omp_in_parallel();)
+            if(!in_parallel) register_threads();
+        }
+        slot_.open_.push_back(slot_.open_.empty() ? std::string(name): slot_.open_.back() + '/' + name);
+    }
+    Stage(const Stage &) = delete;
+    Stage &operator=(const Stage &) = delete;
+    ~Stage() {
+        const auto stop = clock::now();
+        std::lock_guard<std::mutex> lock(slot_.events_mutex_);
+        slot_.events_.push_back(StageEvent{std::move(slot_.open_.back()), start_, stop});
+        slot_.open_.pop_back();
+    }
+};
+
+// Zeroes counters and drops recorded stages; call when no other thread is counting.
+inline void reset() {
+    for(auto &c: detail::unregistered_counts) c.store(0, std::memory_order_relaxed);
+    for(auto &c: detail::unregistered_distances) c.store(0, std::memory_order_relaxed);
+    detail::registry().for_each([](auto &s) {
+        for(auto &c: s.counts_) c.store(0, std::memory_order_relaxed);
+        for(auto &c: s.distances_) c.store(0, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(s.events_mutex_);
+        s.events_.clear();
+    });
+}
+
+struct StageTotal {
+    uint64_t count_ = 0;
+    double total_ms_ = 0., max_ms_ = 0.;
+};
+
+// Completed stages, aggregated by path
+inline std::map<std::string, StageTotal> stage_totals() {
+    std::map<std::string, StageTotal> ret;
+    detail::registry().for_each([&](auto &s) {
+        std::lock_guard<std::mutex> lock(s.events_mutex_);
+        for(const auto &e: s.events_) {
+            auto &t = ret[e.path_];
+            const double ms = std::chrono::duration<double, std::milli>(e.stop_ - e.start_).count();
+            ++t.count_;
+            t.total_ms_ += ms;
+            t.max_ms_ = std::max(t.max_ms_, ms);
+        }
+    });
+    return ret;
+}
+
+/*
+ * Writes {"counters": {...}, "distance_calls": {...}, "stages": {path: {count, total_ms, max_ms}}} to path.
+ * Measures with no calls are omitted; measure_name, if provided, names them (e.g., dist::detail::prob2str),
+ * otherwise they are keyed by number.
+ */
+inline void write_json(const std::string &path, const char *(*measure_name)(unsigned)=nullptr) {
+    std::FILE *fp = detail::open_or_throw(path);
+    std::fputs("{\n  \"counters\": {", fp);
+    for(unsigned i = 0; i < NCOUNTERS; ++i)
+        std::fprintf(fp, "%s\n    \"%s\": %llu", i ? ",": "", counter_names[i], static_cast<unsigned long long>(total(Counter(i))));
+    std::fputs("\n  },\n  \"distance_calls\": {", fp);
+    bool first = true;
+    for(unsigned m = 0; m < MAX_MEASURES; ++m) {
+        const uint64_t n = distance_total(m);
+        if(!n) continue;
+        const std::string name = measure_name ? detail::escape(measure_name(m)): std::to_string(m);
+        std::fprintf(fp, "%s\n    \"%s\": %llu", first ? "": ",", name.data(), static_cast<unsigned long long>(n));
+        first = false;
+    }
+    std::fputs("\n  },\n  \"stages\": {", fp);
+    first = true;
+    for(const auto &[p, t]: stage_totals()) {
+        std::fprintf(fp, "%s\n    \"%s\": {\"count\": %llu, \"total_ms\": %.6f, \"max_ms\": %.6f}",
+                     first ? "": ",", detail::escape(p).data(), static_cast<unsigned long long>(t.count_), t.total_ms_, t.max_ms_);
+        first = false;
+    }
+    std::fputs("\n  }\n}\n", fp);
+    if(std::fclose(fp)) throw std::runtime_error(std::string("Failed to write ") + path);
+}
+
+/*
+ * Writes completed stages in the Chrome trace event format, one complete ("X") event per stage,
+ * with timestamps in microseconds since the first use of metrics in this process.
+ * The stage's leaf name is the event name, and its full path is in args.
+ */
+inline void write_chrome_trace(const std::string &path) {
+    std::FILE *fp = detail::open_or_throw(path);
+    auto &reg = detail::registry();
+    std::fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", fp);
+    bool first = true;
+    reg.for_each([&](auto &s) {
+        std::lock_guard<std::mutex> lock(s.events_mutex_);
+        for(const auto &e: s.events_) {
+            const auto slash = e.path_.rfind('/');
+            const std::string path = detail::escape(e.path_),
+                              name = detail::escape(slash == std::string::npos ? e.path_: e.path_.substr(slash + 1));
+            std::fprintf(fp, "%s\n{\"name\": \"%s\", \"cat\": \"stage\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"path\": \"%s\"}}",
+                         first ? "": ",", name.data(), s.tid_, detail::us_since(e.start_, reg.epoch_),
+                         std::chrono::duration<double, std::micro>(e.stop_ - e.start_).count(), path.data());
+            first = false;
+        }
+    });
+    std::fputs("\n]}\n", fp);
+    if(std::fclose(fp)) throw std::runtime_error(std::string("Failed to write ") + path);
+}
+
+} // namespace metrics
+
+} // namespace minocore
+
+#endif /* FGC_METRICS_H__ */
@@ -0,0 +1,310 @@
+#ifndef FGC_MTX_H__
+#define FGC_MTX_H__
+#include "./csr.h"
+#include "./exception.h"
+#include "./fastparse.h"
+#include "./timer.h"
+#include <cctype>
+#include <climits>
+#include <numeric>
+#include <zlib.h>
+
+/*
+ * Matrix Market (coordinate format) reader.
+ *
+ * Regular uncompressed files are memory-mapped and parsed in parallel in one pass;
+ * anything else (gzip-compressed files, pipes) is streamed through zlib in large chunks,
+ * each of which is parsed in parallel.
+ * Entries may appear in any order: they are bucketed by row with a parallel counting sort,
+ * and each row is then sorted by column.
+ */
+
+namespace minocore {
+
+namespace mtx {
+
+enum Field {
+    REAL,
+    INTEGER,
+    PATTERN
+};
+
+enum Symmetry {
+    GENERAL,
+    SYMMETRIC,
+    SKEW_SYMMETRIC
+};
+
+struct Header {
+    Field field_ = REAL;
+    Symmetry symmetry_ = GENERAL;
+    size_t nr_ = 0, nc_ = 0, nnz_ = 0;
+};
+
+template<typename FT>
+struct Entry {
+    uint32_t row_, col_;
+    FT value_;
+};
+
+namespace detail {
+
+inline bool ci_contains(const char *b, const char *e, const char *key) {
+    const size_t kl = std::strlen(key);
+    for(; b + kl <= e; ++b)
+        if(std::equal(b, b + kl, key, [](char x, char y) {return std::tolower(x) == y;}))
+            return true;
+    return false;
+}
+
+/*
+ * Parses the banner, comments and size line. Returns a pointer to the first entry line, or nullptr if [p, e) ends before the size line.
+ * If at_eof is set, [p, e) is the whole rest of the input, so a final line without a newline is complete.
+ */
+inline const char *parse_header(const char *p, const char *e, Header &h, bool at_eof=false) {
+    for(; p < e;) {
+        const char *le = fastparse::line_end(p, e);
+        if(le == e && !at_eof) return nullptr; // incomplete line
+        if(*p == '%') {
+            if(le - p > 14 && std::strncmp(p, "%%MatrixMarket", 14) == 0) {
+                if(!ci_contains(p, le, "coordinate"))
+                    throw NotImplementedError("Only coordinate-format Matrix Market files are supported");
+                if(ci_contains(p, le, "complex"))
+                    throw NotImplementedError("Complex Matrix Market files are not supported");
+                h.field_ = ci_contains(p, le, "pattern") ? PATTERN: ci_contains(p, le, "integer") ? INTEGER: REAL;
+                h.symmetry_ = ci_contains(p, le, "skew-symmetric") ? SKEW_SYMMETRIC: ci_contains(p, le, "symmetric") ? SYMMETRIC: GENERAL;
+                if(ci_contains(p, le, "hermitian")) throw NotImplementedError("Hermitian Matrix Market files are not supported");
+            }
+        } else {
+            const char *q = p;
+            while(q < le && fastparse::ishspace(*q)) ++q;
+            if(q != le) {
+                h.nr_ = fastparse::parse_uint(q, le);
+                h.nc_ = fastparse::parse_uint(q, le);
+                h.nnz_ = fastparse::parse_uint(q, le);
+                if(!h.nr_ || !h.nc_) throw std::runtime_error("Failed to parse Matrix Market size line");
+                // Entries store 32-bit indices
+                if(std::max(h.nr_, h.nc_) > (uint64_t(1) << 32))
+                    throw std::runtime_error("Matrix Market dimensions exceed 2^32");
+                return std::min(le + 1, e);
+            }
+        }
+        p = std::min(le + 1, e);
+    }
+    return nullptr;
+}
+
+/*
+ * Parses complete lines in [b, e) in parallel and appends to out in file order.
+ * If transpose is set, the file's row indices become columns and vice versa.
+ * Returns the number of entry lines parsed (before symmetric expansion).
+ */
+template<typename FT>
+size_t parse_entries(const char *b, const char *e, const Header &h, bool transpose, std::vector<Entry<FT>> &out,
+                     size_t nchunks=fastparse::default_nchunks())
+{
+    auto chunks = fastparse::line_chunks(b, e, nchunks);
+    std::vector<std::vector<Entry<FT>>> parts(chunks.size());
+    std::vector<size_t> nlines(chunks.size());
+    const size_t nr = transpose ? h.nc_: h.nr_, nc = transpose ? h.nr_: h.nc_;
+    int bad = 0;
+    OMP_PFOR_DYN
+    for(size_t i = 0; i < chunks.size(); ++i) {
+        auto &part = parts[i];
+        part.reserve((chunks[i].second - chunks[i].first) / 12);
+        for(const char *s = chunks[i].first, *ce = chunks[i].second; s < ce; s = fastparse::next_line(s, ce)) {
+            const char *le = fastparse::line_end(s, ce);
+            while(s < le && fastparse::ishspace(*s)) ++s;
+            if(s == le || *s == '%') continue;
+            uint64_t r = fastparse::parse_uint(s, le) - 1, c = fastparse::parse_uint(s, le) - 1;
+            FT v;
+            switch(h.field_) {
+                case PATTERN: v = 1; break;
+                case INTEGER: {
+                    while(s < le && fastparse::ishspace(*s)) ++s;
+                    const bool neg = s < le && *s == '-';
+                    s += neg;
+                    const auto x = fastparse::parse_uint(s, le);
+                    v = neg ? -FT(x): FT(x);
+                    break;
+                }
+                default: v = fastparse::parse_double(s, le);
+            }
+            if(transpose) std::swap(r, c);
+            if(unlikely(r >= nr || c >= nc)) {
+                OMP_ATOMIC
+                ++bad;
+                break;
+            }
+            part.push_back(Entry<FT>{uint32_t(r), uint32_t(c), v});
+            if(h.symmetry_ != GENERAL && r != c)
+                part.push_back(Entry<FT>{uint32_t(c), uint32_t(r), h.symmetry_ == SKEW_SYMMETRIC ? -v: v});
+            ++nlines[i];
+        }
+    }
+    if(bad) throw std::runtime_error("Matrix Market entry index out of range");
+    fastparse::concatenate(parts, out, out.size());
+    return std::accumulate(nlines.begin(), nlines.end(), size_t(0));
+}
+
+} // namespace detail
+
+/*
+ * Parallel counting sort of coordinate entries into CSR arrays.
+ * Entries are split into contiguous blocks, each histograms its rows,
+ * and each block scatters into its own offsets within every row (so the scatter is stable).
+ * Rows are then sorted by column. Duplicate coordinates are rejected.
+ */
+template<typename FT, typename IndPtrType=uint64_t, typename IndicesType=uint32_t>
+CSRArrays<FT, IndPtrType, IndicesType> entries2csr(const std::vector<Entry<FT>> &entries, size_t nr, size_t nc) {
+    const size_t nnz = entries.size();
+    size_t nt = 1;
+    OMP_ONLY(nt = omp_get_max_threads();)
+    const size_t nblocks = std::max(size_t(1), std::min(nt, nnz / std::max(nr, size_t(1))));
+    std::unique_ptr<IndPtrType[]> offsets(new IndPtrType[nblocks * nr]());
+    CSRArrays<FT, IndPtrType, IndicesType> ret;
+    ret.nr_ = nr; ret.nc_ = nc;
+    ret.indptr_.reset(new IndPtrType[nr + 1]);
+    ret.indices_.reset(new IndicesType[nnz]);
+    ret.data_.reset(new FT[nnz]);
+    auto block_start = [&](size_t b) {return nnz * b / nblocks;};
+    OMP_PFOR
+    for(size_t b = 0; b < nblocks; ++b) {
+        IndPtrType *const counts = offsets.get() + b * nr;
+        for(size_t i = block_start(b), e = block_start(b + 1); i < e; ++i)
+            ++counts[entries[i].row_];
+    }
+    ret.indptr_[0] = 0;
+    OMP_PFOR
+    for(size_t r = 0; r < nr; ++r) {
+        IndPtrType total = 0;
+        for(size_t b = 0; b < nblocks; ++b) {
+            auto &c = offsets[b * nr + r];
+            const auto tmp = c;
+            c = total;
+            total += tmp;
+        }
+        ret.indptr_[r + 1] = total;
+    }
+    std::partial_sum(ret.indptr_.get(), ret.indptr_.get() + nr + 1, ret.indptr_.get());
+    OMP_PFOR
+    for(size_t b = 0; b < nblocks; ++b) {
+        IndPtrType *const pos = offsets.get() + b * nr;
+        for(size_t i = block_start(b), e = block_start(b + 1); i < e; ++i) {
+            const auto &entry = entries[i];
+            const size_t dest = ret.indptr_[entry.row_] + pos[entry.row_]++;
+            ret.indices_[dest] = entry.col_;
+            ret.data_[dest] = entry.value_;
+        }
+    }
+    offsets.reset();
+    int duplicates = 0;
+    OMP_PFOR_DYN
+    for(size_t r = 0; r < nr; ++r) {
+        const size_t b = ret.indptr_[r], e = ret.indptr_[r + 1];
+        IndicesType *idx = ret.indices_.get();
+        if(!std::is_sorted(idx + b, idx + e)) {
+            std::vector<std::pair<IndicesType, FT>> tmp(e - b);
+            for(size_t i = b; i < e; ++i) tmp[i - b] = {idx[i], ret.data_[i]};
+            shared::sort(tmp.begin(), tmp.end(), [](const auto &x, const auto &y) {return x.first < y.first;});
+            for(size_t i = b; i < e; ++i) std::tie(idx[i], ret.data_[i]) = tmp[i - b];
+        }
+        if(std::adjacent_find(idx + b, idx + e) != idx + e) {
+            OMP_ATOMIC
+            ++duplicates;
+        }
+    }
+    if(duplicates) throw std::runtime_error(std::to_string(duplicates) + " rows contain duplicate Matrix Market coordinates");
+    return ret;
+}
+
+/*
+ * Reads a coordinate Matrix Market file into CSR arrays.
+ * By default (transpose=true), the file's columns become rows, matching mtx2sparse's historical behavior:
+ * features x samples files (e.g., 10x Genomics matrix.mtx) yield one row per sample.
+ * chunk_bytes bounds the decompressed bytes held at once when streaming.
+ */
+template<typename FT=float, typename IndPtrType=uint64_t, typename IndicesType=uint32_t>
+CSRArrays<FT, IndPtrType, IndicesType> read_mtx(const std::string &path, bool transpose=true, size_t chunk_bytes=size_t(64) << 20) {
+    Header h;
+    std::vector<Entry<FT>> entries;
+    size_t nlines = 0;
+    struct stat st;
+    const bool is_gz = path.size() > 3 && std::equal(path.end() - 3, path.end(), ".gz");
+    if(!is_gz && ::stat(path.data(), &st) == 0 && S_ISREG(st.st_mode)) {
+        csr::MappedFile mf(path);
+        mf.advise(MADV_SEQUENTIAL);
+        const char *b = static_cast<const char *>(mf.data()), *e = b + mf.size();
+        const char *p = detail::parse_header(b, e, h, /*at_eof=*/true);
+        if(!p) throw std::runtime_error(std::string("Failed to parse Matrix Market header from ") + path);
+        entries.reserve(h.symmetry_ == GENERAL ? h.nnz_: 2 * h.nnz_);
+        nlines = detail::parse_entries(p, e, h, transpose, entries);
+    } else {
+        gzFile fp = gzopen(path.data(), "rb");
+        if(!fp) throw std::runtime_error(std::string("Failed to open ") + path);
+        gzbuffer(fp, 1 << 20);
+        std::vector<char> buf(chunk_bytes);
+        size_t carry = 0;
+        bool have_header = false;
+        for(;;) {
+            if(carry == buf.size()) buf.resize(buf.size() * 2); // A single line larger than the buffer
+            const int nread = gzread(fp, buf.data() + carry, std::min(buf.size() - carry, size_t(INT_MAX)));
+            if(nread < 0) {
+                gzclose(fp);
+                throw std::runtime_error(std::string("zlib error reading ") + path);
+            }
+            const bool eof = nread == 0;
+            if(eof && carry && buf[carry - 1] != '\n') buf[carry++] = '\n'; // Terminate the final line
+            const size_t total = carry + nread;
+            const char *b = buf.data(), *e = b + total;
+            const char *lastnl = static_cast<const char *>(::memrchr(b, '\n', total));
+            const char *complete_end = lastnl ? lastnl + 1: b;
+            const char *p = b;
+            if(!have_header) {
+                if((p = detail::parse_header(b, complete_end, h)) == nullptr) {
+                    if(eof) break;
+                    p = b;
+                    carry = total;
+                    continue;
+                }
+                have_header = true;
+                entries.reserve(h.symmetry_ == GENERAL ? h.nnz_: 2 * h.nnz_);
+            }
+            nlines += detail::parse_entries(p, complete_end, h, transpose, entries);
+            carry = e - complete_end;
+            std::memmove(buf.data(), complete_end, carry);
+            if(eof) break;
+        }
+        gzclose(fp);
+        if(!have_header) throw std::runtime_error(std::string("Failed to parse Matrix Market header from ") + path);
+    }
+    if(nlines != h.nnz_)
+        throw std::runtime_error(std::string("Matrix Market file ") + path + " declares " + std::to_string(h.nnz_) + " entries but contains " + std::to_string(nlines));
+    const size_t nr = transpose ? h.nc_: h.nr_, nc = transpose ? h.nr_: h.nc_;
+    return entries2csr<FT, IndPtrType, IndicesType>(entries, nr, nc);
+}
+
+} // namespace mtx
+
+/*
+ * Loads a Matrix Market file into a CompressedMatrix.
+ * As before, the file's first coordinate is treated as the column (see read_mtx);
+ * pass transpose=false to keep the file's orientation.
+ */
+template<typename FT=float, bool SO=blaze::rowMajor>
+blz::SM<FT, SO> mtx2sparse(std::string path, bool transpose=true) {
+    util::Timer t("mtx2sparse load time");
+    auto arr = mtx::read_mtx<FT>(path, transpose);
+    if constexpr(SO == blaze::rowMajor) return csr::arrays2sparse(arr);
+    else return blz::SM<FT, SO>(csr::arrays2sparse(arr));
+}
+
+// As mtx2sparse, but returns an owned CSRMatrixView without copying into blaze storage.
+template<typename FT=float>
+CSRMatrixView<FT, uint64_t, uint32_t> mtx2csr_view(std::string path, bool transpose=true) {
+    return csr::arrays2view(mtx::read_mtx<FT>(path, transpose));
+}
+
+} // namespace minocore
+
+#endif /* FGC_MTX_H__ */
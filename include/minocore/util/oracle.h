@@ -1,10 +1,14 @@
 #ifndef FGC_ORACLE_H__
 #define FGC_ORACLE_H__
 #include <vector>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
+#include <thread>
 #include <unordered_map>
 #include "./macros.h"
+#include "./metrics.h"
 
 namespace minocore {
 
@@ -72,6 +76,19 @@ struct PairKeyType {
     }
 };
 
+struct CacheStats {
+    uint64_t hits_ = 0, misses_ = 0, evictions_ = 0;
+    uint64_t lookups() const {return hits_ + misses_;}
+    double hit_rate() const {return lookups() ? double(hits_) / lookups(): 0.;}
+    CacheStats &operator+=(const CacheStats &o) {
+        hits_ += o.hits_; misses_ += o.misses_; evictions_ += o.evictions_;
+        return *this;
+    }
+    CacheStats operator-(const CacheStats &o) const {
+        return CacheStats{hits_ - o.hits_, misses_ - o.misses_, evictions_ - o.evictions_};
+    }
+};
+
 
 template<typename Oracle, template<typename...> class Map=std::unordered_map, bool symmetric=true, bool threadsafe=false, typename IT=std::uint32_t>
 struct CachingOracleWrapper {
@@ -220,71 +237,270 @@ auto make_matrix_m(const Mat &mat) {
 }
 
 
+/*
+ * Caches whole rows of the oracle, for algorithms which touch every point for each selected facility.
+ * If max_rows is nonzero, at most max_rows rows are kept, replaced in CLOCK order
+ * (a row is skipped once by the hand if it has been read since the hand last passed it).
+ * All accesses take mut_, so threadsafe is kept only for compatibility.
+ */
 template<typename Oracle, template<typename...> class Map=std::unordered_map, bool symmetric=true, bool threadsafe=false, typename IT=std::uint32_t, typename FT=float,
           bool use_row_vector=true>
 struct RowCachingOracleWrapper {
     using output_type = std::decay_t<decltype(std::declval<Oracle>()(0,0))>;
     using VType = blaze::DynamicVector<FT, use_row_vector ? blaze::rowVector: blaze::columnVector>;
-    using map_type = Map<IT, VType>;
+    using map_type = Map<IT, size_t>; // Row id to slot in rows_
     const Oracle &oracle_;
-    mutable map_type map_;
     size_t np_;
 private:
+    mutable map_type map_;
+    mutable std::vector<VType> rows_;
+    mutable std::vector<IT> slot_ids_;
+    size_t max_rows_;
+    mutable size_t hand_ = 0;
+    std::unique_ptr<std::atomic<uint8_t>[]> ref_; // CLOCK reference bits; only used if max_rows_ is set
     mutable std::shared_mutex mut_;
-    using map_iterator = typename map_type::iterator;
-    // TODO: use two kinds of locks
+    mutable std::atomic<uint64_t> hits_{0}, misses_{0}, evictions_{0};
+
+    // Requires at least a shared lock on mut_
+    bool find_cached(IT lh, IT rh, output_type &ret) const {
+        auto it = map_.find(lh);
+        if constexpr(symmetric) {
+            if(it == map_.end() && (it = map_.find(rh)) != map_.end()) std::swap(lh, rh);
+        }
+        if(it == map_.end()) return false;
+        ret = rows_[it->second][rh];
+        if(max_rows_) ref_[it->second].store(1, std::memory_order_relaxed);
+        return true;
+    }
+    // Requires a unique lock on mut_
+    void insert_row(IT id, VType &&row) const {
+        size_t slot;
+        if(!max_rows_ || rows_.size() < max_rows_) {
+            slot = rows_.size();
+            rows_.emplace_back(std::move(row));
+            slot_ids_.push_back(id);
+        } else {
+            while(ref_[hand_].exchange(0, std::memory_order_relaxed))
+                hand_ = (hand_ + 1) % max_rows_;
+            slot = hand_;
+            hand_ = (hand_ + 1) % max_rows_;
+            map_.erase(slot_ids_[slot]);
+            rows_[slot] = std::move(row);
+            slot_ids_[slot] = id;
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+        if(max_rows_) ref_[slot].store(1, std::memory_order_relaxed);
+        map_.emplace(id, slot);
+    }
+    // Requires at least a shared lock on mut_, for reading other cached rows
+    VType compute_row(IT lh) const {
+        VType tmp(np_);
+        OMP_PFOR
+        for(size_t j = 0; j < np_; ++j) {
+            if constexpr(symmetric) {
+                if(auto it = map_.find(j); it != map_.end()) {
+                    tmp[j] = rows_[it->second][lh];
+                    continue;
+                }
+            }
+            tmp[j] = oracle_(lh, j);
+        }
+        return tmp;
+    }
 public:
-    RowCachingOracleWrapper(const Oracle &oracle, size_t np, size_t rsvsz=0): oracle_(oracle), np_(np) {
-        map_.reserve(rsvsz ? rsvsz: np);
+    RowCachingOracleWrapper(const Oracle &oracle, size_t np, size_t rsvsz=0, size_t max_rows=0):
+        oracle_(oracle), np_(np), max_rows_(max_rows)
+    {
+        const size_t rsv = rsvsz ? rsvsz: max_rows ? std::min(max_rows, np): np;
+        map_.reserve(rsv);
+        rows_.reserve(rsv);
+        slot_ids_.reserve(rsv);
+        if(max_rows_) {
+            ref_.reset(new std::atomic<uint8_t>[max_rows_]);
+            for(size_t i = 0; i < max_rows_; ++i) ref_[i].store(0, std::memory_order_relaxed);
+        }
     }
     template<typename It>
     void cache_range(It start, It end) const {
-        unsigned n = std::distance(start, end);
-        for(auto i = 0u; i < n; ++i) {
-            VType tmp(np_);
-            auto lhi = start[i];
-            if(map_.find(lhi) != map_.end()) continue;
-            OMP_PFOR
-            for(size_t j = 0; j < np_; ++j) {
-                auto it = map_.find(j);
-                tmp[j] = (it == map_.end()) ? oracle_(lhi, j): it->second[lhi];
+        const size_t n = std::distance(start, end);
+        // With a row budget, caching more than it holds would only evict the first rows of the range
+        for(size_t i = 0, e = max_rows_ ? std::min(n, max_rows_): n; i < e; ++i) {
+            const IT lhi = start[i];
+            VType tmp;
+            {
+                std::shared_lock<std::shared_mutex> slock(mut_);
+                if(map_.find(lhi) != map_.end()) continue;
+                tmp = compute_row(lhi);
             }
-            map_.emplace(lhi, std::move(tmp));
+            std::unique_lock<std::shared_mutex> ulock(mut_);
+            if(map_.find(lhi) == map_.end()) insert_row(lhi, std::move(tmp));
         }
     }
     output_type operator()(IT lh, IT rh) const {
+        output_type ret;
+        VType tmp;
+        {
+            std::shared_lock<std::shared_mutex> slock(mut_);
+            if(find_cached(lh, rh, ret)) {
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                METRICS_COUNT(CACHE_HITS, 1);
+                return ret;
+            }
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            METRICS_COUNT(CACHE_MISSES, 1);
+            tmp = compute_row(lh);
+        }
+        ret = tmp[rh];
+        std::unique_lock<std::shared_mutex> ulock(mut_);
+        if(map_.find(lh) == map_.end()) insert_row(lh, std::move(tmp));
+        return ret;
+    }
+    size_t size() const {
         std::shared_lock<std::shared_mutex> slock(mut_);
-        map_iterator it;
-        if((it = map_.find(lh)) != map_.end())
-            return it->second[rh];
-        if constexpr(symmetric) {
-            if((it = map_.find(rh)) != map_.end())
-                return it->second[lh];
+        return rows_.size();
+    }
+    size_t max_rows() const {return max_rows_;}
+    // Hits and misses count lookups; rows computed by cache_range are not lookups.
+    CacheStats stats() const {
+        return CacheStats{hits_.load(std::memory_order_relaxed), misses_.load(std::memory_order_relaxed),
+                          evictions_.load(std::memory_order_relaxed)};
+    }
+};
+
+/*
+ * Pairwise cache with a fixed memory budget, for oracles shared by many threads.
+ * Keys hash to one of nshards lock-striped shards and, within it, to a set of WAYS entries.
+ * Misses are computed outside the lock and stored in a free way of the set, or over the victim
+ * chosen by the set's CLOCK hand. Unlike CachingOracleWrapper, memory never grows past the budget;
+ * each shard allocates its sets on its first insertion, so untouched shards cost nothing.
+ */
+template<typename Oracle, bool symmetric=true, typename IT=std::uint32_t>
+class ShardedCachingOracle {
+public:
+    using output_type = std::decay_t<decltype(std::declval<Oracle>()(0,0))>;
+    static constexpr unsigned WAYS = 8;
+    static_assert(sizeof(IT) <= 4, "ShardedCachingOracle packs index pairs into 64-bit keys");
+private:
+    static constexpr uint64_t EMPTY = uint64_t(-1);
+    struct Set {
+        uint64_t keys_[WAYS];
+        output_type vals_[WAYS];
+        uint8_t ref_ = 0, hand_ = 0;
+        Set() {std::fill(keys_, keys_ + WAYS, EMPTY);}
+    };
+    struct alignas(64) Shard {
+        std::mutex mut_;
+        std::unique_ptr<Set[]> sets_; // Guarded by mut_; null until the first insertion
+        std::atomic<uint64_t> hits_{0}, misses_{0}, evictions_{0};
+    };
+    const Oracle &oracle_;
+    size_t nshards_, sets_per_shard_;
+    std::unique_ptr<Shard[]> shards_;
+
+    static uint64_t make_key(IT lh, IT rh) {return (uint64_t(lh) << 32) | uint64_t(rh);}
+    static uint64_t hash(uint64_t key) {
+        key ^= key >> 33; key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33; key *= 0xc4ceb9fe1a85ec53ull;
+        return key ^ (key >> 33);
+    }
+    // Requires the shard's lock
+    static bool find(const Set &s, uint64_t key, unsigned &way) {
+        for(way = 0; way < WAYS; ++way) if(s.keys_[way] == key) return true;
+        return false;
+    }
+public:
+    /*
+     * budget_bytes bounds the memory used by cached entries.
+     * max_entries, if nonzero, is the number of distinct keys that can be looked up (e.g., np * (np - 1) / 2),
+     * so that no more memory than that is ever reserved.
+     * nshards is rounded up to a power of two; 0 uses 4 shards per hardware thread.
+     */
+    ShardedCachingOracle(const Oracle &oracle, size_t budget_bytes=size_t(256) << 20, size_t nshards=0, size_t max_entries=0): oracle_(oracle) {
+        if(!nshards) nshards = 4 * std::max(1u, std::thread::hardware_concurrency());
+        for(nshards_ = 1; nshards_ < nshards; nshards_ <<= 1);
+        size_t nsets = budget_bytes / sizeof(Set) / nshards_;
+        if(max_entries) nsets = std::min(nsets, (max_entries + WAYS * nshards_ - 1) / (WAYS * nshards_));
+        sets_per_shard_ = std::max(size_t(1), nsets);
+        shards_.reset(new Shard[nshards_]);
+    }
+    output_type operator()(IT lh, IT rh) const {
+        if constexpr(symmetric) if(lh > rh) std::swap(lh, rh);
+        const uint64_t key = make_key(lh, rh), h = hash(key);
+        const size_t shard_id = h & (nshards_ - 1), set_id = (h >> 32) % sets_per_shard_;
+        Shard &sh = shards_[shard_id];
+        unsigned way;
+        {
+            std::lock_guard<std::mutex> lock(sh.mut_);
+            if(sh.sets_ && find(sh.sets_[set_id], key, way)) {
+                Set &s = sh.sets_[set_id];
+                s.ref_ |= 1u << way;
+                sh.hits_.fetch_add(1, std::memory_order_relaxed);
+                METRICS_COUNT(CACHE_HITS, 1);
+                return s.vals_[way];
+            }
         }
-        VType tmp(np_);
-#ifdef _OPENMP
-#       pragma omp parallel for
-#endif
-        for(size_t i = 0; i < np_; ++i) 
-            tmp[i] = oracle_(lh, i);
-        output_type ret = tmp[rh];
-#ifndef NDEBUG
-        size_t oldsize = map_.size();
-#endif
-        if constexpr(threadsafe) {
-            slock.unlock();
-            std::unique_lock<std::shared_mutex> ulock(mut_);
-            if(map_.find(lh) != map_.end()) return ret;
-            map_.emplace(lh, std::move(tmp));
-        } else {
-            map_.emplace(lh, std::move(tmp));
+        sh.misses_.fetch_add(1, std::memory_order_relaxed);
+        METRICS_COUNT(CACHE_MISSES, 1);
+        const output_type ret = oracle_(lh, rh);
+        std::lock_guard<std::mutex> lock(sh.mut_);
+        if(!sh.sets_) sh.sets_.reset(new Set[sets_per_shard_]);
+        Set &s = sh.sets_[set_id];
+        if(find(s, key, way)) return ret; // Inserted by another thread in the meantime
+        if(!find(s, EMPTY, way)) {
+            while(s.ref_ & (1u << s.hand_)) {
+                s.ref_ &= ~(1u << s.hand_);
+                s.hand_ = (s.hand_ + 1) % WAYS;
+            }
+            way = s.hand_;
+            s.hand_ = (s.hand_ + 1) % WAYS;
+            sh.evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+        s.keys_[way] = key;
+        s.vals_[way] = ret;
+        s.ref_ &= ~(1u << way);
+        return ret;
+    }
+    bool contains(IT lh, IT rh) const {
+        if constexpr(symmetric) if(lh > rh) std::swap(lh, rh);
+        const uint64_t key = make_key(lh, rh), h = hash(key);
+        Shard &sh = shards_[h & (nshards_ - 1)];
+        std::lock_guard<std::mutex> lock(sh.mut_);
+        unsigned way;
+        return sh.sets_ && find(sh.sets_[(h >> 32) % sets_per_shard_], key, way);
+    }
+    size_t capacity() const {return nshards_ * sets_per_shard_ * WAYS;}
+    // Bytes of sets allocated so far
+    size_t allocated_bytes() const {
+        size_t ret = 0;
+        for(size_t i = 0; i < nshards_; ++i) {
+            std::lock_guard<std::mutex> lock(shards_[i].mut_);
+            if(shards_[i].sets_) ret += sets_per_shard_ * sizeof(Set);
         }
-        DBG_ONLY(if(oldsize != map_.size()) std::fprintf(stderr, "New size: %zu\n", map_.size());)
-        if constexpr(threadsafe) slock.unlock();
         return ret;
     }
+    size_t nshards() const {return nshards_;}
+    CacheStats stats() const {
+        CacheStats ret;
+        for(size_t i = 0; i < nshards_; ++i) {
+            ret.hits_ += shards_[i].hits_.load(std::memory_order_relaxed);
+            ret.misses_ += shards_[i].misses_.load(std::memory_order_relaxed);
+            ret.evictions_ += shards_[i].evictions_.load(std::memory_order_relaxed);
+        }
+        return ret;
+    }
+    void clear() {
+        for(size_t i = 0; i < nshards_; ++i) {
+            std::lock_guard<std::mutex> lock(shards_[i].mut_);
+            shards_[i].sets_.reset();
+        }
+    }
 };
 
+template<bool symmetric=true, typename IT=std::uint32_t, typename Oracle>
+auto make_sharded_caching_oracle(const Oracle &oracle, size_t budget_bytes=size_t(256) << 20, size_t nshards=0, size_t max_entries=0) {
+    return ShardedCachingOracle<Oracle, symmetric, IT>(oracle, budget_bytes, nshards, max_entries);
+}
+
 template<typename It, typename It2, typename T>
 void prep_range(It, It2, const T &) {}
 
@@ -294,10 +510,23 @@ void prep_range(It start, It2 end, const RowCachingOracleWrapper<Oracle, Map, sy
 }
 
 template<template<typename...> class Map=std::unordered_map, bool symmetric=true, bool threadsafe=false, typename IT=std::uint32_t, typename FT=float, typename Oracle>
-auto make_row_caching_oracle_wrapper(const Oracle &oracle, size_t np, size_t rsvsz=0) {
-    return RowCachingOracleWrapper<Oracle, Map, symmetric, threadsafe, IT, FT>(oracle, np, rsvsz);
+auto make_row_caching_oracle_wrapper(const Oracle &oracle, size_t np, size_t rsvsz=0, size_t max_rows=0) {
+    return RowCachingOracleWrapper<Oracle, Map, symmetric, threadsafe, IT, FT>(oracle, np, rsvsz, max_rows);
 }
 
+/*
+ * Cumulative hit/miss counts of a caching oracle, or zeros for oracles without a cache.
+ * Wrappers report the statistics of the oracle they wrap.
+ */
+template<typename T>
+CacheStats cache_stats(const T &) {return CacheStats{};}
+template<typename Oracle, template<typename...> class Map, bool sym, bool ts, typename IT, typename FT, bool use_row_vector>
+CacheStats cache_stats(const RowCachingOracleWrapper<Oracle, Map, sym, ts, IT, FT, use_row_vector> &x) {return x.stats();}
+template<typename Oracle, bool sym, typename IT>
+CacheStats cache_stats(const ShardedCachingOracle<Oracle, sym, IT> &x) {return x.stats();}
+template<typename Oracle, typename IT>
+CacheStats cache_stats(const OracleWrapper<Oracle, IT> &x) {return cache_stats(x.oracle_);}
+
 
 } // namespace minocore
 
@@ -0,0 +1,347 @@
+#ifndef FGC_SERIALIZE_H__
+#define FGC_SERIALIZE_H__
+#include "./csr.h"
+#include <zlib.h>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Versioned binary container for flat arrays.
+ *
+ * Layout (all integers little-endian):
+ *   FileHeader (64 bytes)
+ *   SectionInfo[nsections] (48 bytes each)
+ *   section payloads, each starting at a 64-byte aligned offset
+ *
+ * Uncompressed payloads are the raw arrays, so a Reader over a memory-mapped file hands out
+ * pointers into the mapping without copying.
+ * Compressed payloads are split into independently zlib-compressed blocks:
+ *   uint64_t nblocks, uint64_t block_bytes, uint64_t compressed_sizes[nblocks], blocks...
+ * and are decompressed in parallel on access.
+ */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "minocore binary serialization assumes a little-endian host"
+#endif
+
+namespace minocore {
+
+namespace serial {
+
+static constexpr char MAGIC[8] = {'M', 'I', 'N', 'O', 'C', 'O', 'R', 'E'};
+static constexpr uint32_t VERSION = 1;
+static constexpr size_t ALIGNMENT = 64;
+static constexpr size_t DEFAULT_BLOCK_BYTES = size_t(1) << 20;
+
+enum Kind: uint32_t {
+    INDEX_CORESET         = 1,
+    DENSE_MATRIX_CORESET  = 2,
+    SPARSE_MATRIX_CORESET = 3,
+    CORESET_SAMPLER       = 4,
+    SOLUTION              = 5,
+    STREAMING_STATE       = 6,
+    APPLICATOR_STATE      = 7
+};
+
+enum DType: uint8_t {
+    U8 = 1, U32 = 2, U64 = 3, I32 = 4, I64 = 5, F32 = 6, F64 = 7
+};
+template<typename T> struct dtype_of;
+template<> struct dtype_of<uint8_t>  {static constexpr DType value = U8;};
+template<> struct dtype_of<uint32_t> {static constexpr DType value = U32;};
+template<> struct dtype_of<uint64_t> {static constexpr DType value = U64;};
+template<> struct dtype_of<int32_t>  {static constexpr DType value = I32;};
+template<> struct dtype_of<int64_t>  {static constexpr DType value = I64;};
+template<> struct dtype_of<float>    {static constexpr DType value = F32;};
+template<> struct dtype_of<double>   {static constexpr DType value = F64;};
+template<typename T> static constexpr DType dtype_of_v = dtype_of<std::remove_const_t<T>>::value;
+
+static constexpr uint32_t make_tag(const char (&s)[5]) {
+    return uint32_t(uint8_t(s[0])) | (uint32_t(uint8_t(s[1])) << 8) | (uint32_t(uint8_t(s[2])) << 16) | (uint32_t(uint8_t(s[3])) << 24);
+}
+
+struct FileHeader {
+    char magic_[8];
+    uint32_t version_;
+    uint32_t kind_;
+    uint32_t nsections_;
+    uint32_t flags_;
+    uint64_t reserved_[5];
+};
+static_assert(sizeof(FileHeader) == 64, "FileHeader must be 64 bytes");
+
+struct SectionInfo {
+    uint32_t tag_;
+    uint8_t dtype_;
+    uint8_t compressed_;
+    uint16_t pad_;
+    uint64_t count_;        // Number of elements
+    uint64_t offset_;       // Offset of the payload from the start of the file
+    uint64_t stored_bytes_; // Payload size on disk
+    uint64_t raw_bytes_;    // Size after decompression
+    uint64_t reserved_;
+};
+static_assert(sizeof(SectionInfo) == 48, "SectionInfo must be 48 bytes");
+
+static inline size_t dtype_size(uint8_t dt) {
+    switch(dt) {
+        case U8: return 1;
+        case U32: case I32: case F32: return 4;
+        case U64: case I64: case F64: return 8;
+    }
+    throw std::runtime_error(std::string("Unknown dtype ") + std::to_string(dt));
+}
+
+static inline std::string tag2str(uint32_t tag) {
+    return std::string{char(tag & 0xFF), char((tag >> 8) & 0xFF), char((tag >> 16) & 0xFF), char(tag >> 24)};
+}
+
+// Writes all count bytes to fd, retrying after short writes and interrupted calls.
+static inline void write_fully(int fd, const void *buf, size_t count) {
+    const uint8_t *p = static_cast<const uint8_t *>(buf);
+    while(count) {
+        const ssize_t ret = ::write(fd, p, count);
+        if(ret < 0) {
+            if(errno == EINTR) continue;
+            throw std::system_error(errno, std::system_category(), "Failed to write");
+        }
+        p += ret;
+        count -= ret;
+    }
+}
+
+/*
+ * Collects sections and writes them to path on finish().
+ * Arrays passed to add() are not copied, so they must remain valid until finish().
+ * The file is written to a temporary path, synced and renamed into place, and its directory is then synced,
+ * so readers never see a partial file and a completed finish() survives a crash.
+ */
+class Writer {
+    struct Pending {
+        uint32_t tag_;
+        uint8_t dtype_;
+        const void *data_;
+        size_t count_;
+    };
+    std::string path_;
+    Kind kind_;
+    bool compress_;
+    size_t block_bytes_;
+    int level_;
+    std::vector<Pending> sections_;
+
+    static std::vector<uint8_t> compress_blocks(const void *data, size_t nbytes, size_t block_bytes, int level) {
+        const size_t nblocks = (nbytes + block_bytes - 1) / block_bytes;
+        std::vector<std::vector<uint8_t>> blocks(nblocks);
+        std::atomic<bool> failed(false);
+        OMP_PFOR_DYN
+        for(size_t b = 0; b < nblocks; ++b) {
+            const size_t start = b * block_bytes, len = std::min(block_bytes, nbytes - start);
+            uLongf clen = compressBound(len);
+            blocks[b].resize(clen);
+            if(compress2(blocks[b].data(), &clen, static_cast<const Bytef *>(data) + start, len, level) != Z_OK)
+                failed = true;
+            blocks[b].resize(clen);
+        }
+        if(failed) throw std::runtime_error("zlib compression failed");
+        std::vector<uint8_t> ret(sizeof(uint64_t) * (2 + nblocks));
+        uint64_t *hdr = reinterpret_cast<uint64_t *>(ret.data());
+        hdr[0] = nblocks; hdr[1] = block_bytes;
+        for(size_t b = 0; b < nblocks; ++b) hdr[2 + b] = blocks[b].size();
+        for(const auto &blk: blocks) ret.insert(ret.end(), blk.begin(), blk.end());
+        return ret;
+    }
+    // Syncs the directory holding path, so that a rename into it is durable.
+    static void sync_parent_dir(const std::string &path) {
+        const auto slash = path.find_last_of('/');
+        const std::string dir = slash == std::string::npos ? std::string("."): slash == 0 ? std::string("/"): path.substr(0, slash);
+        const int dfd = ::open(dir.data(), O_RDONLY | O_DIRECTORY);
+        if(dfd < 0) throw std::system_error(errno, std::system_category(), std::string("Failed to open directory ") + dir);
+        const int rc = ::fsync(dfd), err = errno;
+        ::close(dfd);
+        if(rc) throw std::system_error(err, std::system_category(), std::string("Failed to sync directory ") + dir);
+    }
+public:
+    Writer(std::string path, Kind kind, bool compress=false, size_t block_bytes=DEFAULT_BLOCK_BYTES, int level=Z_DEFAULT_COMPRESSION):
+        path_(std::move(path)), kind_(kind), compress_(compress), block_bytes_(block_bytes), level_(level)
+    {
+        if(!block_bytes_) throw std::invalid_argument("Block size must be positive");
+    }
+    template<typename T>
+    Writer &add(uint32_t tag, const T *data, size_t count) {
+        for(const auto &s: sections_)
+            if(s.tag_ == tag) throw std::invalid_argument("Duplicate section " + tag2str(tag));
+        sections_.push_back(Pending{tag, dtype_of_v<T>, static_cast<const void *>(data), count});
+        return *this;
+    }
+    void finish() {
+        const std::string tmp = path_ + ".tmp";
+        std::FILE *fp = std::fopen(tmp.data(), "wb");
+        if(!fp) throw std::system_error(errno, std::system_category(), std::string("Failed to open ") + tmp);
+        try {
+            const int fd = ::fileno(fp);
+            FileHeader hdr;
+            std::memset(&hdr, 0, sizeof(hdr));
+            std::memcpy(hdr.magic_, MAGIC, sizeof(MAGIC));
+            hdr.version_ = VERSION;
+            hdr.kind_ = kind_;
+            hdr.nsections_ = sections_.size();
+            std::vector<SectionInfo> infos(sections_.size());
+            std::vector<std::vector<uint8_t>> payloads(sections_.size());
+            size_t offset = sizeof(FileHeader) + sizeof(SectionInfo) * infos.size();
+            for(size_t i = 0; i < sections_.size(); ++i) {
+                const auto &s = sections_[i];
+                auto &info = infos[i];
+                std::memset(&info, 0, sizeof(info));
+                info.tag_ = s.tag_;
+                info.dtype_ = s.dtype_;
+                info.count_ = s.count_;
+                info.raw_bytes_ = s.count_ * dtype_size(s.dtype_);
+                info.compressed_ = compress_ && info.raw_bytes_;
+                if(info.compressed_) {
+                    payloads[i] = compress_blocks(s.data_, info.raw_bytes_, block_bytes_, level_);
+                    info.stored_bytes_ = payloads[i].size();
+                } else info.stored_bytes_ = info.raw_bytes_;
+                offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+                info.offset_ = offset;
+                offset += info.stored_bytes_;
+            }
+            write_fully(fd, &hdr, sizeof(hdr));
+            if(infos.size()) write_fully(fd, infos.data(), sizeof(SectionInfo) * infos.size());
+            size_t pos = sizeof(FileHeader) + sizeof(SectionInfo) * infos.size();
+            static const uint8_t zeros[ALIGNMENT] = {0};
+            for(size_t i = 0; i < sections_.size(); ++i) {
+                if(infos[i].offset_ > pos) write_fully(fd, zeros, infos[i].offset_ - pos);
+                if(infos[i].stored_bytes_)
+                    write_fully(fd, infos[i].compressed_ ? static_cast<const void *>(payloads[i].data()): sections_[i].data_,
+                                infos[i].stored_bytes_);
+                pos = infos[i].offset_ + infos[i].stored_bytes_;
+            }
+            if(::fsync(fd)) throw std::system_error(errno, std::system_category(), std::string("Failed to sync ") + tmp);
+        } catch(...) {
+            std::fclose(fp);
+            std::remove(tmp.data());
+            throw;
+        }
+        std::fclose(fp);
+        if(std::rename(tmp.data(), path_.data()))
+            throw std::system_error(errno, std::system_category(), std::string("Failed to rename ") + tmp + " to " + path_);
+        sync_parent_dir(path_);
+    }
+};
+
+// Array handed out by a Reader; it keeps the mapping (or decompressed buffer) alive.
+template<typename T>
+struct Array {
+    const T *data_ = nullptr;
+    size_t size_ = 0;
+    std::shared_ptr<const void> owner_;
+    const T *data() const {return data_;}
+    size_t size() const {return size_;}
+    const T &operator[](size_t i) const {return data_[i];}
+    const T *begin() const {return data_;}
+    const T *end() const {return data_ + size_;}
+};
+
+/*
+ * Memory-maps a file written by Writer and validates its header.
+ * Uncompressed sections are returned as pointers into the mapping (zero-copy).
+ * The mapping is private and copy-on-write, so callers may modify returned data without touching the file.
+ */
+class Reader {
+    std::shared_ptr<csr::MappedFile> map_;
+    const FileHeader *hdr_;
+    const SectionInfo *sections_;
+public:
+    Reader(const std::string &path): map_(std::make_shared<csr::MappedFile>(path, /*copy_on_write=*/true)) {
+        const size_t size = map_->size();
+        if(size < sizeof(FileHeader)) throw std::runtime_error(path + " is too small to be a minocore binary file");
+        hdr_ = static_cast<const FileHeader *>(map_->data());
+        if(std::memcmp(hdr_->magic_, MAGIC, sizeof(MAGIC)))
+            throw std::runtime_error(path + " is not a minocore binary file");
+        if(hdr_->version_ > VERSION)
+            throw std::runtime_error(path + " has format version " + std::to_string(hdr_->version_) + ", newer than supported version " + std::to_string(VERSION));
+        if(sizeof(FileHeader) + sizeof(SectionInfo) * size_t(hdr_->nsections_) > size)
+            throw std::runtime_error(path + " is truncated");
+        sections_ = reinterpret_cast<const SectionInfo *>(hdr_ + 1);
+        const size_t table_end = sizeof(FileHeader) + sizeof(SectionInfo) * size_t(hdr_->nsections_);
+        for(uint32_t i = 0; i < hdr_->nsections_; ++i) {
+            const SectionInfo &s = sections_[i];
+            const size_t esize = dtype_size(s.dtype_);
+            if(s.raw_bytes_ % esize || s.raw_bytes_ / esize != s.count_ || s.compressed_ > 1 || (!s.compressed_ && s.stored_bytes_ != s.raw_bytes_)
+               || s.offset_ < table_end || s.offset_ % ALIGNMENT)
+                throw std::runtime_error(path + " has a corrupt entry for section " + tag2str(s.tag_));
+            if(s.offset_ > size || s.stored_bytes_ > size - s.offset_)
+                throw std::runtime_error(path + " is truncated in section " + tag2str(s.tag_));
+        }
+    }
+    Kind kind() const {return static_cast<Kind>(hdr_->kind_);}
+    uint32_t version() const {return hdr_->version_;}
+    const SectionInfo *find(uint32_t tag) const {
+        for(uint32_t i = 0; i < hdr_->nsections_; ++i)
+            if(sections_[i].tag_ == tag) return &sections_[i];
+        return nullptr;
+    }
+    bool has(uint32_t tag) const {return find(tag) != nullptr;}
+    void require_kind(Kind kind) const {
+        if(this->kind() != kind)
+            throw std::runtime_error("Expected file kind " + std::to_string(kind) + ", found " + std::to_string(this->kind()));
+    }
+    template<typename T>
+    Array<T> get(uint32_t tag) const {
+        const SectionInfo *info = find(tag);
+        if(!info) throw std::runtime_error("Missing section " + tag2str(tag));
+        if(info->dtype_ != dtype_of_v<T>)
+            throw std::runtime_error("Section " + tag2str(tag) + " has dtype " + std::to_string(info->dtype_) + ", expected " + std::to_string(dtype_of_v<T>));
+        const uint8_t *payload = static_cast<const uint8_t *>(map_->data()) + info->offset_;
+        Array<T> ret;
+        ret.size_ = info->count_;
+        if(!info->compressed_) {
+            ret.data_ = reinterpret_cast<const T *>(payload);
+            ret.owner_ = map_;
+            return ret;
+        }
+        const uint64_t *hdr = reinterpret_cast<const uint64_t *>(payload);
+        const size_t nwords = info->stored_bytes_ / sizeof(uint64_t);
+        if(nwords < 2 || !hdr[1] || hdr[0] > nwords - 2 || hdr[0] != (info->raw_bytes_ + hdr[1] - 1) / hdr[1])
+            throw std::runtime_error("Corrupt block table in section " + tag2str(tag));
+        const size_t nblocks = hdr[0], block_bytes = hdr[1];
+        std::vector<size_t> offsets(nblocks + 1);
+        offsets[0] = sizeof(uint64_t) * (2 + nblocks);
+        for(size_t b = 0; b < nblocks; ++b) {
+            if(hdr[2 + b] > info->stored_bytes_) throw std::runtime_error("Corrupt block table in section " + tag2str(tag));
+            offsets[b + 1] = offsets[b] + hdr[2 + b];
+        }
+        if(offsets[nblocks] != info->stored_bytes_) throw std::runtime_error("Corrupt block table in section " + tag2str(tag));
+        std::shared_ptr<T[]> buf(new T[info->count_]);
+        uint8_t *const out = reinterpret_cast<uint8_t *>(buf.get());
+        std::atomic<bool> failed(false);
+        OMP_PFOR_DYN
+        for(size_t b = 0; b < nblocks; ++b) {
+            const size_t start = b * block_bytes, expected = std::min(block_bytes, size_t(info->raw_bytes_) - start);
+            uLongf dlen = expected;
+            if(uncompress(out + start, &dlen, payload + offsets[b], offsets[b + 1] - offsets[b]) != Z_OK || dlen != expected)
+                failed = true;
+        }
+        if(failed) throw std::runtime_error("Failed to decompress section " + tag2str(tag));
+        ret.data_ = buf.get();
+        ret.owner_ = std::move(buf);
+        return ret;
+    }
+    // Returns a single scalar stored as a one-element section
+    template<typename T>
+    T scalar(uint32_t tag) const {
+        auto arr = get<T>(tag);
+        if(arr.size() != 1) throw std::runtime_error("Section " + tag2str(tag) + " is not a scalar");
+        return arr[0];
+    }
+};
+
+} // namespace serial
+
+} // namespace minocore
+
+#endif /* FGC_SERIALIZE_H__ */
@@ -0,0 +1,124 @@
+#ifndef FGC_VPTREE_H__
+#define FGC_VPTREE_H__
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace minocore {
+
+namespace knn {
+
+/*
+ * Exact nearest-neighbor search for any metric, over points inserted one at a time.
+ *
+ * Points are held in vantage-point trees (Yianilos, 1993) whose sizes are distinct powers of two.
+ * Like a binary counter, an insertion merges every tree it collides with and rebuilds the union once
+ * (Bentley and Saxe, 1980), so insertion costs O(log^2 n) metric evaluations amortized,
+ * and a query searches O(log n) trees, each pruned with the triangle inequality.
+ *
+ * Metric(a, b) must be a metric (e.g., blz::L2Norm or blz::L1Norm); squared L2 is not,
+ * but has the same nearest neighbors as L2.
+ * Points are copied into the structure and identified by insertion order.
+ */
+template<typename Item, typename Metric, typename FT=double, typename IT=std::uint32_t>
+class DynamicVPTree {
+    // Node b of a tree over ids_[b, e) has vantage point ids_[b]; points within mu_[b] of it are in [b + 1, split_[b]),
+    // and the rest are in [split_[b], e).
+    struct Tree {
+        std::vector<IT> ids_;
+        std::vector<FT> mu_;
+        std::vector<IT> split_;
+        bool empty() const {return ids_.empty();}
+    };
+    Metric metric_;
+    std::vector<Item> items_;
+    std::vector<Tree> levels_; // levels_[i] is empty or holds 2^i points
+
+    void build(Tree &t, size_t b, size_t e, std::vector<std::pair<FT, IT>> &scratch) const {
+        if(e - b <= 1) {
+            if(b < e) t.mu_[b] = 0, t.split_[b] = e;
+            return;
+        }
+        // The middle point is as good a vantage point as a random one, and deterministic
+        std::swap(t.ids_[b], t.ids_[b + (e - b) / 2]);
+        const Item &v = items_[t.ids_[b]];
+        scratch.resize(e - b - 1);
+        for(size_t i = b + 1; i < e; ++i) scratch[i - b - 1] = {FT(metric_(v, items_[t.ids_[i]])), t.ids_[i]};
+        const size_t half = scratch.size() / 2;
+        std::nth_element(scratch.begin(), scratch.begin() + half, scratch.end());
+        for(size_t i = 0; i < scratch.size(); ++i) t.ids_[b + 1 + i] = scratch[i].second;
+        const size_t m = b + 1 + half;
+        t.mu_[b] = scratch[half].first;
+        t.split_[b] = m;
+        build(t, b + 1, m, scratch);
+        build(t, m, e, scratch);
+    }
+    template<typename Query>
+    void search(const Tree &t, size_t b, size_t e, const Query &q, FT &best, std::vector<std::pair<FT, IT>> &found) const {
+        if(b >= e) return;
+        const FT d = metric_(items_[t.ids_[b]], q);
+        if(d <= best) best = d, found.emplace_back(d, t.ids_[b]);
+        const size_t m = t.split_[b];
+        const FT mu = t.mu_[b];
+        // A point within best of q is at least d - best and at most d + best from the vantage point.
+        if(d < mu) {
+            if(d - best <= mu) search(t, b + 1, m, q, best, found);
+            if(d + best >= mu) search(t, m, e, q, best, found);
+        } else {
+            if(d + best >= mu) search(t, m, e, q, best, found);
+            if(d - best <= mu) search(t, b + 1, m, q, best, found);
+        }
+    }
+public:
+    DynamicVPTree(Metric metric=Metric()): metric_(std::move(metric)) {}
+
+    size_t size() const {return items_.size();}
+    const Item &operator[](size_t i) const {return items_[i];}
+    void clear() {items_.clear(); levels_.clear();}
+
+    // Returns the id of the new point, which is the number of points inserted before it.
+    template<typename AItem>
+    IT insert(const AItem &item) {
+        const IT id = items_.size();
+        items_.emplace_back(item);
+        Tree t;
+        t.ids_.push_back(id);
+        for(size_t i = 0;; ++i) {
+            if(i == levels_.size()) levels_.emplace_back();
+            if(levels_[i].empty()) {
+                Tree &dest = levels_[i];
+                dest = std::move(t);
+                dest.mu_.resize(dest.ids_.size());
+                dest.split_.resize(dest.ids_.size());
+                std::vector<std::pair<FT, IT>> scratch;
+                build(dest, 0, dest.ids_.size(), scratch);
+                return id;
+            }
+            t.ids_.insert(t.ids_.end(), levels_[i].ids_.begin(), levels_[i].ids_.end());
+            levels_[i] = Tree();
+        }
+    }
+
+    /*
+     * Calls f(id, distance) for every point at the minimum distance from q (more than one only on ties),
+     * and returns that distance, or the maximum FT if there are no points.
+     */
+    template<typename Query, typename F>
+    FT nearest(const Query &q, const F &f) const {
+        FT best = std::numeric_limits<FT>::max();
+        std::vector<std::pair<FT, IT>> found;
+        for(const auto &t: levels_)
+            if(!t.empty()) search(t, 0, t.ids_.size(), q, best, found);
+        for(const auto &p: found)
+            if(p.first <= best) f(p.second, p.first);
+        return best;
+    }
+};
+
+} // namespace knn
+
+} // namespace minocore
+
+#endif /* FGC_VPTREE_H__ */
@@ -8,6 +8,7 @@
 #include "minocore/util/Inf2Zero.h"
 
 #include "minocore/util/csc.h"
+#include "minocore/util/csr.h"
 
 #include "minocore/util/div.h"
 #include "minocore/util/packed.h"
@@ -0,0 +1,156 @@
+#pragma once
+#ifndef FGC_STREAM_INGEST_H__
+#define FGC_STREAM_INGEST_H__
+#include "minocore/wip/streaming.h"
+#include "minocore/util/csr.h"
+#include <future>
+#include <optional>
+
+namespace minocore {
+namespace streaming {
+
+/*
+ * Block-oriented ingestion for KServiceClusterer.
+ * Sources produce blocks of rows (and optional weights); ingest() clusters one block with add_batch
+ * while the next block is read by a background task, so the clusterer does not wait on I/O
+ * unless reading is slower than clustering.
+ */
+
+template<typename MatrixType, typename WT=double>
+struct Block {
+    MatrixType rows_;
+    std::vector<WT> weights_; // Empty for unit weights
+};
+
+template<typename MatrixType, typename WT=double>
+struct BlockSource {
+    // Fills blk with the next block; returns false when the source is exhausted.
+    virtual bool next(Block<MatrixType, WT> &blk) = 0;
+    virtual ~BlockSource() {}
+};
+
+/*
+ * Row-major binary file of dim-dimensional FT vectors, optionally gzipped,
+ * with an optional file of WT weights (one per row), read like ZlibW.
+ */
+template<typename FT=float, typename WT=double>
+class DenseFileSource: public BlockSource<blaze::DynamicMatrix<FT>, WT> {
+    gzFile fp_, wfp_ = nullptr;
+    size_t dim_, block_rows_;
+    std::string path_;
+public:
+    DenseFileSource(std::string path, size_t dim, size_t block_rows=16384, const std::string &weight_path=""):
+        fp_(gzopen(path.data(), "rb")), dim_(dim), block_rows_(block_rows), path_(std::move(path))
+    {
+        if(!fp_) throw std::runtime_error("Failed to open " + path_);
+        if(weight_path.size() && !(wfp_ = gzopen(weight_path.data(), "rb"))) {
+            gzclose(fp_);
+            throw std::runtime_error("Failed to open " + weight_path);
+        }
+        gzbuffer(fp_, 1 << 20);
+    }
+    DenseFileSource(const DenseFileSource &) = delete;
+    ~DenseFileSource() {
+        gzclose(fp_);
+        if(wfp_) gzclose(wfp_);
+    }
+    bool next(Block<blaze::DynamicMatrix<FT>, WT> &blk) override {
+        std::vector<FT> buf(block_rows_ * dim_);
+        const int64_t nb = gzread(fp_, buf.data(), buf.size() * sizeof(FT));
+        if(nb < 0) throw std::runtime_error("Failed to read from " + path_);
+        if(nb % (dim_ * sizeof(FT))) throw std::runtime_error(path_ + " ends with a partial row");
+        const size_t nr = nb / (dim_ * sizeof(FT));
+        if(!nr) return false;
+        blk.rows_ = blaze::CustomMatrix<FT, blaze::unaligned, blaze::unpadded>(buf.data(), nr, dim_);
+        blk.weights_.clear();
+        if(wfp_) {
+            blk.weights_.resize(nr);
+            if(gzread(wfp_, blk.weights_.data(), nr * sizeof(WT)) != int64_t(nr * sizeof(WT)))
+                throw std::runtime_error("Weight file for " + path_ + " is shorter than its data");
+        }
+        return true;
+    }
+};
+
+// CSR prefix files, as mapped by load_csr_view, delivered as CompressedMatrix blocks.
+template<typename FT=float, typename IndPtrType=uint64_t, typename IndicesType=uint64_t, typename DataType=uint32_t, typename WT=double>
+class CSRFileSource: public BlockSource<blaze::CompressedMatrix<FT, blaze::rowMajor>, WT> {
+    CSRMatrixView<FT, IndPtrType, IndicesType> view_;
+    size_t block_rows_, pos_ = 0;
+public:
+    CSRFileSource(const std::string &prefix, size_t block_rows=16384):
+        view_(load_csr_view<FT, IndPtrType, IndicesType, DataType>(prefix)), block_rows_(block_rows) {}
+    bool next(Block<blaze::CompressedMatrix<FT, blaze::rowMajor>, WT> &blk) override {
+        const size_t nr = std::min(block_rows_, view_.rows() - pos_);
+        if(!nr) return false;
+        auto &m = blk.rows_;
+        m.resize(nr, view_.columns(), false);
+        m.reset();
+        size_t nnz = 0;
+        for(size_t i = 0; i < nr; ++i) nnz += view_.nonZeros(pos_ + i);
+        m.reserve(nnz);
+        for(size_t i = 0; i < nr; ++i) {
+            for(auto it = view_.begin(pos_ + i), e = view_.end(pos_ + i); it != e; ++it)
+                m.append(i, it->index(), it->value());
+            m.finalize(i);
+        }
+        blk.weights_.clear();
+        pos_ += nr;
+        return true;
+    }
+};
+
+namespace detail {
+template<typename MT>
+struct RowRange {
+    const MT &mat_;
+    size_t offset_;
+    auto operator[](size_t i) const {return row(mat_, offset_ + i, blaze::unchecked);}
+};
+}
+
+/*
+ * Feeds every block of sources (in order) to clusterer.add_batch, reading ahead one block.
+ * skip drops the first skip items, for resuming from a checkpoint at clusterer.nseen().
+ * If checkpoint_every is nonzero, a checkpoint is written to checkpoint_path after each block
+ * in which clusterer.nseen() crosses a multiple of checkpoint_every.
+ * Returns the number of items ingested.
+ */
+template<typename Clusterer, typename MatrixType, typename WT>
+size_t ingest(Clusterer &clusterer, std::vector<std::unique_ptr<BlockSource<MatrixType, WT>>> &sources,
+              size_t skip=0, const std::string &checkpoint_path="", size_t checkpoint_every=0)
+{
+    size_t src = 0, nadded = 0;
+    auto fetch = [&]() -> std::optional<Block<MatrixType, WT>> {
+        Block<MatrixType, WT> blk;
+        for(; src < sources.size(); ++src)
+            if(sources[src]->next(blk)) return blk;
+        return std::nullopt;
+    };
+    // Only one fetch is in flight at a time, so fetch's state needs no synchronization.
+    auto fut = std::async(std::launch::async, fetch);
+    for(;;) {
+        auto blk = fut.get();
+        if(!blk) break;
+        fut = std::async(std::launch::async, fetch);
+        const size_t nr = blk->rows_.rows();
+        if(skip >= nr) {
+            skip -= nr;
+            continue;
+        }
+        const size_t offset = skip, n = nr - offset;
+        skip = 0;
+        const size_t before = clusterer.nseen();
+        clusterer.add_batch(detail::RowRange<MatrixType>{blk->rows_, offset}, n,
+                            blk->weights_.empty() ? static_cast<const WT *>(nullptr): blk->weights_.data() + offset);
+        nadded += n;
+        if(checkpoint_every && before / checkpoint_every != clusterer.nseen() / checkpoint_every)
+            clusterer.save_checkpoint(checkpoint_path);
+    }
+    return nadded;
+}
+
+} // namespace streaming
+} // namespace minocore
+
+#endif /* FGC_STREAM_INGEST_H__ */
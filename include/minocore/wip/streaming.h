@@ -14,6 +14,10 @@
 #include <zlib.h>
 
 #include "minocore/dist/distance.h"
+#include "minocore/hash/hash.h"
+#include "minocore/util/serialize.h"
+#include "minocore/util/vptree.h"
+#include <sstream>
 
 
 namespace minocore {
@@ -107,18 +111,176 @@ struct is_uniform_weighting<UniformW<FT>>: public std::true_type {};
     For k-means, k-medians, and Bregman Divergences, we recommend Lloyd's algorithm/EM.
  */
 
-template<typename Item, typename Func, typename WT=double, typename RNG=std::mt19937_64>
+namespace detail {
+
+template<typename Item, typename=void> struct facility_value {using type = Item;};
+template<typename Item> struct facility_value<Item, std::enable_if_t<!std::is_arithmetic_v<Item>>> {using type = blaze::ElementType_t<Item>;};
+
+/*
+ * Flattens a stack of (facility, weight) pairs for checkpoints.
+ * Arithmetic items and dense vectors are stored as rows of DATA;
+ * sparse vectors are stored in compressed-row form (INDP, INDC, DATA).
+ */
+template<typename Item, typename WT>
+struct FacilityArrays {
+    using VT = typename facility_value<Item>::type;
+    static constexpr bool sparse = !std::is_arithmetic_v<Item> && blaze::IsSparseVector_v<Item>;
+    uint64_t shape_[2] = {0, 0}; // {n, dim}
+    std::vector<VT> data_;
+    std::vector<uint64_t> indptr_;
+    std::vector<uint32_t> indices_;
+    std::vector<WT> weights_;
+
+    template<typename Container>
+    void encode(const Container &c) {
+        const size_t n = c.size();
+        shape_[0] = n;
+        weights_.resize(n);
+        if constexpr(std::is_arithmetic_v<Item>) {
+            shape_[1] = 1;
+            data_.resize(n);
+            for(size_t i = 0; i < n; ++i) data_[i] = c[i].first;
+        } else {
+            shape_[1] = n ? c[0].first.size(): 0;
+            if constexpr(sparse) {
+                indptr_.assign(1, 0);
+                for(size_t i = 0; i < n; ++i) {
+                    for(auto it = c[i].first.begin(), e = c[i].first.end(); it != e; ++it)
+                        indices_.push_back(it->index()), data_.push_back(it->value());
+                    indptr_.push_back(data_.size());
+                }
+            } else {
+                data_.resize(n * shape_[1]);
+                for(size_t i = 0; i < n; ++i)
+                    std::copy(c[i].first.begin(), c[i].first.end(), data_.begin() + i * shape_[1]);
+            }
+        }
+        for(size_t i = 0; i < n; ++i) weights_[i] = c[i].second;
+    }
+    void add_to(serial::Writer &w, const char (&prefix)[2]) const {
+        auto tag = [&](const char *suffix) {
+            const char s[5] = {prefix[0], suffix[0], suffix[1], suffix[2], 0};
+            return serial::make_tag(s);
+        };
+        w.add(tag("SHP"), shape_, 2).add(tag("DAT"), data_.data(), data_.size()).add(tag("WTS"), weights_.data(), weights_.size());
+        if constexpr(sparse) w.add(tag("IDP"), indptr_.data(), indptr_.size()).add(tag("IDC"), indices_.data(), indices_.size());
+    }
+    template<typename Container>
+    static void decode(const serial::Reader &r, const char (&prefix)[2], Container &c) {
+        auto tag = [&](const char *suffix) {
+            const char s[5] = {prefix[0], suffix[0], suffix[1], suffix[2], 0};
+            return serial::make_tag(s);
+        };
+        auto shape = r.get<uint64_t>(tag("SHP"));
+        auto data = r.get<VT>(tag("DAT"));
+        auto weights = r.get<WT>(tag("WTS"));
+        const size_t n = shape[0], dim = shape[1];
+        if(weights.size() != n) throw std::runtime_error("Checkpoint has mismatched facilities and weights");
+        serial::Array<uint64_t> indptr;
+        serial::Array<uint32_t> indices;
+        if constexpr(sparse) {
+            indptr = r.get<uint64_t>(tag("IDP"));
+            indices = r.get<uint32_t>(tag("IDC"));
+            if(indptr.size() != n + 1 || indices.size() != data.size()) throw std::runtime_error("Checkpoint has malformed sparse facilities");
+        } else if(data.size() != n * dim) throw std::runtime_error("Checkpoint has malformed facilities");
+        c.clear();
+        for(size_t i = 0; i < n; ++i) {
+            Item item;
+            if constexpr(std::is_arithmetic_v<Item>) {
+                item = data[i];
+            } else if constexpr(sparse) {
+                item.resize(dim);
+                item.reserve(indptr[i + 1] - indptr[i]);
+                for(size_t j = indptr[i]; j < indptr[i + 1]; ++j) item.append(indices[j], data[j]);
+            } else {
+                item.resize(dim);
+                std::copy(data.data() + i * dim, data.data() + (i + 1) * dim, item.begin());
+            }
+            c.emplace_back(std::move(item), weights[i]);
+        }
+    }
+};
+
+} // namespace detail
+
+/*
+ * Facility indexes for KServiceClusterer.
+ * An index is told about every opened facility (insert) and is cleared when facilities are re-streamed.
+ * candidates(query, f) calls f(id) for each facility likely to be nearest and returns false
+ * if it has none, in which case the clusterer scans every facility.
+ *
+ * LinearFacilityIndex: no index; every query scans all facilities. Works for any Func.
+ * VPTreeFacilityIndex: exact, for metrics; queries evaluate O(log^2 n) distances in practice.
+ * LSHFacilityIndex:    approximate, for vector metrics with an LSH family in hash/hash.h.
+ */
+struct LinearFacilityIndex {
+    void clear() {}
+    template<typename Item> void insert(const Item &, size_t) {}
+    template<typename Query, typename F> bool candidates(const Query &, const F &) const {return false;}
+};
+
+/*
+ * LSH index over facilities, for vector items under metrics supported by hash/hash.h
+ * (e.g., L2LSHasher for Euclidean and squared Euclidean, L1LSHasher for L1).
+ * Queries touch only colliding buckets, so their cost does not grow with the number of facilities.
+ */
+template<typename Hasher, typename IT=std::uint32_t>
+class LSHFacilityIndex {
+    hash::LSHTable<Hasher, IT> table_;
+public:
+    template<typename...Args>
+    LSHFacilityIndex(Args &&...args): table_(std::forward<Args>(args)...) {}
+    void clear() {table_.clear();}
+    template<typename Item> void insert(const Item &item, size_t id) {table_.add(item, IT(id));}
+    template<typename Query, typename F>
+    bool candidates(const Query &q, const F &f) const {
+        auto hits = table_.query(q);
+        for(const auto &pair: hits) f(size_t(pair.first));
+        return !hits.empty();
+    }
+};
+
+/*
+ * Exact index: reports the facilities nearest under Metric, found with knn::DynamicVPTree.
+ * Metric must be a metric which ranks facilities as the clusterer's Func does
+ * (e.g., blz::L2Norm for blz::sqrL2Norm), in which case the clusterer makes the same decisions
+ * as with LinearFacilityIndex, up to ties. Facilities are copied into the index.
+ */
+template<typename Item, typename Metric>
+class VPTreeFacilityIndex {
+    knn::DynamicVPTree<Item, Metric> tree_;
+public:
+    VPTreeFacilityIndex(Metric metric=Metric()): tree_(std::move(metric)) {}
+    void clear() {tree_.clear();}
+    template<typename AItem> void insert(const AItem &item, size_t id) {
+        // Facilities are only ever appended, or all cleared, so ids match insertion order
+        const size_t tid = tree_.insert(item);
+        assert(tid == id);
+        (void)tid; (void)id;
+    }
+    template<typename Query, typename F>
+    bool candidates(const Query &q, const F &f) const {
+        if(!tree_.size()) return false;
+        tree_.nearest(q, [&f](size_t id, double) {f(id);});
+        return true;
+    }
+};
+
+// Index chooses how nearest facilities are found; see LinearFacilityIndex, VPTreeFacilityIndex and LSHFacilityIndex.
+template<typename Item, typename Func, typename WT=double, typename RNG=std::mt19937_64, typename Index=LinearFacilityIndex>
 class KServiceClusterer {
     Func func_;
-    WT l_i_, f_, cost_, alpha_, beta_;
+    WT l_i_, f_, cost_ = 0, alpha_, beta_;
     unsigned k_;
     size_t n_ = 0, i_ = 0;
+    size_t nseen_ = 0; // Stream items added, excluding re-streamed facilities
+    Index index_;
 public:
     struct mutable_stack: public std::stack<std::pair<Item, WT>> {
         mutable_stack() {}
         auto &getc() {return this->c;}
         const auto &getc() const {return this->c;}
-        auto  operator[](size_t index) const {return this->c[index];}
+        const auto &operator[](size_t index) const {return this->c[index];}
         auto &operator[](size_t index)       {return this->c[index];}
     };
     mutable_stack mstack_;
@@ -137,77 +299,191 @@ public:
                         4. * alpha_ * alpha_ * alpha_ * get_cofl() * get_cofl() + 2 * alpha_ * alpha_ * get_cofl());
     }
 
+    // Nearest facility among [first, mstack_.size()), or {-1, max} if there are none.
+    template<typename AItem>
+    std::pair<unsigned, WT> scan(const AItem &item, size_t first=0) const {
+        std::pair<unsigned, WT> ret{-1, std::numeric_limits<WT>::max()};
+        for(size_t j = first; j < mstack_.size(); ++j) {
+            const WT dist = func_(mstack_[j].first, item);
+            if(dist < ret.second) ret = {unsigned(j), dist};
+        }
+        return ret;
+    }
     template<typename AItem>
     std::pair<unsigned, WT> assign(const AItem &item) const {
         if(mstack_.empty()) return {-1, std::numeric_limits<WT>::max()};
-        unsigned i = 0;
-        WT mindist = func_(mstack_[0], item), dist;
-        for(unsigned j = 1; j < mstack_.size(); ++j)
-            if((dist = func_(mstack_[j])) < mindist) mindist = dist, i = j;
-        return {i, mindist};
+        std::pair<unsigned, WT> ret{-1, std::numeric_limits<WT>::max()};
+        const bool found = index_.candidates(item, [&](size_t j) {
+            const WT dist = func_(mstack_[j].first, item);
+            if(dist < ret.second) ret = {unsigned(j), dist};
+        });
+        return found ? ret: scan(item);
     }
+private:
+    // Opens or merges given the nearest facility; returns true if the phase ended,
+    // in which case facilities were moved to readingstack_ to be re-streamed.
     template<typename AItem>
-    void add(const AItem &item, WT weight=1.) {
-        auto [asn, mincost] = assign(item);
+    bool decide(const AItem &item, WT weight, std::pair<unsigned, WT> nearest) {
+        auto [asn, mincost] = nearest;
         auto cost = weight * mincost;
         auto gam = get_gamma();
         if(cost / f_ > urd_(rng_)) {
             mstack_.push(std::pair<Item, WT>{item, weight});
+            index_.insert(mstack_.top().first, mstack_.size() - 1);
         } else {
             cost_ += cost;
             mstack_[asn].second += weight;
         }
         if(cost_ > gam * l_i_ || mstack_.size() > (gam - 1) * (1 + std::log(n_)) * k_) {
-            readingstack_ = std::move(mstack_.getc());
+            auto &c = mstack_.getc();
+            readingstack_.insert(readingstack_.end(), std::make_move_iterator(c.begin()), std::make_move_iterator(c.end()));
+            c.clear();
+            index_.clear();
+            cost_ = 0;
             ++i_;
             l_i_ *= beta_;
             f_ = l_i_ / (k_ * (1 + std::log(n_)));
+            return true;
         }
+        return false;
     }
-    template<typename Generator, typename WeightGen=UniformW<WT>>
-    void process_step(Generator &gen, WeightGen &wgen=WeightGen()) {
-        if(readingstack_.size()) {
-            add(readingstack_.top().first, readingstack_.top().second);
-            readingstack_.pop();
+    // Re-adds one facility from the finished phase.
+    void restream_one() {
+        auto p = std::move(readingstack_.back());
+        readingstack_.pop_back();
+        decide(p.first, p.second, assign(p.first));
+    }
+public:
+    template<typename AItem>
+    void add(const AItem &item, WT weight=1.) {
+        decide(item, weight, assign(item));
+        ++nseen_;
+    }
+    /*
+     * Adds items[0, n) (any container or pointer supporting operator[]), with optional weights.
+     * Nearest facilities are found for the whole block in parallel; the open/merge decisions are then
+     * made in order, additionally scanning only facilities opened since the parallel pass.
+     * With an exact index, the result is the same as adding the items one at a time.
+     * If a phase ends mid-block, the rest of the block is assigned again against the new facilities.
+     */
+    template<typename Items>
+    void add_batch(const Items &items, size_t n, const WT *weights=nullptr) {
+        while(!readingstack_.empty()) restream_one();
+        std::vector<std::pair<unsigned, WT>> nearest;
+        for(size_t start = 0; start < n;) {
+            const size_t nfac = mstack_.size();
+            nearest.resize(n - start);
+            OMP_PFOR_DYN
+            for(size_t i = start; i < n; ++i) nearest[i - start] = assign(items[i]);
+            size_t i = start;
+            for(; i < n; ++i) {
+                auto best = nearest[i - start];
+                if(mstack_.size() > nfac) {
+                    auto fresh = scan(items[i], nfac);
+                    if(fresh.second < best.second) best = fresh;
+                }
+                ++nseen_;
+                if(decide(items[i], weights ? weights[i]: WT(1), best)) {
+                    ++i;
+                    break;
+                }
+            }
+            start = i;
+            if(start < n) {
+                // Facilities from the finished phase are re-streamed before the rest of the block.
+                while(!readingstack_.empty()) restream_one();
+            }
         }
-        ++n_;
+    }
+    template<typename Generator, typename WeightGen=UniformW<WT>>
+    void process_step(Generator &gen, WeightGen &wgen) {
+        if(readingstack_.size()) restream_one();
         add(gen(), wgen());
     }
     template<typename Generator, typename WeightGen=UniformW<WT>>
     void process(Generator &gen, WeightGen &&wgen=WeightGen()) {
         WeightGen weight_gen(std::move(wgen));
         while(gen.size() /* maybe rename for easier interface? */ ) {
-            process_step(gen, wgen);
+            process_step(gen, weight_gen);
         }
     }
-    KServiceClusterer(Func func, unsigned k, size_t n, double alpha, uint64_t seed=std::rand()):
+    size_t nfacilities() const {return mstack_.size();}
+    size_t nseen() const {return nseen_;}
+
+    /*
+     * Writes the full streaming state (both facility stacks, phase parameters and RNG state) to path.
+     * The file is synced and replaced atomically, so a crash during a checkpoint leaves the previous one intact,
+     * and a checkpoint that has returned survives a crash.
+     * Items must be arithmetic or blaze vectors, and RNG must support operator<< and operator>>.
+     */
+    void save_checkpoint(const std::string &path, bool compress=false) const {
+        detail::FacilityArrays<Item, WT> facilities, reading;
+        facilities.encode(mstack_.getc());
+        reading.encode(readingstack_);
+        const double params[5] = {double(l_i_), double(f_), double(cost_), double(alpha_), double(beta_)};
+        const uint64_t counts[4] = {k_, n_, i_, nseen_};
+        std::ostringstream oss;
+        oss << rng_;
+        const std::string rngstate = oss.str();
+        serial::Writer w(path, serial::STREAMING_STATE, compress);
+        w.add(serial::make_tag("PARM"), params, 5).add(serial::make_tag("CNTS"), counts, 4)
+         .add(serial::make_tag("RNG "), reinterpret_cast<const uint8_t *>(rngstate.data()), rngstate.size());
+        facilities.add_to(w, "M");
+        reading.add_to(w, "R");
+        w.finish();
+    }
+    /*
+     * Restores state written by save_checkpoint into a clusterer constructed with the same Func and Index.
+     * The facility index is rebuilt; resume the stream after the first nseen() items.
+     */
+    void load_checkpoint(const std::string &path) {
+        serial::Reader r(path);
+        r.require_kind(serial::STREAMING_STATE);
+        auto params = r.get<double>(serial::make_tag("PARM"));
+        auto counts = r.get<uint64_t>(serial::make_tag("CNTS"));
+        auto rngstate = r.get<uint8_t>(serial::make_tag("RNG "));
+        if(params.size() != 5 || counts.size() != 4) throw std::runtime_error("Malformed streaming checkpoint");
+        l_i_ = params[0]; f_ = params[1]; cost_ = params[2]; alpha_ = params[3]; beta_ = params[4];
+        k_ = counts[0]; n_ = counts[1]; i_ = counts[2]; nseen_ = counts[3];
+        std::istringstream iss(std::string(reinterpret_cast<const char *>(rngstate.data()), rngstate.size()));
+        if(!(iss >> rng_)) throw std::runtime_error("Failed to restore RNG state");
+        detail::FacilityArrays<Item, WT>::decode(r, "M", mstack_.getc());
+        detail::FacilityArrays<Item, WT>::decode(r, "R", readingstack_);
+        index_.clear();
+        for(size_t j = 0; j < mstack_.size(); ++j) index_.insert(mstack_[j].first, j);
+    }
+    KServiceClusterer(Func func, unsigned k, size_t n, double alpha, uint64_t seed=std::rand(), Index index=Index()):
         func_(func), l_i_(1),
-        alpha_(alpha), beta_(2. * alpha_ * alpha_  * get_cofl() + 2. * alpha_), k_(k), n_(n), i_(1)
+        alpha_(alpha), beta_(2. * alpha_ * alpha_  * get_cofl() + 2. * alpha_), k_(k), n_(n), i_(1), index_(std::move(index))
     {
+        f_ = l_i_ / (k_ * (1 + std::log(n_)));
         rng_.seed(seed);
     }
 };
 
-template<typename Item, typename Func, template<typename> class WeightGen=UniformW, typename FT=double>
-auto make_kservice_clusterer(Func func, unsigned k, size_t n, double alpha, bool uniform_weighting=is_uniform_weighting<WeightGen<FT>>::value) {
+template<typename Item, typename Func, typename Index, template<typename> class WeightGen=UniformW, typename FT=double>
+auto make_kservice_clusterer(Func func, unsigned k, size_t n, double alpha, Index index,
+                             bool uniform_weighting=is_uniform_weighting<WeightGen<FT>>::value)
+{
     if(uniform_weighting) std::fprintf(stderr, "Uniform weighting\n");
-    return KServiceClusterer<Item, Func, FT>(func, k, n, alpha);
+    return KServiceClusterer<Item, Func, FT, std::mt19937_64, Index>(func, k, n, alpha, std::rand(), std::move(index));
 }
 
+// The online clusterers for vector items use exact VP-tree indexes under the corresponding metric.
 template<typename Item, template<typename> class WeightGen=UniformW, typename FT=double>
 auto make_online_kmedian_clusterer(unsigned k, size_t n, bool uniform_weighting=is_uniform_weighting<WeightGen<FT>>::value) {
-    blz::L1Norm func;
-    return make_kservice_clusterer<Item, blz::L1Norm, FT>(blz::L1Norm(), k, n, 1., uniform_weighting);
+    return make_kservice_clusterer<Item, blz::L1Norm, VPTreeFacilityIndex<Item, blz::L1Norm>, WeightGen, FT>(
+        blz::L1Norm(), k, n, 1., VPTreeFacilityIndex<Item, blz::L1Norm>(), uniform_weighting);
 }
 template<typename Item, template<typename> class WeightGen=UniformW, typename FT=double>
 auto make_online_kmeans_clusterer(unsigned k, size_t n, bool uniform_weighting=is_uniform_weighting<WeightGen<FT>>::value) {
-    blz::sqrL2Norm func;
-    return make_kservice_clusterer<Item, blz::sqrL2Norm, FT>(blz::sqrL2Norm(), k, n, 2., uniform_weighting);
+    return make_kservice_clusterer<Item, blz::sqrL2Norm, VPTreeFacilityIndex<Item, blz::L2Norm>, WeightGen, FT>(
+        blz::sqrL2Norm(), k, n, 2., VPTreeFacilityIndex<Item, blz::L2Norm>(), uniform_weighting);
 }
 template<typename Item, template<typename> class WeightGen=UniformW, typename FT=double>
 auto make_online_l2_clusterer(unsigned k, size_t n, bool uniform_weighting=is_uniform_weighting<WeightGen<FT>>::value) {
-    blz::L2Norm func;
-    return make_kservice_clusterer<Item, blz::L2Norm, FT>(blz::L2Norm(), k, n, 1., uniform_weighting);
+    return make_kservice_clusterer<Item, blz::L2Norm, VPTreeFacilityIndex<Item, blz::L2Norm>, WeightGen, FT>(
+        blz::L2Norm(), k, n, 1., VPTreeFacilityIndex<Item, blz::L2Norm>(), uniform_weighting);
 }
 
 } // namespace streaming
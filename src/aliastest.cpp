@@ -0,0 +1,59 @@
+#include "minocore/util/alias.h"
+#include <cmath>
+
+using namespace minocore;
+
+// The alias table and sorted-uniform sampler must reproduce their input distribution,
+// and give the same tables and draws for any number of threads.
+int main() {
+    const size_t n = 20000; // Several pieces
+    std::vector<float> w(n);
+    wy::WyRand<uint64_t> rng(31);
+    for(size_t i = 0; i < n; ++i) w[i] = i % 11 == 0 ? 0.f: float(rng() % 1000) / (i % 97 == 0 ? 1.f: 100.f);
+    const double total = std::accumulate(w.begin(), w.end(), 0.);
+
+    std::vector<float> probs0;
+    std::vector<uint32_t> aliases0, sorted0;
+    for(const int nt: {1, 3, 8}) {
+        OMP_SET_NT(nt);
+        OMP_ONLY(assert(omp_get_max_threads() == nt);)
+        sampling::AliasTable<float, wy::WyRand<uint32_t, 2>, uint32_t> table(w.begin(), w.end(), 7);
+        // Mass implied by the table: its own column's probability plus the remainders aliased to it
+        std::vector<double> mass(n);
+        for(size_t i = 0; i < n; ++i) {
+            assert(table.probs()[i] >= 0.f && table.probs()[i] <= 1.f + 1e-5f);
+            mass[i] += table.probs()[i];
+            mass[table.aliases()[i]] += 1. - table.probs()[i];
+        }
+        for(size_t i = 0; i < n; ++i)
+            assert(std::abs(mass[i] / n - w[i] / total) < 1e-6);
+        auto sorted = sampling::sample_sorted_uniforms<uint32_t>(w.data(), n, 50000, 11);
+        assert(std::is_sorted(sorted.begin(), sorted.end()));
+        for(const auto i: sorted) assert(w[i] > 0.f);
+        if(probs0.empty()) {
+            probs0.assign(table.probs(), table.probs() + n);
+            aliases0.assign(table.aliases(), table.aliases() + n);
+            sorted0 = sorted;
+        } else {
+            assert(std::equal(probs0.begin(), probs0.end(), table.probs()));
+            assert(std::equal(aliases0.begin(), aliases0.end(), table.aliases()));
+            assert(sorted == sorted0);
+        }
+    }
+
+    // Empirical frequencies on a small distribution, within 5 standard deviations
+    const std::vector<double> sw{1., 0., 3., 0.5, 10., 2., 0.25, 7.};
+    const double stotal = std::accumulate(sw.begin(), sw.end(), 0.);
+    const size_t ndraws = 400000;
+    sampling::AliasTable<double, wy::WyRand<uint32_t, 2>, uint32_t> small(sw.begin(), sw.end(), 13);
+    std::vector<size_t> acounts(sw.size()), scounts(sw.size());
+    for(size_t i = 0; i < ndraws; ++i) ++acounts[small.sample()];
+    for(const auto i: sampling::sample_sorted_uniforms<uint32_t>(sw.data(), sw.size(), ndraws, 17)) ++scounts[i];
+    for(size_t i = 0; i < sw.size(); ++i) {
+        const double p = sw[i] / stotal, sd = std::sqrt(ndraws * p * (1. - p));
+        std::fprintf(stderr, "%zu: expected %g, alias %zu, sorted uniforms %zu\n", i, p * ndraws, acounts[i], scounts[i]);
+        assert(std::abs(acounts[i] - p * ndraws) <= 5. * sd);
+        assert(std::abs(scounts[i] - p * ndraws) <= 5. * sd);
+    }
+    std::fprintf(stderr, "Alias table and sorted-uniform sampling match their distributions\n");
+}
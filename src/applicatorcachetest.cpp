@@ -0,0 +1,106 @@
+#include "minocore/dist/applicator_cache.h"
+#include <filesystem>
+
+using namespace minocore;
+
+using PriorT = blaze::DynamicVector<double, blaze::rowVector>;
+
+// Copies the file at path to out, replacing section PRIR with prior.
+static void rewrite_prior(const std::string &path, const std::string &out, const std::vector<double> &prior) {
+    serial::Reader r(path);
+    serial::Writer w(out, serial::APPLICATOR_STATE);
+    auto meta = r.get<uint64_t>(jsd::tags::META);
+    auto lambda = r.get<double>(jsd::tags::LMBD);
+    w.add(jsd::tags::META, meta.data(), meta.size()).add(jsd::tags::LMBD, lambda.data(), lambda.size());
+    std::vector<serial::Array<double>> keep;
+    for(const auto tag: {jsd::tags::DATA, jsd::tags::RSUM, jsd::tags::JSDC, jsd::tags::LOGD, jsd::tags::SQRD}) {
+        if(!r.has(tag)) continue;
+        keep.push_back(r.get<double>(tag));
+        w.add(tag, keep.back().data(), keep.back().size());
+    }
+    w.add(jsd::tags::PRIR, prior.data(), prior.size());
+    w.finish();
+}
+
+// A saved and reloaded applicator must give the same data, row sums and distances as the original.
+template<typename MatrixType>
+static void check_round_trip(const MatrixType &raw, dist::DissimilarityMeasure measure, dist::Prior prior,
+                             const PriorT *pc, const std::string &dir) {
+    using store_t = jsd::ApplicatorStore<MatrixType>;
+    const std::string path = dir + "/app";
+    const uint64_t key = store_t::make_key(store_t::hash_input(raw), measure, prior, pc);
+    const size_t n = raw.rows();
+    // Applicators normalize their data in place
+    MatrixType data = raw;
+    jsd::DissimilarityApplicator<MatrixType> app(data, measure, prior, pc, jsd::CACHE_FULL);
+    // Caches are only saved once built
+    jsd::save_applicator(app, path, key);
+    assert(!serial::Reader(path).has(jsd::tags::LOGD) && !serial::Reader(path).has(jsd::tags::JSDC));
+    app.prepare_caches();
+    jsd::save_applicator(app, path, key);
+    assert(serial::Reader(path).has(jsd::tags::LOGD) == dist::detail::needs_logs(measure));
+    assert(serial::Reader(path).has(jsd::tags::SQRD) == dist::detail::needs_sqrt(measure));
+
+    for(const auto mode: {jsd::CACHE_FULL, jsd::CACHE_NONE}) {
+        MatrixType ldata = raw;
+        auto loaded = jsd::load_applicator(ldata, path, key, measure, mode);
+        assert(loaded.cache_mode() == mode);
+        assert(ldata == data);
+        assert(loaded.row_sums() == app.row_sums());
+        for(size_t i = 0; i < n; ++i) {
+            for(size_t j = 0; j < n; ++j) {
+                const double x = app(i, j), y = loaded(i, j);
+                // Full-precision caches are restored exactly; without them, logs and square roots are recomputed
+                assert(mode == jsd::CACHE_FULL ? x == y: std::abs(x - y) <= 1e-10 * std::max(1., std::abs(x)));
+            }
+        }
+    }
+
+    // Mismatched files are rejected before the data is touched
+    MatrixType ldata = raw;
+    bool threw = false;
+    try {jsd::load_applicator(ldata, path, key + 1, measure);} catch(const std::runtime_error &) {threw = true;}
+    assert(threw && ldata == raw);
+    if(pc) {
+        const std::string bad = dir + "/badprior";
+        rewrite_prior(path, bad, std::vector<double>(raw.columns() + 1, 1.));
+        threw = false;
+        try {jsd::load_applicator(ldata, bad, key, measure);} catch(const std::runtime_error &) {threw = true;}
+        assert(threw && ldata == raw);
+    }
+
+    // The second call loads what the first saved
+    MatrixType first = raw, second = raw;
+    auto made = jsd::make_cached_applicator(first, dir, measure, prior, pc);
+    auto restored = jsd::make_cached_applicator(second, dir, measure, prior, pc);
+    assert(first == second && made.row_sums() == restored.row_sums());
+    for(size_t i = 0; i < n; ++i)
+        for(size_t j = 0; j < n; ++j)
+            assert(made(i, j) == restored(i, j));
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directory(dir);
+}
+
+int main() {
+    char tmpl[] = "/tmp/applicatorcachetestXXXXXX";
+    if(!::mkdtemp(tmpl)) throw std::system_error(errno, std::system_category(), "mkdtemp");
+    const std::string dir = tmpl;
+    const size_t n = 30, d = 20;
+    wy::WyRand<uint64_t> rng(5);
+    std::uniform_real_distribution<double> urd(0.01, 1.);
+    blaze::DynamicMatrix<double> dense(n, d);
+    blaze::CompressedMatrix<double> sparse(n, d);
+    for(size_t i = 0; i < n; ++i) {
+        for(size_t j = 0; j < d; ++j) {
+            dense(i, j) = urd(rng);
+            if(j == i % d || rng() % 3 == 0) sparse(i, j) = urd(rng);
+        }
+    }
+    const PriorT prior{0.5};
+    for(const auto measure: {blz::JSD, blz::HELLINGER}) {
+        check_round_trip(dense, measure, dist::NONE, static_cast<const PriorT *>(nullptr), dir);
+        check_round_trip(sparse, measure, dist::GAMMA_BETA, &prior, dir);
+    }
+    std::filesystem::remove_all(dir);
+    std::fprintf(stderr, "Applicator cache tests passed\n");
+}
@@ -0,0 +1,218 @@
+#include "minocore/dist/applicator.h"
+#include <getopt.h>
+#include <chrono>
+#include <random>
+
+/*
+ * Micro-benchmarks for DissimilarityApplicator::call<M>, for every measure the applicator dispatches,
+ * in the i-j (two rows), i-vector and vector-i (row vs. a dense center, with its log/sqrt cache) forms,
+ * over dense and sparse, float and double data, with and without a Dirichlet prior,
+ * for each dimension and density requested.
+ *
+ * Kernels run single-threaded; lazy applicator caches are built by a warm-up pass before timing.
+ * Output is one record per (measure, form, storage, type, prior, dimension, density), as CSV or JSON,
+ * with ns/op and GB/s, where GB/s counts the bytes of the operand rows and vectors only
+ * (not the applicator's log/sqrt caches).
+ */
+
+using namespace minocore;
+using namespace blz;
+using clk = std::chrono::steady_clock;
+
+static volatile double benchmark_sink;
+
+struct Record {
+    const char *measure_, *form_, *storage_, *type_, *prior_;
+    size_t d_;
+    double density_, nnz_per_row_;
+    double ns_per_op_, gbps_;
+    uint64_t ops_;
+};
+
+struct Options {
+    std::vector<size_t> dims{64, 1024, 16384};
+    std::vector<double> densities{1., 0.1, 0.01};
+    size_t nrows = 128;
+    unsigned ncenters = 8;
+    double min_seconds = 0.05;
+    uint64_t seed = 13;
+    bool json = false, run_dense = true, run_sparse = true, run_float = true, run_double = true;
+};
+
+template<DissimilarityMeasure...Ms> struct MeasureList {};
+// The measures dispatched by DissimilarityApplicator::operator()
+using BenchmarkedMeasures = MeasureList<
+    L1, L2, SQRL2, JSM, JSD, MKL, POISSON, HELLINGER, BHATTACHARYYA_METRIC, BHATTACHARYYA_DISTANCE,
+    TOTAL_VARIATION_DISTANCE, LLR, REVERSE_MKL, REVERSE_POISSON, UWLLR, OLLR, ITAKURA_SAITO, REVERSE_ITAKURA_SAITO,
+    COSINE_DISTANCE, PROBABILITY_COSINE_DISTANCE, COSINE_SIMILARITY, PROBABILITY_COSINE_SIMILARITY, EMD, WEMD>;
+
+// Calls f(t) for t = 0, 1, ... until min_seconds have passed, after one untimed pass of n calls.
+// Returns (ns per call, calls timed).
+template<typename F>
+std::pair<double, uint64_t> time_calls(const F &f, size_t n, double min_seconds) {
+    double sink = 0.;
+    for(size_t t = 0; t < n; ++t) sink += f(t);
+    uint64_t ops = 0;
+    double elapsed;
+    const auto start = clk::now();
+    do {
+        for(size_t t = 0; t < n; ++t) sink += f(ops + t);
+        ops += n;
+    } while((elapsed = std::chrono::duration<double>(clk::now() - start).count()) < min_seconds);
+    benchmark_sink = sink;
+    return {elapsed * 1e9 / ops, ops};
+}
+
+// Nonnegative data with each entry nonzero with probability density, and at least one nonzero per row
+blaze::DynamicMatrix<double> make_data(size_t nr, size_t d, double density, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> unif;
+    std::gamma_distribution<double> gamma(2., 2.);
+    blaze::DynamicMatrix<double> ret(nr, d, 0.);
+    for(size_t i = 0; i < nr; ++i) {
+        for(size_t j = 0; j < d; ++j)
+            if(unif(rng) < density) ret(i, j) = gamma(rng) + 1e-3;
+        if(blaze::nonZeros(row(ret, i)) == 0) ret(i, rng() % d) = gamma(rng) + 1e-3;
+    }
+    return ret;
+}
+
+template<typename MatrixType>
+struct MeasureBench {
+    using FT = blaze::ElementType_t<MatrixType>;
+    using VT = blaze::DynamicVector<FT, blaze::rowVector>;
+    const Options &opts_;
+    const MatrixType &base_;
+    const char *storage_, *type_;
+    std::vector<Record> &out_;
+
+    template<DissimilarityMeasure M>
+    void run(dist::Prior prior) {
+        MatrixType data(base_);
+        const VT prior_data{FT(1)};
+        DissimilarityApplicator<MatrixType> app(data, M, prior, prior == dist::DIRICHLET ? &prior_data: static_cast<const VT *>(nullptr));
+        const size_t nr = app.size(), d = data.columns();
+        const double nnz_per_row = double(blaze::nonZeros(app.data())) / nr;
+        const double row_bytes = blaze::IsSparseMatrix_v<MatrixType> ? nnz_per_row * (sizeof(FT) + sizeof(size_t)): double(d * sizeof(FT));
+        const double vec_bytes = d * sizeof(FT);
+        // Centers as in Lloyd's: dense rows of the prepared data, with the caches set_cache makes for M
+        std::vector<VT> centers(opts_.ncenters), caches;
+        for(unsigned c = 0; c < opts_.ncenters; ++c) centers[c] = row(app.data(), (c * 31 + 7) % nr);
+        if(dist::detail::needs_logs(M) || dist::detail::needs_sqrt(M)) {
+            caches.resize(centers.size());
+            for(size_t c = 0; c < centers.size(); ++c) dist::detail::set_cache(centers[c], caches[c], M);
+        }
+        auto cache = [&](size_t c) {return caches.empty() ? static_cast<const VT *>(nullptr): &caches[c];};
+        const unsigned nc = opts_.ncenters;
+        auto emit = [&](const char *form, std::pair<double, uint64_t> timing, double bytes) {
+            out_.push_back(Record{dist::detail::prob2str(M), form, storage_, type_, prior == dist::DIRICHLET ? "dirichlet": "none",
+                                  d, 0., nnz_per_row, timing.first, bytes / timing.first, timing.second});
+        };
+        emit("ij", time_calls([&](size_t t) {return double(app.template call<M>(t % nr, (t * 7 + 1) % nr));}, nr, opts_.min_seconds), 2. * row_bytes);
+        // OLLR's vector forms compute LLR, with a message per call
+        if constexpr(M != OLLR) {
+            emit("iv", time_calls([&](size_t t) {return double(app.template call<M>(t % nr, centers[t % nc], cache(t % nc)));}, nr, opts_.min_seconds),
+                 row_bytes + vec_bytes);
+            emit("vi", time_calls([&](size_t t) {return double(app.template call<M>(centers[t % nc], t % nr, cache(t % nc)));}, nr, opts_.min_seconds),
+                 row_bytes + vec_bytes);
+        }
+    }
+    template<DissimilarityMeasure...Ms>
+    void run_all(MeasureList<Ms...>) {
+        for(const auto prior: {dist::NONE, dist::DIRICHLET}) {
+            (run<Ms>(prior), ...);
+        }
+    }
+};
+
+template<typename MatrixType>
+void bench_matrix(const Options &opts, const blaze::DynamicMatrix<double> &base, double density,
+                  const char *storage, const char *type, std::vector<Record> &out)
+{
+    const MatrixType data(base);
+    const size_t start = out.size();
+    MeasureBench<MatrixType>{opts, data, storage, type, out}.run_all(BenchmarkedMeasures{});
+    for(size_t i = start; i < out.size(); ++i) out[i].density_ = density;
+    std::fprintf(stderr, "Finished %s %s, d = %zu, density = %g\n", storage, type, size_t(base.columns()), density);
+}
+
+void write_records(std::FILE *fp, const std::vector<Record> &records, bool json) {
+    if(json) {
+        std::fputs("[", fp);
+        for(size_t i = 0; i < records.size(); ++i) {
+            const auto &r = records[i];
+            std::fprintf(fp, "%s\n{\"measure\": \"%s\", \"form\": \"%s\", \"storage\": \"%s\", \"type\": \"%s\", \"prior\": \"%s\", "
+                             "\"d\": %zu, \"density\": %g, \"nnz_per_row\": %g, \"ns_per_op\": %.4f, \"gbps\": %.4f, \"ops\": %llu}",
+                         i ? ",": "", r.measure_, r.form_, r.storage_, r.type_, r.prior_, r.d_, r.density_, r.nnz_per_row_,
+                         r.ns_per_op_, r.gbps_, static_cast<unsigned long long>(r.ops_));
+        }
+        std::fputs("\n]\n", fp);
+    } else {
+        std::fputs("measure,form,storage,type,prior,d,density,nnz_per_row,ns_per_op,gbps,ops\n", fp);
+        for(const auto &r: records)
+            std::fprintf(fp, "%s,%s,%s,%s,%s,%zu,%g,%g,%.4f,%.4f,%llu\n", r.measure_, r.form_, r.storage_, r.type_, r.prior_,
+                         r.d_, r.density_, r.nnz_per_row_, r.ns_per_op_, r.gbps_, static_cast<unsigned long long>(r.ops_));
+    }
+}
+
+template<typename T, typename F>
+std::vector<T> parse_list(const char *s, const F &f) {
+    std::vector<T> ret;
+    for(char *end; *s; s = *end ? end + 1: end) {
+        ret.push_back(f(s, &end));
+        if(end == s) throw std::invalid_argument(std::string("Could not parse list at '") + s + "'");
+    }
+    return ret;
+}
+
+void usage(const char *ex) {
+    std::fprintf(stderr, "Usage: %s <flags>\n"
+                         "-d\tComma-separated dimensions [64,1024,16384]\n"
+                         "-s\tComma-separated densities (fraction of nonzero entries) [1,0.1,0.01]\n"
+                         "-n\tNumber of rows [128]\n"
+                         "-c\tNumber of centers for the vector forms [8]\n"
+                         "-m\tMinimum seconds per benchmark [0.05]\n"
+                         "-S\tSeed [13]\n"
+                         "-D\tDense only\n-P\tSparse only\n-f\tFloat only\n-F\tDouble only\n"
+                         "-j\tEmit JSON instead of CSV\n"
+                         "-o\tOutput path [stdout]\n", ex);
+    std::exit(1);
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    std::string outpath;
+    for(int c;(c = getopt(argc, argv, "d:s:n:c:m:S:o:DPfFjh?")) >= 0;) {
+        switch(c) {
+            case 'd': opts.dims = parse_list<size_t>(optarg, [](const char *s, char **e) {return std::strtoull(s, e, 10);}); break;
+            case 's': opts.densities = parse_list<double>(optarg, [](const char *s, char **e) {return std::strtod(s, e);}); break;
+            case 'n': opts.nrows = std::strtoull(optarg, nullptr, 10); break;
+            case 'c': opts.ncenters = std::atoi(optarg); break;
+            case 'm': opts.min_seconds = std::atof(optarg); break;
+            case 'S': opts.seed = std::strtoull(optarg, nullptr, 10); break;
+            case 'o': outpath = optarg; break;
+            case 'D': opts.run_sparse = false; break;
+            case 'P': opts.run_dense = false; break;
+            case 'f': opts.run_double = false; break;
+            case 'F': opts.run_float = false; break;
+            case 'j': opts.json = true; break;
+            case 'h': case '?': usage(*argv);
+        }
+    }
+    if(!opts.nrows || !opts.ncenters) throw std::invalid_argument("Need at least one row and one center");
+    OMP_SET_NT(1);
+    std::vector<Record> records;
+    for(const auto d: opts.dims) {
+        for(const auto density: opts.densities) {
+            const auto base = make_data(opts.nrows, d, density, opts.seed);
+            if(opts.run_dense && opts.run_float) bench_matrix<blaze::DynamicMatrix<float>>(opts, base, density, "dense", "float", records);
+            if(opts.run_dense && opts.run_double) bench_matrix<blaze::DynamicMatrix<double>>(opts, base, density, "dense", "double", records);
+            if(opts.run_sparse && opts.run_float) bench_matrix<blaze::CompressedMatrix<float>>(opts, base, density, "sparse", "float", records);
+            if(opts.run_sparse && opts.run_double) bench_matrix<blaze::CompressedMatrix<double>>(opts, base, density, "sparse", "double", records);
+        }
+    }
+    std::FILE *fp = outpath.empty() ? stdout: std::fopen(outpath.data(), "w");
+    if(!fp) throw std::runtime_error(std::string("Could not open ") + outpath);
+    write_records(fp, records, opts.json);
+    if(fp != stdout) std::fclose(fp);
+}
@@ -0,0 +1,58 @@
+#include "minocore/dist/applicator.h"
+
+using namespace minocore;
+
+using PriorT = blaze::DynamicVector<double, blaze::rowVector>;
+
+// Distances under CACHE_FLOAT and CACHE_NONE must match CACHE_FULL, and CACHE_AUTO must follow the budget.
+template<typename MatrixType>
+static void check_modes(const MatrixType &raw, dist::DissimilarityMeasure measure) {
+    // Applicators normalize their data in place
+    MatrixType fulldata = raw, floatdata = raw, nonedata = raw;
+    jsd::DissimilarityApplicator<MatrixType> full(fulldata, measure, dist::NONE, static_cast<const PriorT *>(nullptr), jsd::CACHE_FULL);
+    jsd::DissimilarityApplicator<MatrixType> flt(floatdata, measure, dist::NONE, static_cast<const PriorT *>(nullptr), jsd::CACHE_FLOAT);
+    jsd::DissimilarityApplicator<MatrixType> none(nonedata, measure, dist::NONE, static_cast<const PriorT *>(nullptr), jsd::CACHE_NONE);
+    assert(full.cache_mode() == jsd::CACHE_FULL && flt.cache_mode() == jsd::CACHE_FLOAT && none.cache_mode() == jsd::CACHE_NONE);
+    full.prepare_caches();
+    flt.prepare_caches();
+    const size_t n = raw.rows();
+    for(size_t i = 0; i < n; ++i) {
+        for(size_t j = 0; j < n; ++j) {
+            const double fv = full(i, j), lv = flt(i, j), nv = none(i, j);
+            assert(std::abs(fv - nv) <= 1e-10 * std::max(1., std::abs(fv)) || !std::fprintf(stderr, "none %zu/%zu: %g vs %g\n", i, j, nv, fv));
+            assert(std::abs(fv - lv) <= 1e-4 * std::max(1., std::abs(fv)) || !std::fprintf(stderr, "float %zu/%zu: %g vs %g\n", i, j, lv, fv));
+        }
+    }
+
+    const size_t dbytes = none.cache_bytes(sizeof(double)), fbytes = none.cache_bytes(sizeof(float));
+    assert(dbytes > fbytes);
+    none.set_cache_mode(jsd::CACHE_AUTO, dbytes);
+    assert(none.cache_mode() == jsd::CACHE_FULL);
+    none.set_cache_mode(jsd::CACHE_AUTO, dbytes - 1);
+    assert(none.cache_mode() == jsd::CACHE_FLOAT);
+    none.set_cache_mode(jsd::CACHE_AUTO, fbytes - 1);
+    assert(none.cache_mode() == jsd::CACHE_NONE);
+    // The default budget, a share of physical memory, easily holds these
+    none.set_cache_mode(jsd::CACHE_AUTO);
+    assert(dbytes > jsd::detail::default_cache_budget() || none.cache_mode() == jsd::CACHE_FULL);
+}
+
+int main() {
+    const size_t n = 40, d = 25;
+    wy::WyRand<uint64_t> rng(7);
+    std::uniform_real_distribution<double> urd(0.01, 1.);
+    blaze::DynamicMatrix<double> dense(n, d);
+    blaze::CompressedMatrix<double> sparse(n, d);
+    for(size_t i = 0; i < n; ++i) {
+        for(size_t j = 0; j < d; ++j) {
+            dense(i, j) = urd(rng);
+            if(j == i % d || rng() % 3 == 0) sparse(i, j) = urd(rng);
+        }
+    }
+    for(const auto measure: {blz::JSD, blz::MKL, blz::HELLINGER, blz::BHATTACHARYYA_METRIC})
+        check_modes(dense, measure);
+    // Zeros make MKL infinite
+    for(const auto measure: {blz::JSD, blz::HELLINGER, blz::BHATTACHARYYA_METRIC})
+        check_modes(sparse, measure);
+    std::fprintf(stderr, "Cache mode tests passed\n");
+}
@@ -0,0 +1,85 @@
+#include "minocore/wip/stream_ingest.h"
+#include <filesystem>
+
+using namespace minocore;
+using namespace minocore::streaming;
+
+using Source = BlockSource<blaze::DynamicMatrix<float>, double>;
+using Clusterer = KServiceClusterer<blaze::DynamicVector<float, blaze::rowVector>, blz::sqrL2Norm, double>;
+
+// Passes blocks through from another source, then fails as if the process had died.
+struct CrashingSource: public Source {
+    std::unique_ptr<Source> src_;
+    size_t nleft_;
+    CrashingSource(std::unique_ptr<Source> src, size_t nblocks): src_(std::move(src)), nleft_(nblocks) {}
+    bool next(Block<blaze::DynamicMatrix<float>, double> &blk) override {
+        if(!nleft_--) throw std::runtime_error("Simulated crash");
+        return src_->next(blk);
+    }
+};
+
+static std::vector<std::unique_ptr<Source>> open_sources(const std::vector<std::string> &paths, size_t dim) {
+    std::vector<std::unique_ptr<Source>> ret;
+    for(const auto &p: paths) ret.emplace_back(new DenseFileSource<float, double>(p, dim, 256));
+    return ret;
+}
+
+// A clusterer resumed from a checkpoint must end in the same state as one that ran uninterrupted.
+int main() {
+    char tmpl[] = "/tmp/checkpointtestXXXXXX";
+    if(!::mkdtemp(tmpl)) throw std::system_error(errno, std::system_category(), "mkdtemp");
+    const std::string dir = tmpl;
+    const size_t dim = 8, nper = 2000, k = 5;
+    const std::vector<std::string> paths{dir + "/a.bin", dir + "/b.bin.gz"};
+    std::mt19937_64 mt(3);
+    std::normal_distribution<float> nd;
+    for(const auto &p: paths) {
+        std::vector<float> data(nper * dim);
+        for(size_t i = 0; i < nper; ++i)
+            for(size_t j = 0; j < dim; ++j) data[i * dim + j] = nd(mt) + 10.f * ((i % k) == j);
+        gzFile fp = gzopen(p.data(), p.back() == 'z' ? "wb": "wbT");
+        gzwrite(fp, data.data(), data.size() * sizeof(float));
+        gzclose(fp);
+    }
+    const size_t n = nper * paths.size();
+    Clusterer full(blz::sqrL2Norm(), k, n, 2., 7);
+    {
+        auto sources = open_sources(paths, dim);
+        const size_t ningested = ingest(full, sources);
+        assert(ningested == n);
+    }
+
+    const std::string ckpt = dir + "/ckpt.bin";
+    {
+        Clusterer crashed(blz::sqrL2Norm(), k, n, 2., 7);
+        auto sources = open_sources(paths, dim);
+        std::vector<std::unique_ptr<Source>> crashing;
+        crashing.emplace_back(new CrashingSource(std::move(sources[0]), 5));
+        bool threw = false;
+        try {ingest(crashed, crashing, 0, ckpt, 500);} catch(const std::runtime_error &) {threw = true;}
+        assert(threw);
+    }
+    assert(::access((ckpt + ".tmp").data(), F_OK) != 0);
+    Clusterer resumed(blz::sqrL2Norm(), k, n, 2., 99);
+    resumed.load_checkpoint(ckpt);
+    const size_t skip = resumed.nseen();
+    std::fprintf(stderr, "Resuming after %zu of %zu items\n", skip, n);
+    assert(skip > 0 && skip < nper);
+    {
+        auto sources = open_sources(paths, dim);
+        const size_t ningested = ingest(resumed, sources, skip);
+        assert(ningested == n - skip);
+    }
+
+    assert(resumed.nseen() == full.nseen() && full.nseen() == n);
+    auto same = [](const auto &x, const auto &y) {
+        if(x.size() != y.size()) return false;
+        for(size_t i = 0; i < x.size(); ++i)
+            if(x[i].second != y[i].second || x[i].first != y[i].first) return false;
+        return true;
+    };
+    assert(same(resumed.mstack_.getc(), full.mstack_.getc()));
+    assert(same(resumed.readingstack_, full.readingstack_));
+    std::fprintf(stderr, "Resumed run matches the uninterrupted run with %zu facilities\n", full.nfacilities());
+    std::filesystem::remove_all(dir);
+}
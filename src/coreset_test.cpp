@@ -1,4 +1,5 @@
 #include "minocore/coreset.h"
+#include <set>
 using namespace minocore;
 
 int main() {
@@ -26,4 +27,22 @@ int main() {
     sample.compact();
     std::fprintf(stderr, "sample of 20 is of size %zu after compacting\n", sample.size());
     //if(0) sampler.make_sampler(10, 10, nullptr, nullptr);
+
+    sampler.set_keep_assignments();
+    sampler.make_sampler(npoints, ncenters, costs.data(), assignments.data(), weights.data(), 2);
+    // Every cluster with positive mass is sampled, even when n is the number of clusters
+    auto strat = sampler.sample(ncenters, 3, 0.1, coresets::STRATIFIED_BY_CENTER);
+    std::set<uint32_t> strata;
+    for(size_t i = 0; i < strat.size(); ++i) strata.insert(assignments[strat.indices_[i]]);
+    assert(strata.size() == ncenters);
+    bool threw = false;
+    try {sampler.sample(ncenters - 1, 3, 0.1, coresets::STRATIFIED_BY_CENTER);} catch(const std::invalid_argument &) {threw = true;}
+    assert(threw);
+    // Poisson samples have n points and the total weight in expectation
+    const double total_weight = std::accumulate(weights.begin(), weights.end(), 0.);
+    auto pois = sampler.sample(1000, 5, 0.1, coresets::POISSON);
+    const double pois_weight = std::accumulate(pois.weights_.begin(), pois.weights_.end(), 0.);
+    std::fprintf(stderr, "Poisson sample of 1000 has %zu points and weight %g of %g\n", pois.size(), pois_weight, total_weight);
+    assert(pois.size() > 850 && pois.size() < 1150);
+    assert(std::abs(pois_weight - total_weight) < .1 * total_weight);
 }
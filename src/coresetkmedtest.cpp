@@ -0,0 +1,148 @@
+#include "minocore/clustering.h"
+
+using namespace minocore;
+using namespace minocore::clustering;
+
+// Rows of a prepared applicator keep their prior, row sums and distances when gathered into a new applicator.
+static void test_like_applicator() {
+    blaze::CompressedMatrix<double> cm{
+        {0, 7, 6, 0, 6, 6, 0, 0, 7, 9},
+        {6, 7, 0, 0, 0, 5, 6, 9, 0, 0},
+        {1, 5, 0, 3, 1, 1, 1, 3, 1, 1},
+        {1, 1, 3, 2, 2, 0, 21, 1, 7, 1},
+        {0, 0, 0, 4, 0, 0, 0, 2, 0, 8}
+    };
+    const blaze::DynamicVector<double, blaze::rowVector> prior{0.5};
+    auto app = make_probdiv_applicator(cm, blz::JSD, jsd::GAMMA_BETA, &prior);
+    const std::vector<uint32_t> ids{4, 1, 3};
+    blaze::CompressedMatrix<double> sub = rows(app.data(), ids.data(), ids.size());
+    auto like = jsd::make_like_applicator(app, sub, ids.data(), ids.size());
+    for(size_t i = 0; i < ids.size(); ++i) {
+        assert(like.row_sums()[i] == app.row_sums()[ids[i]]);
+        for(size_t j = 0; j < ids.size(); ++j)
+            assert(std::abs(like(i, j) - app(ids[i], ids[j])) < 1e-12 || !std::fprintf(stderr, "%zu/%zu: %g vs %g\n", i, j, like(i, j), app(ids[i], ids[j])));
+    }
+}
+
+// Client weights must change the metric k-median solution, for dense and sparse facility costs.
+static void test_weighted_kmedian() {
+    const std::vector<float> x{0., 1., 2., 3., 100.};
+    const std::vector<float> w{1., 1., 1., 1., 100.};
+    auto oracle = [&x](size_t i, size_t j) {return std::abs(x[i] - x[j]);};
+    for(const unsigned sparse: {0u, unsigned(x.size())}) {
+        auto ct = make_clustering_traits<float, uint32_t, HARD, INTRINSIC>(x.size(), 1, UNIFORM_SAMPLING, METRIC_KMEDIAN, CONSTANT_FACTOR);
+        ct.compute_full = false;
+        ct.sparse_candidates = sparse;
+        auto [uc, uasn, ucosts] = perform_cluster_metric_kmedian<uint32_t, float>(oracle, x.size(), ct);
+        assert(uc.size() == 1 && uc[0] == 2);
+        ct.weights = w.data();
+        auto [wc, wasn, wcosts] = perform_cluster_metric_kmedian<uint32_t, float>(oracle, x.size(), ct);
+        assert(wc.size() == 1 && wc[0] == 4);
+        // Costs are distances, not weighted distances
+        for(size_t i = 0; i < x.size(); ++i) assert(wcosts[i] == oracle(i, 4));
+    }
+}
+
+// Metric k-median on a weighted coreset should estimate, and nearly match, the cost on the full data.
+static void test_coreset_cost() {
+    const size_t n = 3000, d = 3, k = 3;
+    blaze::DynamicMatrix<float> mat(n, d);
+    wy::WyRand<uint64_t> rng(5);
+    std::uniform_real_distribution<float> urd;
+    for(size_t i = 0; i < n; ++i)
+        for(size_t j = 0; j < d; ++j)
+            mat(i, j) = urd(rng) + 20.f * (j == i % k);
+    auto app = make_probdiv_applicator(mat, blz::L1);
+    auto ct = make_clustering_traits<float, uint32_t, HARD, INTRINSIC>(n, k, D2_SAMPLING, METRIC_KMEDIAN, CONSTANT_FACTOR);
+    ct.seed = 11;
+    update_defaults_with_measure(ct, app.get_measure());
+
+    detail::CoresetRun<INTRINSIC, blaze::DynamicMatrix<float>, float, uint32_t> run(app, ct, 400);
+    run.seed();
+    run.sensitivity();
+    run.sample();
+    run.optimize();
+    run.assign();
+    const auto &cs = *run.cs_;
+    const auto &centers = run.center_ids_;
+    assert(centers.size() == k);
+    double full = 0., est = 0.;
+    for(size_t i = 0; i < n; ++i) full += run.costs_[i];
+    for(size_t i = 0; i < cs.size(); ++i) {
+        double best = std::numeric_limits<double>::max();
+        for(const auto c: centers) best = std::min(best, double(app(cs.indices_[i], c)));
+        est += cs.weights_[i] * best;
+    }
+    auto [fc, fasn, fcosts] = perform_cluster_metric_kmedian<uint32_t, float>(detail::make_aa(app), n, ct);
+    const double direct = blaze::sum(fcosts);
+    std::fprintf(stderr, "Coreset estimate %g, full-data cost %g of the coreset solution, %g of the full-data solution\n", est, full, direct);
+    assert(std::abs(est - full) < 0.25 * full);
+    assert(full < 1.2 * direct);
+}
+
+// Coreset mode through the public entry point: the size it resolves to, and results for every point of the full data.
+static void test_perform_clustering_coreset() {
+    auto ct = make_clustering_traits<float, uint32_t, HARD, INTRINSIC>(1000, 3);
+    assert(requested_coreset_size(ct) == 0);
+    ct.coreset_eps = 0.1;
+    assert(requested_coreset_size(ct) == 300);
+    ct.coreset_size = 50;
+    assert(requested_coreset_size(ct) == 50);
+    ct.coreset_size = 2; // Never fewer points than centers
+    assert(requested_coreset_size(ct) == 3);
+
+    const size_t n = 3000, d = 3, k = 3;
+    blaze::DynamicMatrix<float> mat(n, d);
+    wy::WyRand<uint64_t> rng(9);
+    std::uniform_real_distribution<float> urd;
+    for(size_t i = 0; i < n; ++i)
+        for(size_t j = 0; j < d; ++j)
+            mat(i, j) = urd(rng) + 20.f * (j == i % k);
+
+    // Intrinsic metric k-median: assignments are ids of center points in the full data
+    auto app = make_probdiv_applicator(mat, blz::L1);
+    auto aa = detail::make_aa(app);
+    auto cluster = [&](size_t cs_size, double cs_eps, unsigned nrestarts) {
+        return perform_clustering<HARD, INTRINSIC>(app, n, k, nullptr, D2_SAMPLING, METRIC_KMEDIAN, CONSTANT_FACTOR,
+                                                   11, 100, 1e-4, cs_size, cs_eps, nrestarts);
+    };
+    auto [dc, dasn, dcosts] = cluster(0, 0., 1);
+    const double direct = blaze::sum(dcosts);
+    for(const auto &[cs_size, cs_eps, nrestarts]: {std::make_tuple(size_t(400), 0., 1u), std::make_tuple(size_t(0), 0.1, 1u),
+                                                   std::make_tuple(size_t(400), 0., 3u)})
+    {
+        auto [cc, casn, ccosts] = cluster(cs_size, cs_eps, nrestarts);
+        assert(cc.size() == k && casn.size() == n && ccosts.size() == n);
+        for(size_t i = 0; i < n; ++i) {
+            assert(std::find(cc.begin(), cc.end(), casn[i]) != cc.end());
+            assert(ccosts[i] == aa(i, casn[i]));
+            for(const auto c: cc) assert(ccosts[i] <= aa(i, c));
+        }
+        const double cost = blaze::sum(ccosts);
+        std::fprintf(stderr, "Coreset (size %zu, eps %g, %u restarts) cost %g, full-data cost %g\n", cs_size, cs_eps, nrestarts, cost, direct);
+        assert(cost < 1.2 * direct);
+    }
+    // A coreset as large as the data is not used
+    auto [fc, fasn, fcosts] = cluster(n, 0., 1);
+    assert(fc == dc && fasn == dasn && fcosts == dcosts);
+
+    // Extrinsic EM: assignments are positions in the returned centers
+    auto sqapp = make_probdiv_applicator(mat, blz::SQRL2);
+    auto [sc, sasn, scosts] = perform_clustering<HARD, EXTRINSIC>(sqapp, n, k, nullptr, D2_SAMPLING, EXPECTATION_MAXIMIZATION,
+                                                                  BICRITERIA, 11, 100, 1e-4, 0, 0.1);
+    assert(sc.size() == k && sasn.size() == n && scosts.size() == n);
+    for(size_t i = 0; i < n; ++i) {
+        assert(sasn[i] < k);
+        const double c = blaze::sqrNorm(row(mat, i) - sc[sasn[i]]);
+        assert(std::abs(scosts[i] - c) <= 1e-3 * std::max(1., c));
+        for(const auto &ctr: sc) assert(c <= blaze::sqrNorm(row(mat, i) - ctr) * (1. + 1e-6));
+    }
+}
+
+int main() {
+    test_like_applicator();
+    test_weighted_kmedian();
+    test_coreset_cost();
+    test_perform_clustering_coreset();
+    std::fprintf(stderr, "Weighted and coreset k-median tests passed\n");
+}
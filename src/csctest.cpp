@@ -1,8 +1,15 @@
 #include "minocore/util/csc.h"
 
+static bool zero_copy = false, transpose = false;
+
 template<typename IndPtrT, typename IndicesT, typename VT>
 void dothing(std::string path) {
-    auto read = minocore::csc2sparse<float, IndPtrT, IndicesT, VT>(path);
+    if(zero_copy) {
+        auto view = minocore::load_csr_view<float, IndPtrT, IndicesT, VT>(path);
+        std::fprintf(stderr, "nr: %zu. nc: %zu. nnz: %zu. sum: %g\n", view.rows(), view.columns(), view.nonZeros(), double(blaze::sum(row(view, 0))));
+        return;
+    }
+    auto read = minocore::csc2sparse<float, IndPtrT, IndicesT, VT>(path, false, transpose);
     std::fprintf(stderr, "nr: %zu. nc: %zu. nnz: %zu\n", read.rows(), read.columns(), read.nonZeros());
 }
 
@@ -28,14 +35,18 @@ int main(int argc, char *argv[]) {
     VT ip = U64;
     VT id = U64;
     VT dt = F32;
-    for(int c;(c = getopt(argc, argv, "p:i:d:h")) >= 0;) {
+    for(int c;(c = getopt(argc, argv, "p:i:d:zTh")) >= 0;) {
         switch(c) {
             case 'p': ip = c2v(optarg); break;
             case 'i': id = c2v(optarg); break;
             case 'd': dt = c2v(optarg); break;
+            case 'z': zero_copy = true; break;
+            case 'T': transpose = true; break;
         }
     }
     // Use as ./csctest -pu32 -iu32 -df32 cao_atlas_
+    // Add -z to map the files as a CSRMatrixView instead of copying into a CompressedMatrix
+    // Add -T to transpose (rows become the CSC row indices)
     if(optind != argc) inpath = argv[optind];
     if(dt != U32 && dt != F32) throw std::runtime_error("Not supported: datatype other than f32 or u32");
     if(ip == U64) {
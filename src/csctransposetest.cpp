@@ -0,0 +1,58 @@
+#include "minocore/util/csc.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace minocore;
+
+// Transposing a CSC matrix must match a serial transposition, and transposing twice must give back the original arrays,
+// for any number of threads.
+int main() {
+    const uint32_t nf = 300, n = 1000;
+    wy::WyRand<uint64_t> rng(7);
+    std::vector<uint64_t> indptr{0};
+    std::vector<uint32_t> indices;
+    std::vector<float> data;
+    for(uint32_t c = 0; c < n; ++c) {
+        for(uint32_t r = 0; r < nf; ++r) {
+            if(rng() % 16 == 0) {
+                indices.push_back(r);
+                data.push_back(float(rng() % 100 + 1));
+            }
+        }
+        indptr.push_back(indices.size());
+    }
+    // Serial reference: row r of the transpose holds, in column order, every (c, v) with r in column c
+    std::vector<uint64_t> rindptr(nf + 1);
+    for(const auto r: indices) ++rindptr[r + 1];
+    std::partial_sum(rindptr.begin(), rindptr.end(), rindptr.begin());
+    std::vector<uint32_t> rindices(indices.size());
+    std::vector<float> rdata(indices.size());
+    {
+        std::vector<uint64_t> pos(rindptr.begin(), rindptr.end() - 1);
+        for(uint32_t c = 0; c < n; ++c) {
+            for(size_t s = indptr[c]; s < indptr[c + 1]; ++s) {
+                const uint64_t p = pos[indices[s]]++;
+                rindices[p] = c;
+                rdata[p] = data[s];
+            }
+        }
+    }
+    const CSCMatrixView<uint64_t, uint32_t, float> csc(indptr.data(), indices.data(), data.data(), indices.size(), nf, n);
+    for(const int nt: {1, 3, 8}) {
+        OMP_SET_NT(nt);
+        OMP_ONLY(assert(omp_get_max_threads() == nt);)
+        auto t = detail::csc_transpose<float>(csc);
+        assert(t.nr_ == nf && t.nc_ == n && t.nnz() == indices.size());
+        assert(std::equal(rindptr.begin(), rindptr.end(), t.indptr_.get()));
+        assert(std::equal(rindices.begin(), rindices.end(), t.indices_.get()));
+        assert(std::equal(rdata.begin(), rdata.end(), t.data_.get()));
+        const CSCMatrixView<uint64_t, uint32_t, float> tcsc(t.indptr_.get(), t.indices_.get(), t.data_.get(), t.nnz(), n, nf);
+        auto tt = detail::csc_transpose<float>(tcsc);
+        assert(tt.nr_ == n && tt.nc_ == nf);
+        assert(std::equal(indptr.begin(), indptr.end(), tt.indptr_.get()));
+        assert(std::equal(indices.begin(), indices.end(), tt.indices_.get()));
+        assert(std::equal(data.begin(), data.end(), tt.data_.get()));
+    }
+    std::fprintf(stderr, "Double transposition matches the original\n");
+}
@@ -0,0 +1,77 @@
+#include "minocore/clustering.h"
+#include "minocore/util/csr.h"
+
+using namespace minocore;
+
+// A DissimilarityApplicator over a CSRMatrixView must agree with one over the same data in a CompressedMatrix,
+// through prep and a Lloyd iteration.
+int main() {
+    const size_t nr = 200, nc = 50;
+    const unsigned k = 5;
+    wy::WyRand<uint64_t> rng(13);
+    blaze::CompressedMatrix<float> cm(nr, nc);
+    cm.reserve(nr * nc / 3);
+    for(size_t i = 0; i < nr; ++i) {
+        bool any = false;
+        for(size_t j = 0; j < nc; ++j) {
+            if(rng() % 4 == 0 || (!any && j == nc - 1)) {
+                cm.append(i, j, float(1 + rng() % 10));
+                any = true;
+            }
+        }
+        cm.finalize(i);
+    }
+    CSRArrays<float, uint64_t, uint32_t> arr;
+    arr.nr_ = nr; arr.nc_ = nc;
+    arr.indptr_.reset(new uint64_t[nr + 1]);
+    arr.indices_.reset(new uint32_t[cm.nonZeros()]);
+    arr.data_.reset(new float[cm.nonZeros()]);
+    arr.indptr_[0] = 0;
+    for(size_t i = 0, p = 0; i < nr; ++i) {
+        for(auto it = cm.begin(i); it != cm.end(i); ++it, ++p) {
+            arr.indices_[p] = it->index();
+            arr.data_[p] = it->value();
+        }
+        arr.indptr_[i + 1] = arr.indptr_[i] + cm.nonZeros(i);
+    }
+    auto view = csr::arrays2view(std::move(arr));
+    {
+        // Mapping a view of trailing rows stores only their values
+        const size_t skip = 10;
+        CSRMatrixView<float, uint64_t, uint32_t> tail(view.indptr() + skip, view.indices(), view.data(), nr - skip, nc, view.owner());
+        auto doubled = tail.map([](float x) {return 2.f * x;});
+        assert(doubled.data_offset() == view.indptr()[skip]);
+        for(size_t i = 0; i < nr - skip; ++i) {
+            for(size_t j = 0; j < nc; ++j)
+                assert(doubled(i, j) == 2.f * cm(i + skip, j));
+            assert(size_t(std::distance(doubled.begin(i), doubled.end(i))) == cm.nonZeros(i + skip));
+        }
+    }
+    for(const auto measure: {JSD, SQRL2}) {
+        blaze::CompressedMatrix<float> cmcopy(cm);
+        auto vcopy = view.map([](float x) {return x;});
+        DissimilarityApplicator<blaze::CompressedMatrix<float>> app(cmcopy, measure, jsd::DIRICHLET);
+        DissimilarityApplicator<CSRMatrixView<float, uint64_t, uint32_t>> vapp(vcopy, measure, jsd::DIRICHLET);
+        for(size_t i = 0; i < nr; ++i) {
+            assert(std::abs(app.row_sums()[i] - vapp.row_sums()[i]) < 1e-4);
+            for(size_t j = 0; j < nr; j += 17)
+                assert(std::abs(app(i, j) - vapp(i, j)) <= 1e-4 * std::max(1.f, std::abs(app(i, j))));
+        }
+        std::vector<blaze::DynamicVector<float, blaze::rowVector>> centers, vcenters;
+        for(unsigned c = 0; c < k; ++c) {
+            centers.emplace_back(row(app.data(), c * 37 % nr));
+            vcenters.emplace_back(row(vapp.data(), c * 37 % nr));
+        }
+        blaze::DynamicVector<uint32_t> asn(nr), vasn(nr);
+        blaze::DynamicVector<float> costs(nr), vcosts(nr);
+        clustering::perform_lloyd_loop<clustering::HARD>(centers, asn, app, k, costs, 0, static_cast<const float *>(nullptr), 1, 0.);
+        clustering::perform_lloyd_loop<clustering::HARD>(vcenters, vasn, vapp, k, vcosts, 0, static_cast<const float *>(nullptr), 1, 0.);
+        for(size_t i = 0; i < nr; ++i) {
+            assert(asn[i] == vasn[i]);
+            assert(std::abs(costs[i] - vcosts[i]) <= 1e-4 * std::max(1.f, std::abs(costs[i])));
+        }
+        for(unsigned c = 0; c < k; ++c)
+            assert(blaze::max(blaze::abs(centers[c] - vcenters[c])) < 1e-5);
+        std::fprintf(stderr, "%s: view and CompressedMatrix agree\n", dist::detail::prob2str(measure));
+    }
+}
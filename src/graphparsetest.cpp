@@ -0,0 +1,99 @@
+#include "minocore/graph/fastparse.h"
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+using namespace minocore;
+using EL = graph::EdgeList<float, uint32_t>;
+
+static bool same(const EL &x, const EL &y) {
+    return x.nnodes_ == y.nnodes_ && x.edges_ == y.edges_ && x.weights_ == y.weights_;
+}
+
+// Each loader must give the expected edges for one chunk or many, and the binary cache must round-trip
+// and be rebuilt when its source changes.
+int main() {
+    char tmpl[] = "/tmp/graphparsetestXXXXXX";
+    if(!::mkdtemp(tmpl)) throw std::system_error(errno, std::system_category(), "mkdtemp");
+    const std::filesystem::path dir = tmpl;
+    wy::WyRand<uint64_t> rng(41);
+    const size_t n = 2000, m = 20000; // Large enough for many chunks
+
+    // DIMACS shortest-path format
+    EL expected;
+    expected.nnodes_ = n;
+    const std::string gr = dir / "g.gr";
+    {
+        std::ofstream ofs(gr);
+        ofs << "c random graph\nc with comments\np sp " << n << ' ' << m << '\n';
+        for(size_t i = 0; i < m; ++i) {
+            const uint32_t u = rng() % n, v = rng() % n;
+            const float w = float(rng() % 1000) + (i % 2 ? 0.25f: 0.f);
+            ofs << "a " << u + 1 << ' ' << v + 1 << ' ' << w << '\n';
+            if(i % 997 == 0) ofs << "c interleaved comment\n";
+            expected.edges_.emplace_back(u, v);
+            expected.weights_.push_back(w);
+        }
+    }
+    for(const size_t nchunks: {1, 3, 64})
+        assert(same(graph::fast_dimacs_official_parse<float, uint32_t>(gr, nchunks), expected));
+
+    // Adjacency lists: vertex ids are line numbers, skipping lines which do not start with a digit
+    EL expected_adj;
+    expected_adj.nnodes_ = n;
+    const std::string adj = dir / "g.graph";
+    {
+        std::ofstream ofs(adj);
+        ofs << n << ' ' << 2 * n << '\n';
+        for(uint32_t i = 0; i < n; ++i) {
+            if(i % 500 == 0) ofs << "% comment\n";
+            for(unsigned j = 0, nn = 1 + rng() % 3; j < nn; ++j) {
+                const uint32_t v = rng() % n;
+                ofs << v + 1 << (j + 1 == nn ? '\n': ' ');
+                expected_adj.edges_.emplace_back(i, v);
+            }
+        }
+    }
+    expected_adj.weights_.assign(expected_adj.edges_.size(), 1.f);
+    for(const size_t nchunks: {1, 3, 64})
+        assert(same(graph::fast_dimacs_unweighted_parse<float, uint32_t>(adj, nchunks), expected_adj));
+
+    // NBER csv: the header is skipped, and vertices are numbered in order of first appearance
+    EL expected_nber;
+    const std::string csv = dir / "nber.csv";
+    {
+        std::ofstream ofs(csv);
+        ofs << "state1,place1,mi_to_place,state2,place2\n";
+        std::map<std::pair<unsigned, unsigned>, uint32_t> ids;
+        auto getid = [&](std::pair<unsigned, unsigned> loc) {return ids.emplace(loc, uint32_t(ids.size())).first->second;};
+        for(size_t i = 0; i < m; ++i) {
+            const std::pair<unsigned, unsigned> lhs(rng() % 50, rng() % 40), rhs(rng() % 50, rng() % 40);
+            const float w = float(rng() % 5000) / 4.f;
+            ofs << '"' << lhs.first << "\",\"" << lhs.second << "\"," << w << ",\"" << rhs.first << "\",\"" << rhs.second << "\"\n";
+            const uint32_t lid = getid(lhs);
+            expected_nber.edges_.emplace_back(lid, getid(rhs));
+            expected_nber.weights_.push_back(w);
+        }
+        expected_nber.nnodes_ = ids.size();
+    }
+    for(const size_t nchunks: {1, 3, 64})
+        assert(same(graph::fast_nber_parse<float, uint32_t>(csv, nchunks), expected_nber));
+
+    // Binary cache
+    const std::string cache = dir / "g.gr.cache";
+    assert(same(cached_parse_edgelist<float, uint32_t>(gr, cache), expected));
+    assert(std::filesystem::exists(cache));
+    EL cached;
+    assert(cached.read(cache, nullptr) && same(cached, expected));
+    assert(same(cached_parse_edgelist<float, uint32_t>(gr, cache), expected));
+    {
+        // A changed source (here, of a different size) invalidates the cache
+        std::ofstream ofs(gr);
+        ofs << "p sp 3 2\na 1 2 1.5\na 2 3 2.5\n";
+    }
+    auto changed = cached_parse_edgelist<float, uint32_t>(gr, cache);
+    assert(changed.nnodes_ == 3 && changed.num_edges() == 2 && changed.weights_[1] == 2.5f);
+    assert(cached.read(cache, nullptr) && same(cached, changed));
+    std::filesystem::remove_all(dir);
+    std::fprintf(stderr, "Graph loader tests passed\n");
+}
@@ -326,6 +326,7 @@ void usage(const char *ex) {
                          "-i\tSet number of Thorup mincost iterations for iterative Thorup D mincost. Implied -I\n"
                          "-I\tUse iterated Thorup D mincost.\n"
                          "-E\tOptimize sampled coresets and measure time and accuracy\n"
+                         "-G\tCache the parsed graph in binary form at <input>.mcgc and reuse it on later runs\n"
                 , ex);
     std::exit(1);
 }
@@ -389,6 +390,7 @@ int main(int argc, char **argv) {
     std::vector<unsigned> coreset_sizes;
     std::vector<unsigned> extra_ks;
     bool rectangular = false;
+    bool use_graph_cache = false;
     bool use_thorup_d = true, use_thorup_iterative = false;
     unsigned testing_num_centersets = 500;
     size_t rammax = 16uLL << 30;
@@ -408,7 +410,7 @@ int main(int argc, char **argv) {
     //bool test_samples_from_thorup_sampled = true;
     double eps = 0.1;
     BoundingBoxData bbox;
-    for(int c;(c = getopt(argc, argv, "C:e:B:S:N:T:t:p:o:M:z:s:c:K:k:R:i:VEILbDrh?")) >= 0;) {
+    for(int c;(c = getopt(argc, argv, "C:e:B:S:N:T:t:p:o:M:z:s:c:K:k:R:i:VEILbDGrh?")) >= 0;) {
         switch(c) {
             case 'e': if((eps = std::atof(optarg)) > 1. || eps < 0.)
                         throw std::runtime_error("Required: 0 >= eps >= 1.");
@@ -421,6 +423,7 @@ int main(int argc, char **argv) {
             case 'z': z = std::atof(optarg); break;
             case 'L': local_search_all_vertices = true; break;
             case 'r': rectangular = true; break;
+            case 'G': use_graph_cache = true; break;
             case 'b': std::cerr << "best improvement has been removed.\n"; break;
             case 'R': seed = std::strtoull(optarg, nullptr, 10); break;
             case 'M': rammax = str2nbytes(optarg); break;
@@ -462,7 +465,7 @@ int main(int argc, char **argv) {
 
     // Parse the graph
     util::Timer timer("parse time:");
-    minocore::Graph<undirectedS, float> g = parse_by_fn(input);
+    minocore::Graph<undirectedS, float> g = parse_by_fn(input, use_graph_cache);
     timer.stop();
     timer.display();
     using Vertex = typename boost::graph_traits<decltype(g)>::vertex_descriptor;
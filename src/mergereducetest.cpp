@@ -0,0 +1,93 @@
+#include "minocore/coreset/merge_reduce.h"
+#include <random>
+
+using namespace minocore;
+using namespace minocore::coresets;
+
+template<typename MT>
+double kmeans_cost(const MT &mat, const blaze::DynamicMatrix<double> &centers, const double *weights=nullptr) {
+    double ret = 0.;
+    for(size_t i = 0; i < mat.rows(); ++i) {
+        double best = std::numeric_limits<double>::max();
+        for(size_t j = 0; j < centers.rows(); ++j)
+            best = std::min(best, blaze::sqrNorm(row(mat, i) - row(centers, j)));
+        ret += (weights ? weights[i]: 1.) * best;
+    }
+    return ret;
+}
+
+// Feeds rows of a matrix in fixed-size chunks, as hdf5::DenseRowReader does
+struct MatrixSource {
+    using MatrixType = blaze::DynamicMatrix<double>;
+    const MatrixType &mat_;
+    size_t chunk_rows_;
+    template<typename F>
+    void for_each(F &&func) const {
+        for(size_t start = 0; start < mat_.rows(); start += chunk_rows_) {
+            MatrixType chunk = submatrix(mat_, start, 0, std::min(chunk_rows_, mat_.rows() - start), mat_.columns());
+            func(start, chunk);
+        }
+    }
+};
+
+// A merge-and-reduce coreset must hold O(cs_size * log n) points while streaming,
+// and its final reduction must preserve the total weight and k-means costs of the stream.
+int main() {
+    const size_t n = 20100, k = 4, d = 3, cs_size = 400, batch = 777;
+    wy::WyRand<uint64_t> rng(59);
+    std::normal_distribution<double> nd;
+    blaze::DynamicMatrix<double> centers(k, d), pts(n, d);
+    for(size_t j = 0; j < k; ++j)
+        for(size_t c = 0; c < d; ++c) centers(j, c) = 10. * (j + c % 2);
+    for(size_t i = 0; i < n; ++i)
+        for(size_t c = 0; c < d; ++c) pts(i, c) = centers(i % k, c) + nd(rng);
+    // A second, deliberately poor, solution
+    blaze::DynamicMatrix<double> shifted(centers);
+    for(size_t j = 0; j < k; ++j) shifted(j, 0) += 3.;
+
+    MergeReduceCoreset<blaze::DynamicMatrix<double>, double> mr(k, cs_size, 13);
+    size_t max_held = 0;
+    for(size_t start = 0; start < n; start += batch) {
+        mr.add(submatrix(pts, start, 0, std::min(batch, n - start), d));
+        max_held = std::max(max_held, mr.size());
+        assert(mr.size() <= cs_size * (mr.nlevels() + 1));
+    }
+    assert(mr.npoints() == n);
+    const size_t maxlevels = std::ceil(std::log2(double(n) / cs_size)) + 1;
+    assert(mr.nlevels() <= maxlevels);
+    assert(max_held <= cs_size * (maxlevels + 1));
+    assert(mr.nreductions() > 0);
+
+    const size_t held = mr.size();
+    auto cs = mr.result();
+    assert(mr.size() == held); // result() does not consume the stream
+    assert(cs.mat_.rows() <= cs_size && cs.mat_.rows() == cs.weights_.size() && cs.rowwise_);
+    const double wsum = blaze::sum(cs.weights_);
+    std::fprintf(stderr, "Held at most %zu points in %zu levels; coreset of %zu points with total weight %g\n",
+                 max_held, mr.nlevels(), cs.mat_.rows(), wsum);
+    assert(std::abs(wsum - n) <= 0.2 * n);
+    for(const auto *sol: {&centers, &shifted}) {
+        const double full = kmeans_cost(pts, *sol), approx = kmeans_cost(cs.mat_, *sol, cs.weights_.data());
+        std::fprintf(stderr, "Full cost %g, coreset cost %g\n", full, approx);
+        assert(std::abs(full - approx) <= 0.25 * full);
+    }
+
+    // Weighted points count by their weight: doubling every weight doubles the total
+    MergeReduceCoreset<blaze::DynamicMatrix<double>, double> wmr(k, cs_size, 13);
+    std::vector<double> twos(n, 2.);
+    wmr.add(pts, twos.data());
+    assert(std::abs(blaze::sum(wmr.result().weights_) - 2. * n) <= 0.2 * 2. * n);
+
+    // Mismatched dimensions are rejected (n is not a multiple of cs_size, so the leaf buffer is not empty)
+    bool threw = false;
+    try {
+        mr.add(blaze::DynamicMatrix<double>(2, d + 1, 0.));
+    } catch(const std::invalid_argument &) {threw = true;}
+    assert(threw);
+
+    // Streaming through a chunked source gives a bounded coreset
+    auto scs = stream_kmeans_coreset(MatrixSource{pts, 1500}, k, cs_size, 17);
+    assert(scs.mat_.rows() <= cs_size);
+    assert(std::abs(kmeans_cost(pts, centers) - kmeans_cost(scs.mat_, centers, scs.weights_.data())) <= 0.25 * kmeans_cost(pts, centers));
+    std::fprintf(stderr, "Merge-and-reduce tests passed\n");
+}
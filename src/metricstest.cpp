@@ -0,0 +1,187 @@
+#ifndef MINOCORE_METRICS
+#define MINOCORE_METRICS
+#endif
+#include "minocore/util/metrics.h"
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+using namespace minocore;
+
+// Just enough JSON to read back what metrics writes: objects, arrays, strings and numbers.
+struct Json {
+    enum Kind {OBJECT, ARRAY, STRING, NUMBER} kind_ = NUMBER;
+    std::map<std::string, Json> object_;
+    std::vector<Json> array_;
+    std::string string_;
+    double number_ = 0.;
+    const Json &operator[](const std::string &key) const {
+        auto it = object_.find(key);
+        if(it == object_.end()) throw std::runtime_error("Missing key " + key);
+        return it->second;
+    }
+};
+
+struct JsonParser {
+    const std::string &s_;
+    size_t pos_ = 0;
+    JsonParser(const std::string &s): s_(s) {}
+    void skip() {while(pos_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[pos_]))) ++pos_;}
+    void expect(char c) {
+        skip();
+        if(pos_ >= s_.size() || s_[pos_] != c) throw std::runtime_error(std::string("Expected ") + c + " at " + std::to_string(pos_));
+        ++pos_;
+    }
+    bool consume(char c) {
+        skip();
+        if(pos_ < s_.size() && s_[pos_] == c) {++pos_; return true;}
+        return false;
+    }
+    std::string string() {
+        expect('"');
+        std::string ret;
+        while(s_.at(pos_) != '"') {
+            if(s_[pos_] == '\\') ++pos_;
+            ret += s_.at(pos_++);
+        }
+        ++pos_;
+        return ret;
+    }
+    Json value() {
+        Json ret;
+        skip();
+        if(consume('{')) {
+            ret.kind_ = Json::OBJECT;
+            if(consume('}')) return ret;
+            do {
+                std::string key = string();
+                expect(':');
+                if(!ret.object_.emplace(key, value()).second) throw std::runtime_error("Duplicate key " + key);
+            } while(consume(','));
+            expect('}');
+        } else if(consume('[')) {
+            ret.kind_ = Json::ARRAY;
+            if(consume(']')) return ret;
+            do ret.array_.push_back(value()); while(consume(','));
+            expect(']');
+        } else if(s_.at(pos_) == '"') {
+            ret.kind_ = Json::STRING;
+            ret.string_ = string();
+        } else {
+            char *end;
+            ret.number_ = std::strtod(s_.data() + pos_, &end);
+            if(end == s_.data() + pos_) throw std::runtime_error("Bad value at " + std::to_string(pos_));
+            pos_ = end - s_.data();
+        }
+        return ret;
+    }
+};
+
+static Json parse_file(const std::string &path) {
+    std::ifstream ifs(path);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    const std::string text = ss.str();
+    JsonParser p(text);
+    Json ret = p.value();
+    p.skip();
+    assert(p.pos_ == text.size());
+    return ret;
+}
+
+static const char *measure_name(unsigned m) {
+    return m == 3 ? "three": m == metrics::MAX_MEASURES - 1 ? "last": "other";
+}
+
+// Counts must add up across threads, with or without slots, and stages must come out in the JSON and trace files.
+int main() {
+    metrics::reset();
+    int nthreads = 1;
+    OMP_ONLY(nthreads = omp_get_max_threads();)
+    {
+        METRICS_STAGE("outer");
+        // The outermost stage gives this thread and each thread of its OpenMP team a slot
+        std::vector<const void *> slots(nthreads);
+        OMP_PRAGMA("omp parallel for schedule(static, 1)")
+        for(int t = 0; t < nthreads; ++t) {
+            slots[t] = metrics::detail::tls_slot();
+            METRICS_COUNT(LLOYD_ITERATIONS, 1);
+            METRICS_COUNT_DISTANCE(3);
+            METRICS_STAGE("worker");
+        }
+        for(const auto p: slots) assert(p);
+        assert(std::set<const void *>(slots.begin(), slots.end()).size() == size_t(nthreads));
+        {
+            METRICS_STAGE("inner");
+            METRICS_COUNT(CACHE_HITS, 5);
+            METRICS_COUNT_DISTANCE(1000); // Shares the last slot
+        }
+    }
+    // A thread which never opened a stage counts without getting a slot
+    const size_t nslots = metrics::detail::registry().slots_.size();
+    std::thread([]() {
+        METRICS_COUNT(SWAPS_PRUNED, 2);
+        METRICS_COUNT_DISTANCE(3);
+        assert(!metrics::detail::tls_slot());
+    }).join();
+    assert(metrics::detail::registry().slots_.size() == nslots);
+
+    assert(metrics::total(metrics::LLOYD_ITERATIONS) == uint64_t(nthreads));
+    assert(metrics::total(metrics::CACHE_HITS) == 5 && metrics::total(metrics::SWAPS_PRUNED) == 2);
+    assert(metrics::distance_total(3) == uint64_t(nthreads) + 1);
+    assert(metrics::distance_total(metrics::MAX_MEASURES - 1) == 1);
+    const auto totals = metrics::stage_totals();
+    assert(totals.at("outer").count_ == 1 && totals.at("outer/inner").count_ == 1);
+    // Workers start their own paths, except the thread which opened "outer"
+    assert(totals.at("outer/worker").count_ + (totals.count("worker") ? totals.at("worker").count_: 0) == uint64_t(nthreads));
+    assert(totals.at("outer").total_ms_ >= totals.at("outer/inner").total_ms_);
+
+    char tmpl[] = "/tmp/metricstestXXXXXX";
+    const int fd = ::mkstemp(tmpl);
+    if(fd < 0) throw std::system_error(errno, std::system_category(), "mkstemp");
+    ::close(fd);
+    const std::string path = tmpl;
+
+    metrics::write_json(path, measure_name);
+    const Json j = parse_file(path);
+    for(unsigned i = 0; i < metrics::NCOUNTERS; ++i)
+        assert(j["counters"][metrics::counter_names[i]].number_ == double(metrics::total(metrics::Counter(i))));
+    assert(j["distance_calls"].object_.size() == 2);
+    assert(j["distance_calls"]["three"].number_ == nthreads + 1 && j["distance_calls"]["last"].number_ == 1);
+    assert(j["stages"].object_.size() == totals.size());
+    for(const auto &[p, t]: totals) {
+        const auto &s = j["stages"][p];
+        assert(s["count"].number_ == double(t.count_));
+        assert(std::abs(s["total_ms"].number_ - t.total_ms_) <= 1e-5 && std::abs(s["max_ms"].number_ - t.max_ms_) <= 1e-5);
+    }
+
+    metrics::write_chrome_trace(path);
+    const Json trace = parse_file(path);
+    const auto &events = trace["traceEvents"].array_;
+    size_t nevents = 0;
+    for(const auto &[p, t]: totals) nevents += t.count_;
+    assert(events.size() == nevents);
+    std::map<std::string, uint64_t> seen;
+    for(const auto &e: events) {
+        const std::string &p = e["args"]["path"].string_;
+        const auto slash = p.rfind('/');
+        assert(e["name"].string_ == (slash == std::string::npos ? p: p.substr(slash + 1)));
+        assert(e["ph"].string_ == "X" && e["cat"].string_ == "stage");
+        assert(e["ts"].number_ >= 0. && e["dur"].number_ >= 0.);
+        ++seen[p];
+    }
+    for(const auto &[p, t]: totals) assert(seen[p] == t.count_);
+
+    metrics::reset();
+    assert(metrics::total(metrics::SWAPS_PRUNED) == 0 && metrics::distance_total(3) == 0 && metrics::stage_totals().empty());
+    std::remove(path.data());
+    std::fprintf(stderr, "Metrics tests passed\n");
+}
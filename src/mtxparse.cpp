@@ -3,18 +3,56 @@
 #include "blaze/util/Serialization.h"
 #include <getopt.h>
 
-int main(int argc, char *argv[]) {
-    bool use_float = true;
-    for(int c;(c = getopt(argc, argv, "d:")) >= 0;)
-        if(c == 'd') use_float = false;
-    std::string out("/dev/stdout");
-    if(optind + 2 <= argc)
-        out = argv[optind + 1];
-    blaze::Archive<std::ofstream> ret(out);
-    if(use_float) {
-        ret << minocore::mtx2sparse<float>(argc == 1 ? "/dev/stdin": (char *)argv[optind]);
-    } else {
-        ret << minocore::mtx2sparse<double>(argc == 1 ? "/dev/stdin": (char *)argv[optind]);
+void usage(const char *ex) {
+    std::fprintf(stderr, "usage: %s <opts> [input.mtx[.gz]=/dev/stdin] [output]\n"
+                         "Benchmarks the Matrix Market reader and optionally serializes the result.\n"
+                         "-d\tUse double precision\n"
+                         "-n\tNumber of timed repetitions [1]\n"
+                         "-p\tNumber of threads [all]\n"
+                         "-C\tStreaming chunk size in MiB for compressed or piped input [64]\n"
+                         "-N\tDo not transpose (keep the file's rows as rows)\n"
+                         "-s\tSkip writing output\n", ex);
+    std::exit(1);
+}
+
+template<typename FT>
+int run(std::string in, std::string out, unsigned nreps, size_t chunk_bytes, bool transpose, bool write) {
+    minocore::CSRArrays<FT, uint64_t, uint32_t> arr;
+    double total_ms = 0.;
+    for(unsigned i = 0; i < nreps; ++i) {
+        auto start = std::chrono::high_resolution_clock::now();
+        arr = minocore::mtx::read_mtx<FT>(in, transpose, chunk_bytes);
+        auto stop = std::chrono::high_resolution_clock::now();
+        double ms = minocore::util::timediff2ms(start, stop);
+        total_ms += ms;
+        std::fprintf(stderr, "rep %u: %gms, %zu x %zu with %zu nonzeros (%g M nonzeros/s)\n",
+                     i, ms, arr.nr_, arr.nc_, arr.nnz(), arr.nnz() / ms * 1e-3);
+    }
+    std::fprintf(stderr, "mean: %gms\n", total_ms / nreps);
+    if(write) {
+        blaze::Archive<std::ofstream> ret(out);
+        ret << minocore::csr::arrays2sparse(arr);
     }
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    bool use_float = true, transpose = true, write = true;
+    unsigned nreps = 1;
+    size_t chunk_bytes = size_t(64) << 20;
+    for(int c;(c = getopt(argc, argv, "n:p:C:dNsh?")) >= 0;) {
+        switch(c) {
+            case 'd': use_float = false; break;
+            case 'n': nreps = std::max(1, std::atoi(optarg)); break;
+            case 'p': OMP_SET_NT(std::atoi(optarg)); break;
+            case 'C': chunk_bytes = std::strtoull(optarg, nullptr, 10) << 20; break;
+            case 'N': transpose = false; break;
+            case 's': write = false; break;
+            case 'h': case '?': default: usage(argv[0]);
+        }
+    }
+    std::string in = optind < argc ? argv[optind]: "/dev/stdin";
+    std::string out = optind + 1 < argc ? argv[optind + 1]: "/dev/stdout";
+    return use_float ? run<float>(in, out, nreps, chunk_bytes, transpose, write)
+                     : run<double>(in, out, nreps, chunk_bytes, transpose, write);
+}
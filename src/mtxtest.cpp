@@ -0,0 +1,71 @@
+#include "minocore/util/mtx.h"
+#include <unistd.h>
+
+using namespace minocore;
+
+static std::string tmpdir;
+
+static std::string write_file(const std::string &name, const std::string &contents) {
+    const std::string path = tmpdir + '/' + name;
+    if(name.size() > 3 && name.substr(name.size() - 3) == ".gz") {
+        gzFile fp = gzopen(path.data(), "wb");
+        gzwrite(fp, contents.data(), contents.size());
+        gzclose(fp);
+    } else {
+        std::FILE *fp = std::fopen(path.data(), "wb");
+        std::fwrite(contents.data(), 1, contents.size(), fp);
+        std::fclose(fp);
+    }
+    return path;
+}
+
+static bool throws(const std::string &path) {
+    try {
+        mtx::read_mtx<float>(path, false);
+    } catch(const std::exception &e) {
+        std::fprintf(stderr, "Rejected %s: %s\n", path.data(), e.what());
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    char tmpl[] = "/tmp/mtxtestXXXXXX";
+    if(!::mkdtemp(tmpl)) throw std::system_error(errno, std::system_category(), "mkdtemp");
+    tmpdir = tmpl;
+    const std::string banner = "%%MatrixMarket matrix coordinate real general\n% comment\n";
+    for(const std::string ext: {"", ".gz"}) {
+        // Size line is the last line, without a trailing newline, and there are no entries
+        auto empty = mtx::read_mtx<float>(write_file("empty.mtx" + ext, banner + "3 4 0"), false);
+        assert(empty.nr_ == 3 && empty.nc_ == 4 && empty.nnz() == 0);
+        // Out-of-order entries, and a final entry line without a newline
+        auto arr = mtx::read_mtx<float>(write_file("small.mtx" + ext, banner + "3 4 4\n3 1 2.5\n1 4 -1\n1 2 3e1\n2 3 7"), false);
+        assert(arr.nr_ == 3 && arr.nc_ == 4 && arr.nnz() == 4);
+        const uint64_t indptr[] {0, 2, 3, 4};
+        const uint32_t indices[] {1, 3, 2, 0};
+        const float data[] {30.f, -1.f, 7.f, 2.5f};
+        assert(std::equal(indptr, indptr + 4, arr.indptr_.get()));
+        assert(std::equal(indices, indices + 4, arr.indices_.get()));
+        assert(std::equal(data, data + 4, arr.data_.get()));
+        // Transposed by default
+        auto tarr = mtx::read_mtx<float>(write_file("small.mtx" + ext, banner + "3 4 1\n3 1 2.5\n"));
+        assert(tarr.nr_ == 4 && tarr.nc_ == 3 && tarr.indptr_[1] == 1 && tarr.indices_[0] == 2);
+        // Symmetric files are expanded
+        auto sym = mtx::read_mtx<float>(write_file("sym.mtx" + ext, "%%MatrixMarket matrix coordinate pattern symmetric\n3 3 2\n2 1\n3 3\n"), false);
+        assert(sym.nnz() == 3 && sym.indices_[0] == 1 && sym.indices_[1] == 0 && sym.indices_[2] == 2);
+
+        assert(throws(write_file("zeroidx.mtx" + ext, banner + "3 4 1\n0 1 1\n")));
+        assert(throws(write_file("rowrange.mtx" + ext, banner + "3 4 1\n4 1 1\n")));
+        assert(throws(write_file("colrange.mtx" + ext, banner + "3 4 1\n1 5 1\n")));
+        assert(throws(write_file("missingcol.mtx" + ext, banner + "3 4 1\n1\n")));
+        assert(throws(write_file("toomany.mtx" + ext, banner + "3 4 1\n1 1 1\n2 2 2\n")));
+        assert(throws(write_file("toofew.mtx" + ext, banner + "3 4 2\n1 1 1\n")));
+        assert(throws(write_file("duplicate.mtx" + ext, banner + "3 4 2\n1 1 1\n1 1 2\n")));
+        assert(throws(write_file("huge.mtx" + ext, banner + "8589934592 4 1\n1 1 1\n")));
+        assert(throws(write_file("zerodim.mtx" + ext, banner + "0 4 0\n")));
+        assert(throws(write_file("noheader.mtx" + ext, "% only a comment\n")));
+        assert(throws(write_file("array.mtx" + ext, "%%MatrixMarket matrix array real general\n2 2\n1\n2\n3\n4\n")));
+    }
+    std::system((std::string("rm -rf ") + tmpdir).data());
+    std::fprintf(stderr, "Matrix Market reader tests passed\n");
+}
@@ -0,0 +1,63 @@
+#include "minocore/util/blaze_adaptor.h"
+#include "minocore/util/oracle.h"
+#include <cmath>
+
+using namespace minocore;
+
+// Caching oracles must return the oracle's values and count every lookup as exactly one hit or miss.
+int main() {
+    const size_t n = 300;
+    std::atomic<uint64_t> ncalls{0};
+    auto oracle = [&ncalls](size_t i, size_t j) {
+        ncalls.fetch_add(1, std::memory_order_relaxed);
+        return float(std::abs(double(i) - double(j)) + std::sqrt(double(i + j)));
+    };
+
+    for(const size_t budget: {size_t(1) << 12, size_t(64) << 20}) {
+        ncalls = 0;
+        auto cache = make_sharded_caching_oracle<true, uint32_t>(oracle, budget, 8);
+        for(unsigned pass = 0; pass < 2; ++pass) {
+            OMP_PFOR
+            for(size_t i = 0; i < n; ++i)
+                for(size_t j = 0; j < n; ++j)
+                    assert(cache(i, j) == oracle(i, j));
+        }
+        const auto st = cache.stats();
+        // The assertions above call the oracle directly once per lookup
+        assert(st.lookups() == 2 * n * n);
+        assert(ncalls == st.misses_ + 2 * n * n);
+        if(budget > (n * n) * 32) assert(st.evictions_ == 0 && st.hits_ >= 2 * n * n - n * (n + 1));
+        std::fprintf(stderr, "Sharded cache (%zu bytes): %zu hits, %zu misses, %zu evictions\n",
+                     budget, size_t(st.hits_), size_t(st.misses_), size_t(st.evictions_));
+    }
+
+    // Capacity is capped by the number of distinct pairs, and shards allocate their sets only when first filled
+    {
+        auto cache = make_sharded_caching_oracle<true, uint32_t>(oracle, size_t(1) << 30, 8, n * (n - 1) / 2);
+        assert(cache.capacity() >= n * (n - 1) / 2 && cache.capacity() < n * (n - 1) / 2 + 8 * decltype(cache)::WAYS);
+        assert(cache.allocated_bytes() == 0);
+        assert(cache(0, 1) == oracle(0, 1) && cache(1, 0) == oracle(1, 0));
+        const size_t one = cache.allocated_bytes();
+        assert(one > 0 && one < (size_t(1) << 20));
+        for(size_t i = 0; i < n; ++i) assert(cache(i, (i * 7) % n) == oracle(i, (i * 7) % n));
+        assert(cache.allocated_bytes() <= 8 * one);
+        cache.clear();
+        assert(cache.allocated_bytes() == 0 && !cache.contains(0, 1));
+    }
+
+    for(const size_t max_rows: {size_t(0), size_t(20)}) {
+        ncalls = 0;
+        auto cache = make_row_caching_oracle_wrapper<std::unordered_map, true, true, uint32_t, float>(oracle, n, 0, max_rows);
+        std::vector<uint32_t> prefetch{3, 7, 11};
+        cache.cache_range(prefetch.begin(), prefetch.end());
+        assert(cache.stats().lookups() == 0);
+        for(size_t i = 0; i < n; ++i)
+            for(size_t j = 0; j < n; ++j)
+                assert(cache(i, j) == oracle(i, j));
+        const auto st = cache.stats();
+        assert(st.lookups() == n * n);
+        if(!max_rows) assert(st.misses_ < n && st.evictions_ == 0);
+        std::fprintf(stderr, "Row cache (%zu rows): %zu hits, %zu misses, %zu evictions\n",
+                     max_rows, size_t(st.hits_), size_t(st.misses_), size_t(st.evictions_));
+    }
+}
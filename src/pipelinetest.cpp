@@ -0,0 +1,61 @@
+#include "minocore/clustering/pipeline.h"
+
+using namespace minocore;
+using namespace minocore::clustering;
+
+using Mat = blaze::DynamicMatrix<float>;
+
+// Pipeline jobs must match detail::CoresetRun run stage by stage with the same traits,
+// and a second run must reuse the prepared data.
+int main() {
+    const size_t n = 3000, d = 3, k = 3;
+    Mat raw(n, d);
+    wy::WyRand<uint64_t> rng(13);
+    std::uniform_real_distribution<float> urd;
+    for(size_t i = 0; i < n; ++i)
+        for(size_t j = 0; j < d; ++j)
+            raw(i, j) = urd(rng) + 20.f * (j == i % k);
+    // Applicators normalize their data in place
+    Mat reference = raw;
+    auto refapp = make_probdiv_applicator(reference, blz::L1);
+
+    Mat data;
+    unsigned nloads = 0;
+    CoresetPipeline<INTRINSIC, Mat> pipeline(data, blz::L1, dist::NONE, nullptr, [&](Mat &m) {m = raw; ++nloads;}, 2, 1);
+    auto base = make_clustering_traits<float, uint32_t, HARD, INTRINSIC>(n, k, D2_SAMPLING, METRIC_KMEDIAN, CONSTANT_FACTOR);
+    bool threw = false;
+    try {pipeline.add_job(base);} catch(const std::invalid_argument &) {threw = true;}
+    assert(threw);
+    base.coreset_size = 400;
+    const std::vector<uint64_t> seeds{11, 12, 13};
+    for(const auto seed: seeds) pipeline.add_job(base, k, seed);
+    assert(pipeline.njobs() == seeds.size());
+
+    std::vector<double> costs;
+    for(unsigned pass = 0; pass < 2; ++pass) {
+        pipeline.run();
+        assert(nloads == 1);
+        for(size_t j = 0; j < seeds.size(); ++j) {
+            auto ct = base;
+            ct.seed = seeds[j];
+            update_defaults_with_measure(ct, refapp.get_measure());
+            detail::CoresetRun<INTRINSIC, Mat, float, uint32_t> run(refapp, ct, 400);
+            run.seed(); run.sensitivity(); run.sample(); run.optimize(); run.assign();
+            const auto &job = pipeline.job(j);
+            assert(job.approx_centers_ == run.approx_centers_);
+            assert(job.cs_->indices_ == run.cs_->indices_ && job.cs_->weights_ == run.cs_->weights_);
+            assert(job.center_ids_ == run.center_ids_);
+            assert(pipeline.cost(j) == run.cost());
+            if(pass) assert(pipeline.cost(j) == costs[j]);
+            else costs.push_back(pipeline.cost(j));
+        }
+        // Costs, and so the best job, outlive the results moved out of the jobs
+        const size_t best = pipeline.best();
+        auto [centers, asn, ccosts] = pipeline.result(best);
+        assert(centers.size() == k && asn.size() == n && ccosts.size() == n);
+        assert(pipeline.best() == best && pipeline.cost(best) == costs[best]);
+        for(size_t j = 0; j < seeds.size(); ++j) assert(costs[best] <= costs[j]);
+        std::fprintf(stderr, "Pass %u: best of %zu jobs is %zu, with cost %g\n", pass, seeds.size(), best, costs[best]);
+    }
+    std::fprintf(stderr, "Pipeline tests passed\n");
+}
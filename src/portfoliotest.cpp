@@ -0,0 +1,69 @@
+#include "minocore/optim/portfolio.h"
+#include <cassert>
+#include <cstdio>
+#include <limits>
+#include <string>
+
+using namespace minocore;
+
+int main() {
+    {
+        RestartPortfolio pf;
+        assert(pf.update(10., 0) == 0);
+        assert(pf.update(1000., 100) == 0); // No slack by default
+        assert(pf.update(20., 1, 15.) == 2); // Cannot reach 10
+        assert(pf.update(12., 1, 10.) == 0); // Could still tie
+        assert(pf.update(10., 2, 10.) == 1); // Cannot improve further
+        assert(pf.nabandoned() == 1);
+        RestartPortfolio slack(0.05, 3);
+        slack.offer(10.);
+        assert(slack.update(11., 2) == 0 && slack.update(11., 3) == 2);
+    }
+    {
+        // Restart 0 converges to 10 first; restart 1 learns it cannot win from its lower bound,
+        // and restarts 2 and 3 fall too far behind once past their grace steps.
+        RestartPortfolio pf(0.5, 3);
+        std::atomic<unsigned> nlbcalls(0);
+        auto best = run_portfolio(4, [&](unsigned r, RestartPortfolio &pf) {
+            const double lb = pf.shared_lower_bound([&]() {++nlbcalls; return 5.;});
+            assert(lb == 5.);
+            double cost = 100. * (r + 1);
+            for(unsigned step = 0;; ++step, cost *= .8) {
+                const double final_lb = r == 0 ? std::max(cost * .8, 10.): r == 1 ? 12.: lb;
+                if(const int rc = pf.update(std::max(cost, final_lb), step, final_lb)) {
+                    if(rc == 2) return std::make_pair(std::numeric_limits<double>::infinity(), r);
+                    return std::make_pair(std::max(cost, final_lb), r);
+                }
+            }
+        }, pf, 1);
+        assert(best.first == 10. && best.second == 0u);
+        assert(pf.nabandoned() == 3 && nlbcalls == 1);
+    }
+    int levels = 1;
+    OMP_ONLY(levels = omp_get_max_active_levels();)
+    for(const unsigned ngroups: {1u, 4u}) {
+        // Ties go to the lowest restart
+        RestartPortfolio pf;
+        auto best = run_portfolio(16, [](unsigned r, RestartPortfolio &) {
+            return std::make_pair(double(r % 5 == 2 ? 1.: 2.), r);
+        }, pf, ngroups);
+        assert(best.first == 1. && best.second == 2u);
+
+        // An exception in one restart is rethrown after the others return
+        RestartPortfolio epf;
+        bool threw = false;
+        try {
+            run_portfolio(16, [](unsigned r, RestartPortfolio &) {
+                if(r == 3) throw std::runtime_error("restart 3 failed");
+                return std::make_pair(double(r), r);
+            }, epf, ngroups);
+        } catch(const std::runtime_error &e) {
+            threw = std::string(e.what()) == "restart 3 failed";
+        }
+        assert(threw && epf.terminated());
+        int nlevels = 1;
+        OMP_ONLY(nlevels = omp_get_max_active_levels();)
+        assert(nlevels == levels);
+    }
+    std::fprintf(stderr, "Portfolio tests passed\n");
+}
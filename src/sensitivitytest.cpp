@@ -0,0 +1,58 @@
+#include "minocore/coreset/coreset.h"
+
+using namespace minocore;
+using namespace minocore::coresets;
+
+// Per-center sums and sensitivities must be bitwise reproducible for a given thread count,
+// and must match serial reference sums for any thread count.
+int main() {
+    const size_t np = 100000, ncenters = 7; // The last center has no points
+    wy::WyRand<uint64_t> rng(37);
+    std::vector<float> costs(np), weights(np);
+    std::vector<uint32_t> asn(np);
+    for(size_t i = 0; i < np; ++i) {
+        asn[i] = rng() % (ncenters - 1);
+        costs[i] = float(rng() % 100000) / 1000.f;
+        weights[i] = 0.5f + float(rng() % 8);
+    }
+    std::vector<double> wsums(ncenters), csums(ncenters);
+    std::vector<uint64_t> counts(ncenters);
+    for(size_t i = 0; i < np; ++i) {
+        wsums[asn[i]] += weights[i];
+        csums[asn[i]] += double(weights[i]) * costs[i];
+        ++counts[asn[i]];
+    }
+    // BFL: w * (cost / total cost + 1 / (cluster weight * cluster size)), normalized
+    const double total_cost = std::accumulate(csums.begin(), csums.end(), 0.);
+    std::vector<double> bfl(np);
+    for(size_t i = 0; i < np; ++i)
+        bfl[i] = weights[i] * (costs[i] / total_cost + 1. / (wsums[asn[i]] * counts[asn[i]]));
+    const double bfl_total = std::accumulate(bfl.begin(), bfl.end(), 0.);
+
+    auto close = [](double x, double y) {return std::abs(x - y) <= 1e-9 * std::max(1., std::abs(y));};
+    for(const int nt: {1, 3, 8}) {
+        OMP_SET_NT(nt);
+        OMP_ONLY(assert(omp_get_max_threads() == nt);)
+        const auto sums = coresets::detail::center_sums(np, ncenters, costs.data(), asn.data(), weights.data());
+        const auto again = coresets::detail::center_sums(np, ncenters, costs.data(), asn.data(), weights.data());
+        assert(sums.weight_sums_ == again.weight_sums_ && sums.cost_sums_ == again.cost_sums_);
+        assert(sums.total_cost_ == again.total_cost_ && sums.raw_cost_ == again.raw_cost_);
+        assert(sums.counts_ == counts && sums.counts_[ncenters - 1] == 0);
+        for(size_t c = 0; c < ncenters; ++c)
+            assert(close(sums.weight_sums_[c], wsums[c]) && close(sums.cost_sums_[c], csums[c]));
+        assert(close(sums.total_cost_, total_cost));
+
+        for(const auto sens: {BFL, VX, LBK}) {
+            CoresetSampler<float, uint32_t> lhs, rhs;
+            lhs.set_lazy_alias(); rhs.set_lazy_alias();
+            lhs.make_sampler(np, ncenters, costs.data(), asn.data(), weights.data(), 13, sens);
+            rhs.make_sampler(np, ncenters, costs.data(), asn.data(), weights.data(), 13, sens);
+            assert(std::equal(lhs.probs_.get(), lhs.probs_.get() + np, rhs.probs_.get()));
+            assert(std::abs(lhs.total_probability() - 1.) < 1e-3);
+            if(sens == BFL)
+                for(size_t i = 0; i < np; ++i)
+                    assert(std::abs(lhs.probs_[i] - bfl[i] / bfl_total) <= 1e-5 * bfl[i] / bfl_total);
+        }
+    }
+    std::fprintf(stderr, "Sensitivities are reproducible and match serial sums\n");
+}
@@ -0,0 +1,161 @@
+#include "minocore/coreset/serialize.h"
+#include <fstream>
+
+using namespace minocore;
+
+static std::vector<char> slurp(const std::string &path) {
+    std::ifstream ifs(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+static void spew(const std::string &path, const std::vector<char> &buf) {
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs.write(buf.data(), buf.size());
+}
+// Writes a modified copy of src to dst, then checks that reading section tag from it fails
+template<typename T, typename F>
+static void assert_rejected(const std::string &src, const std::string &dst, uint32_t tag, const F &corrupt) {
+    auto buf = slurp(src);
+    corrupt(buf);
+    spew(dst, buf);
+    try {
+        serial::Reader r(dst);
+        r.get<T>(tag);
+    } catch(const std::exception &e) {
+        std::fprintf(stderr, "Rejected corrupt file: %s\n", e.what());
+        return;
+    }
+    std::fprintf(stderr, "Corrupt file %s was accepted\n", dst.data());
+    std::abort();
+}
+
+// Round trips through the binary container, raw and compressed, and rejection of corrupt files
+int main() {
+    char tmpl[] = "/tmp/serialtestXXXXXX";
+    if(!::mkdtemp(tmpl)) throw std::system_error(errno, std::system_category(), "mkdtemp");
+    const std::string dir = tmpl;
+    wy::WyRand<uint64_t> rng(17);
+    std::vector<uint32_t> ids(10000);
+    std::vector<double> vals(10000);
+    for(size_t i = 0; i < ids.size(); ++i) ids[i] = rng() % 1000, vals[i] = double(rng() % 1000) / 7.;
+    const std::string raw = dir + "/raw.bin", cmp = dir + "/cmp.bin", bad_sampler = dir + "/bad_sampler.bin";
+    for(const bool compress: {false, true}) {
+        const std::string &path = compress ? cmp: raw;
+        // Small blocks, so that compressed sections span many blocks
+        serial::Writer w(path, serial::INDEX_CORESET, compress, 4096);
+        const uint64_t one = 1;
+        w.add(serial::tags::INDX, ids.data(), ids.size()).add(serial::tags::DATA, vals.data(), vals.size())
+         .add(serial::tags::META, &one, 1).add(serial::tags::WTS, vals.data(), 0);
+        w.finish();
+        serial::Reader r(path);
+        assert(r.kind() == serial::INDEX_CORESET && r.version() == serial::VERSION);
+        auto rids = r.get<uint32_t>(serial::tags::INDX);
+        auto rvals = r.get<double>(serial::tags::DATA);
+        assert(std::equal(ids.begin(), ids.end(), rids.begin()) && rids.size() == ids.size());
+        assert(std::equal(vals.begin(), vals.end(), rvals.begin()) && rvals.size() == vals.size());
+        assert(r.scalar<uint64_t>(serial::tags::META) == 1);
+        assert(r.get<double>(serial::tags::WTS).size() == 0);
+        assert(!r.has(serial::tags::PROB));
+        bool threw = false;
+        try {r.get<float>(serial::tags::DATA);} catch(const std::runtime_error &) {threw = true;}
+        assert(threw);
+
+        coresets::IndexCoreset<uint32_t, float> ics(100);
+        for(size_t i = 0; i < ics.size(); ++i) ics.indices_[i] = rng() % 1000, ics.weights_[i] = float(rng() % 100) / 3.f;
+        serial::save(ics, dir + "/ics.bin", compress);
+        auto lics = serial::load_index_coreset<uint32_t, float>(dir + "/ics.bin");
+        assert(lics.indices_ == ics.indices_ && lics.weights_ == ics.weights_);
+
+        // Dense and sparse sections
+        blaze::DynamicMatrix<float> dm(50, 20);
+        blaze::CompressedMatrix<float> sm(50, 20);
+        for(size_t i = 0; i < dm.rows(); ++i) {
+            for(size_t j = 0; j < dm.columns(); ++j) {
+                dm(i, j) = rng() % 3 ? 0.f: float(rng() % 100);
+                if(dm(i, j)) sm.append(i, j, dm(i, j));
+            }
+            sm.finalize(i);
+        }
+        blaze::DynamicVector<double> cw(50);
+        for(auto &x: cw) x = double(rng() % 100) / 11.;
+        coresets::MatrixCoreset<blaze::DynamicMatrix<float>, double> dcs{dm, cw, true};
+        coresets::MatrixCoreset<blaze::CompressedMatrix<float>, double> scs{sm, cw, true};
+        serial::save(dcs, dir + "/dense.bin", compress);
+        serial::save(scs, dir + "/sparse.bin", compress);
+        auto ldcs = serial::load_matrix_coreset<blaze::DynamicMatrix<float>, double>(dir + "/dense.bin");
+        auto lscs = serial::load_matrix_coreset<blaze::CompressedMatrix<float>, double>(dir + "/sparse.bin");
+        assert(ldcs.mat_ == dm && ldcs.weights_ == cw && ldcs.rowwise_);
+        assert(lscs.mat_ == sm && lscs.weights_ == cw && lscs.rowwise_);
+        auto mscs = serial::map_sparse_coreset<float, double>(dir + "/sparse.bin");
+        assert(mscs.mat_.rows() == sm.rows() && mscs.mat_.columns() == sm.columns() && mscs.weights_ == cw);
+        for(size_t i = 0; i < sm.rows(); ++i)
+            for(size_t j = 0; j < sm.columns(); ++j)
+                assert(mscs.mat_(i, j) == sm(i, j));
+
+        // Samplers with their alias tables
+        std::vector<float> costs(1000);
+        std::vector<uint32_t> asn(1000);
+        for(size_t i = 0; i < costs.size(); ++i) costs[i] = float(rng() % 100) / 10.f, asn[i] = rng() % 5;
+        coresets::CoresetSampler<float, uint32_t> sampler;
+        sampler.set_keep_assignments();
+        sampler.make_sampler(costs.size(), 5, costs.data(), asn.data(), static_cast<const float *>(nullptr), 13);
+        serial::save(sampler, dir + "/sampler.bin", compress);
+        auto lsampler = serial::load_sampler<float, uint32_t>(dir + "/sampler.bin");
+        assert(lsampler == sampler);
+        assert(std::equal(asn.begin(), asn.end(), lsampler.asn_.get()));
+        auto s1 = sampler.sample(100, 21), s2 = lsampler.sample(100, 21);
+        assert(s1.indices_ == s2.indices_ && s1.weights_ == s2.weights_);
+        std::fprintf(stderr, "Round trips passed (%s)\n", compress ? "compressed": "raw");
+    }
+
+    // Sampler sections whose lengths do not match np
+    {
+        const uint64_t np = 1000, meta[6] = {np, 5, 5, 13, uint64_t(coresets::BFL), 0};
+        std::vector<float> probs(np, 1.f / np);
+        std::vector<uint32_t> seq(np);
+        std::iota(seq.begin(), seq.end(), 0u);
+        for(const uint32_t tag: {serial::tags::WTS, serial::tags::ASN, serial::tags::FLAS, serial::tags::ALIA}) {
+            serial::Writer w(bad_sampler, serial::CORESET_SAMPLER);
+            w.add(serial::tags::META, meta, 6).add(serial::tags::PROB, probs.data(), np);
+            if(tag == serial::tags::WTS) w.add(tag, probs.data(), np - 1);
+            else if(tag == serial::tags::ALIA) w.add(serial::tags::ALPR, probs.data(), np).add(tag, seq.data(), np - 1);
+            else w.add(tag, seq.data(), np - 1);
+            w.finish();
+            bool threw = false;
+            try {
+                serial::load_sampler<float, uint32_t>(bad_sampler);
+            } catch(const std::runtime_error &e) {
+                std::fprintf(stderr, "Rejected sampler: %s\n", e.what());
+                threw = true;
+            }
+            assert(threw);
+        }
+    }
+
+    // Corrupt headers, section tables and block tables
+    const std::string bad = dir + "/bad.bin";
+    auto info_of = [](std::vector<char> &buf, size_t i) {
+        return reinterpret_cast<serial::SectionInfo *>(buf.data() + sizeof(serial::FileHeader)) + i;
+    };
+    assert_rejected<uint32_t>(raw, bad, serial::tags::INDX, [](auto &buf) {buf[0] = 'X';});
+    assert_rejected<uint32_t>(raw, bad, serial::tags::INDX, [](auto &buf) {reinterpret_cast<serial::FileHeader *>(buf.data())->version_ = serial::VERSION + 1;});
+    assert_rejected<uint32_t>(raw, bad, serial::tags::INDX, [](auto &buf) {buf.resize(40);});
+    assert_rejected<uint32_t>(raw, bad, serial::tags::INDX, [](auto &buf) {buf.resize(buf.size() - 100);});
+    assert_rejected<uint32_t>(raw, bad, serial::tags::INDX, [](auto &buf) {reinterpret_cast<serial::FileHeader *>(buf.data())->nsections_ = 1u << 30;});
+    assert_rejected<uint32_t>(raw, bad, serial::tags::INDX, [&](auto &buf) {info_of(buf, 0)->offset_ = uint64_t(-64);});
+    assert_rejected<uint32_t>(raw, bad, serial::tags::INDX, [&](auto &buf) {info_of(buf, 0)->count_ *= 2;});
+    assert_rejected<uint32_t>(raw, bad, serial::tags::INDX, [&](auto &buf) {info_of(buf, 0)->dtype_ = 99;});
+    assert_rejected<uint32_t>(raw, bad, serial::tags::INDX, [&](auto &buf) {info_of(buf, 0)->offset_ = 8;});
+    assert_rejected<uint32_t>(cmp, bad, serial::tags::INDX, [&](auto &buf) {
+        reinterpret_cast<uint64_t *>(buf.data() + info_of(buf, 0)->offset_)[0] = uint64_t(1) << 40;
+    });
+    assert_rejected<uint32_t>(cmp, bad, serial::tags::INDX, [&](auto &buf) {
+        reinterpret_cast<uint64_t *>(buf.data() + info_of(buf, 0)->offset_)[2] += 1;
+    });
+    assert_rejected<uint32_t>(cmp, bad, serial::tags::INDX, [&](auto &buf) {
+        auto info = info_of(buf, 0);
+        const size_t nblocks = reinterpret_cast<uint64_t *>(buf.data() + info->offset_)[0];
+        buf[info->offset_ + sizeof(uint64_t) * (2 + nblocks) + 4] ^= 0x5A;
+    });
+    std::system((std::string("rm -rf ") + dir).data());
+    std::fprintf(stderr, "Serialization tests passed\n");
+}
@@ -0,0 +1,82 @@
+#include "minocore/coreset/shard.h"
+#include "minocore/util/mtx.h"
+#include <getopt.h>
+
+using namespace minocore;
+
+/*
+ * Map:    shardcoreset build  [opts] <shard.mtx> <shard.coreset>
+ * Reduce: shardcoreset reduce [opts] <output prefix> <shard.coreset>...
+ * Runs as independent processes; the reducer writes <prefix>.coreset and <prefix>.solution.
+ */
+
+using MatrixType = blz::SM<float, blaze::rowMajor>;
+
+void usage(const char *ex) {
+    std::fprintf(stderr, "usage: %s build [opts] <shard.mtx> <output>\n"
+                         "       %s reduce [opts] <output prefix> <shard coresets...>\n"
+                         "-k\tset k [10]\n"
+                         "-c\tset coreset size [1000]\n"
+                         "-s\tset random seed [137]\n"
+                         "-S\tsensitivity method: BFL, VX, LBK [BFL]\n"
+                         "-m\tmaximum number of Lloyd iterations for the final clustering [100]\n"
+                         "-T\tdo not transpose Matrix Market input (by default, its columns become points)\n"
+                         "-z\tcompress output\n"
+                         "-p\tset number of threads\n",
+                 ex, ex);
+    std::exit(1);
+}
+
+int main(int argc, char **argv) {
+    if(argc < 2) usage(argv[0]);
+    const std::string mode = argv[1];
+    if(mode != "build" && mode != "reduce") usage(argv[0]);
+    size_t k = 10, cs_size = 1000, maxiter = 100;
+    uint64_t seed = 137;
+    bool transpose = true, compress = false;
+    coresets::SensitivityMethod sens = coresets::BFL;
+    optind = 2;
+    for(int c;(c = getopt(argc, argv, "k:c:s:S:m:p:Tzh?")) >= 0;) {
+        switch(c) {
+            case 'k': k = std::strtoull(optarg, nullptr, 10); break;
+            case 'c': cs_size = std::strtoull(optarg, nullptr, 10); break;
+            case 's': seed = std::strtoull(optarg, nullptr, 10); break;
+            case 'm': maxiter = std::strtoull(optarg, nullptr, 10); break;
+            case 'p': OMP_SET_NT(std::atoi(optarg)); break;
+            case 'T': transpose = false; break;
+            case 'z': compress = true; break;
+            case 'S': {
+                const std::string s = optarg;
+                if(s == "BFL") sens = coresets::BFL;
+                else if(s == "VX") sens = coresets::VX;
+                else if(s == "LBK") sens = coresets::LBK;
+                else usage(argv[0]);
+                break;
+            }
+            case 'h': default: usage(argv[0]);
+        }
+    }
+    if(mode == "build") {
+        if(argc - optind != 2) usage(argv[0]);
+        util::Timer t("shard coreset");
+        auto shard = mtx2sparse<float>(argv[optind], transpose);
+        std::fprintf(stderr, "Shard %s: %zu points, %zu features\n", argv[optind], shard.rows(), shard.columns());
+        auto cs = coresets::build_shard_coreset<double>(shard, k, cs_size, seed, sens);
+        serial::save(cs, argv[optind + 1], compress);
+        std::fprintf(stderr, "Wrote coreset of %zu points to %s\n", cs.size(), argv[optind + 1]);
+    } else {
+        if(argc - optind < 2) usage(argv[0]);
+        const std::string prefix = argv[optind];
+        const std::vector<std::string> paths(argv + optind + 1, argv + argc);
+        util::Timer t("reduce shard coresets");
+        auto cs = coresets::reduce_shard_coresets<MatrixType, double>(paths, k, cs_size, seed, sens);
+        std::fprintf(stderr, "Reduced %zu shard coresets to %zu points, total weight %g\n", paths.size(), cs.size(), blaze::sum(cs.weights_));
+        serial::save(cs, prefix + ".coreset", compress);
+        auto [centers, assignments, costs] = coresets::cluster_coreset(cs, k, seed, maxiter);
+        std::vector<blaze::DynamicVector<float, blaze::rowVector>> centerrows(centers.rows());
+        for(size_t i = 0; i < centers.rows(); ++i) centerrows[i] = row(centers, i);
+        serial::save_solution<uint32_t, double>(prefix + ".solution", centerrows, assignments, costs, compress);
+        std::fprintf(stderr, "Weighted cost on coreset: %g\n", blaze::dot(costs, cs.weights_));
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+#include "minocore/coreset/shard.h"
+#include <filesystem>
+#include <random>
+
+using namespace minocore;
+using namespace minocore::coresets;
+
+using Mat = blaze::DynamicMatrix<double>;
+
+static double kmeans_cost(const Mat &mat, const Mat &centers, const double *weights=nullptr) {
+    double ret = 0.;
+    for(size_t i = 0; i < mat.rows(); ++i) {
+        double best = std::numeric_limits<double>::max();
+        for(size_t j = 0; j < centers.rows(); ++j)
+            best = std::min(best, blaze::sqrNorm(row(mat, i) - row(centers, j)));
+        ret += (weights ? weights[i]: 1.) * best;
+    }
+    return ret;
+}
+
+// Shard coresets written to files and reduced by another caller must summarize the full data,
+// and the reduction must be reproducible for a given seed.
+int main() {
+    const size_t nshards = 4, shard_rows = 5000, k = 5, d = 4, cs_size = 300;
+    char tmpl[] = "/tmp/shardtestXXXXXX";
+    if(!::mkdtemp(tmpl)) throw std::system_error(errno, std::system_category(), "mkdtemp");
+    const std::filesystem::path dir = tmpl;
+    wy::WyRand<uint64_t> rng(71);
+    std::normal_distribution<double> nd;
+    Mat centers(k, d), full(nshards * shard_rows, d);
+    for(size_t j = 0; j < k; ++j)
+        for(size_t c = 0; c < d; ++c) centers(j, c) = 20. * ((j + c) % k);
+    // Shards are not identically distributed: each shard leans towards different clusters
+    for(size_t i = 0; i < full.rows(); ++i) {
+        const size_t cl = (i / shard_rows + (rng() % 3 ? 0: rng() % k)) % k;
+        for(size_t c = 0; c < d; ++c) full(i, c) = centers(cl, c) + nd(rng);
+    }
+
+    // Map: one coreset file per shard
+    std::vector<std::string> paths;
+    double shard_weight = 0.;
+    for(size_t s = 0; s < nshards; ++s) {
+        Mat shard = submatrix(full, s * shard_rows, 0, shard_rows, d);
+        auto cs = build_shard_coreset(shard, k, cs_size, 100 + s);
+        assert(cs.mat_.rows() <= cs_size && cs.rowwise_);
+        shard_weight += blaze::sum(cs.weights_);
+        paths.push_back(dir / ("shard" + std::to_string(s) + ".bin"));
+        serial::save(cs, paths.back());
+    }
+
+    // Merging is exact concatenation
+    auto merged = merge_shard_coresets<Mat, double>(paths);
+    assert(merged.mat_.rows() == merged.weights_.size() && merged.mat_.rows() <= nshards * cs_size);
+    assert(std::abs(blaze::sum(merged.weights_) - shard_weight) <= 1e-9 * shard_weight);
+
+    // Reduce: reproducible for a seed, bounded, and preserving weight and costs
+    auto reduced = reduce_shard_coresets<Mat, double>(paths, k, cs_size, 7);
+    auto again = reduce_shard_coresets<Mat, double>(paths, k, cs_size, 7);
+    assert(reduced.mat_ == again.mat_ && reduced.weights_ == again.weights_);
+    assert(reduced.mat_.rows() <= cs_size);
+    const double n = full.rows(), wsum = blaze::sum(reduced.weights_);
+    assert(std::abs(wsum - n) <= 0.2 * n);
+    const double true_cost = kmeans_cost(full, centers), cs_cost = kmeans_cost(reduced.mat_, centers, reduced.weights_.data());
+    std::fprintf(stderr, "Reduced %zu shards to %zu points of total weight %g; cost of true centers %g, on coreset %g\n",
+                 nshards, reduced.mat_.rows(), wsum, true_cost, cs_cost);
+    assert(std::abs(true_cost - cs_cost) <= 0.25 * true_cost);
+
+    // Centers found on the coreset are nearly as good on the full data as the true centers
+    auto [ccenters, casn, ccosts] = cluster_coreset(reduced, k, 11);
+    assert(ccenters.rows() == k && casn.size() == reduced.mat_.rows() && ccosts.size() == reduced.mat_.rows());
+    const double found_cost = kmeans_cost(full, ccenters);
+    std::fprintf(stderr, "Cost of coreset solution on full data: %g\n", found_cost);
+    assert(found_cost <= 1.5 * true_cost);
+
+    // Small shards are kept whole, with their input weights
+    {
+        Mat small = submatrix(full, 0, 0, 50, d);
+        std::vector<double> w(50, 3.);
+        auto cs = build_shard_coreset(small, k, cs_size, 1, BFL, w.data());
+        assert(cs.mat_ == small && blaze::min(cs.weights_) == 3. && blaze::max(cs.weights_) == 3.);
+    }
+
+    // Mismatched and missing shards are rejected
+    {
+        Mat other(10, d + 1, 1.);
+        serial::save(MatrixCoreset<Mat, double>{other, blaze::DynamicVector<double>(10, 1.), true}, dir / "other.bin");
+        bool threw = false;
+        try {merge_shard_coresets<Mat, double>({paths[0], dir / "other.bin"});} catch(const std::invalid_argument &) {threw = true;}
+        assert(threw);
+        threw = false;
+        try {merge_shard_coresets<Mat, double>({paths[0], dir / "missing.bin"});} catch(const std::runtime_error &) {threw = true;}
+        assert(threw);
+    }
+    std::filesystem::remove_all(dir);
+    std::fprintf(stderr, "Shard-and-merge tests passed\n");
+}
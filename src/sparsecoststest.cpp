@@ -0,0 +1,140 @@
+#include "minocore/clustering.h"
+
+using namespace minocore;
+using namespace minocore::clustering;
+
+// With m = |S| candidates per client, sparse facility costs must give JV and local search the same solutions as dense costs;
+// with fewer, they must be lower bounds, and solutions must stay close.
+int main() {
+    const size_t np = 400, k = 4;
+    std::vector<std::array<float, 2>> pts(np);
+    wy::WyRand<uint64_t> rng(23);
+    std::uniform_real_distribution<float> urd;
+    for(size_t i = 0; i < np; ++i) pts[i] = {urd(rng) + 3.f * (i % k), urd(rng)};
+    auto oracle = [&pts](size_t i, size_t j) {return std::hypot(pts[i][0] - pts[j][0], pts[i][1] - pts[j][1]);};
+
+    std::vector<uint32_t> fids;
+    for(size_t i = 0; i < np; i += 8) fids.push_back(i);
+    const size_t nf = fids.size();
+    blaze::DynamicMatrix<float> dense(nf, np);
+    for(size_t f = 0; f < nf; ++f)
+        for(size_t c = 0; c < np; ++c)
+            dense(f, c) = oracle(fids[f], c);
+    // Neighbor lists holding every point, so that every facility is a candidate of every client
+    std::vector<packed::pair<float, uint32_t>> knns(np * np);
+    for(size_t c = 0; c < np; ++c)
+        for(size_t j = 0; j < np; ++j)
+            knns[c * np + j] = {float(oracle(c, j)), uint32_t(j)};
+    auto exact = make_sparse_facility_costs<float, uint32_t>(oracle, fids.data(), nf, np, nf);
+    auto fromknn = make_knn_facility_costs<float, uint32_t>(oracle, fids.data(), nf, np, nf, knns);
+    for(size_t f = 0; f < nf; ++f) {
+        for(size_t c = 0; c < np; ++c) {
+            assert(exact(f, c) == dense(f, c));
+            assert(fromknn(f, c) == dense(f, c));
+        }
+    }
+
+    auto solution_cost = [&](const std::vector<uint32_t> &rows) {
+        double ret = 0.;
+        for(size_t c = 0; c < np; ++c) {
+            float best = std::numeric_limits<float>::max();
+            for(const auto r: rows) best = std::min(best, dense(r, c));
+            ret += best;
+        }
+        return ret;
+    };
+    auto ct = make_clustering_traits<float, uint32_t, HARD, INTRINSIC>(np, k, UNIFORM_SAMPLING, METRIC_KMEDIAN, CONSTANT_FACTOR);
+    for(const auto solver: {JAIN_VAZIRANI_FL, LOCAL_SEARCH, JV_PLUS_LOCAL_SEARCH}) {
+        ct.metric_solver = solver;
+        auto dsol = solve_facility_kmedian<uint32_t>(dense, ct);
+        auto esol = solve_facility_kmedian<uint32_t>(exact, ct);
+        auto ksol = solve_facility_kmedian<uint32_t>(fromknn, ct);
+        const double dcost = solution_cost(dsol), ecost = solution_cost(esol), kcost = solution_cost(ksol);
+        std::fprintf(stderr, "Solver %d: dense %g, exact sparse %g, kNN sparse %g\n", int(solver), dcost, ecost, kcost);
+        if(solver == JAIN_VAZIRANI_FL) {
+            std::sort(dsol.begin(), dsol.end()); std::sort(esol.begin(), esol.end()); std::sort(ksol.begin(), ksol.end());
+            assert(dsol == esol && dsol == ksol);
+        }
+        // Local search may take different (equally good) swaps, as sparse swap evaluation visits clients in another order
+        const double tol = solver == JAIN_VAZIRANI_FL ? 1e-4: 1e-2;
+        assert(std::abs(dcost - ecost) <= tol * dcost);
+        assert(std::abs(dcost - kcost) <= tol * dcost);
+    }
+
+    // Through dispatch: sparse candidates from neighbor lists, with m = |S|
+    ct.metric_solver = JV_PLUS_LOCAL_SEARCH;
+    ct.compute_full = false;
+    auto [dc, dasn, dcosts] = perform_cluster_metric_kmedian<uint32_t, float>(oracle, np, ct);
+    ct.sparse_candidates = std::min(size_t(std::ceil(k * ct.approx_mul)), np);
+    ct.knns = &knns;
+    auto [kc, kasn, kcosts] = perform_cluster_metric_kmedian<uint32_t, float>(oracle, np, ct);
+    assert(std::abs(blaze::sum(dcosts) - blaze::sum(kcosts)) <= 1e-2 * blaze::sum(dcosts));
+
+    // m < |S|: each client keeps its m nearest facilities, and every other pair costs the largest of them, a lower bound
+    for(const unsigned m: {1u, 3u, 8u}) {
+        auto sp = make_sparse_facility_costs<float, uint32_t>(oracle, fids.data(), nf, np, m);
+        assert(sp.nonZeros() == m * np);
+        std::vector<float> col(nf);
+        for(size_t c = 0; c < np; ++c) {
+            for(size_t f = 0; f < nf; ++f) col[f] = dense(f, c);
+            std::sort(col.begin(), col.end());
+            const auto span = sp.column_span(c);
+            assert(span.size() == m && sp.fallback(c) == col[m - 1]);
+            for(size_t i = 0; i < m; ++i) assert(span.val_[i] == col[i] && dense(span.idx_[i], c) == col[i]);
+            for(size_t f = 0; f < nf; ++f) {
+                if(sp.find(f, c) == sp.npos) assert(sp(f, c) == sp.fallback(c) && sp(f, c) <= dense(f, c));
+                else assert(sp(f, c) == dense(f, c));
+            }
+        }
+        if(m == 1) continue;
+        for(const auto solver: {JAIN_VAZIRANI_FL, LOCAL_SEARCH, JV_PLUS_LOCAL_SEARCH}) {
+            ct.metric_solver = solver;
+            const double dcost = solution_cost(solve_facility_kmedian<uint32_t>(dense, ct));
+            const auto ssol = solve_facility_kmedian<uint32_t>(sp, ct);
+            assert(!ssol.empty());
+            const double scost = solution_cost(ssol);
+            std::fprintf(stderr, "Solver %d with %u candidates per client: dense %g, sparse %g\n", int(solver), m, dcost, scost);
+            assert(scost <= 1.25 * dcost);
+        }
+    }
+
+    // Short neighbor lists: most clients have no open facility among their candidates, and are costed with their fallback
+    {
+        const size_t kk = 4;
+        std::vector<packed::pair<float, uint32_t>> short_knns(np * kk);
+        std::vector<uint32_t> nearest(np);
+        for(size_t c = 0; c < np; ++c) {
+            std::vector<packed::pair<float, uint32_t>> all(knns.begin() + c * np, knns.begin() + (c + 1) * np);
+            std::partial_sort(all.begin(), all.begin() + kk, all.end(), [](auto x, auto y) {return x.first < y.first;});
+            std::copy(all.begin(), all.begin() + kk, short_knns.begin() + c * kk);
+            for(size_t f = 1; f < nf; ++f) if(dense(f, c) < dense(nearest[c], c)) nearest[c] = f;
+        }
+        auto sp = make_knn_facility_costs<float, uint32_t>(oracle, fids.data(), nf, np, 2, short_knns, nearest.data());
+        ct.metric_solver = JV_PLUS_LOCAL_SEARCH;
+        const auto sol = solve_facility_kmedian<uint32_t>(sp, ct);
+        assert(!sol.empty());
+        size_t nmissed = 0;
+        for(size_t c = 0; c < np; ++c) {
+            bool missed = true;
+            for(const auto f: sol) {
+                if(sp.find(f, c) == sp.npos) assert(sp(f, c) == sp.fallback(c));
+                else missed = false;
+            }
+            nmissed += missed;
+        }
+        std::fprintf(stderr, "%zu/%zu clients have no open facility among their candidates\n", nmissed, np);
+        assert(nmissed > 0);
+
+        // Through dispatch, points are still assigned exactly to their nearest returned center
+        ct.sparse_candidates = 2;
+        ct.knns = &short_knns;
+        auto [sc, sasn, scosts] = perform_cluster_metric_kmedian<uint32_t, float>(oracle, np, ct);
+        assert(!sc.empty() && sasn.size() == np);
+        for(size_t i = 0; i < np; ++i) {
+            assert(std::find(sc.begin(), sc.end(), sasn[i]) != sc.end());
+            assert(scosts[i] == float(oracle(sasn[i], i)));
+            for(const auto c: sc) assert(scosts[i] <= float(oracle(c, i)));
+        }
+    }
+    std::fprintf(stderr, "Sparse facility costs match dense\n");
+}
@@ -8,6 +8,6 @@ struct exfunc {
 };
 
 int main() {
-    auto clusterer = minocore::streaming::make_kservice_clusterer<uint64_t, exfunc>(exfunc{}, 50, 1e9, 2.);
+    auto clusterer = minocore::streaming::make_kservice_clusterer<uint64_t, exfunc>(exfunc{}, 50, 1e9, 2., minocore::streaming::LinearFacilityIndex());
     clusterer.add(uint64_t(3));
 }
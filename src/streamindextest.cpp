@@ -0,0 +1,65 @@
+#include "minocore/wip/streaming.h"
+
+using namespace minocore;
+using namespace minocore::streaming;
+
+using Item = blaze::DynamicVector<float, blaze::rowVector>;
+using Hasher = hash::L2LSHasher<float>;
+
+template<typename Index>
+using Clusterer = KServiceClusterer<Item, blz::sqrL2Norm, double, std::mt19937_64, Index>;
+
+// Facility indexes: the exact VP-tree index must make the same decisions as a linear scan,
+// and the LSH index must find facilities nearly as near as a linear scan does.
+int main() {
+    const size_t dim = 8, n = 4000, k = 5;
+    std::mt19937_64 mt(19);
+    std::normal_distribution<float> nd;
+    std::vector<Item> pts(n, Item(dim));
+    for(size_t i = 0; i < n; ++i)
+        for(size_t j = 0; j < dim; ++j) pts[i][j] = nd(mt) + 10.f * ((i % k) == j);
+    auto same = [](const auto &x, const auto &y) {
+        if(x.size() != y.size()) return false;
+        for(size_t i = 0; i < x.size(); ++i)
+            if(x[i].second != y[i].second || x[i].first != y[i].first) return false;
+        return true;
+    };
+
+    // Exact index, one item at a time and in blocks
+    Clusterer<LinearFacilityIndex> linear(blz::sqrL2Norm(), k, n, 2., 7);
+    Clusterer<VPTreeFacilityIndex<Item, blz::L2Norm>> vp(blz::sqrL2Norm(), k, n, 2., 7), vpbatch(blz::sqrL2Norm(), k, n, 2., 7);
+    for(const auto &p: pts) linear.add(p), vp.add(p);
+    for(size_t start = 0; start < n; start += 333)
+        vpbatch.add_batch(pts.data() + start, std::min(size_t(333), n - start));
+    std::fprintf(stderr, "Linear index: %zu facilities; VP-tree index: %zu\n", linear.nfacilities(), vp.nfacilities());
+    assert(same(linear.mstack_.getc(), vp.mstack_.getc()) && same(linear.readingstack_, vp.readingstack_));
+    assert(same(vp.mstack_.getc(), vpbatch.mstack_.getc()) && same(vp.readingstack_, vpbatch.readingstack_));
+    for(size_t i = 0; i < n; i += 7)
+        assert(vp.assign(pts[i]) == vp.scan(pts[i]));
+
+    // LSH index: costs of the facilities it finds, against the nearest ones
+    Clusterer<LSHFacilityIndex<Hasher>> lsh(blz::sqrL2Norm(), k, n, 2., 7, LSHFacilityIndex<Hasher>(LSHasherSettings{dim, 2, 8}, 12., 31));
+    for(const auto &p: pts) lsh.add(p);
+    assert(lsh.nseen() == n && lsh.nfacilities() > 0);
+    double exact = 0., approx = 0.;
+    for(const auto &p: pts) {
+        const auto found = lsh.assign(p), nearest = lsh.scan(p);
+        assert(found.first < lsh.nfacilities());
+        assert(found.second >= nearest.second);
+        exact += nearest.second; approx += found.second;
+    }
+    std::fprintf(stderr, "LSH index: %zu facilities; total cost %g against %g for the nearest facilities\n",
+                 lsh.nfacilities(), approx, exact);
+    assert(approx <= 1.25 * exact);
+
+    // Clearing an LSH table leaves no hits, and it can be refilled
+    hash::LSHTable<Hasher> table(LSHasherSettings{dim, 2, 8}, 12., 31);
+    for(size_t i = 0; i < 100; ++i) table.add(pts[i], uint32_t(i));
+    assert(table.ids_used_ == 100 && table.query(pts[0]).count(0));
+    table.clear();
+    assert(table.ids_used_ == 0 && table.query(pts[0]).empty());
+    table.add(pts[1], 0u);
+    auto hits = table.query(pts[1]);
+    assert(hits.size() == 1 && hits.begin()->first == 0u && hits.begin()->second == 8u);
+    std::fprintf(stderr, "Facility index tests passed\n");
+}
@@ -0,0 +1,60 @@
+#include "minocore/clustering/sweep.h"
+
+using namespace minocore;
+using namespace minocore::clustering;
+
+using Mat = blaze::DynamicMatrix<float>;
+
+// Sweep costs must not increase with k, and warm starts must match cold starts (to within 1%) on well-separated clusters.
+template<typename Sweep>
+static void check_sweep(const Sweep &warm, const Sweep &cold, const std::vector<unsigned> &ks, size_t n) {
+    assert(warm.ks_ == ks && cold.ks_ == ks);
+    for(size_t i = 0; i < ks.size(); ++i) {
+        const auto &[centers, asn, costs] = warm.solution(ks[i]);
+        assert(centers.size() == ks[i] && asn.size() == n && costs.size() == n);
+        assert(std::abs(warm.cost(ks[i]) - double(blaze::sum(costs))) <= 1e-4 * warm.cost(ks[i]));
+        std::fprintf(stderr, "k = %u: warm %g, cold %g\n", ks[i], warm.cost(ks[i]), cold.cost(ks[i]));
+        assert(warm.cost(ks[i]) <= cold.cost(ks[i]) * (1. + 1e-2));
+        if(i) assert(warm.cost(ks[i]) <= warm.cost(ks[i - 1]) * (1. + 1e-6));
+    }
+    bool threw = false;
+    try {warm.cost(ks.back() + 1);} catch(const std::out_of_range &) {threw = true;}
+    assert(threw);
+}
+
+int main() {
+    const size_t n = 800, d = 4;
+    const std::vector<unsigned> ks{1, 2, 3, 4};
+    // Unsorted, with a duplicate
+    const std::vector<unsigned> unsorted{3, 1, 4, 2, 3};
+    Mat mat(n, d);
+    wy::WyRand<uint64_t> rng(17);
+    std::uniform_real_distribution<float> urd;
+    for(size_t i = 0; i < n; ++i)
+        for(size_t j = 0; j < d; ++j)
+            mat(i, j) = urd(rng) + 20.f * (j == i % d);
+
+    {
+        auto oracle = [&mat](size_t i, size_t j) {return blaze::l2Norm(row(mat, i) - row(mat, j));};
+        auto ct = make_clustering_traits<float, uint32_t, HARD, INTRINSIC>(n, ks.back(), D2_SAMPLING, METRIC_KMEDIAN, CONSTANT_FACTOR);
+        ct.compute_full = false;
+        for(const auto solver: {LOCAL_SEARCH, JV_PLUS_LOCAL_SEARCH}) {
+            ct.metric_solver = solver;
+            auto warm = sweep_metric_kmedian<uint32_t, float>(oracle, n, unsorted, ct);
+            auto cold = sweep_metric_kmedian<uint32_t, float>(oracle, n, unsorted, ct, false);
+            check_sweep(warm, cold, ks, n);
+        }
+        bool threw = false;
+        try {sweep_metric_kmedian<uint32_t, float>(oracle, n, {0}, ct);} catch(const std::invalid_argument &) {threw = true;}
+        assert(threw);
+    }
+    {
+        auto app = make_probdiv_applicator(mat, blz::SQRL2);
+        auto warm = sweep_lloyd(app, unsorted, 13);
+        auto cold = sweep_lloyd(app, unsorted, 13, static_cast<const float *>(nullptr), 100, 1e-4, false);
+        check_sweep(warm, cold, ks, n);
+        // The smallest k starts from the same k-means++ prefix either way
+        assert(warm.cost(ks.front()) == cold.cost(ks.front()));
+    }
+    std::fprintf(stderr, "Sweep tests passed\n");
+}
@@ -11,45 +11,15 @@ using namespace minocore;
 using namespace boost;
 
 
-template<typename Graph, typename ICon, typename FCon, typename IT, typename RetCon, typename CSWT>
-void calculate_distortion_centerset(Graph &x, const ICon &indices, FCon &costbuffer,
-                             const std::vector<coresets::IndexCoreset<IT, CSWT>> &coresets,
-                             RetCon &ret, double z)
+// Fills costbuffer with each vertex's distance to its nearest center in indices.
+template<typename Graph, typename ICon, typename FCon>
+void calculate_centerset_costs(Graph &x, const ICon &indices, FCon &costbuffer)
 {
-    assert(ret.size() == coresets.size());
-    const size_t nv = boost::num_vertices(x);
-    const size_t ncs = coresets.size();
     util::ScopedSyntheticVertex<Graph> vx(x);
-    {
-        auto synthetic_vertex = vx.get();
-        for(auto idx: indices)
-            boost::add_edge(synthetic_vertex, idx, 0., x);
-        boost::dijkstra_shortest_paths(x, synthetic_vertex, distance_map(&costbuffer[0]));
-    }
-    if(z != 1.) {
-        costbuffer = pow(costbuffer, z);
-    }
-    double fullcost = 0.;
-    OMP_PRAGMA("omp parallel for reduction(+:fullcost)")
-    for(unsigned i = 0; i < nv; ++i) {
-        fullcost += costbuffer[i];
-    }
-    OMP_PFOR
-    for(size_t j = 0; j < ncs; ++j) {
-        const auto indices = coresets[j].indices_.data();
-        const auto weights = coresets[j].weights_.data();
-        const size_t cssz = coresets[j].size();
-        double coreset_cost = 0.;
-        for(unsigned i = 0; i < cssz; ++i) {
-            coreset_cost += costbuffer[indices[i]] * weights[i];
-        }
-        ret[j] = coreset_cost;
-    }
-    for(size_t j = 0; j < ncs; ++j) {
-        double distortion = std::abs(ret[j] / fullcost - 1.);
-        //std::fprintf(stderr, "distortion for coreset %zu of size %zu is %g\n", j, coresets[j].size(), distortion);
-        ret[j] = distortion;
-    }
+    auto synthetic_vertex = vx.get();
+    for(auto idx: indices)
+        boost::add_edge(synthetic_vertex, idx, 0., x);
+    boost::dijkstra_shortest_paths(x, synthetic_vertex, distance_map(&costbuffer[0]));
 }
 
 template<typename GraphT>
@@ -91,6 +61,10 @@ max_component(GraphT &g) {
     return g;
 }
 
+// Coresets are generated in groups of ncs (one per coreset size), in this order.
+static constexpr const char *GROUP_NAMES[] = {"uniform", "IID", "SYSTEMATIC", "STRATIFIED_BY_CENTER", "POISSON"};
+static constexpr size_t NGROUPS = sizeof(GROUP_NAMES) / sizeof(GROUP_NAMES[0]);
+
 void print_header(std::ofstream &ofs, char **argv, unsigned nsamples, unsigned k, double z, size_t nv, size_t ne) {
     ofs << "##Command-line: '";
     while(*argv) {
@@ -101,10 +75,10 @@ void print_header(std::ofstream &ofs, char **argv, unsigned nsamples, unsigned k
     char buf[128];
     std::sprintf(buf, "'\n##z: %g\n##nsamples: %u\n##k: %u\n##nv: %zu\n##ne: %zu\n", z, nsamples, k, nv, ne);
     ofs << buf;
-    ofs << "#coreset_size\tmax distortion (VX11)\tmean distortion (VX11)\t "
-        << "max distortion (BFL16)\tmean distortion (BFL16)"
-        << "max distortion (uniform sampling)\tmean distortion (uniform sampling)"
-        << "\n";
+    ofs << "#coreset_size";
+    for(const auto name: GROUP_NAMES)
+        ofs << "\tmax distortion (" << name << ")\tmean distortion (" << name << ")\tmean size (" << name << ')';
+    ofs << "\n";
 }
 
 void usage(const char *ex) {
@@ -117,7 +91,7 @@ void usage(const char *ex) {
                          "-R\tSet random seed. Default: hash based on command-line arguments\n"
                          "-z\tset z [1.]\n"
                          "-t\tSet number of sampled centers to test [500]\n"
-                         "-T\tNumber of Thorup sampling trials [15]\n",
+                         "-T\tNumber of Thorup sampling trials for the sampler's bicriteria solution [15]\n",
                  ex);
     std::exit(1);
 }
@@ -131,6 +105,7 @@ int main(int argc, char **argv) {
     unsigned testing_num_centersets = 500;
     //size_t nsampled_max = 0;
     unsigned coreset_testing_num_iters = 5;
+    unsigned num_thorup_trials = 15;
     uint64_t seed = std::accumulate(argv, argv + argc, uint64_t(0),
         [](auto x, auto y) {
             return x ^ std::hash<std::string>{}(y);
@@ -143,6 +118,7 @@ int main(int argc, char **argv) {
             case 'R': seed = std::strtoull(optarg, nullptr, 10); break;
             case 't': testing_num_centersets = std::atoi(optarg); break;
             case 'N': coreset_testing_num_iters = std::atoi(optarg); break;
+            case 'T': num_thorup_trials = std::atoi(optarg); break;
             case 'p': OMP_SET_NT(std::atoi(optarg)); break;
             case 'o': output_prefix = optarg; break;
             case 's': fn = optarg; break;
@@ -214,6 +190,17 @@ int main(int argc, char **argv) {
         shared::sort(r.begin(), r.end());
     }
     coresets::UniformSampler<float, uint32_t> uniform_sampler(boost::num_vertices(g));
+    // Importance sampler from a bicriteria solution, shared by all non-uniform sampling schemes
+    coresets::CoresetSampler<float, uint32_t> sampler;
+    {
+        auto [bicriteria_centers, _] = thorup_sample_mincost(g, k, seed, num_thorup_trials);
+        auto [costs, assignments] = get_costs(g, bicriteria_centers);
+        if(z != 1.) costs = pow(costs, z);
+        sampler.set_keep_assignments(); // For STRATIFIED_BY_CENTER
+        sampler.make_sampler(boost::num_vertices(g), bicriteria_centers.size(), costs.data(), assignments.data(),
+                             nullptr, seed, coresets::BFL);
+    }
+    static constexpr coresets::SamplingScheme schemes[] = {coresets::IID, coresets::SYSTEMATIC, coresets::STRATIFIED_BY_CENTER, coresets::POISSON};
     // We run the inner loop `coreset_testing_num_iters` times
     // and average the maximum distortion.
     // We do this because there are two sources of randomness:
@@ -223,55 +210,59 @@ int main(int argc, char **argv) {
     // the expected behavior
 
     const size_t ncs = coreset_sizes.size();
-    const size_t distvecsz = ncs;
+    const size_t distvecsz = ncs * NGROUPS;
     blaze::DynamicVector<double> meanmaxdistortion(distvecsz, 0.),
-                                 meanmeandistortion(distvecsz, 0.);
+                                 meanmeandistortion(distvecsz, 0.),
+                                 meansize(distvecsz, 0.);
     //
     for(size_t i = 0; i < coreset_testing_num_iters; ++i) {
-        // The first ncs coresets are VX-sampled, the second ncs are BFL-sampled, and the last ncs
-        // are uniformly randomly sampled.
+        // Groups of ncs coresets follow GROUP_NAMES: uniform, then each SamplingScheme on the BFL sampler,
+        // all at equal nominal coreset sizes.
         std::vector<coresets::IndexCoreset<uint32_t, float>> coresets;
-        coresets.reserve(ncs * 3);
+        coresets.reserve(distvecsz);
         for(auto coreset_size: coreset_sizes) {
             coresets.emplace_back(uniform_sampler.sample(coreset_size));
         }
+        for(const auto scheme: schemes) {
+            for(auto coreset_size: coreset_sizes) {
+                coresets.emplace_back(sampler.sample(coreset_size, rng(), 0.1, scheme));
+                if(scheme == coresets::IID) coresets.back().compact();
+            }
+        }
+        for(size_t j = 0; j < distvecsz; ++j)
+            meansize[j] += coresets[j].size();
         assert(coresets.size() == distvecsz);
         std::fprintf(stderr, "[Phase 5] Generated coresets\n");
-        blaze::DynamicVector<double> maxdistortion(distvecsz, std::numeric_limits<double>::min()),
-                                     meandistortion(distvecsz, 0.);
+        coresets::DistortionEvaluator<uint32_t, float> evaluator(coresets, boost::num_vertices(g), z);
+        evaluator.reset(random_centers.rows());
         OMP_PFOR
         for(size_t i = 0; i < random_centers.rows(); ++i) {
-            //if(i % 10 == 0)
-            //    std::fprintf(stderr, "Calculating distortion %zu/%zu\n", i, random_centers.rows());
             auto rc = row(random_centers, i);
             assert(rc.size() == k);
             blaze::DynamicVector<double> distbuffer(boost::num_vertices(g));
-            blaze::DynamicVector<double> currentdistortion(coresets.size());
             decltype(g) gcopy(g);
-            calculate_distortion_centerset(gcopy, rc, distbuffer, coresets, currentdistortion, z);
-            OMP_CRITICAL
-            {
-                maxdistortion = blaze::serial(max(maxdistortion, currentdistortion));
-            }
-            OMP_CRITICAL
-            {
-                meandistortion = blaze::serial(meandistortion + currentdistortion);
-            }
+            calculate_centerset_costs(gcopy, rc, distbuffer);
+            evaluator.add_costs(i, distbuffer);
         }
+        const auto report = evaluator.report();
+        blaze::DynamicVector<double> maxdistortion(distvecsz), meandistortion(distvecsz);
+        for(size_t j = 0; j < distvecsz; ++j)
+            maxdistortion[j] = report[j].max_, meandistortion[j] = report[j].mean_;
         meanmaxdistortion += maxdistortion;
-        meandistortion /= random_centers.rows();
         meanmeandistortion += meandistortion;
         std::cerr << "mean [" << i << "]\n" << meandistortion;
         std::cerr << "max  [" <<  i << "]\n" << maxdistortion;
     }
     meanmaxdistortion /= coreset_testing_num_iters;
     meanmeandistortion /= coreset_testing_num_iters;
+    meansize /= coreset_testing_num_iters;
     for(size_t i = 0; i < ncs; ++i) {
-        tblout << coreset_sizes[i]
-               << '\t' << meanmaxdistortion[i] << '\t' << meanmeandistortion[i]
-               << '\t' << meanmaxdistortion[i + ncs] << '\t' << meanmeandistortion[i + ncs]
-               << '\t' << meanmaxdistortion[i + ncs * 2] << '\t' << meanmeandistortion[i + ncs * 2]
-               << '\n';
+        tblout << coreset_sizes[i];
+        for(size_t grp = 0; grp < NGROUPS; ++grp) {
+            const size_t j = i + ncs * grp;
+            tblout << '\t' << meanmaxdistortion[j] << '\t' << meanmeandistortion[j] << '\t' << meansize[j];
+        }
+        tblout << '\n';
     }
     return EXIT_SUCCESS;
 }